@@ -0,0 +1,10 @@
+/**
+ * file: pmap.h
+ * desc: stands in for /extoll2/include/pmap.h under the RMA2 emulation;
+ * Oncilla includes it but uses nothing from it
+ */
+
+#ifndef __PMAP_EMU_H__
+#define __PMAP_EMU_H__
+
+#endif  /* __PMAP_EMU_H__ */
@@ -0,0 +1,870 @@
+/**
+ * file: rma2.c
+ * desc: software emulation of EXTOLL's librma2 for machines without the
+ * hardware, built into lib/librma2.so by scons rma2emu=1.
+ *
+ * The processes of a host that open ports share one segment holding the
+ * table of ports and registered regions and each port's notification
+ * queue; the VPID of a port is its index in the table. Registering memory
+ * moves it, in place, onto a shared memory object that other processes map
+ * the first time they put to or get from it. The NLA of a region encodes
+ * its index and the offset into the object.
+ *
+ * Each port has a worker thread standing for its link. A put or get
+ * occupies the link for size / bandwidth and arrives latency later, when
+ * the worker copies the data and queues the notifications the spec asks
+ * for: the requester's on the posting port, the completer's on the port
+ * that receives the data and the responder's on the port a get reads from.
+ *
+ * Environment:
+ *   RMA2_EMU_SHM         name of the shared segment (default /ocm_rma2)
+ *   RMA2_EMU_NODE        node id of the ports of this process (default 0)
+ *   RMA2_EMU_LATENCY_US  latency of a put or get (default 1)
+ *   RMA2_EMU_BW_MBPS     bandwidth of a port's link in MB/s (default 0, as
+ *                        fast as memcpy)
+ */
+
+#define _GNU_SOURCE /* for mremap */
+
+/* System includes */
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Project includes */
+#include "rma2.h"
+
+/* Internal definitions */
+
+#define MAGIC           (0x524d4132454d5500UL ^ sizeof(struct shm_root))
+#define MAX_PORTS       512
+#define MAX_REGIONS     4096
+#define NOTI_RING       256 /* notifications queued per port */
+#define CMD_RING        256 /* commands in flight per port */
+#define MAX_XFER        (8U << 20) /* per put or get, as the hardware */
+#define NLA_SHIFT       40 /* regions of up to 1 TiB */
+#define NLA_REGION(nla) ((long)((nla) >> NLA_SHIFT) - 1)
+#define NLA_OFFSET(nla) ((nla) & ((1UL << NLA_SHIFT) - 1))
+#define SPIN_NS         50000 /* closer to a deadline than this, spin */
+#define MOVE_CHUNK      (2UL << 20) /* of a region moved at a time */
+
+#define DEFAULT_SHM         "/ocm_rma2"
+#define DEFAULT_LATENCY_US  1
+
+/* word0 of a notification: command, class, peer node and vpid, size */
+enum { CMD_PUT = 1, CMD_GET = 2 };
+#define NOTI_WORD0(cmd, class, node, vpid, size) \
+    (((uint64_t)(cmd) << 60) | ((uint64_t)(class) << 56) | \
+     ((uint64_t)(node) << 40) | ((uint64_t)(vpid) << 24) | \
+     ((uint64_t)(size) & 0xffffff))
+
+/* in the shared segment */
+
+struct shm_port
+{
+    int used;
+    pid_t pid;
+    RMA2_Nodeid node;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint32_t head, tail;
+    uint64_t dropped; /* notifications that found the queue full */
+    RMA2_Notification ring[NOTI_RING];
+};
+
+struct shm_region
+{
+    int used;
+    uint32_t gen; /* bumped by every registration; names the object */
+    int port;
+    size_t len; /* of the object, whole pages */
+};
+
+struct shm_root
+{
+    uint64_t magic;
+    pthread_mutex_t lock; /* port and region tables */
+    struct shm_port ports[MAX_PORTS];
+    struct shm_region regions[MAX_REGIONS];
+};
+
+/* in this process */
+
+struct cmd
+{
+    bool put;
+    int peer; /* port owning the remote region */
+    char *local, *remote;
+    uint32_t size;
+    RMA2_NLA nla;
+    RMA2_Notification_Spec spec;
+    uint64_t due; /* ns it arrives */
+};
+
+struct RMA2_Endpoint
+{
+    int slot;
+    RMA2_Nodeid node;
+    uint64_t link_free; /* ns the link is busy until */
+    struct cmd cmds[CMD_RING];
+    uint32_t head, tail;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t tid;
+    bool stop;
+};
+
+struct RMA2_Connection
+{
+    RMA2_Nodeid node;
+    RMA2_VPID vpid;
+};
+
+struct RMA2_Region
+{
+    int slot;
+    char *addr; /* as registered */
+    size_t size;
+    char *base; /* page-aligned start of the object */
+    size_t len;
+    RMA2_NLA nla; /* of addr */
+};
+
+/* a remote region mapped into this process */
+struct mapping
+{
+    uint32_t gen;
+    char *addr;
+    size_t len;
+};
+
+/* Internal state */
+
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+static RMA2_ERROR init_err;
+static struct shm_root *root;
+
+/* room left in object names for the region slot and generation */
+static char shm_name[NAME_MAX - 32];
+static RMA2_Nodeid node_id;
+static uint64_t latency_ns = DEFAULT_LATENCY_US * 1000UL;
+static uint64_t bw_mbps;
+
+static struct mapping maps[MAX_REGIONS];
+static pthread_mutex_t maps_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Private functions */
+
+static uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+static void
+wait_until(uint64_t t)
+{
+    struct timespec ts;
+    uint64_t now;
+
+    while ((now = now_ns()) < t) {
+        if (t - now < SPIN_NS)
+            continue;
+        ts.tv_sec = (t - SPIN_NS / 2) / 1000000000UL;
+        ts.tv_nsec = (t - SPIN_NS / 2) % 1000000000UL;
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+    }
+}
+
+/* locks in the segment survive processes that die holding them */
+static void
+shm_lock(pthread_mutex_t *m)
+{
+    if (pthread_mutex_lock(m) == EOWNERDEAD)
+        pthread_mutex_consistent(m);
+}
+
+static void
+shm_wait(pthread_cond_t *c, pthread_mutex_t *m)
+{
+    if (pthread_cond_wait(c, m) == EOWNERDEAD)
+        pthread_mutex_consistent(m);
+}
+
+static void
+obj_name(char *name, int slot, uint32_t gen)
+{
+    snprintf(name, NAME_MAX, "%s.%d.%u", shm_name, slot, gen);
+}
+
+static bool
+is_zero(const char *p, size_t n)
+{
+    return !p[0] && !memcmp(p, p + 1, n - 1);
+}
+
+/* Move the pages of r onto the object fd, a chunk at a time so only one is
+ * ever held twice. Chunks that are still zero need no copy */
+static int
+move_to_shm(struct RMA2_Region *r, int fd)
+{
+    size_t off, n;
+    char *tmp;
+
+    for (off = 0; off < r->len; off += n) {
+        n = (r->len - off < MOVE_CHUNK ? r->len - off : MOVE_CHUNK);
+        if (!is_zero(r->base + off, n)) {
+            tmp = mmap(NULL, n, PROT_READ | PROT_WRITE, MAP_SHARED, fd, off);
+            if (tmp == MAP_FAILED)
+                return -1;
+            memcpy(tmp, r->base + off, n);
+            munmap(tmp, n);
+        }
+        if (mmap(r->base + off, n, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_FIXED, fd, off) == MAP_FAILED)
+            return -1;
+    }
+    return 0;
+}
+
+/* and back to private memory, freeing the object's pages as it goes */
+static int
+move_to_private(struct RMA2_Region *r, int fd)
+{
+    size_t off, n;
+    char *tmp;
+
+    for (off = 0; off < r->len; off += n) {
+        n = (r->len - off < MOVE_CHUNK ? r->len - off : MOVE_CHUNK);
+        tmp = mmap(NULL, n, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (tmp == MAP_FAILED)
+            return -1;
+        if (!is_zero(r->base + off, n))
+            memcpy(tmp, r->base + off, n);
+        if (mremap(tmp, n, n, MREMAP_MAYMOVE | MREMAP_FIXED,
+                    r->base + off) == MAP_FAILED) {
+            munmap(tmp, n);
+            return -1;
+        }
+        if (fd >= 0)
+            fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, off, n);
+    }
+    return 0;
+}
+
+static void
+init_port(struct shm_port *p)
+{
+    pthread_mutexattr_t ma;
+    pthread_condattr_t ca;
+
+    pthread_mutexattr_init(&ma);
+    pthread_mutexattr_setpshared(&ma, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&ma, PTHREAD_MUTEX_ROBUST);
+    pthread_condattr_init(&ca);
+    pthread_condattr_setpshared(&ca, PTHREAD_PROCESS_SHARED);
+    pthread_mutex_init(&p->lock, &ma);
+    pthread_cond_init(&p->cond, &ca);
+    pthread_mutexattr_destroy(&ma);
+    pthread_condattr_destroy(&ca);
+    p->head = p->tail = 0;
+    p->dropped = 0;
+}
+
+/* map the segment, creating it if this is the first process */
+static RMA2_ERROR
+attach(void)
+{
+    pthread_mutexattr_t ma;
+    struct stat st;
+    bool created = true;
+    int fd, i;
+
+    fd = shm_open(shm_name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0 && errno == EEXIST) {
+        created = false;
+        fd = shm_open(shm_name, O_RDWR, 0600);
+    }
+    if (fd < 0)
+        return RMA2_ERR_FD;
+    if (created && ftruncate(fd, sizeof(*root))) {
+        close(fd);
+        shm_unlink(shm_name);
+        return RMA2_ERR_MMAP;
+    }
+    /* the creator may not have sized it yet */
+    for (i = 0; !created; i++) {
+        if (fstat(fd, &st) || i == 1000) {
+            close(fd);
+            return RMA2_ERR_FD;
+        }
+        if (st.st_size) {
+            if ((size_t)st.st_size != sizeof(*root)) {
+                close(fd);
+                return RMA2_ERR_INVALID_VERSION;
+            }
+            break;
+        }
+        usleep(1000);
+    }
+    root = mmap(NULL, sizeof(*root), PROT_READ | PROT_WRITE, MAP_SHARED,
+            fd, 0);
+    close(fd);
+    if (root == MAP_FAILED) {
+        root = NULL;
+        return RMA2_ERR_MMAP;
+    }
+
+    if (created) {
+        pthread_mutexattr_init(&ma);
+        pthread_mutexattr_setpshared(&ma, PTHREAD_PROCESS_SHARED);
+        pthread_mutexattr_setrobust(&ma, PTHREAD_MUTEX_ROBUST);
+        pthread_mutex_init(&root->lock, &ma);
+        pthread_mutexattr_destroy(&ma);
+        for (i = 0; i < MAX_PORTS; i++)
+            init_port(&root->ports[i]);
+        __atomic_store_n(&root->magic, MAGIC, __ATOMIC_RELEASE);
+        return RMA2_SUCCESS;
+    }
+    for (i = 0; __atomic_load_n(&root->magic, __ATOMIC_ACQUIRE) != MAGIC;
+            i++) {
+        if (i == 1000)
+            return RMA2_ERR_INVALID_VERSION;
+        usleep(1000);
+    }
+    return RMA2_SUCCESS;
+}
+
+static void
+init(void)
+{
+    const char *env;
+
+    snprintf(shm_name, sizeof(shm_name), "%s",
+            ((env = getenv("RMA2_EMU_SHM")) ? env : DEFAULT_SHM));
+    if ((env = getenv("RMA2_EMU_NODE")))
+        node_id = strtoul(env, NULL, 0);
+    if ((env = getenv("RMA2_EMU_LATENCY_US")))
+        latency_ns = strtoul(env, NULL, 0) * 1000UL;
+    if ((env = getenv("RMA2_EMU_BW_MBPS")))
+        bw_mbps = strtoul(env, NULL, 0);
+    init_err = attach();
+}
+
+/* with root->lock held */
+static void
+release_region(int slot)
+{
+    char name[NAME_MAX];
+
+    obj_name(name, slot, root->regions[slot].gen);
+    shm_unlink(name);
+    root->regions[slot].used = 0;
+}
+
+/* with root->lock held: drop the ports, and their regions, of processes
+ * that exited without closing them */
+static void
+reclaim(void)
+{
+    int i, r;
+
+    for (i = 0; i < MAX_PORTS; i++) {
+        if (!root->ports[i].used || !(kill(root->ports[i].pid, 0) &&
+                    errno == ESRCH))
+            continue;
+        for (r = 0; r < MAX_REGIONS; r++)
+            if (root->regions[r].used && root->regions[r].port == i)
+                release_region(r);
+        root->ports[i].used = 0;
+        init_port(&root->ports[i]);
+    }
+}
+
+static void
+push(int slot, uint64_t word0, uint64_t word1)
+{
+    struct shm_port *p = &root->ports[slot];
+
+    shm_lock(&p->lock);
+    if (p->used && p->head - p->tail < NOTI_RING) {
+        p->ring[p->head % NOTI_RING].word0 = word0;
+        p->ring[p->head % NOTI_RING].word1 = word1;
+        p->head++;
+        pthread_cond_broadcast(&p->cond);
+    } else if (p->used && !p->dropped++) {
+        fprintf(stderr, "rma2 emulation: notification queue of vpid %d"
+                " is full, dropping\n", slot);
+    }
+    pthread_mutex_unlock(&p->lock);
+}
+
+/* queue the notifications of a command that arrived */
+static void
+notify(struct RMA2_Endpoint *ep, struct cmd *c)
+{
+    int cmd = (c->put ? CMD_PUT : CMD_GET);
+    RMA2_Nodeid peer_node = root->ports[c->peer].node;
+
+    if (c->spec & RMA2_REQUESTER_NOTIFICATION)
+        push(ep->slot, NOTI_WORD0(cmd, RMA2_REQUESTER_NOTIFICATION,
+                    peer_node, c->peer, c->size), c->nla);
+    if (c->spec & RMA2_COMPLETER_NOTIFICATION) {
+        if (c->put)
+            push(c->peer, NOTI_WORD0(cmd, RMA2_COMPLETER_NOTIFICATION,
+                        ep->node, ep->slot, c->size), c->nla);
+        else
+            push(ep->slot, NOTI_WORD0(cmd, RMA2_COMPLETER_NOTIFICATION,
+                        peer_node, c->peer, c->size), c->nla);
+    }
+    if (!c->put && (c->spec & RMA2_RESPONDER_NOTIFICATION))
+        push(c->peer, NOTI_WORD0(cmd, RMA2_RESPONDER_NOTIFICATION,
+                    ep->node, ep->slot, c->size), c->nla);
+}
+
+/* the link of a port: carries out its commands in order, each when due */
+static void *
+worker(void *arg)
+{
+    struct RMA2_Endpoint *ep = (struct RMA2_Endpoint *)arg;
+    struct cmd c;
+
+    /* deadlines are microseconds apart */
+    prctl(PR_SET_TIMERSLACK, 1UL);
+    pthread_mutex_lock(&ep->lock);
+    for (;;) {
+        while (ep->head == ep->tail && !ep->stop)
+            pthread_cond_wait(&ep->cond, &ep->lock);
+        if (ep->head == ep->tail)
+            break;
+        c = ep->cmds[ep->tail % CMD_RING];
+        pthread_mutex_unlock(&ep->lock);
+
+        wait_until(c.due);
+        if (c.put)
+            memcpy(c.remote, c.local, c.size);
+        else
+            memcpy(c.local, c.remote, c.size);
+        notify(ep, &c);
+
+        pthread_mutex_lock(&ep->lock);
+        ep->tail++;
+        pthread_cond_broadcast(&ep->cond);
+    }
+    pthread_mutex_unlock(&ep->lock);
+    return NULL;
+}
+
+/* address of [nla, nla + size) of a region on the node of h, mapping the
+ * region if needed; NULL if there is no such memory */
+static char *
+map_remote(RMA2_Handle h, RMA2_NLA nla, uint32_t size, int *peer)
+{
+    struct shm_region r;
+    struct mapping *m;
+    char name[NAME_MAX], *addr = NULL;
+    long slot = NLA_REGION(nla);
+    size_t off = NLA_OFFSET(nla);
+    int fd;
+
+    if (slot < 0 || slot >= MAX_REGIONS)
+        return NULL;
+    shm_lock(&root->lock);
+    r = root->regions[slot];
+    if (r.used && root->ports[r.port].node != h->node)
+        r.used = 0;
+    pthread_mutex_unlock(&root->lock);
+    if (!r.used || off + size > r.len)
+        return NULL;
+    *peer = r.port;
+
+    pthread_mutex_lock(&maps_lock);
+    m = &maps[slot];
+    if (m->addr && m->gen != r.gen) {
+        munmap(m->addr, m->len);
+        m->addr = NULL;
+    }
+    if (!m->addr) {
+        obj_name(name, slot, r.gen);
+        if ((fd = shm_open(name, O_RDWR, 0)) >= 0) {
+            m->addr = mmap(NULL, r.len, PROT_READ | PROT_WRITE, MAP_SHARED,
+                    fd, 0);
+            close(fd);
+            if (m->addr == MAP_FAILED)
+                m->addr = NULL;
+            m->gen = r.gen;
+            m->len = r.len;
+        }
+    }
+    if (m->addr)
+        addr = m->addr + off;
+    pthread_mutex_unlock(&maps_lock);
+    return addr;
+}
+
+static RMA2_ERROR
+post(RMA2_Port port, RMA2_Handle h, RMA2_Region *region, uint32_t offset,
+        uint32_t size, RMA2_NLA nla, RMA2_Notification_Spec spec, bool put)
+{
+    struct cmd *c;
+    char *remote;
+    uint64_t now;
+    int peer;
+
+    if (!port || !h || !region || size > MAX_XFER ||
+            (size_t)offset + size > region->size)
+        return RMA2_ERR_ERROR;
+    if (!(remote = map_remote(h, nla, size, &peer)))
+        return RMA2_ERR_ERROR;
+
+    pthread_mutex_lock(&port->lock);
+    while (port->head - port->tail == CMD_RING)
+        pthread_cond_wait(&port->cond, &port->lock);
+    c = &port->cmds[port->head % CMD_RING];
+    c->put = put;
+    c->peer = peer;
+    c->local = region->addr + offset;
+    c->remote = remote;
+    c->size = size;
+    c->nla = nla;
+    c->spec = spec;
+    /* the link carries one command after the other */
+    now = now_ns();
+    if (port->link_free < now)
+        port->link_free = now;
+    if (bw_mbps)
+        port->link_free += size * 1000UL / bw_mbps;
+    c->due = port->link_free + latency_ns;
+    port->head++;
+    pthread_cond_broadcast(&port->cond);
+    pthread_mutex_unlock(&port->lock);
+    return RMA2_SUCCESS;
+}
+
+/* Public functions */
+
+RMA2_ERROR
+rma2_open(RMA2_Port *port)
+{
+    struct RMA2_Endpoint *ep;
+    sigset_t all, old;
+    int slot;
+
+    pthread_once(&init_once, init);
+    if (init_err)
+        return init_err;
+    if (!port || !(ep = calloc(1, sizeof(*ep))))
+        return RMA2_ERR_ERROR;
+
+    shm_lock(&root->lock);
+    reclaim();
+    for (slot = 0; slot < MAX_PORTS && root->ports[slot].used; slot++)
+        ;
+    if (slot < MAX_PORTS) {
+        root->ports[slot].used = 1;
+        root->ports[slot].pid = getpid();
+        root->ports[slot].node = node_id;
+        root->ports[slot].head = root->ports[slot].tail = 0;
+        root->ports[slot].dropped = 0;
+    }
+    pthread_mutex_unlock(&root->lock);
+    if (slot == MAX_PORTS) {
+        free(ep);
+        return RMA2_ERR_PORTS_USED;
+    }
+
+    ep->slot = slot;
+    ep->node = node_id;
+    pthread_mutex_init(&ep->lock, NULL);
+    pthread_cond_init(&ep->cond, NULL);
+    /* signals are for the app's threads, not ours */
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    if (pthread_create(&ep->tid, NULL, worker, ep)) {
+        pthread_sigmask(SIG_SETMASK, &old, NULL);
+        shm_lock(&root->lock);
+        root->ports[slot].used = 0;
+        pthread_mutex_unlock(&root->lock);
+        free(ep);
+        return RMA2_ERR_ERROR;
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    *port = ep;
+    return RMA2_SUCCESS;
+}
+
+/* finishes the commands posted, then drops the port and what is still
+ * registered on it */
+RMA2_ERROR
+rma2_close(RMA2_Port port)
+{
+    int r;
+
+    if (!port)
+        return RMA2_ERR_ERROR;
+    pthread_mutex_lock(&port->lock);
+    port->stop = true;
+    pthread_cond_broadcast(&port->cond);
+    pthread_mutex_unlock(&port->lock);
+    pthread_join(port->tid, NULL);
+
+    shm_lock(&root->lock);
+    for (r = 0; r < MAX_REGIONS; r++)
+        if (root->regions[r].used && root->regions[r].port == port->slot)
+            release_region(r);
+    root->ports[port->slot].used = 0;
+    pthread_mutex_unlock(&root->lock);
+
+    pthread_mutex_destroy(&port->lock);
+    pthread_cond_destroy(&port->cond);
+    free(port);
+    return RMA2_SUCCESS;
+}
+
+RMA2_ERROR
+rma2_connect(RMA2_Port port, RMA2_Nodeid dest_node, RMA2_VPID dest_vpid,
+        RMA2_Connection_Options conn_type, RMA2_Handle *handle)
+{
+    struct RMA2_Connection *h;
+    bool found;
+
+    if (!port || !handle || dest_vpid >= MAX_PORTS)
+        return RMA2_ERR_ERROR;
+    shm_lock(&root->lock);
+    found = (root->ports[dest_vpid].used &&
+            root->ports[dest_vpid].node == dest_node);
+    pthread_mutex_unlock(&root->lock);
+    if (!found || !(h = calloc(1, sizeof(*h))))
+        return RMA2_ERR_ERROR;
+    h->node = dest_node;
+    h->vpid = dest_vpid;
+    *handle = h;
+    return RMA2_SUCCESS;
+}
+
+RMA2_ERROR
+rma2_disconnect(RMA2_Port port, RMA2_Handle handle)
+{
+    if (!port || !handle)
+        return RMA2_ERR_ERROR;
+    free(handle);
+    return RMA2_SUCCESS;
+}
+
+/* The pages of [address, address + size) are moved onto a shared memory
+ * object, keeping their contents and address. They lose any huge page or
+ * NUMA placement they had */
+RMA2_ERROR
+rma2_register(RMA2_Port port, void *address, size_t size,
+        RMA2_Region **region)
+{
+    struct RMA2_Region *r;
+    uintptr_t page = sysconf(_SC_PAGESIZE);
+    char name[NAME_MAX];
+    uint32_t gen = 0;
+    int slot, fd = -1;
+
+    if (!port || !address || !size || !region)
+        return RMA2_ERR_ERROR;
+    if (!(r = calloc(1, sizeof(*r))))
+        return RMA2_ERR_ERROR;
+    r->addr = (char *)address;
+    r->size = size;
+    r->base = (char *)((uintptr_t)address & ~(page - 1));
+    r->len = ((r->addr + size - r->base) + page - 1) & ~(page - 1);
+
+    shm_lock(&root->lock);
+    for (slot = 0; slot < MAX_REGIONS && root->regions[slot].used; slot++)
+        ;
+    if (slot < MAX_REGIONS) {
+        root->regions[slot].used = 1;
+        gen = ++root->regions[slot].gen;
+        root->regions[slot].port = port->slot;
+        root->regions[slot].len = r->len;
+    }
+    pthread_mutex_unlock(&root->lock);
+    if (slot == MAX_REGIONS) {
+        free(r);
+        return RMA2_ERR_ERROR;
+    }
+    r->slot = slot;
+
+    obj_name(name, slot, gen);
+    /* left over from a process that was killed */
+    shm_unlink(name);
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0 || ftruncate(fd, r->len) || move_to_shm(r, fd))
+        goto fail;
+    close(fd);
+
+    r->nla = ((RMA2_NLA)(slot + 1) << NLA_SHIFT) + (r->addr - r->base);
+    *region = r;
+    return RMA2_SUCCESS;
+
+fail:
+    if (fd >= 0) {
+        /* whatever was moved already comes back */
+        move_to_private(r, -1);
+        close(fd);
+    }
+    shm_lock(&root->lock);
+    release_region(slot);
+    pthread_mutex_unlock(&root->lock);
+    free(r);
+    return RMA2_ERR_MMAP;
+}
+
+/* the pages go back to private memory, contents and address kept */
+RMA2_ERROR
+rma2_unregister(RMA2_Port port, RMA2_Region *region)
+{
+    char name[NAME_MAX];
+    uint32_t gen;
+    int fd, ret;
+
+    if (!port || !region)
+        return RMA2_ERR_ERROR;
+    shm_lock(&root->lock);
+    gen = root->regions[region->slot].gen;
+    pthread_mutex_unlock(&root->lock);
+    obj_name(name, region->slot, gen);
+    fd = shm_open(name, O_RDWR, 0);
+    ret = move_to_private(region, fd);
+    if (fd >= 0)
+        close(fd);
+    if (ret)
+        return RMA2_ERR_MMAP;
+
+    shm_lock(&root->lock);
+    if (root->regions[region->slot].used &&
+            root->regions[region->slot].port == port->slot)
+        release_region(region->slot);
+    pthread_mutex_unlock(&root->lock);
+    free(region);
+    return RMA2_SUCCESS;
+}
+
+RMA2_Nodeid
+rma2_get_nodeid(RMA2_Port port)
+{
+    return (port ? port->node : 0);
+}
+
+RMA2_VPID
+rma2_get_vpid(RMA2_Port port)
+{
+    return (port ? port->slot : 0);
+}
+
+RMA2_ERROR
+rma2_get_nla(RMA2_Region *region, size_t offset, RMA2_NLA *nla)
+{
+    if (!region || !nla || offset > region->size)
+        return RMA2_ERR_ERROR;
+    *nla = region->nla + offset;
+    return RMA2_SUCCESS;
+}
+
+RMA2_ERROR
+rma2_post_put_bt(RMA2_Port port, RMA2_Handle handle, RMA2_Region *src_region,
+        uint32_t src_offset, uint32_t size, RMA2_NLA dest_address,
+        RMA2_Notification_Spec spec, RMA2_Command_Modifier modifier)
+{
+    return post(port, handle, src_region, src_offset, size, dest_address,
+            spec, true);
+}
+
+RMA2_ERROR
+rma2_post_get_bt(RMA2_Port port, RMA2_Handle handle, RMA2_Region *dest_region,
+        uint32_t dest_offset, uint32_t size, RMA2_NLA src_address,
+        RMA2_Notification_Spec spec, RMA2_Command_Modifier modifier)
+{
+    return post(port, handle, dest_region, dest_offset, size, src_address,
+            spec, false);
+}
+
+/* Notifications are handed out in order and stay valid until freed */
+RMA2_ERROR
+rma2_noti_get_block(RMA2_Port port, RMA2_Notification **notification)
+{
+    struct shm_port *p;
+
+    if (!port || !notification)
+        return RMA2_ERR_ERROR;
+    p = &root->ports[port->slot];
+    shm_lock(&p->lock);
+    while (p->head == p->tail)
+        shm_wait(&p->cond, &p->lock);
+    *notification = &p->ring[p->tail % NOTI_RING];
+    pthread_mutex_unlock(&p->lock);
+    return RMA2_SUCCESS;
+}
+
+RMA2_ERROR
+rma2_noti_probe(RMA2_Port port, RMA2_Notification **notification)
+{
+    struct shm_port *p;
+    RMA2_ERROR rc = RMA2_SUCCESS;
+
+    if (!port || !notification)
+        return RMA2_ERR_ERROR;
+    p = &root->ports[port->slot];
+    shm_lock(&p->lock);
+    if (p->head == p->tail)
+        rc = RMA2_ERR_NO_NOTI;
+    else
+        *notification = &p->ring[p->tail % NOTI_RING];
+    pthread_mutex_unlock(&p->lock);
+    return rc;
+}
+
+RMA2_ERROR
+rma2_noti_free(RMA2_Port port, RMA2_Notification *notification)
+{
+    struct shm_port *p;
+    RMA2_ERROR rc = RMA2_ERR_ERROR;
+
+    if (!port)
+        return RMA2_ERR_ERROR;
+    p = &root->ports[port->slot];
+    shm_lock(&p->lock);
+    if (p->head != p->tail && notification == &p->ring[p->tail % NOTI_RING]) {
+        p->tail++;
+        pthread_cond_broadcast(&p->cond);
+        rc = RMA2_SUCCESS;
+    }
+    pthread_mutex_unlock(&p->lock);
+    return rc;
+}
+
+void
+rma2_noti_dump(RMA2_Notification *n)
+{
+    static const char *cls[] = {
+        [RMA2_REQUESTER_NOTIFICATION] = "requester",
+        [RMA2_COMPLETER_NOTIFICATION] = "completer",
+        [RMA2_RESPONDER_NOTIFICATION] = "responder"
+    };
+    unsigned int c = (n->word0 >> 56) & 0xf;
+
+    printf("%s %s notification: peer node %lu vpid %lu, %lu bytes, NLA 0x%lx\n",
+            ((n->word0 >> 60) == CMD_PUT ? "put" : "get"),
+            (c < sizeof(cls) / sizeof(*cls) && cls[c] ? cls[c] : "?"),
+            (n->word0 >> 40) & 0xffff, (n->word0 >> 24) & 0xffff,
+            n->word0 & 0xffffff, n->word1);
+}
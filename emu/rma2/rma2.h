@@ -0,0 +1,94 @@
+/**
+ * file: rma2.h
+ * desc: software emulation of the part of EXTOLL's librma2 interface that
+ * Oncilla uses, so the RMA path builds and runs without EXTOLL hardware
+ * (scons rma2emu=1). Declarations follow /extoll2/include/rma2.h; see
+ * rma2.c for how the emulation behaves.
+ */
+
+#ifndef __RMA2_EMU_H__
+#define __RMA2_EMU_H__
+
+/* System includes */
+#include <stddef.h>
+#include <stdint.h>
+
+/* Types */
+
+typedef uint16_t RMA2_Nodeid;
+typedef uint16_t RMA2_VPID;
+/* network level address of registered memory */
+typedef uint64_t RMA2_NLA;
+
+typedef enum {
+    RMA2_SUCCESS = 0,
+    RMA2_ERR_ERROR,
+    RMA2_ERR_IOCTL,
+    RMA2_ERR_MMAP,
+    RMA2_ERR_NO_DEVICE,
+    RMA2_ERR_PORTS_USED,
+    RMA2_ERR_FD,
+    RMA2_ERR_INVALID_VERSION,
+    RMA2_ERR_NO_NOTI
+} RMA2_ERROR;
+
+typedef enum {
+    RMA2_CONN_DEFAULT = 0
+} RMA2_Connection_Options;
+
+/* which ends of a put or get are notified; may be or'ed */
+typedef enum {
+    RMA2_NO_NOTIFICATION = 0,
+    RMA2_REQUESTER_NOTIFICATION = 1,
+    RMA2_COMPLETER_NOTIFICATION = 2,
+    RMA2_RESPONDER_NOTIFICATION = 4
+} RMA2_Notification_Spec;
+
+typedef enum {
+    RMA2_CMD_DEFAULT = 0
+} RMA2_Command_Modifier;
+
+typedef struct RMA2_Endpoint RMA2_Endpoint;
+typedef RMA2_Endpoint *RMA2_Port;
+typedef struct RMA2_Connection *RMA2_Handle;
+typedef struct RMA2_Region RMA2_Region;
+
+typedef struct RMA2_Notification {
+    uint64_t word0; /* class, command, peer node and vpid, size */
+    uint64_t word1; /* NLA the command addressed */
+} RMA2_Notification;
+
+/* Function prototypes */
+
+RMA2_ERROR rma2_open(RMA2_Port *port);
+RMA2_ERROR rma2_close(RMA2_Port port);
+RMA2_ERROR rma2_connect(RMA2_Port port, RMA2_Nodeid dest_node,
+        RMA2_VPID dest_vpid, RMA2_Connection_Options conn_type,
+        RMA2_Handle *handle);
+RMA2_ERROR rma2_disconnect(RMA2_Port port, RMA2_Handle handle);
+
+RMA2_ERROR rma2_register(RMA2_Port port, void *address, size_t size,
+        RMA2_Region **region);
+RMA2_ERROR rma2_unregister(RMA2_Port port, RMA2_Region *region);
+
+RMA2_Nodeid rma2_get_nodeid(RMA2_Port port);
+RMA2_VPID rma2_get_vpid(RMA2_Port port);
+RMA2_ERROR rma2_get_nla(RMA2_Region *region, size_t offset, RMA2_NLA *nla);
+
+RMA2_ERROR rma2_post_put_bt(RMA2_Port port, RMA2_Handle handle,
+        RMA2_Region *src_region, uint32_t src_offset, uint32_t size,
+        RMA2_NLA dest_address, RMA2_Notification_Spec spec,
+        RMA2_Command_Modifier modifier);
+RMA2_ERROR rma2_post_get_bt(RMA2_Port port, RMA2_Handle handle,
+        RMA2_Region *dest_region, uint32_t dest_offset, uint32_t size,
+        RMA2_NLA src_address, RMA2_Notification_Spec spec,
+        RMA2_Command_Modifier modifier);
+
+RMA2_ERROR rma2_noti_get_block(RMA2_Port port,
+        RMA2_Notification **notification);
+/* RMA2_ERR_NO_NOTI if none is queued */
+RMA2_ERROR rma2_noti_probe(RMA2_Port port, RMA2_Notification **notification);
+RMA2_ERROR rma2_noti_free(RMA2_Port port, RMA2_Notification *notification);
+void rma2_noti_dump(RMA2_Notification *notification);
+
+#endif  /* __RMA2_EMU_H__ */
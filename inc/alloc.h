@@ -47,8 +47,10 @@ struct alloc_request
 {
     int orig_rank;  /* originating rank where app is */
     int remote_rank; /* node requested for allocation, TODO not yet used */
-    size_t bytes;
+    size_t bytes; /* per buffer */
+    unsigned int count; /* number of equally sized buffers requested */
     enum alloc_ation_type type;
+    int numa_node; /* ocm_alloc_params.numa_node */
     /* TODO other properties */
 };
 
@@ -70,11 +72,21 @@ struct alloc_ation
     int orig_rank;
     int remote_rank;
     //A sequentially increasing ID used to find
-    //and release remote allocations
+    //and release remote allocations. A batch of 'count' buffers
+    //owns the IDs [rem_alloc_id, rem_alloc_id + count)
     uint64_t rem_alloc_id;
 
     enum alloc_ation_type type;
-    size_t bytes;
+    size_t bytes; /* per buffer */
+    //Number of buffers in the batch. RDMA buffers listen on consecutive
+    //ports starting at u.rdma.port; RMA buffers share one registered
+    //region, buffer i starting at u.rma.dest_nla + i * bytes
+    unsigned int count;
+    //Only used on the serving node: buffers of the batch not yet freed
+    unsigned int live;
+    //Requested placement, ocm_alloc_params.numa_node; the serving node
+    //resolves it against its own topology
+    int numa_node;
 
     union {
         #ifdef EXTOLL
@@ -93,6 +105,9 @@ struct alloc_ation
             char ib_ip[HOST_NAME_MAX];
             int port;
             ib_t ib_rem;
+            //Serving node: still waiting for the client, and freed
+            //meanwhile, leaving the teardown to the accepting thread
+            bool accepting, cancelled;
         } rdma;
         #endif
     } u;
@@ -0,0 +1,35 @@
+/**
+ * file: buf.h
+ * desc: page-backed buffers for memory that is registered with the NIC:
+ * served buffers and the library's staging buffers. Large buffers are
+ * backed by huge pages when possible, so pinning and registering them takes
+ * fewer translation entries and the NIC misses its IOTLB less often.
+ *
+ * OCM_HUGEPAGES picks the backing:
+ *   off   4 KiB pages only
+ *   thp   transparent huge pages via madvise (default)
+ *   2m    hugetlb 2 MiB pages, falling back to thp
+ *   1g    hugetlb 1 GiB pages, falling back to 2m, then thp
+ * hugetlb pages must be reserved beforehand (vm.nr_hugepages or
+ * /sys/kernel/mm/hugepages); buffers smaller than a huge page never use
+ * one.
+ */
+
+#ifndef __BUF_H__
+#define __BUF_H__
+
+/* System includes */
+#include <stddef.h>
+
+/* Other project includes */
+
+/* Project includes */
+
+/* Function prototypes */
+
+/* zeroed, page-aligned buffer on node (see topo.h; -1 for anywhere) */
+void *buf_alloc(size_t len, int node);
+/* release a buffer of buf_alloc; anything else is passed to free() */
+void buf_free(void *buf);
+
+#endif  /* __BUF_H__ */
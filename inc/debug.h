@@ -15,11 +15,12 @@
 #include <unistd.h>
 
 /* Project includes */
+#include <log.h>
 #include <util/compiler.h>
 
 //To use these debugs functions pass 'OCM_VERBOSE=1' before your
-//executable and any arguments
-#define __DEBUG_ENABLED     (getenv("OCM_VERBOSE"))
+//executable and any arguments; see log.h for finer control
+#define __DEBUG_ENABLED     (log_enabled(OCM_LOG_DEBUG))
 
 /**
  * Halt immediately if expression 'expr' evaluates to true and print a message.
@@ -47,8 +48,10 @@
 
 #define ABORT()     ABORT2(1)
 
+/* synchronous; flushes queued log messages first so they precede it */
 #define __detailed_print(fmt, args...)                  \
     do {                                                \
+        log_flush();                                    \
         fprintf(stderr, "(%d:%d) %s::%s[%d]: ",     \
                 getpid(),(pid_t)syscall(SYS_gettid),    \
                 __FILE__, __func__, __LINE__);          \
@@ -57,11 +60,6 @@
     } while(0)
 
 /* debug printing. will only print if env var OCM_VERBOSE is defined */
-#define printd(fmt, args...)                                            \
-    do {                                                                \
-        if(__DEBUG_ENABLED) {                                           \
-            __detailed_print(fmt, ##args);                              \
-        }                                                               \
-    } while(0)
+#define printd(fmt, args...)    log_print(OCM_LOG_DEBUG, fmt, ##args)
 
 #endif /* DEBUG_H_ */
@@ -10,11 +10,12 @@
 /* System includes */
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdio.h>
 
 /* Other project includes */
-//RMA2 header files
-#include "/extoll2/include/rma2.h"
-#include "/extoll2/include/pmap.h"
+//RMA2 header files, from /extoll2/include or emu/rma2 (scons rma2emu=1)
+#include <rma2.h>
+#include <pmap.h>
 
 /* Project includes */
 
@@ -25,6 +26,10 @@
 struct extoll_alloc; /* forward declaration */
 typedef struct extoll_alloc * extoll_t;
 
+//Called on the daemon's notification thread for each notification of a
+//server allocation. It must not block or call back into the allocation
+typedef void (*extoll_noti_fn)(extoll_t ex, RMA2_Notification *n, void *arg);
+
 //extoll_params contains all the information needed to set up/disconnect
 //an RMA2 connection. The __rma_t struct in src/extoll.h contains the
 //variables used to manage an existing connection.
@@ -41,6 +46,16 @@ struct extoll_params {
   void* buf;
   //Buffer size - specified in terms of Bytes (not ints as IB is)
   size_t buf_len;
+  //Client only: size of the remote buffer, bounding dest offsets.
+  //0 means it is as large as buf
+  size_t dest_len;
+  //Placement of buf, as ocm_alloc_params.numa_node (0 = next to the NIC)
+  int numa_node;
+  //Client only: put/get operations outstanding per transfer (up to 64) and
+  //the most bytes each moves (4 KB to 8 MB). 0 takes OCM_RMA_DEPTH
+  //(default 4) and OCM_RMA_CHUNK (default 8m)
+  uint32_t pipeline_depth;
+  uint32_t chunk_bytes;
 };
 
 /* Global state (externs) */
@@ -51,8 +66,12 @@ int extoll_init(void);
 extoll_t extoll_new(struct extoll_params *p);
 int extoll_free(extoll_t ex);
 int extoll_connect(extoll_t ex, bool is_server);
-//Wait for notifications on server - typically used with put 
-//operations (client handles get notifications)
+//Notifications of connected server allocations - typically from put
+//operations (client handles get notifications) - are taken off their
+//ports by one notification thread per process. extoll_set_noti_handler
+//has them passed to fn; by default they are only counted.
+int extoll_set_noti_handler(extoll_t ex, extoll_noti_fn fn, void *arg);
+//Keep a server allocation open until Ctrl-\ is entered
 void extoll_notification(extoll_t ex);
 int extoll_disconnect(extoll_t ex, bool is_server);
 int extoll_read(extoll_t ex, size_t src_offset, size_t dest_offset, size_t len);
@@ -22,11 +22,21 @@
 struct ib_alloc; /* forward declaration */
 typedef struct ib_alloc * ib_t;
 
+/* how ib_poll waits for a completion */
+enum ib_poll_mode {
+    IB_POLL_DEFAULT = 0, /* OCM_IB_POLL, or event */
+    IB_POLL_EVENT, /* sleep on the completion channel */
+    IB_POLL_BUSY, /* spin on the CQ */
+    IB_POLL_HYBRID /* spin for spin_us, then sleep */
+};
+
 struct ib_params {
     char        *addr; /* used only by client */
     uint32_t    port;
     void        *buf;
     size_t      buf_len;
+    int         poll_mode; /* enum ib_poll_mode */
+    uint32_t    spin_us; /* hybrid; 0 for OCM_IB_SPIN_US or the default */
 };
 
 /* Global state (externs) */
@@ -36,8 +46,14 @@ struct ib_params {
 int ib_init(void);
 ib_t ib_new(struct ib_params *p);
 int ib_free(ib_t ib);
+int ib_listen(ib_t ib);
 int ib_connect(ib_t ib, bool is_server);
+/* make a server's ib_connect, pending or future, give up waiting for the
+ * client and fail */
+int ib_cancel(ib_t ib);
 int ib_disconnect(ib_t ib, bool is_server);
+/* ib_read/ib_write queue a transfer, posted in batches; ib_poll posts what
+ * is left and waits for all of them */
 int ib_read(ib_t ib, size_t src_offset, size_t dest_offset, size_t len);
 int ib_write(ib_t ib, size_t src_offset, size_t dest_offset, size_t len);
 int ib_poll(ib_t ib);
@@ -0,0 +1,75 @@
+/**
+ * file: lib_cache.h
+ * desc: client-side cache of a remote buffer, enabled per allocation with
+ * ocm_alloc_params.cache_bytes. Entries are fixed-size blocks of the remote
+ * buffer kept in local memory and evicted by a clock hand. Reads of cached
+ * blocks are served locally; missing blocks fully covered by a read are
+ * kept. Writes update cached blocks and either go to the remote buffer as
+ * well (write-through) or only when the block is evicted or flushed
+ * (write-back).
+ *
+ * Each cache owns a staging area right after the allocation's local buffer.
+ * A readahead thread fills it: when reads of an allocation follow a
+ * sequential or fixed-stride pattern, the blocks of the next accesses are
+ * read into the cache while the app works on the current ones, as are
+ * ranges named by ocm_prefetch. Readahead never evicts dirty blocks.
+ *
+ * The cache never sees other clients' writes to the same remote buffer.
+ *
+ * Environment:
+ *   OCM_CACHE_BYTES   capacity for allocations that do not set cache_bytes
+ *   OCM_CACHE_POLICY  "wb" makes those write-back
+ *   OCM_CACHE_BLOCK   block size (default 64k)
+ *   OCM_READAHEAD     readahead_bytes for allocations that do not set it
+ */
+
+#ifndef __LIB_CACHE_H__
+#define __LIB_CACHE_H__
+
+/* System includes */
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Other project includes */
+
+/* Project includes */
+#include <oncillamem.h>
+
+/* Types */
+
+/* move len bytes between offset loff of the local buffer and offset roff of
+ * the remote one; arg is what the cache call was given */
+typedef int (*cache_xfer_t)(void *arg, bool write, size_t loff, size_t roff,
+        size_t len);
+
+struct lib_cache;
+
+/* Function prototypes */
+
+/* cache_bytes/write_back/readahead as asked for, or from the environment if
+ * 0. Readahead without a cache gets one. Returns the bytes of staging the
+ * allocation needs after its local buffer, 0 if it is not to be cached */
+size_t lib_cache_config(size_t *cache_bytes, bool *write_back,
+        size_t *readahead);
+/* cache over a remote buffer read and written through local[0, local_len),
+ * with local[local_len, local_len + stage_len) its own. Readahead transfers
+ * are issued with ra_arg */
+struct lib_cache *lib_cache_new(size_t capacity, bool write_back,
+        size_t readahead, char *local, size_t local_len, size_t stage_len,
+        size_t remote_len, cache_xfer_t xfer, void *ra_arg);
+/* stop readahead and drop everything, dirty blocks included */
+void lib_cache_free(struct lib_cache *c);
+
+/* read remote [roff, roff + len) into local + loff */
+int lib_cache_read(struct lib_cache *c, size_t loff, size_t roff, size_t len,
+        void *arg);
+/* write local + loff to remote [roff, roff + len) */
+int lib_cache_write(struct lib_cache *c, size_t loff, size_t roff,
+        size_t len, void *arg);
+/* queue remote [roff, roff + len) for readahead and return */
+int lib_cache_prefetch(struct lib_cache *c, size_t roff, size_t len);
+/* write back all dirty blocks */
+int lib_cache_flush(struct lib_cache *c, void *arg);
+void lib_cache_stats(struct lib_cache *c, struct ocm_cache_stats *s);
+
+#endif  /* __LIB_CACHE_H__ */
@@ -0,0 +1,31 @@
+/**
+ * file: lib_copy.h
+ * desc: copy engine for the host-memory legs of ocm_copy. Small copies are
+ * a plain memcpy. Large ones are split across a few persistent threads
+ * pinned to the NIC's NUMA node (the caller's if unknown), and each piece is copied with
+ * non-temporal (streaming) stores, so multi-GB copies do not evict the
+ * cache or leave bandwidth on the table. The SIMD variant (AVX-512, AVX2
+ * or plain memcpy) is chosen once at run time.
+ *
+ * Environment:
+ *   OCM_COPY_THREADS    pool threads besides the caller (default: up to 3,
+ *                       fewer if the node has fewer CPUs; 0 disables)
+ *   OCM_COPY_MIN_BYTES  smallest copy handed to the engine (default 1m)
+ */
+
+#ifndef __LIB_COPY_H__
+#define __LIB_COPY_H__
+
+/* System includes */
+#include <stddef.h>
+
+/* Other project includes */
+
+/* Project includes */
+
+/* Function prototypes */
+
+/* memcpy for possibly very large, non-overlapping buffers */
+void *lib_copy(void *dst, const void *src, size_t len);
+
+#endif  /* __LIB_COPY_H__ */
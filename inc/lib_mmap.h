@@ -0,0 +1,38 @@
+/**
+ * file: lib_mmap.h
+ * desc: demand-paged mappings of remote allocations, see ocm_mmap in
+ * oncillamem.h. A handler thread per mapping serves its userfaultfd: a
+ * missing-page fault reads the block holding the page from the remote
+ * buffer through the allocation's local buffer; pages come in
+ * write-protected so the first store marks the block dirty. When the
+ * resident set is full a clock hand picks a block to evict, writing it back
+ * first if dirty.
+ *
+ * Where unprivileged userfaultfd is disabled (vm.unprivileged_userfaultfd=0)
+ * and the process lacks CAP_SYS_PTRACE, the handler falls back to a
+ * user-mode-only userfaultfd (Linux 5.11+). Loads and stores by the app are
+ * still served, but faults taken inside the kernel are not: read(), write(),
+ * send() and other syscalls given a not-yet-resident part of the mapping
+ * fail with EFAULT. Copy such data through a plain buffer first.
+ *
+ * Environment:
+ *   OCM_MMAP_BLOCK  bytes read or written per fault/eviction (default 64k,
+ *                   a multiple of the page size)
+ */
+
+#ifndef __LIB_MMAP_H__
+#define __LIB_MMAP_H__
+
+/* System includes */
+
+/* Other project includes */
+
+/* Project includes */
+#include <oncillamem.h>
+
+/* Function prototypes */
+
+/* drop the mapping of a, if any, without writing it back; for ocm_free */
+void lib_mmap_release(ocm_alloc_t a);
+
+#endif  /* __LIB_MMAP_H__ */
@@ -0,0 +1,78 @@
+/**
+ * file: lib_record.h
+ * desc: workload recorder. With OCM_RECORD=<path> set, libocm logs every
+ * ocm_alloc, ocm_free, ocm_copy and ocm_copy_onesided call to a compact
+ * binary file that tools/ocm_replay re-issues against a cluster. A "%p" in
+ * the path is replaced by the pid; a forked child that calls ocm_init again
+ * records to <path>.<pid> so it does not clobber its parent's file.
+ *
+ * File format: a header, then one variable-length record per call in the
+ * order the calls completed.
+ *
+ *   header:  "OCMREC" u8 version u8 0 | u64 wall-clock start (ns, little
+ *            endian)
+ *   record:  u8 op | u8 flags | thread | start | dur | fields ...
+ *
+ * All record fields after the flags are LEB128 varints. thread numbers the
+ * recording threads from 1; start is the zigzag-encoded difference to the
+ * start of the previous record (calls complete out of order), in ns; dur is
+ * how long the call took, in ns. Allocations are numbered from 1 in the
+ * order they were made, and later records refer to them by that number (0
+ * for an allocation the recorder never saw). The fields per op are
+ *
+ *   ALLOC:     kind count local_bytes rem_bytes first_id
+ *   FREE:      id
+ *   COPY:      dest_id src_id bytes src_off dest_off src_off_2 dest_off_2
+ *   ONESIDED:  id bytes src_off dest_off
+ *
+ * An ALLOC of count buffers takes ids first_id .. first_id + count - 1.
+ */
+
+#ifndef __LIB_RECORD_H__
+#define __LIB_RECORD_H__
+
+/* System includes */
+#include <stdint.h>
+
+/* Other project includes */
+
+/* Project includes */
+#include <oncillamem.h>
+
+/* Defines */
+
+#define OCM_REC_MAGIC       "OCMREC"
+#define OCM_REC_VERSION     1
+#define OCM_REC_HDR_LEN     16
+/* longest encoded record: two bytes plus at most 12 varints */
+#define OCM_REC_MAX_LEN     (2 + 12 * 10)
+
+enum ocm_rec_op
+{
+    OCM_REC_ALLOC = 1,
+    OCM_REC_FREE,
+    OCM_REC_COPY,
+    OCM_REC_ONESIDED,
+};
+
+#define OCM_REC_FAILED      0x1 /* the call returned an error */
+#define OCM_REC_WRITE       0x2 /* op_flag of a copy */
+
+/* Functions */
+
+/* start recording if OCM_RECORD is set */
+int lib_record_init(void);
+void lib_record_fin(void);
+
+/* each returns at once unless recording; start is a lib_stats_now time */
+/* returns the id of the first of count allocations, 0 if not recording */
+uint64_t lib_record_alloc(ocm_alloc_param_t p, unsigned int count,
+        uint64_t start, bool failed);
+void lib_record_free(uint64_t id, uint64_t start, bool failed);
+/* write is the op_flag the caller passed, which do_copy may have changed */
+void lib_record_copy(uint64_t dest_id, uint64_t src_id, ocm_param_t p,
+        bool write, uint64_t start, bool failed);
+void lib_record_onesided(uint64_t id, ocm_param_t p, uint64_t start,
+        bool failed);
+
+#endif  /* __LIB_RECORD_H__ */
@@ -0,0 +1,48 @@
+/**
+ * file: lib_stats.h
+ * desc: per-kind, per-operation latency and byte counters kept by libocm;
+ * read through ocm_stats_get/ocm_stats_dump in oncillamem.h
+ */
+
+#ifndef __LIB_STATS_H__
+#define __LIB_STATS_H__
+
+/* System includes */
+#include <stdint.h>
+#include <time.h>
+
+/* Other project includes */
+
+/* Project includes */
+#include <oncillamem.h>
+
+/* Defines */
+
+/* evaluate expr and record how long it took as phase of op */
+#define STATS_TIME(kind, op, phase, expr)                       \
+    ({                                                          \
+        uint64_t __t0 = lib_stats_now();                        \
+        typeof(expr) __r = (expr);                              \
+        lib_stats_record(kind, op, phase, lib_stats_now() - __t0); \
+        __r;                                                    \
+    })
+
+/* Functions */
+
+static inline uint64_t
+lib_stats_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+void lib_stats_record(enum ocm_kind kind, enum ocm_stat_op op,
+        enum ocm_stat_phase phase, uint64_t ns);
+/* count a whole operation: its total latency, bytes moved and outcome */
+void lib_stats_op(enum ocm_kind kind, enum ocm_stat_op op,
+        uint64_t start_ns, uint64_t bytes, bool failed);
+/* dump as requested by OCM_STATS, if set */
+void lib_stats_fin(void);
+
+#endif  /* __LIB_STATS_H__ */
@@ -0,0 +1,55 @@
+/**
+ * file: lib_wc.h
+ * desc: write-combining buffer of a remote allocation, enabled with
+ * ocm_alloc_params.wc_bytes. Writes of up to a quarter of the buffer that
+ * touch or overlap the pending extent are merged into it instead of each
+ * becoming a transfer. The extent is written out as one transfer when it
+ * fills up, when a write does not join it, when it has been pending for
+ * OCM_WC_TIMEOUT, by ocm_flush, and before a read or large write that
+ * overlaps it. All transfers of the allocation go through here so the
+ * timer never races the app's own.
+ *
+ * Environment:
+ *   OCM_WC_BYTES    wc_bytes for allocations that do not set it
+ *   OCM_WC_TIMEOUT  microseconds a write may wait (default 100)
+ */
+
+#ifndef __LIB_WC_H__
+#define __LIB_WC_H__
+
+/* System includes */
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Other project includes */
+
+/* Project includes */
+
+/* Types */
+
+/* move len bytes between offset loff of the local buffer and offset roff of
+ * the remote one; arg is what the call was given */
+typedef int (*wc_xfer_t)(void *arg, bool write, size_t loff, size_t roff,
+        size_t len);
+
+struct lib_wc;
+
+/* Function prototypes */
+
+/* wc_bytes as asked for, or from the environment if 0; returns the bytes of
+ * staging the allocation needs for it */
+size_t lib_wc_config(size_t *wc_bytes);
+/* combine into local[off, off + bytes); timed flushes are issued with
+ * timer_arg */
+struct lib_wc *lib_wc_new(size_t bytes, char *local, size_t off,
+        wc_xfer_t xfer, void *timer_arg);
+/* stop the timer and drop the pending extent */
+void lib_wc_free(struct lib_wc *w);
+
+/* a transfer of the allocation, combined if it is a small write */
+int lib_wc_xfer(struct lib_wc *w, bool write, size_t loff, size_t roff,
+        size_t len, void *arg);
+/* write out the pending extent */
+int lib_wc_flush(struct lib_wc *w, void *arg);
+
+#endif  /* __LIB_WC_H__ */
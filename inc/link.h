@@ -0,0 +1,76 @@
+/**
+ * file: link.h
+ * desc: persistent per-peer daemon connections. Messages queued for a peer
+ * are coalesced by a sender thread into framed batches, one write per batch;
+ * the receiving side handles every message of a batch before its replies go
+ * out, so those are coalesced too.
+ *
+ * Tunables (environment):
+ *   OCM_LINK_DELAY_US     time a sender waits for more messages to join a
+ *                         batch once one is queued (default 0: only batch
+ *                         what queued up during the previous write)
+ *   OCM_LINK_BATCH_BYTES  size at which a batch is sent without waiting
+ *                         further (default 16384)
+ */
+
+#ifndef __LINK_H__
+#define __LINK_H__
+
+/* System includes */
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Other project includes */
+
+/* Project includes */
+#include <msg.h>
+#include <sock.h>
+
+/* Types */
+
+struct peer_link;
+
+/* an inbound message as handed to the handler */
+struct link_in
+{
+    struct peer_link *link;
+    uint64_t seq;
+    bool want_reply;
+};
+
+/* traffic exchanged with one peer over all links to it */
+struct link_stats
+{
+    uint64_t tx_msgs, tx_frames, tx_bytes;
+    uint64_t rx_msgs, rx_frames, rx_bytes;
+    uint64_t queued;    /* bytes waiting to be sent */
+    uint64_t waiting;   /* requests waiting for a reply */
+};
+
+/* called on the link's receive thread for every inbound request or one-way
+ * message; must not block for long as it holds up the rest of the peer's
+ * traffic */
+typedef void (*link_handler_t)(struct link_in *in, struct message *msg);
+
+/* Function prototypes */
+
+int link_init(link_handler_t handler);
+void link_fin(void);
+
+/* take over an accepted connection; messages on it go to the handler */
+int link_accept(struct sockconn *conn);
+
+/* queue msg for rank without waiting for a reply */
+int link_send(int rank, struct message *msg);
+/* queue msg for rank and block until the reply overwrites msg */
+int link_send_recv(int rank, struct message *msg);
+/* answer an inbound request; ignored for one-way messages */
+int link_reply(struct link_in *in, struct message *msg);
+/* keep the link of a copy of in alive so a handler can hand the request to
+ * another thread and reply from there; drop it with link_release */
+void link_hold(struct link_in *in);
+void link_release(struct link_in *in);
+
+int link_get_stats(int rank, struct link_stats *stats);
+
+#endif  /* __LINK_H__ */
@@ -0,0 +1,66 @@
+/**
+ * file: log.h
+ * desc: leveled logging. The level is read from the environment once and
+ * cached; levels above OCM_LOG_MAX are compiled out entirely. Messages are
+ * formatted by the calling thread into its own lock-free ring and written
+ * out by a background thread, so logging never blocks on stderr.
+ *
+ * Environment:
+ *   OCM_LOG_LEVEL  error, warn, info or debug (or 0-3)
+ *   OCM_VERBOSE    if set and OCM_LOG_LEVEL is not, same as debug
+ *   OCM_LOG_SYNC   if set, write each message immediately (for crashes
+ *                  that would lose what is still buffered)
+ */
+
+#ifndef __LOG_H__
+#define __LOG_H__
+
+/* System includes */
+#include <stdbool.h>
+
+/* Other project includes */
+
+/* Project includes */
+#include <util/compiler.h>
+
+/* Defines */
+
+#define OCM_LOG_ERROR   0
+#define OCM_LOG_WARN    1
+#define OCM_LOG_INFO    2
+#define OCM_LOG_DEBUG   3
+
+/* most verbose level built in; e.g. -DOCM_LOG_MAX=OCM_LOG_INFO drops printd */
+#ifndef OCM_LOG_MAX
+#define OCM_LOG_MAX     OCM_LOG_DEBUG
+#endif
+
+#define log_print(lvl, fmt, args...)                                    \
+    do {                                                                \
+        if ((lvl) <= OCM_LOG_MAX && log_enabled(lvl))                   \
+            log_write(lvl, __FILE__, __func__, __LINE__, fmt, ##args);  \
+    } while (0)
+
+/* Global state (externs) */
+
+/* < 0 until first read from the environment */
+extern int log_cur_level;
+
+/* Function prototypes */
+
+int log_level_init(void);
+void log_write(int level, const char *file, const char *func, int line,
+        const char *fmt, ...) __attribute__((format(printf, 5, 6)));
+/* write out everything logged so far */
+void log_flush(void);
+
+/* true if messages of level are logged; the level is read from the
+ * environment on first use. A macro, as an inline function fails -Winline
+ * in cold paths */
+#define log_enabled(level)                                              \
+    ((level) <= (dbg_unlikely(__atomic_load_n(&log_cur_level,           \
+                    __ATOMIC_RELAXED) < 0) ?                            \
+                log_level_init() :                                      \
+                __atomic_load_n(&log_cur_level, __ATOMIC_RELAXED)))
+
+#endif  /* __LOG_H__ */
@@ -26,7 +26,7 @@
 
 /* Function prototypes */
 
-int mem_init(const char *nodefile_path);
+int mem_init(const char *nodefile_path, int rank);
 int mem_new_request(struct message *m);
 void mem_fin(void);
 void mem_set_outbox(struct queue *outbox);
@@ -10,6 +10,7 @@
 /* System includes */
 #include <stdio.h>
 #include <limits.h>
+#include <stdint.h>
 
 /* Other project includes */
 
@@ -61,6 +62,12 @@ struct message
 
     pid_t pid; /* app which made request */
     int rank; /* rank (app) which made request */
+    /* assigned by the library per request and echoed back unchanged in the
+     * reply, so concurrent callers in one app can find their own response */
+    uint64_t id;
+    /* set by the library for each alloc/free and carried unchanged through
+     * every daemon that works on it; 0 if the request is not traced */
+    uint64_t trace_id;
 
     /* message specifics */
     union {
@@ -36,6 +36,8 @@ extern int node_file_entries;
 /* Static inline functions */
 
 /* Function prototypes */
-int parse_nodefile(const char *path, int *_myrank /* out */);
+/* rank < 0 finds our rank by matching gethostname() against the entries;
+ * otherwise rank is taken as given, allowing several daemons per host */
+int parse_nodefile(const char *path, int rank, int *_myrank /* out */);
 
 #endif  /* __NODEFILE_H__ */
@@ -8,6 +8,7 @@
 #define __ONCILLAMEM_H__
 
 /* System includes */
+#include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <stdint.h>
@@ -22,6 +23,10 @@
 /* Definitions */
 
 typedef struct lib_alloc * ocm_alloc_t;
+typedef struct lib_alloc_req * ocm_alloc_req_t;
+
+/* called from a library thread when an asynchronous allocation completes */
+typedef void (*ocm_alloc_cb_t)(ocm_alloc_req_t req, void *arg);
 
 enum ocm_kind
 {
@@ -55,10 +60,91 @@ struct ocm_alloc_params
     uint64_t local_alloc_bytes;
     uint64_t rem_alloc_bytes;
     enum ocm_kind kind;
+    ///NUMA node for the buffers, on this host and on the serving one:
+    ///OCM_NUMA_NIC (0, the default) places staging and served buffers
+    ///next to the NIC, OCM_NUMA_ANY leaves placement to the kernel and
+    ///OCM_NUMA_NODE(n) asks for node n. Local host allocations are only
+    ///placed when a node is given.
+    int numa_node;
+    ///Bytes of a local cache in front of the remote buffer, 0 for none
+    ///(or OCM_CACHE_BYTES). Only for data no other client writes
+    uint64_t cache_bytes;
+    ///Keep cached writes local until evicted or ocm_cache_flush instead
+    ///of also writing them to the remote buffer
+    bool cache_write_back;
+    ///Bytes to read ahead of sequential or strided reads into the cache,
+    ///0 for none (or OCM_READAHEAD). Gives the allocation a cache if it
+    ///has none
+    uint64_t readahead_bytes;
+    ///Bytes of a buffer that merges small adjacent writes into one
+    ///transfer, 0 for none (or OCM_WC_BYTES). See ocm_flush
+    uint64_t wc_bytes;
+    ///How transfers wait for completion on InfiniBand, an ocm_poll_mode
+    int poll_mode;
+    ///Microseconds OCM_POLL_HYBRID spins before sleeping, 0 for
+    ///OCM_IB_SPIN_US or 50
+    uint32_t poll_spin_us;
 };
 
+///How an allocation waits for its transfers to complete
+enum ocm_poll_mode
+{
+    OCM_POLL_DEFAULT = 0, /* OCM_IB_POLL, or event */
+    OCM_POLL_EVENT, /* sleep until the NIC raises an interrupt */
+    OCM_POLL_BUSY, /* spin on the completion queue */
+    OCM_POLL_HYBRID /* spin for poll_spin_us, then sleep */
+};
+
+#define OCM_NUMA_NIC        0
+#define OCM_NUMA_ANY        (-1)
+#define OCM_NUMA_NODE(n)    ((n) + 1)
+
 typedef struct ocm_alloc_params * ocm_alloc_param_t;
 
+///Client cache counters of one allocation; hits and misses count blocks
+struct ocm_cache_stats
+{
+    uint64_t hits, misses;
+    uint64_t hit_bytes, miss_bytes;
+    uint64_t evictions;
+    uint64_t writebacks; /* dirty blocks written to the remote buffer */
+    uint64_t prefetched; /* blocks read ahead */
+    uint64_t prefetch_hits; /* of those, blocks read afterwards */
+};
+
+///Operations the library keeps latency histograms for, per allocation kind
+enum ocm_stat_op
+{
+    OCM_STAT_ALLOC = 0,
+    OCM_STAT_FREE,
+    OCM_STAT_COPY,
+    OCM_STAT_ONESIDED,
+    OCM_STAT_PREFETCH, /* readahead transfers of the cache */
+    OCM_STAT_FLUSH, /* write-combining flushes outside of a copy */
+    OCM_STAT_NUM_OPS
+};
+
+///Phases of an operation. For copies 'stage' is the memcpy through the
+///local bounce buffer, 'post' issuing the transfer and 'wait' polling for
+///its completion. For alloc/free 'post' is the daemon round trip and 'wait'
+///setting up or tearing down the transport connection.
+enum ocm_stat_phase
+{
+    OCM_STAT_TOTAL = 0,
+    OCM_STAT_STAGE,
+    OCM_STAT_POST,
+    OCM_STAT_WAIT,
+    OCM_STAT_NUM_PHASES
+};
+
+///Latency summary of one op/phase; errors and bytes count whole operations
+///and are the same for every phase
+struct ocm_stats
+{
+    uint64_t count, errors, bytes;
+    uint64_t min_ns, mean_ns, p50_ns, p90_ns, p99_ns, p999_ns, max_ns;
+};
+
 
 /* Globals */
 
@@ -69,8 +155,22 @@ typedef struct ocm_alloc_params * ocm_alloc_param_t;
 int ocm_init(void);
 int ocm_tini(void);
 ocm_alloc_t ocm_alloc(ocm_alloc_param_t alloc_param);
+/* allocate 'count' buffers described by alloc_param in one request */
+int ocm_alloc_many(ocm_alloc_param_t alloc_param, unsigned int count,
+        ocm_alloc_t out[]);
 int ocm_free(ocm_alloc_t a);
 
+/* start an allocation and return at once with a pending request. Completion
+ * makes ocm_alloc_req_fd readable (an eventfd) and calls cb, if given */
+ocm_alloc_req_t ocm_alloc_async(ocm_alloc_param_t alloc_param,
+        ocm_alloc_cb_t cb, void *cb_arg);
+int ocm_alloc_req_fd(ocm_alloc_req_t req);
+/* true once the request has completed */
+bool ocm_alloc_test(ocm_alloc_req_t req);
+/* wait for completion, release req and return the allocation (NULL on
+ * failure); may be called from the completion callback */
+ocm_alloc_t ocm_alloc_wait(ocm_alloc_req_t req);
+
 /* get pointer to local buffer */
 int ocm_localbuf(ocm_alloc_t a, void **buf, size_t *len);
 
@@ -87,4 +187,39 @@ int ocm_copy_in(ocm_alloc_t dst, void *src);
 int ocm_copy(ocm_alloc_t dst, ocm_alloc_t src, ocm_param_t options);
 
 int ocm_copy_onesided(ocm_alloc_t src, ocm_param_t options); 
+/* the n one-sided copies in ops, in order. On InfiniBand they are posted
+ * in batches and waited for once */
+int ocm_copy_onesided_many(ocm_alloc_t src, struct ocm_params ops[],
+    unsigned int n);
+
+/* map the remote buffer of a into memory; loads and stores fault its pages
+ * in on demand. At most local_alloc_bytes of it are resident, the rest is
+ * written back on eviction or by ocm_msync. While mapped, the local buffer
+ * of a belongs to the mapping. Local host allocations map to their buffer.
+ * Needs userfaultfd with write-protect support (Linux 5.7) */
+void *ocm_mmap(ocm_alloc_t a);
+/* write dirty pages of the mapping back to the remote buffer */
+int ocm_msync(ocm_alloc_t a);
+/* write back and remove the mapping; ocm_free drops it unwritten */
+int ocm_munmap(ocm_alloc_t a);
+
+/* write out the small writes to a that are still being combined; this also
+ * happens after OCM_WC_TIMEOUT, before an overlapping read and at ocm_free */
+int ocm_flush(ocm_alloc_t a);
+/* write cached and combined writes of a back to its remote buffer */
+int ocm_cache_flush(ocm_alloc_t a);
+/* start reading [offset, offset + len) of the remote buffer of a into its
+ * cache and return; later reads of it are served locally. -1 if a has no
+ * cache */
+int ocm_prefetch(ocm_alloc_t a, size_t offset, size_t len);
+/* counters of the cache of a; -1 if it has none */
+int ocm_cache_stats(ocm_alloc_t a, struct ocm_cache_stats *stats);
+
+/* statistics collected since start-up or the last ocm_stats_reset.
+ * OCM_STATS=1 dumps them to stderr at ocm_tini; any other value names a file
+ * to append the dump to */
+int ocm_stats_get(enum ocm_kind kind, enum ocm_stat_op op,
+        enum ocm_stat_phase phase, struct ocm_stats *stats);
+void ocm_stats_dump(FILE *f);
+void ocm_stats_reset(void);
 #endif  /* __ONCILLAMEM_H__ */
@@ -27,9 +27,14 @@
 
 #define PMSG_DAEMON_PID     (-1)
 
-/* pmsg assumes singular message size throughout */
+/* pmsg assumes a singular maximum message size throughout */
 int pmsg_init(size_t pmsg_size);
 
+/* select which daemon mailbox to own or attach to when several daemons share
+ * a host; must precede pmsg_open/pmsg_attach. Without it the single
+ * ATTACH_DAEMON_MQ_NAME is used */
+int pmsg_set_instance(int instance);
+
 /* open/close self mailbox for receiving messages */
 /* only one receive mailbox supported */
 int pmsg_open(pid_t self_pid);
@@ -39,15 +44,21 @@ int pmsg_close(void);
 int pmsg_attach(pid_t to_pid);
 int pmsg_detach(pid_t to_pid);
 
-/* send a message to a mailbox previously attached */
-int pmsg_send(pid_t to_pid, void *msg);
-/* receive a message from within self mailbox */
+/* send a message of len bytes to a mailbox previously attached */
+int pmsg_send(pid_t to_pid, void *msg, size_t len);
+/* receive a message from within self mailbox into msg, which must hold the
+ * maximum message size; returns the message length */
 int pmsg_recv(void *msg, bool block);
 
-/* clean lingering pmsg mailboxes in the system */
+/* clean lingering pmsg mailboxes in the system: those of processes no
+ * longer alive and our own daemon mailbox */
 int pmsg_cleanup(void);
 
 /* number of messages pending in receive queue */
 int pmsg_pending(void);
 
+/* sleep until a message is pending or timeout_ms passes; returns 1 if a
+ * message is pending, 0 on timeout */
+int pmsg_wait(int timeout_ms);
+
 #endif /* __PMSG_H__ */
@@ -0,0 +1,88 @@
+/**
+ * file: stats.h
+ * desc: daemon counters and request latency histograms, served as JSON or
+ * Prometheus text on a local Unix socket. Updating them is lock-free so they
+ * can sit on every request path.
+ */
+
+#ifndef __STATS_H__
+#define __STATS_H__
+
+/* System includes */
+#include <stdint.h>
+#include <time.h>
+
+/* Other project includes */
+
+/* Project includes */
+
+/* Defines */
+
+enum stats_counter
+{
+    STATS_APPS = 0,         /* gauge: apps attached to this daemon */
+    STATS_APPS_TOTAL,
+    STATS_PMSG_IN,          /* messages from apps */
+    STATS_PMSG_OUT,         /* messages to apps */
+    STATS_OUTBOX,           /* gauge: messages waiting to go to apps */
+    STATS_REQS_INFLIGHT,    /* gauge: app requests being worked on */
+    STATS_REQ_ALLOC,
+    STATS_REQ_FREE,
+    STATS_REQ_ERRORS,
+    STATS_PLACED,           /* rank 0: buffers placed */
+    STATS_SERVED,           /* gauge: buffers this node serves */
+    STATS_SERVED_BYTES,     /* gauge */
+    STATS_SERVED_ALLOCS,    /* buffers set up for other nodes */
+    STATS_SERVED_FREES,
+    STATS_NUM_COUNTERS
+};
+
+enum stats_phase
+{
+    STATS_PH_APP_ALLOC = 0, /* app alloc request until its reply */
+    STATS_PH_APP_FREE,
+    STATS_PH_PLACE,         /* asking rank 0 where to allocate */
+    STATS_PH_DO_ALLOC,      /* serving node sets up the buffers */
+    STATS_PH_DO_FREE,
+    STATS_PH_SERVE_ALLOC,   /* alloc_ate on the serving node */
+    STATS_PH_SERVE_FREE,    /* dealloc_ate on the serving node */
+    STATS_NUM_PHASES
+};
+
+/* Global state (externs) */
+
+extern uint64_t stats_counters[STATS_NUM_COUNTERS];
+
+/* Static inline functions */
+
+static inline void
+stats_add(enum stats_counter c, int64_t n)
+{
+    __atomic_fetch_add(&stats_counters[c], (uint64_t)n, __ATOMIC_RELAXED);
+}
+
+static inline void
+stats_inc(enum stats_counter c)
+{
+    stats_add(c, 1);
+}
+
+static inline void
+stats_dec(enum stats_counter c)
+{
+    stats_add(c, -1);
+}
+
+/* Function prototypes */
+
+/* CLOCK_MONOTONIC in nanoseconds */
+uint64_t stats_now(void);
+
+/* record that phase took since start, a stats_now() timestamp */
+void stats_phase(enum stats_phase phase, uint64_t start);
+
+/* serve stats on a Unix socket at path */
+int stats_init(const char *path);
+void stats_fin(void);
+
+#endif  /* __STATS_H__ */
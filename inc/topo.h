@@ -0,0 +1,42 @@
+/**
+ * file: topo.h
+ * desc: NUMA topology of this host, read from sysfs so neither libnuma nor
+ * its headers are needed. On hosts without /sys/devices/system/node every
+ * CPU is reported as node 0.
+ */
+
+#ifndef __TOPO_H__
+#define __TOPO_H__
+
+/* System includes */
+#include <sched.h>
+#include <stddef.h>
+
+/* Other project includes */
+
+/* Project includes */
+
+/* Function prototypes */
+
+/* The NIC's node comes from /sys/class/{infiniband,extoll}/<dev>/device/
+ * numa_node; OCM_NIC_NODE overrides it. -1 wherever a node is expected
+ * means "anywhere" and makes the bind calls no-ops. */
+
+/* number of NUMA nodes, at least 1 */
+int topo_num_nodes(void);
+/* node the calling thread is running on */
+int topo_cur_node(void);
+#ifdef CPU_SETSIZE /* cpu_set_t: _GNU_SOURCE was defined before any include */
+/* CPUs of node into set; returns the number of CPUs or -1 */
+int topo_node_cpus(int node, cpu_set_t *set);
+#endif
+/* node of the network device, -1 if unknown or there is only one node */
+int topo_nic_node(void);
+/* node for an ocm_alloc_params.numa_node value, or -1 */
+int topo_pick_node(int numa_node);
+/* place the pages of a page-aligned buffer on node, moving touched ones */
+int topo_bind_mem(void *addr, size_t len, int node);
+/* run the calling thread, and threads it creates later, on node's CPUs */
+int topo_bind_thread(int node);
+
+#endif  /* __TOPO_H__ */
@@ -0,0 +1,78 @@
+/**
+ * file: trace.h
+ * desc: request tracing. Every alloc and free carries a trace id from the
+ * library through its daemon, rank 0 and the serving node; each process
+ * that handles it records timed spans under that id. With OCM_TRACE set to
+ * a directory, a process appends its spans to
+ *
+ *     <dir>/ocm-trace.<host>.<pid>
+ *
+ * as text lines; tools/ocm_trace merges the files of all processes into one
+ * Chrome/Perfetto timeline. Span times are wall-clock, so traces taken on
+ * different hosts line up as well as their clocks do.
+ *
+ * File format, one record per line:
+ *
+ *     P <pid> <rank> <process name>
+ *     S <trace id, hex> <start ns since epoch> <duration ns> <tid> <span name>
+ */
+
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+/* System includes */
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+/* Other project includes */
+
+/* Project includes */
+
+/* Defines */
+
+/* evaluate expr and record how long it took as span name of trace id */
+#define TRACE_SPAN(id, name, expr)                              \
+    ({                                                          \
+        uint64_t __ts = trace_now();                            \
+        typeof(expr) __tr = (expr);                             \
+        trace_span(id, name, __ts);                             \
+        __tr;                                                   \
+    })
+
+/* Global state (externs) */
+
+/* >= 0 while spans are being recorded */
+extern int trace_fd;
+
+/* Static inline functions */
+
+static inline bool
+trace_enabled(void)
+{
+    return trace_fd >= 0;
+}
+
+/* span start times are CLOCK_MONOTONIC, like stats_now/lib_stats_now */
+static inline uint64_t
+trace_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+/* Function prototypes */
+
+/* start recording if OCM_TRACE names a directory; rank is -1 for apps */
+int trace_init(const char *name, int rank);
+void trace_fin(void);
+
+/* a new id, unique across processes and hosts; never 0 */
+uint64_t trace_new_id(void);
+
+/* record span name of trace id from start (a trace_now time) until now;
+ * id 0 means the request is not traced */
+void trace_span(uint64_t id, const char *name, uint64_t start);
+
+#endif  /* __TRACE_H__ */
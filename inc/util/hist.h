@@ -0,0 +1,140 @@
+/**
+ * file: hist.h
+ * desc: fixed-size log-linear latency histogram in the style of HdrHistogram.
+ * Every power of two is split into HIST_SUB linear buckets, so a recorded
+ * value is off by at most 1/HIST_SUB (6%) of itself. Updates are lock-free
+ * and may come from any thread; readers see a slightly stale but consistent
+ * enough picture for reporting.
+ */
+
+#ifndef __HIST_H__
+#define __HIST_H__
+
+/* System includes */
+#include <stdint.h>
+#include <string.h>
+
+/* Defines */
+
+#define HIST_SUB_BITS   4
+#define HIST_SUB        (1UL << HIST_SUB_BITS)
+/* values from 2^HIST_MAX_BITS on share the last bucket (~18 minutes in ns) */
+#define HIST_MAX_BITS   40
+#define HIST_BUCKETS    (HIST_SUB + (HIST_MAX_BITS - HIST_SUB_BITS) * HIST_SUB)
+
+/* Types */
+
+struct hist
+{
+    uint64_t count, sum, min, max;
+    uint64_t b[HIST_BUCKETS];
+};
+
+/* Functions */
+
+static inline unsigned int
+hist_index(uint64_t v)
+{
+    unsigned int shift;
+
+    if (v < HIST_SUB)
+        return v;
+    if (v >> HIST_MAX_BITS)
+        return HIST_BUCKETS - 1;
+    shift = 63 - __builtin_clzll(v) - HIST_SUB_BITS;
+    return HIST_SUB + shift * HIST_SUB + ((v >> shift) - HIST_SUB);
+}
+
+/* middle of the range a bucket covers */
+static inline uint64_t
+hist_value(unsigned int idx)
+{
+    unsigned int shift;
+
+    if (idx < HIST_SUB)
+        return idx;
+    shift = (idx - HIST_SUB) / HIST_SUB;
+    return ((HIST_SUB + (idx - HIST_SUB) % HIST_SUB) << shift) +
+        ((1UL << shift) >> 1);
+}
+
+static inline void
+hist_add(struct hist *h, uint64_t v)
+{
+    uint64_t old;
+
+    __atomic_fetch_add(&h->b[hist_index(v)], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->sum, v, __ATOMIC_RELAXED);
+    old = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+    while (v > old && !__atomic_compare_exchange_n(&h->max, &old, v,
+                true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+    /* min is kept as ~min so a zeroed histogram needs no initialization */
+    old = __atomic_load_n(&h->min, __ATOMIC_RELAXED);
+    while (~v > old && !__atomic_compare_exchange_n(&h->min, &old, ~v,
+                true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+    __atomic_fetch_add(&h->count, 1, __ATOMIC_RELEASE);
+}
+
+static inline uint64_t
+hist_count(const struct hist *h)
+{
+    return __atomic_load_n(&h->count, __ATOMIC_ACQUIRE);
+}
+
+static inline uint64_t
+hist_min(const struct hist *h)
+{
+    return (hist_count(h) ? ~__atomic_load_n(&h->min, __ATOMIC_RELAXED) : 0);
+}
+
+static inline uint64_t
+hist_max(const struct hist *h)
+{
+    return __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+}
+
+static inline uint64_t
+hist_mean(const struct hist *h)
+{
+    uint64_t n = hist_count(h);
+    return (n ? __atomic_load_n(&h->sum, __ATOMIC_RELAXED) / n : 0);
+}
+
+/* value below which fraction p (0..1) of the samples fall */
+static inline uint64_t
+hist_percentile(const struct hist *h, double p)
+{
+    uint64_t n = hist_count(h), want, seen = 0, v;
+    unsigned int i;
+
+    if (n == 0)
+        return 0;
+    want = (uint64_t)(p * n + 0.5);
+    if (want == 0)
+        want = 1;
+    for (i = 0; i < HIST_BUCKETS; i++) {
+        seen += __atomic_load_n(&h->b[i], __ATOMIC_RELAXED);
+        if (seen >= want)
+            break;
+    }
+    if (i == HIST_BUCKETS)
+        return hist_max(h);
+    /* the bucket middle can lie outside what was actually recorded */
+    v = hist_value(i);
+    if (v > hist_max(h))
+        v = hist_max(h);
+    if (v < hist_min(h))
+        v = hist_min(h);
+    return v;
+}
+
+/* not atomic with respect to concurrent hist_add */
+static inline void
+hist_reset(struct hist *h)
+{
+    memset(h, 0, sizeof(*h));
+}
+
+#endif  /* __HIST_H__ */
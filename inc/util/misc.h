@@ -0,0 +1,64 @@
+/**
+ * file: misc.h
+ * desc: small helpers shared by the library and the tools in tools/: size
+ * arguments, a microsecond clock and percentiles of sorted samples. Static
+ * but not inline: they are called from cold paths like main, where -Winline
+ * would reject them, and the library does not export them to apps.
+ */
+
+#ifndef __MISC_H__
+#define __MISC_H__
+
+/* System includes */
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+/* Functions */
+
+/* "64k", "1.5m", "2g", "0x1000": bytes, with binary k/m/g suffixes */
+static uint64_t
+parse_size(const char *s)
+{
+    char *end;
+    double v = strtod(s, &end);
+
+    if (v <= 0)
+        return 0;
+    switch (*end) {
+        case 'k': case 'K': v *= 1UL << 10; break;
+        case 'm': case 'M': v *= 1UL << 20; break;
+        case 'g': case 'G': v *= 1UL << 30; break;
+    }
+    return (uint64_t)v;
+}
+
+/* CLOCK_MONOTONIC in microseconds */
+static double
+now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/* qsort comparator for doubles, ascending */
+static int
+cmp_double(const void *a, const void *b)
+{
+    double x = *(const double*)a, y = *(const double*)b;
+
+    return (x > y) - (x < y);
+}
+
+/* p-th quantile (0..1) of n samples sorted ascending; 0 if there are none */
+static double
+pct(const double *sorted, unsigned long n, double p)
+{
+    if (n == 0)
+        return 0;
+    return sorted[(unsigned long)(p * (n - 1) + 0.5)];
+}
+
+#endif  /* __MISC_H__ */
@@ -0,0 +1,65 @@
+/**
+ * file: wire.h
+ * desc: explicit on-the-wire encoding of struct message, used between
+ * daemons (TCP) and between the library and its daemon (pmsg)
+ *
+ * A message is an 8 byte header followed by a body of sections:
+ *
+ *   header:  u8 version | u8 type | u8 status | u8 reserved | u32 body length
+ *   section: u8 tag | u8 reserved | u16 length | fields ...
+ *
+ * All integers are big endian. Newer versions may only append sections or
+ * append fields to the end of a section: a decoder skips sections and
+ * trailing fields it does not know and zero-fills fields the sender did not
+ * include, so daemons one version apart can talk during a rolling upgrade.
+ * Process-local state (list links, ib_t/extoll_t handles) is never sent.
+ */
+
+#ifndef __WIRE_H__
+#define __WIRE_H__
+
+/* System includes */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/* Other project includes */
+
+/* Project includes */
+#include <msg.h>
+
+/* Defines */
+
+#define WIRE_VERSION        1
+#define WIRE_HDR_LEN        8
+/* largest encoded message accepted; the current encoding stays well under */
+#define WIRE_MSG_MAX        1024
+
+/* Types */
+
+enum wire_tag
+{
+    WIRE_TAG_INVALID = 0,
+    WIRE_TAG_COMMON, /* pid, rank, request id, trace id */
+    WIRE_TAG_REQ, /* struct alloc_request */
+    WIRE_TAG_ALLOC, /* struct alloc_ation, transport independent part */
+    WIRE_TAG_RDMA, /* alloc_ation.u.rdma */
+    WIRE_TAG_RMA, /* alloc_ation.u.rma */
+    WIRE_TAG_NODE /* struct alloc_node_config */
+};
+
+/* Function prototypes */
+
+/* encode msg into buf; returns the encoded length or -1 if it does not fit */
+int wire_pack(const struct message *msg, void *buf, size_t len);
+/* decode len bytes from buf into msg; returns 0 or -1 if malformed */
+int wire_unpack(struct message *msg, const void *buf, size_t len);
+/* body length announced by a header of WIRE_HDR_LEN bytes */
+size_t wire_body_len(const void *hdr);
+
+/* pmsg transport: encode/decode around pmsg_send/pmsg_recv */
+int wire_pmsg_send(pid_t to_pid, const struct message *msg);
+int wire_pmsg_recv(struct message *msg, bool block);
+
+#endif  /* __WIRE_H__ */
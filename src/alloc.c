@@ -17,10 +17,13 @@
 
 /* Project includes */
 #include <alloc.h>
+#include <buf.h>
 #include <debug.h>
 #include <util/list.h>
 #include <util/mem.h>
 #include <nodefile.h>
+#include <stats.h>
+#include <topo.h>
 
 /* Directory includes */
 #ifdef EXTOLL
@@ -76,6 +79,7 @@ alloc_add_node(int rank, struct alloc_node_config *config)
 int
 alloc_find(struct alloc_request *req, struct alloc_ation *alloc)
 {
+    struct alloc_ation *rec;
 
     if (!req || !alloc) return -1;
 
@@ -90,6 +94,9 @@ alloc_find(struct alloc_request *req, struct alloc_ation *alloc)
     */
 
     alloc->bytes        = req->bytes; /* TODO validate size will fit on node */
+    //All buffers of a batch request are placed by this one decision
+    alloc->count        = (req->count ? req->count : 1);
+    alloc->numa_node    = req->numa_node;
 
     if ((req->type == ALLOC_MEM_HOST) || (req->type == ALLOC_MEM_GPU))
     {
@@ -130,11 +137,17 @@ alloc_find(struct alloc_request *req, struct alloc_ation *alloc)
 
     else BUG(1);
 
-    INIT_LIST_HEAD(&alloc->link);
+    //Keep our own record; the caller's alloc is returned in a message
+    rec = malloc(sizeof(*rec));
+    if (!rec)
+        return -1;
+    *rec = *alloc;
+    INIT_LIST_HEAD(&rec->link);
     lock_root_allocs();
-    list_add(&alloc->link, &root_allocs);
-    num_allocs++;
+    list_add(&rec->link, &root_allocs);
+    num_allocs += rec->count;
     unlock_root_allocs();
+    stats_add(STATS_PLACED, rec->count);
 
     return 0;
 }
@@ -153,37 +166,96 @@ alloc_ate(struct alloc_ation *alloc)
     //Create a new allocation structure that can be saved on this node
     //to handle teardown
     struct alloc_ation *rem_alloc;
-    printd("Size of local alloc %lu, remote alloc %lu\n",sizeof(*alloc), sizeof(*rem_alloc));
-    rem_alloc = calloc(1, sizeof(*rem_alloc));
 
     if (!alloc)
         return -1;
-
-    //Copy the remote allocation ID to the local struct
-    rem_alloc->rem_alloc_id = alloc->rem_alloc_id;
+    if (alloc->count == 0)
+        alloc->count = 1;
 
     #ifdef INFINIBAND
     if (alloc->type == ALLOC_MEM_RDMA) {
+        //Each RDMA buffer needs its own connection and so its own record.
+        //Listen on every port of the batch first so the client never finds
+        //a later port closed while we still accept on an earlier one.
+        struct alloc_ation **batch;
         struct ib_params p;
-        p.addr      = NULL;
-        p.port      = alloc->u.rdma.port;
-        p.buf_len   = alloc->bytes;
-        p.buf       = calloc(1, alloc->bytes);
-        ABORT2(!p.buf);
-        if (!(rem_alloc->u.rdma.ib_rem = ib_new(&p)))
-            ABORT();
-        printd("RDMA: wait for client on port %d\n", p.port);
-        if (ib_connect(rem_alloc->u.rdma.ib_rem, true))
-            ABORT();
-        
-        rem_alloc->type = ALLOC_MEM_RDMA;
+        unsigned int i;
+        bool cancelled;
+        int err;
+        //count came in over the network
+        if (!(batch = calloc(alloc->count, sizeof(*batch))))
+            return -1;
+        for (i = 0; i < alloc->count; i++) {
+            batch[i] = calloc(1, sizeof(*rem_alloc));
+            ABORT2(!batch[i]);
+            batch[i]->type = ALLOC_MEM_RDMA;
+            batch[i]->bytes = alloc->bytes;
+            batch[i]->count = batch[i]->live = 1;
+            batch[i]->rem_alloc_id = alloc->rem_alloc_id + i;
+            memset(&p, 0, sizeof(p));
+            p.addr      = NULL;
+            p.port      = alloc->u.rdma.port + i;
+            p.buf_len   = alloc->bytes;
+            p.buf       = buf_alloc(alloc->bytes,
+                    topo_pick_node(alloc->numa_node));
+            ABORT2(!p.buf);
+            if (!(batch[i]->u.rdma.ib_rem = ib_new(&p)))
+                ABORT();
+            if (ib_listen(batch[i]->u.rdma.ib_rem))
+                ABORT();
+            batch[i]->u.rdma.accepting = true;
+            INIT_LIST_HEAD(&batch[i]->link);
+        }
+        //Listed before they are accepted, so a client that gives up on the
+        //batch can free the buffers it never connects to
+        lock_allocs();
+        for (i = 0; i < alloc->count; i++) {
+            printd("Adding new remote alloc with ID %lu to list\n", batch[i]->rem_alloc_id);
+            list_add(&batch[i]->link, &allocs);
+        }
+        unlock_allocs();
+        stats_add(STATS_SERVED, alloc->count);
+        stats_add(STATS_SERVED_ALLOCS, alloc->count);
+        stats_add(STATS_SERVED_BYTES, alloc->bytes * alloc->count);
+        for (i = 0; i < alloc->count; i++) {
+            printd("RDMA: wait for client on port %d\n", alloc->u.rdma.port + i);
+            err = ib_connect(batch[i]->u.rdma.ib_rem, true);
+            lock_allocs();
+            batch[i]->u.rdma.accepting = false;
+            cancelled = batch[i]->u.rdma.cancelled;
+            unlock_allocs();
+            if (cancelled) {
+                //dealloc_ate already took it off the list
+                printd("RDMA: alloc %lu freed before the client connected\n", batch[i]->rem_alloc_id);
+                if (!err)
+                    ib_disconnect(batch[i]->u.rdma.ib_rem, true);
+                ib_free(batch[i]->u.rdma.ib_rem);
+                free(batch[i]);
+            } else if (err)
+                ABORT();
+        }
+        free(batch);
+        return 0;
     }
     #endif
 
+    rem_alloc = calloc(1, sizeof(*rem_alloc));
+    if (!rem_alloc)
+        return -1;
+
+    //Copy the remote allocation ID to the local struct
+    rem_alloc->rem_alloc_id = alloc->rem_alloc_id;
+    rem_alloc->bytes = alloc->bytes;
+    rem_alloc->count = rem_alloc->live = alloc->count;
+
     #ifdef EXTOLL
     if (alloc->type == ALLOC_MEM_RMA) {
         struct extoll_params p;
-        p.buf_len   = alloc->bytes;
+        memset(&p, 0, sizeof(p));
+        //The whole batch is registered as one region in a single pass
+        p.buf_len   = alloc->bytes * alloc->count;
+        p.dest_len  = 0;
+        p.numa_node = alloc->numa_node;
         //We don't need to allocate the buffer since connect does this
         //for us
         if (!(rem_alloc->u.rma.ex_rem = extoll_new(&p)))
@@ -198,25 +270,30 @@ alloc_ate(struct alloc_ation *alloc)
         alloc->u.rma.node_id = rem_alloc->u.rma.ex_rem->params.dest_node;
         alloc->u.rma.vpid = rem_alloc->u.rma.ex_rem->params.dest_vpid;
         alloc->u.rma.dest_nla = rem_alloc->u.rma.ex_rem->params.dest_nla;
-   
+        rem_alloc->type = ALLOC_MEM_RMA;
     }
+    else
     #endif
     #ifdef CUDA
-    else if (alloc->type == ALLOC_MEM_GPU)
+    if (alloc->type == ALLOC_MEM_GPU)
     {
       printf("Remote CUDA allocations not supported!\n");
     }
+    else
     #endif
-    else {
+    {
         BUG(1);
     }
 
     //Add the local allocation ptr to a linked list so we can close the connection later
-    INIT_LIST_HEAD(&alloc->link);
+    INIT_LIST_HEAD(&rem_alloc->link);
     printd("Adding new remote alloc with ID %lu to list\n", rem_alloc->rem_alloc_id);
     lock_allocs();
     list_add(&rem_alloc->link, &allocs);
     unlock_allocs();
+    stats_add(STATS_SERVED, rem_alloc->count);
+    stats_add(STATS_SERVED_ALLOCS, rem_alloc->count);
+    stats_add(STATS_SERVED_BYTES, rem_alloc->bytes * rem_alloc->count);
 
     return 0;
 }
@@ -238,15 +315,44 @@ dealloc_ate(struct alloc_ation *alloc)
 
     rem_alloc=NULL;
 
-    //Iterate over the list of remote allocations
+    //Iterate over the list of remote allocations; a batch record covers
+    //the IDs [rem_alloc_id, rem_alloc_id + count)
+    lock_allocs();
     for_each_alloc(tmp, allocs)
     {
-      if(tmp->rem_alloc_id == alloc->rem_alloc_id)
+      if(alloc->rem_alloc_id >= tmp->rem_alloc_id &&
+          alloc->rem_alloc_id < tmp->rem_alloc_id + tmp->count)
       {
         rem_alloc = tmp;
         break;
       }
     }
+    if(rem_alloc != NULL)
+    {
+      stats_dec(STATS_SERVED);
+      stats_inc(STATS_SERVED_FREES);
+      stats_add(STATS_SERVED_BYTES, -(int64_t)rem_alloc->bytes);
+      //Buffers of a shared region go away with the last one freed
+      if(--rem_alloc->live > 0)
+      {
+        printd("Allocation %lu released, %u left in its batch\n", alloc->rem_alloc_id, rem_alloc->live);
+        unlock_allocs();
+        return 0;
+      }
+      list_del(&rem_alloc->link);
+      #ifdef INFINIBAND
+      //Still being accepted: the accepting thread tears it down, and
+      //the record stays valid until it sees cancelled under the lock
+      if (rem_alloc->type == ALLOC_MEM_RDMA && rem_alloc->u.rdma.accepting)
+      {
+        rem_alloc->u.rdma.cancelled = true;
+        ib_cancel(rem_alloc->u.rdma.ib_rem);
+        unlock_allocs();
+        return 0;
+      }
+      #endif
+    }
+    unlock_allocs();
 
     if(rem_alloc == NULL)
     {
@@ -261,6 +367,8 @@ dealloc_ate(struct alloc_ation *alloc)
     {
         if (ib_disconnect(rem_alloc->u.rdma.ib_rem, true))
             ABORT();
+        //Also releases the served buffer
+        ib_free(rem_alloc->u.rdma.ib_rem);
     }
     #endif
     #ifdef EXTOLL
@@ -268,6 +376,7 @@ dealloc_ate(struct alloc_ation *alloc)
     {
       if (extoll_disconnect(rem_alloc->u.rma.ex_rem, true))
             ABORT();
+      extoll_free(rem_alloc->u.rma.ex_rem);
     }
     #endif 
     #ifdef CUDA
@@ -277,6 +386,7 @@ dealloc_ate(struct alloc_ation *alloc)
     }
     #endif
 
+    free(rem_alloc);
     return 0;
 
 }
@@ -0,0 +1,192 @@
+/**
+ * file: buf.c
+ * desc: huge-page backed buffers, see buf.h
+ */
+
+/* System includes */
+#define _GNU_SOURCE /* for MAP_HUGETLB, MADV_HUGEPAGE */
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/* Other project includes */
+
+/* Project includes */
+#include <buf.h>
+#include <debug.h>
+#include <topo.h>
+#include <util/list.h>
+
+/* Internal definitions */
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT  26
+#endif
+
+#define SHIFT_2M    21
+#define SHIFT_1G    30
+
+enum backing
+{
+    BACK_PAGES = 0,
+    BACK_THP,
+    BACK_2M,
+    BACK_1G
+};
+
+/* one mapping handed out by buf_alloc */
+struct buf
+{
+    struct list_head link;
+    void *addr;
+    size_t len; /* as mapped */
+};
+
+/* Internal state */
+
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+static enum backing backing = BACK_THP;
+
+static LIST_HEAD(bufs);
+static pthread_mutex_t bufs_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Private functions */
+
+static void
+buf_init(void)
+{
+    const char *env = getenv("OCM_HUGEPAGES");
+
+    if (!env)
+        return;
+    if (!strcmp(env, "off") || !strcmp(env, "0"))
+        backing = BACK_PAGES;
+    else if (!strcmp(env, "thp"))
+        backing = BACK_THP;
+    else if (!strcmp(env, "2m") || !strcmp(env, "2M"))
+        backing = BACK_2M;
+    else if (!strcmp(env, "1g") || !strcmp(env, "1G"))
+        backing = BACK_1G;
+    else
+        printd("unknown OCM_HUGEPAGES '%s', using thp\n", env);
+}
+
+/* hugetlb pages of 1 << shift bytes; fails unless enough are reserved */
+static void *
+map_hugetlb(size_t *len, int shift)
+{
+    size_t page = 1UL << shift, l = (*len + page - 1) & ~(page - 1);
+    void *p;
+
+    if (*len < page)
+        return NULL;
+    p = mmap(NULL, l, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB |
+            (shift << MAP_HUGE_SHIFT), -1, 0);
+    if (p == MAP_FAILED)
+        return NULL;
+    *len = l;
+    return p;
+}
+
+/* regular pages; for thp the mapping is trimmed to a 2 MiB boundary so the
+ * kernel can back all of it with huge pages */
+static void *
+map_pages(size_t *len, bool thp)
+{
+    size_t page = 1UL << SHIFT_2M, l = *len, head, tail;
+    char *p;
+
+    if (!thp || l < page) {
+        p = mmap(NULL, l, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        return (p == MAP_FAILED ? NULL : p);
+    }
+    l = (l + page - 1) & ~(page - 1);
+    p = mmap(NULL, l + page, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+        return NULL;
+    head = (-(uintptr_t)p) & (page - 1);
+    tail = page - head;
+    if (head)
+        munmap(p, head);
+    if (tail)
+        munmap(p + head + l, tail);
+    p += head;
+    if (madvise(p, l, MADV_HUGEPAGE))
+        printd("no transparent huge pages for %p+%lu\n", p, l);
+    *len = l;
+    return p;
+}
+
+/* Public functions */
+
+void *
+buf_alloc(size_t len, int node)
+{
+    struct buf *b;
+    void *p = NULL;
+    size_t l = len;
+    const char *how = "1g";
+
+    pthread_once(&init_once, buf_init);
+    if (len == 0 || !(b = calloc(1, sizeof(*b))))
+        return NULL;
+
+    if (backing == BACK_1G)
+        p = map_hugetlb(&l, SHIFT_1G);
+    if (!p && backing >= BACK_2M) {
+        how = "2m";
+        p = map_hugetlb(&l, SHIFT_2M);
+    }
+    if (!p) {
+        how = (backing >= BACK_THP ? "thp" : "4k");
+        p = map_pages(&l, backing >= BACK_THP);
+    }
+    if (!p) {
+        free(b);
+        return NULL;
+    }
+    /* nothing touched the pages yet, so this decides where they go */
+    topo_bind_mem(p, l, node);
+    printd("buffer %p: %lu bytes (%lu mapped, %s) on node %d\n",
+            p, len, l, how, node);
+
+    b->addr = p;
+    b->len = l;
+    INIT_LIST_HEAD(&b->link);
+    pthread_mutex_lock(&bufs_lock);
+    list_add(&b->link, &bufs);
+    pthread_mutex_unlock(&bufs_lock);
+    return p;
+}
+
+void
+buf_free(void *buf)
+{
+    struct buf *b, *found = NULL;
+
+    if (!buf)
+        return;
+    pthread_mutex_lock(&bufs_lock);
+    list_for_each_entry(b, &bufs, link) {
+        if (b->addr == buf) {
+            list_del(&b->link);
+            found = b;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&bufs_lock);
+
+    if (!found) {
+        free(buf);
+        return;
+    }
+    munmap(found->addr, found->len);
+    free(found);
+}
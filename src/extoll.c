@@ -8,6 +8,8 @@
  */
 
 /* System includes */
+#include <pthread.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -17,162 +19,131 @@
 
 /* Project includes */
 #include <util/list.h>
+#include <util/misc.h>
 #include <io/extoll.h>
 #include <debug.h>
 
 /* Directory includes */
 #include "extoll.h"
-#include "extoll_noti.h"
 
 /* Globals */
 
 /* Internal definitions */
 
+#define DEFAULT_DEPTH   4
+//Each outstanding put/get owes a notification; more than the port's
+//notification queue holds (256 in emu/rma2) are dropped and never arrive
+#define MAX_DEPTH       64
+//A single put/get can move up to 8 MB
+#define MAX_CHUNK       (8UL << 20)
+#define MIN_CHUNK       (4UL << 10)
+
 /* Internal state */
 
 static LIST_HEAD(extoll_allocs);
-//Run the notification only once
-static int run_once;
+/* allocations may be created and released from many app threads at once */
+static pthread_mutex_t extoll_allocs_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* process-wide pipeline shape, from OCM_RMA_DEPTH and OCM_RMA_CHUNK */
+static pthread_once_t pipe_once = PTHREAD_ONCE_INIT;
+static uint32_t pipe_depth = DEFAULT_DEPTH;
+static uint32_t pipe_chunk = MAX_CHUNK;
 
 /* Private functions */
 
-//put_get_flag: put = 0; get = 1
-int extoll_rma2_transfer(extoll_t ex, size_t put_get_flag, size_t src_offset, size_t dest_offset, size_t len)
+  static uint32_t
+clamp_depth(uint64_t v)
 {
-  RMA2_ERROR rc;
-
-  //The number of notifications specifies how many overlapping put/get operations we can 
-  //**NOTE** Testing showed that increasing the number of notifications doesn't have a great impact
-  //on bandwidth so 2 is the default number of overlapping calls
-  uint32_t num_notis = 2;
-  uint32_t i;
-  //**NOTE: This command can transfer up to 8 MB at once, so larger transfers must be broken down into smaller transfers
-  //For the last transfer we may need to transfer a small amount of data for the second put/get
-  uint64_t max_num_B_per_call = 8*(1<<20);
+  return (v > MAX_DEPTH ? MAX_DEPTH : v);
+}
 
-  uint32_t last_transfer_flag = 0;
-  uint32_t last_num_transfers = 0;
+  static uint32_t
+clamp_chunk(uint64_t v)
+{
+  return (v > MAX_CHUNK ? MAX_CHUNK : (v < MIN_CHUNK ? MIN_CHUNK : v));
+}
 
-  uint64_t *src_addr = (uint64_t*)calloc(num_notis,sizeof(uint64_t));
-  uint64_t *dest_addr = (uint64_t*)calloc(num_notis,sizeof(uint64_t));
+  static void
+pipe_init(void)
+{
+  const char *env;
+  uint64_t v;
 
-  //Initialize the destination and source offset and check to make sure that we aren't
-  //reading or writing past the local or remote buffer
-  ex->rma_conn.dest_offset = dest_offset;
-  ex->rma_conn.src_offset = src_offset;
+  if ((env = getenv("OCM_RMA_DEPTH")) && (v = strtoul(env, NULL, 0)))
+    pipe_depth = clamp_depth(v);
+  if ((env = getenv("OCM_RMA_CHUNK")) && (v = parse_size(env)))
+    pipe_chunk = clamp_chunk(v);
+}
 
-  printd("RMA2 data transfer - need to transfer %lu B in 8 MB chunks\n", len);
-  printd("Up to %d overlapping put/get operations are allowed\n", num_notis);
+/* Wait for one notification and release it */
+  static int
+wait_noti(struct extoll_alloc *ex)
+{
+  RMA2_ERROR rc;
 
-  while(len > 0)
+  //By timing the blocking time we get a full picture of when the put/get operation completed
+  rc = rma2_noti_get_block(ex->rma_conn.port, &(ex->rma_conn.notification));
+  if (rc != RMA2_SUCCESS)
   {
-    //Each time through the loop update the base address to put/get to/from and then update
-    //the address for each additional put/get call
-    dest_addr[0] = ex->params.dest_nla+ex->rma_conn.dest_offset;
-    src_addr[0] = ex->rma_conn.src_offset;
-
-    for(i = 1; i < num_notis; i++)
-    {
-      dest_addr[i] = dest_addr[i-1] + max_num_B_per_call;
-      src_addr[i]  = src_addr[i-1] + max_num_B_per_call;
-    }
-
-    //Issue N overlapping puts (0) or gets (1) to increase bandwidth
-    if(put_get_flag == 0)
-    {
-      for(i = 0; ((i < num_notis) && (!last_transfer_flag)); i++)
-      {
-        //Check first for the last transfer (one smaller than 8 MB)
-        if(len <= max_num_B_per_call)
-        {
-          if(len == 0)
-          {
-            last_transfer_flag = 1;
-            break;
-          }
-          last_transfer_flag = 1;
-          max_num_B_per_call = len;
-          len = 0;
-          last_num_transfers = i+1;
-
-        }
-        else
-          len -= max_num_B_per_call;
-
-        //For put, RMA2_COMPLETER_NOTIFICATION indicates the the put command has completed (write has finished in remote memory)
-         rc=rma2_post_put_bt(ex->rma_conn.port,ex->rma_conn.handle,ex->rma_conn.region, src_addr[i], max_num_B_per_call,dest_addr[i],RMA2_REQUESTER_NOTIFICATION,RMA2_CMD_DEFAULT);
-        //rc=rma2_post_put_bt(ex->rma_conn.port,ex->rma_conn.handle,ex->rma_conn.region, src_addr[i], max_num_B_per_call,dest_addr[i],RMA2_COMPLETER_NOTIFICATION | RMA2_REQUESTER_NOTIFICATION,RMA2_CMD_DEFAULT);
-
-      }//end for
-    }//end if put
-    else
-    {
-      for(i = 0; ((i < num_notis) && (!last_transfer_flag)); i++)
-      {
+    fprintf(stderr,"error in rma2_noti_get_block\n");
+    return -1;
+  }
+  //rma2_noti_dump just prints out the notification so it is not neccessarily needed
+  //Only at log level debug (OCM_LOG_LEVEL=debug)
+  if (log_enabled(OCM_LOG_DEBUG))
+    rma2_noti_dump(ex->rma_conn.notification);
+  //But notifications must be freed to process new notifications
+  rma2_noti_free(ex->rma_conn.port, ex->rma_conn.notification);
+  return 0;
+}
 
-        printd("Num B left %lu i %d num_notis %d\n",len, i, num_notis);
-        //Check first for the last transfer (one smaller than 8 MB)
-        if(len <= max_num_B_per_call)
-        {
-          if(len == 0)
-          {
-            last_transfer_flag = 1;
-            break;
-          }
-
-          last_transfer_flag = 1;
-          max_num_B_per_call = len;
-          len = 0;
-          last_num_transfers = i+1;
-        }
-        else
-          len -= max_num_B_per_call;
-        
-        //For put, RMA2_COMPLETER_NOTIFICATION indicates the the put command has completed (write has finished in remote memory)
-        rc=rma2_post_get_bt(ex->rma_conn.port,ex->rma_conn.handle,ex->rma_conn.region, src_addr[i], max_num_B_per_call,dest_addr[i],RMA2_COMPLETER_NOTIFICATION,RMA2_CMD_DEFAULT);
-
-        //Increment the dest and source offset for each put or get
-        ex->rma_conn.dest_offset += max_num_B_per_call;
-        ex->rma_conn.src_offset += max_num_B_per_call;
-      }//end for
-    }
+//put_get_flag: put = 0; get = 1
+//The transfer is cut into chunks of rma_conn.chunk bytes. Up to rma_conn.depth
+//of them are outstanding, and the next one is posted as soon as any
+//notification returns, so the link does not idle between chunks.
+  static int
+extoll_rma2_transfer(extoll_t ex, size_t put_get_flag, size_t src_offset, size_t dest_offset, size_t len)
+{
+  struct __rma_t *conn = &ex->rma_conn;
+  uint32_t inflight = 0, n;
+  RMA2_ERROR rc = RMA2_SUCCESS;
 
-    //One the last sequence of transfers there may be fewer outstanding notifications
-    if(last_transfer_flag)
-      num_notis = last_num_transfers;
+  printd("RMA2 data transfer - %lu B in %u B chunks, %u outstanding\n",
+      len, conn->chunk, conn->depth);
 
-    //Wait for N notifications that the data was transferred
-      for(i=0;i<num_notis;i++)
+  while (inflight > 0 || (len > 0 && rc == RMA2_SUCCESS))
+  {
+    if (len > 0 && rc == RMA2_SUCCESS && inflight < conn->depth)
+    {
+      n = (len < conn->chunk ? len : conn->chunk);
+      //For put, RMA2_REQUESTER_NOTIFICATION returns once the data has left the
+      //local buffer; RMA2_COMPLETER_NOTIFICATION would wait for the remote write
+      if (put_get_flag == 0)
+        rc = rma2_post_put_bt(conn->port, conn->handle, conn->region, src_offset, n,
+            ex->params.dest_nla + dest_offset, RMA2_REQUESTER_NOTIFICATION, RMA2_CMD_DEFAULT);
+      else
+        rc = rma2_post_get_bt(conn->port, conn->handle, conn->region, src_offset, n,
+            ex->params.dest_nla + dest_offset, RMA2_COMPLETER_NOTIFICATION, RMA2_CMD_DEFAULT);
+      if (rc != RMA2_SUCCESS)
       {
-        printd("Notis i %d num_notis %d\n", i, num_notis);
-        //By timing the blocking time we get a full picture of when the put/get operation completed
-        rc=rma2_noti_get_block(ex->rma_conn.port, &(ex->rma_conn.notification));
-
-        if (rc!=RMA2_SUCCESS)
-        {
-          fprintf(stderr,"error in rma2_noti_get_block\n");
-          return 1;
-        }
-        printd("\nGot Notification:\n");
-        printd("-------------------------\n");
-        //rma2_noti_dump just prints out the notification so it is not neccessarily needed
-        //Diable by default; check inc/debug.h on how to enable
-#ifdef __DEBUG_ENABLED  
-        rma2_noti_dump(ex->rma_conn.notification);
-#endif
-        //But notifications must be freed to process new notifications
-        rma2_noti_free(ex->rma_conn.port,ex->rma_conn.notification);
-        printd("-------------------------\n");
+        //Still collect the notifications of what was posted
+        print_err(rc);
+        continue;
       }
-  }//end while
-
-  free(src_addr);
-  free(dest_addr);
+      inflight++;
+      src_offset += n;
+      dest_offset += n;
+      len -= n;
+      continue;
+    }
+    if (wait_noti(ex))
+      return -1;
+    inflight--;
+  }
 
-  return 0;
+  return (rc == RMA2_SUCCESS ? 0 : -1);
 }
 
-
 /* Public functions */
 
   int
@@ -197,9 +168,15 @@ extoll_new(struct extoll_params *p)
   //Store the destination node ID, VPID, and NLA
   memcpy(&ex->params, p, sizeof(*p));
 
-  /* TODO Lock this list */
+  pthread_once(&pipe_once, pipe_init);
+  ex->rma_conn.depth = (p->pipeline_depth ? clamp_depth(p->pipeline_depth) : pipe_depth);
+  ex->rma_conn.chunk = (p->chunk_bytes ? clamp_chunk(p->chunk_bytes) : pipe_chunk);
+
   INIT_LIST_HEAD(&ex->link);
+  INIT_LIST_HEAD(&ex->noti_link);
+  pthread_mutex_lock(&extoll_allocs_lock);
   list_add(&ex->link, &extoll_allocs);
+  pthread_mutex_unlock(&extoll_allocs_lock);
 
   return (extoll_t)ex;
 
@@ -217,7 +194,9 @@ extoll_free(extoll_t ex)
   //pages are unregistered in extoll_client_disconnect)
 
   //Delete the EXTOLL object from the list
+  pthread_mutex_lock(&extoll_allocs_lock);
   list_del(&(ex->link));
+  pthread_mutex_unlock(&extoll_allocs_lock);
 
   //Free the EXTOLL object
   free(ex);
@@ -225,22 +204,33 @@ extoll_free(extoll_t ex)
 
 }
 
+//The notifications themselves are served by the notification thread from
+//extoll_connect on; this only keeps the caller, e.g. a test server, waiting
+//until the user is done with the allocation
 void extoll_notification(extoll_t ex)
 {
-  //Store this location so we can jump back here if needed to
-  //break out of the notification call
-  setjmp(jmp_noti_buf);
-  //Once we jump back the notification call will not be run the second time
-  if(!run_once)
-  {
-    run_once = 1;
-    extoll_server_notification((struct extoll_alloc*)ex);
-  }
-  //TODO - fix the RMA free path so that we don't need to call 
-  //the disconnect function here
-  extoll_server_disconnect((struct extoll_alloc*)ex);
-  //Pass a Ctrl-C so that the main daemon (in src/main.c) will also be terminated)
-  raise(SIGINT);
+  sigset_t quit, old;
+  int sig;
+
+  if (!ex)
+    return;
+
+  sigemptyset(&quit);
+  sigaddset(&quit, SIGQUIT);
+  pthread_sigmask(SIG_BLOCK, &quit, &old);
+  printf("Server is waiting for notifications - enter Ctrl-\\ to exit\n");
+  sigwait(&quit, &sig);
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+  printd("%lu notifications\n", ((struct extoll_alloc*)ex)->notis);
+}
+
+  int
+extoll_set_noti_handler(extoll_t ex, extoll_noti_fn fn, void *arg)
+{
+  if (!ex)
+    return -1;
+  extoll_server_noti_handler((struct extoll_alloc*)ex, fn, arg);
+  return 0;
 }
 
 //Close down the EXTOLL server and client applications
@@ -281,13 +271,21 @@ extoll_connect(extoll_t ex, bool is_server)
   return err;
 }
 
+/* size of the remote buffer, as far as the client knows */
+  static size_t
+dest_len(extoll_t ex)
+{
+  return (ex->params.dest_len ? ex->params.dest_len : ex->params.buf_len);
+}
+
 /* client function: pull data fom server */
   int
 extoll_read(extoll_t ex, size_t src_offset, size_t dest_offset, size_t len)
 {
   if (!ex)
     return -1;
-  if ((dest_offset + len) > ex->params.buf_len) {
+  if ((src_offset + len) > ex->params.buf_len ||
+      (dest_offset + len) > dest_len(ex)) {
     printd("error: would read past end of remote buffer\n");
     return -1;
   }
@@ -301,7 +299,8 @@ extoll_write(extoll_t ex, size_t src_offset, size_t dest_offset, size_t len)
 {
   if (!ex || len == 0)
     return -1;
-  if ((dest_offset + len) > ex->params.buf_len) {
+  if ((src_offset + len) > ex->params.buf_len ||
+      (dest_offset + len) > dest_len(ex)) {
     printd("error: would write past end of remote buffer\n");
     return -1;
   }
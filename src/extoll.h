@@ -10,11 +10,6 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-//Used to handle a special case where the notification blocking
-//statement cannot be broken out of
-#include <setjmp.h>
-//Create a signal handler to break out of notification
-#include <signal.h>
 #include <sys/types.h>
 
 #include <fcntl.h>                                             
@@ -22,8 +17,8 @@
 #include <sys/mman.h>                                           
 #include <sys/ioctl.h>                                           
 #include <sys/time.h>                                             
-#include "/extoll2/include/pmap.h"
-#include "/extoll2/include/rma2.h"
+#include <pmap.h>
+#include <rma2.h>
 
 #include <util/list.h>
 
@@ -38,18 +33,17 @@ struct __rma_t {
   //Notifications specify that a particular operation (typically a
   //put or get) has completed within the EXTOLL NIC hardware and that
   //memory referred to by this operation can be safely used
-  //For best bandwidth, two put/get operations can be overlapped, requiring
-  //two notifications
+  //Every put/get of a transfer returns one
   RMA2_Notification* notification;
   //Handles hold information on connections
   RMA2_Handle handle;
   //The connection type specifies whether the RMA connection is directly
   //accessing memory, registers, or using API-related structures
   RMA2_Connection_Options conn_type;
-  //Local offset used for data transfers
-  uint64_t src_offset;
-  //Remote offset used for data transfers
-  uint64_t dest_offset;
+  //Transfers are pipelined: up to depth put/get operations of at most
+  //chunk bytes each are outstanding at once
+  uint32_t depth;
+  uint32_t chunk;
   //A void pointer to pages that are pinned and can be associated
   //with an RMA2_Region
   void* buf;
@@ -60,11 +54,18 @@ struct extoll_alloc
     struct list_head    link;
     struct __rma_t rma_conn;
     struct extoll_params params;
+    //Server only: entry in the notification thread's list, the handler
+    //it passes each notification to and how many it has passed
+    struct list_head    noti_link;
+    extoll_noti_fn noti_fn;
+    void *noti_arg;
+    uint64_t notis;
 };
 
 /* server functions */
 int extoll_server_connect(struct extoll_alloc *ex_alloc);
-void extoll_server_notification(struct extoll_alloc *ex_alloc);
+void extoll_server_noti_handler(struct extoll_alloc *ex_alloc,
+    extoll_noti_fn fn, void *arg);
 int extoll_server_disconnect(struct extoll_alloc *ex_alloc);
 
 /* client functions */
@@ -17,7 +17,9 @@
 
 /* Project includes */
 #include <io/extoll.h>
+#include <buf.h>
 #include <debug.h>
+#include <topo.h>
 
 /* Directory includes */
 #include "extoll.h"
@@ -35,15 +37,16 @@ int extoll_client_connect(struct extoll_alloc *ex)
 
   printf("Setting up remote memory connection to node %d, vpid %d, and 0x%lx NLA with RMA2\n", ex->params.dest_node, ex->params.dest_vpid, ex->params.dest_nla);
 
-  int mem_result=posix_memalign((void**)&(ex->rma_conn.buf),4096,ex->params.buf_len);
+  //Zeroed, possibly huge-page backed
+  ex->rma_conn.buf = buf_alloc(ex->params.buf_len,
+      topo_pick_node(ex->params.numa_node));
 
-  if (mem_result!=0)
+  if (!ex->rma_conn.buf)
   {
     perror("Memory Buffer allocation failed. Bailing out.");
     return -1;
   }
 
-  memset(ex->rma_conn.buf, 0, ex->params.buf_len);
   printd("Region starts at %p\n", ex->rma_conn.buf);
 
   printf("Opening port\n");
@@ -81,22 +84,33 @@ int extoll_client_disconnect(struct extoll_alloc *ex)
 {
   RMA2_ERROR rc;
 
+  //Also undoes a connect that failed half way
+  if (!ex->rma_conn.port)
+    goto buf;
 
-  printf("RMA2 disconnect\n");
-  rc=rma2_disconnect(ex->rma_conn.port,ex->rma_conn.handle);
-
-  if (rc!=RMA2_SUCCESS) 
-  { 
-    print_err(rc);
-    return -1;
+  if (ex->rma_conn.handle)
+  {
+    printf("RMA2 disconnect\n");
+    rc=rma2_disconnect(ex->rma_conn.port,ex->rma_conn.handle);
+
+    if (rc!=RMA2_SUCCESS) 
+    { 
+      print_err(rc);
+      return -1;
+    }
+    ex->rma_conn.handle = NULL;
   }
 
-  rc=rma2_unregister(ex->rma_conn.port, ex->rma_conn.region);
-
-  if (rc!=RMA2_SUCCESS) 
-  { 
-    print_err(rc);
-    return -1;
+  if (ex->rma_conn.region)
+  {
+    rc=rma2_unregister(ex->rma_conn.port, ex->rma_conn.region);
+
+    if (rc!=RMA2_SUCCESS) 
+    { 
+      print_err(rc);
+      return -1;
+    }
+    ex->rma_conn.region = NULL;
   }
 
 
@@ -109,10 +123,13 @@ int extoll_client_disconnect(struct extoll_alloc *ex)
     print_err(rc);
     return -1;
   }
+  ex->rma_conn.port = NULL;
 
-
-  //Free the memory region and associated buffer
-  //free(ex->rma.region);
+buf:
+  //Free the buffer now that it is no longer registered
+  if (ex->rma_conn.buf)
+    buf_free(ex->rma_conn.buf);
+  ex->rma_conn.buf = NULL;
   return 0;
 }
 
@@ -5,6 +5,9 @@
  */
 
 /* System includes */
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
@@ -14,24 +17,168 @@
 
 /* Project includes */
 #include <io/extoll.h>
+#include <buf.h>
 #include <debug.h>
+#include <topo.h>
 
 /* Directory includes */
 #include "extoll.h"
-#include "extoll_noti.h"
 
 /* Internal definitions */
 
+//Notifications taken from one port before moving to the next
+#define NOTI_BATCH      64
+//Idle rounds spent polling before the thread starts to sleep, and how
+//long it sleeps at most (us)
+#define NOTI_SPIN       128
+#define NOTI_SLEEP_MAX  1000
+
 /* Internal state */
 
+//Server allocations whose ports the notification thread serves. RMA2 cannot
+//block on several ports at once, so the thread probes each of them in turn
+//and backs off to sleeping while all are quiet.
+static LIST_HEAD(noti_allocs);
+static pthread_mutex_t noti_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t noti_cond;
+static pthread_once_t noti_once = PTHREAD_ONCE_INIT;
+static pthread_t noti_tid;
+static bool noti_running;
+//Threads waiting to change the list; the notification thread steps aside
+//for them between rounds even while notifications keep coming
+static unsigned int noti_waiters;
+
 /* Private functions */
-static void sighandler(int sig)
+
+static void noti_cond_init(void)
+{
+  pthread_condattr_t attr;
+
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&noti_cond, &attr);
+  pthread_condattr_destroy(&attr);
+}
+
+/* noti_lock for changing the list or a handler */
+static void noti_lock_take(void)
 {
-    printf("Received signal %d - breaking out of the loop\n",sig);
-    noti_loop = 0;
+  pthread_once(&noti_once, noti_cond_init);
+  __atomic_fetch_add(&noti_waiters, 1, __ATOMIC_RELAXED);
+  pthread_mutex_lock(&noti_lock);
+  __atomic_fetch_sub(&noti_waiters, 1, __ATOMIC_RELAXED);
+}
 
-    //Jump back to src/extoll.c:extoll_notification initiate EXTOLL teardown
-    longjmp(jmp_noti_buf,1);
+static void noti_lock_give(void)
+{
+  pthread_cond_broadcast(&noti_cond);
+  pthread_mutex_unlock(&noti_lock);
+}
+
+/* one notification of ex, with noti_lock held */
+static void dispatch(struct extoll_alloc *ex, RMA2_Notification *n)
+{
+  ex->notis++;
+  if (log_enabled(OCM_LOG_DEBUG))
+    rma2_noti_dump(n);
+  if (ex->noti_fn)
+    ex->noti_fn((extoll_t)ex, n, ex->noti_arg);
+}
+
+//The daemon-wide notification thread: takes the notifications of every
+//served allocation off its port and hands them to the allocation
+static void *noti_thread(void *arg)
+{
+  struct extoll_alloc *ex;
+  RMA2_Notification *n;
+  struct timespec ts;
+  unsigned int idle = 0, i, found;
+  long sleep_us;
+
+  pthread_mutex_lock(&noti_lock);
+  while (true)
+  {
+    while (__atomic_load_n(&noti_waiters, __ATOMIC_RELAXED))
+      pthread_cond_wait(&noti_cond, &noti_lock);
+
+    if (list_empty(&noti_allocs))
+    {
+      idle = 0;
+      pthread_cond_wait(&noti_cond, &noti_lock);
+      continue;
+    }
+
+    found = 0;
+    list_for_each_entry(ex, &noti_allocs, noti_link)
+    {
+      for (i = 0; i < NOTI_BATCH &&
+          rma2_noti_probe(ex->rma_conn.port, &n) == RMA2_SUCCESS; i++)
+      {
+        dispatch(ex, n);
+        //Notifications must be freed to process new notifications
+        rma2_noti_free(ex->rma_conn.port, n);
+      }
+      found += i;
+    }
+    if (found)
+    {
+      idle = 0;
+      continue;
+    }
+
+    //Spin for a while, then back off
+    if (++idle < NOTI_SPIN)
+    {
+      pthread_mutex_unlock(&noti_lock);
+      sched_yield();
+      pthread_mutex_lock(&noti_lock);
+      continue;
+    }
+    sleep_us = 10L << ((idle - NOTI_SPIN) < 7 ? (idle - NOTI_SPIN) : 7);
+    if (sleep_us > NOTI_SLEEP_MAX)
+      sleep_us = NOTI_SLEEP_MAX;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    ts.tv_nsec += sleep_us * 1000L;
+    ts.tv_sec += ts.tv_nsec / 1000000000L;
+    ts.tv_nsec %= 1000000000L;
+    pthread_cond_timedwait(&noti_cond, &noti_lock, &ts);
+  }
+  pthread_mutex_unlock(&noti_lock);
+  return NULL;
+}
+
+/* hand the notifications of ex to the notification thread, starting it the
+ * first time */
+static int noti_watch(struct extoll_alloc *ex)
+{
+  sigset_t all, old;
+  int ret = 0;
+
+  noti_lock_take();
+  if (!noti_running)
+  {
+    //Signals are for the daemon's main thread
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    noti_running = !pthread_create(&noti_tid, NULL, noti_thread, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (!noti_running)
+      ret = -1;
+  }
+  if (!ret)
+    list_add_tail(&ex->noti_link, &noti_allocs);
+  noti_lock_give();
+  return ret;
+}
+
+/* once this returns the thread no longer touches ex */
+static void noti_unwatch(struct extoll_alloc *ex)
+{
+  noti_lock_take();
+  if (!list_empty(&ex->noti_link))
+    list_del_init(&ex->noti_link);
+  noti_lock_give();
+  printd("RMA region served %lu notifications\n", ex->notis);
 }
 
 /* Public functions */
@@ -40,10 +187,9 @@ static void sighandler(int sig)
 int extoll_server_connect(struct extoll_alloc *ex)
 {
   RMA2_ERROR rc;
-  int mem_result = 0;
 
   printd("extoll_server_connect:: local_buff_size_B is %lu B\n",ex->params.buf_len);
-  //Note that posix_memalign does a malloc, so the buffer should not be allocated yet!
+  //The buffer is allocated here, so it should not be allocated yet!
 
       rc=rma2_open(&(ex->rma_conn.port));
 
@@ -71,9 +217,10 @@ int extoll_server_connect(struct extoll_alloc *ex)
     return -1;
   }
 
-    mem_result=posix_memalign((void**)&(ex->rma_conn.buf),4096,ex->params.buf_len);
+    ex->rma_conn.buf = buf_alloc(ex->params.buf_len,
+        topo_pick_node(ex->params.numa_node));
 
-  if (mem_result!=0)
+  if (!ex->rma_conn.buf)
   {
     perror("Memory Buffer allocation failed. Bailing out.");
     return -1;
@@ -111,37 +258,25 @@ int extoll_server_connect(struct extoll_alloc *ex)
   rma2_get_nla(ex->rma_conn.region, 0, &(ex->params.dest_nla));
 
   printf("Registered region: node %u vpid %u NLA 0x%lx\n", ex->params.dest_node,  ex->params.dest_vpid,(uint64_t)(ex->params.dest_nla));
-  
-  return 0;
-}
 
-//Capture notifications from RMA put operations
-void extoll_server_notification(struct extoll_alloc *ex)
-{
-  RMA2_ERROR rc;
-
-  /*Catch the Ctrl-\ key combination and jump to the teardown code*/
-  signal(SIGQUIT, &sighandler);
-
-  noti_loop = 1;
-
-  printf("Server is waiting for notifications - enter Ctrl-\\ to exit\n");
-  while (noti_loop)
+  //Notifications of puts and gets on the region are taken care of by the
+  //daemon-wide notification thread
+  if (noti_watch(ex))
   {
-    rc=rma2_noti_get_block(ex->rma_conn.port, &(ex->rma_conn.notification));
-    //nonblocking version
-    //rc=rma2_noti_probe(rma2Obj->port, &(rma2Obj->notification));
-    if (rc != RMA2_SUCCESS)
-    {
-      continue;
-    }
-#ifdef __DEBUG_ENABLED
-    rma2_noti_dump(ex->rma_conn.notification);
-#endif
-    rma2_noti_free(ex->rma_conn.port,ex->rma_conn.notification);
-    printd("\n\nContent !=0:\n\n");
+    fprintf(stderr, "could not start the notification thread\n");
+    return -1;
   }
 
+  return 0;
+}
+
+//Set the function the notification thread calls for each notification of ex
+void extoll_server_noti_handler(struct extoll_alloc *ex, extoll_noti_fn fn, void *arg)
+{
+  noti_lock_take();
+  ex->noti_fn = fn;
+  ex->noti_arg = arg;
+  noti_lock_give();
 }
 
 int extoll_server_disconnect(struct extoll_alloc *ex)
@@ -149,6 +284,8 @@ int extoll_server_disconnect(struct extoll_alloc *ex)
 
   RMA2_ERROR rc;
 
+  //The port must be left alone before it is closed
+  noti_unwatch(ex);
 
   //Note that disconnect is not needed on this end, since we
   //never performed rma2_connect
@@ -175,7 +312,8 @@ int extoll_server_disconnect(struct extoll_alloc *ex)
   }
 
 
-  //free(ex->rma.buf);
+  buf_free(ex->rma_conn.buf);
+  ex->rma_conn.buf = NULL;
 
   return 0;
 }
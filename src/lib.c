@@ -8,6 +8,8 @@
 #include <stdio.h>
 #include <pthread.h>
 #include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
 
 /* Other project includes */
 
@@ -15,8 +17,18 @@
 #include <oncillamem.h>
 #include <pmsg.h>
 #include <msg.h>
+#include <wire.h>
 #include <debug.h>
 #include <alloc.h>
+#include <buf.h>
+#include <lib_cache.h>
+#include <lib_wc.h>
+#include <lib_copy.h>
+#include <lib_mmap.h>
+#include <lib_record.h>
+#include <lib_stats.h>
+#include <topo.h>
+#include <trace.h>
 
 /* Directory includes */
 #ifdef CUDA
@@ -33,12 +45,29 @@
 
 /* Internal definitions */
 
+//What a transfer, maybe issued by the cache, is accounted under
+struct xfer_ctx {
+  ocm_alloc_t a;
+  enum ocm_kind kind;
+  enum ocm_stat_op op;
+};
+
 struct lib_alloc {
   struct list_head link;
   enum ocm_kind kind;
   //A unique allocation ID per node to allow sending ocm_free messages to
   //remote nodes
   uint64_t rem_alloc_id;
+  //Number of the allocation in the OCM_RECORD file, 0 if not recording
+  uint64_t rec_id;
+  //Client cache of the remote buffer, NULL if none
+  struct lib_cache *cache;
+  //What the readahead of the cache is accounted under
+  struct xfer_ctx ra_ctx;
+  //Write-combining buffer, NULL if none, and what its timed flushes are
+  //accounted under
+  struct lib_wc *wc;
+  struct xfer_ctx wc_ctx;
   /* TODO Later, when allocations are composed of partitioned distributed
    * allocations, this will no longer be a single union, but an array of them,
    * to accomodate the heterogeneity in allocations.
@@ -90,8 +119,185 @@ static pthread_mutex_t allocs_lock = PTHREAD_MUTEX_INITIALIZER;
 #define lock_allocs()   pthread_mutex_lock(&allocs_lock)
 #define unlock_allocs() pthread_mutex_unlock(&allocs_lock)
 
+/* A caller blocked on the daemon's reply to one request. The dispatcher thread
+ * owns the receive mailbox and hands each reply to the waiter whose id it
+ * carries, so any number of app threads may have requests in flight.
+ */
+struct lib_req {
+  struct list_head link;
+  uint64_t id;
+  bool done;
+  int err;
+  struct message msg; /* reply, valid once done */
+  pthread_cond_t cond;
+};
+
+/* An allocation running asynchronously on its own thread. Both that thread
+ * and the app hold a reference; the last one to let go frees it.
+ */
+struct lib_alloc_req {
+  struct ocm_alloc_params params; /* copied, the app may reuse its own */
+  ocm_alloc_cb_t cb;
+  void *cb_arg;
+  int efd; /* eventfd signalled on completion */
+  bool done;
+  int refs;
+  ocm_alloc_t alloc; /* result, NULL on failure */
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+};
+
+/* how long the dispatcher sleeps in the mailbox before checking for exit */
+#define DISPATCH_WAIT_MS  100
+
+static LIST_HEAD(reqs); /* list of lib_req awaiting a reply */
+static pthread_mutex_t reqs_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t next_req_id = 1;
+
+static pthread_t dispatch_tid;
+static volatile bool dispatch_alive = false;
+
+#define for_each_req(req, reqs) \
+  list_for_each_entry(req, &reqs, link)
+#define lock_reqs()     pthread_mutex_lock(&reqs_lock)
+#define unlock_reqs()   pthread_mutex_unlock(&reqs_lock)
+
 /* Private functions */
 
+/* hand a reply to its waiter; replies nobody waits on are dropped */
+  static void
+dispatch_msg(struct message *msg)
+{
+  struct lib_req *req;
+  bool found = false;
+
+  lock_reqs();
+  for_each_req(req, reqs) {
+    if (req->id == msg->id) {
+      found = true;
+      req->msg = *msg;
+      req->done = true;
+      list_del_init(&req->link);
+      pthread_cond_signal(&req->cond);
+      break;
+    }
+  }
+  unlock_reqs();
+  if (!found)
+    printd("dropping %s for unknown request %lu\n",
+        MSG_TYPE2STR(msg->type), msg->id);
+}
+
+/* wake every waiter with an error, e.g. when we detach from the daemon */
+  static void
+fail_reqs(void)
+{
+  struct lib_req *req, *tmp;
+
+  lock_reqs();
+  list_for_each_entry_safe(req, tmp, &reqs, link) {
+    req->err = -1;
+    req->done = true;
+    list_del_init(&req->link);
+    pthread_cond_signal(&req->cond);
+  }
+  unlock_reqs();
+}
+
+  static void *
+dispatch_thread(void *arg)
+{
+  struct message msg;
+
+  printd("reply dispatcher alive\n");
+  //Replies arrive through the daemon, which runs next to the NIC
+  topo_bind_thread(topo_nic_node());
+  while (dispatch_alive) {
+    if (pmsg_wait(DISPATCH_WAIT_MS) <= 0)
+      continue;
+    while (pmsg_pending() > 0) {
+      if (wire_pmsg_recv(&msg, false) < 0)
+        break;
+      dispatch_msg(&msg);
+    }
+  }
+  fail_reqs();
+  return NULL;
+}
+
+  static int
+launch_dispatch_thread(void)
+{
+  dispatch_alive = true;
+  if (pthread_create(&dispatch_tid, NULL, dispatch_thread, NULL)) {
+    dispatch_alive = false;
+    printd("error launching reply dispatcher\n");
+    return -1;
+  }
+  return 0;
+}
+
+  static void
+stop_dispatch_thread(void)
+{
+  if (!dispatch_alive)
+    return;
+  lock_reqs();
+  dispatch_alive = false;
+  unlock_reqs();
+  pthread_join(dispatch_tid, NULL);
+}
+
+/* Send msg to the daemon under a fresh request id and block until the
+ * dispatcher delivers the matching reply, which overwrites msg.
+ */
+  static int
+send_recv_daemon(struct message *msg)
+{
+  struct lib_req req;
+  uint64_t start = trace_now(), trace = msg->trace_id;
+  int ret = -1;
+
+  memset(&req, 0, sizeof(req));
+  INIT_LIST_HEAD(&req.link);
+  pthread_cond_init(&req.cond, NULL);
+
+  lock_reqs();
+  if (!dispatch_alive) {
+    unlock_reqs();
+    goto out;
+  }
+  req.id = next_req_id++;
+  list_add_tail(&req.link, &reqs);
+  unlock_reqs();
+
+  msg->id = req.id;
+  printd("sending %s (request %lu) to daemon\n",
+      MSG_TYPE2STR(msg->type), req.id);
+  if (wire_pmsg_send(PMSG_DAEMON_PID, msg)) {
+    lock_reqs();
+    if (!req.done)
+      list_del(&req.link);
+    unlock_reqs();
+    goto out;
+  }
+
+  lock_reqs();
+  while (!req.done)
+    pthread_cond_wait(&req.cond, &reqs_lock);
+  unlock_reqs();
+
+  if (req.err)
+    goto out;
+  *msg = req.msg;
+  ret = 0;
+
+out:
+  pthread_cond_destroy(&req.cond);
+  trace_span(trace, "daemon_request", start);
+  return ret;
+}
+
 /* Global functions */
 
   int
@@ -101,10 +307,17 @@ ocm_init(void)
   int tries = 10; /* to open daemon mailbox */
   bool opened = false, attached = false;
   int ret = -1;
+  char *env;
 
   /* open resources */
-  if (pmsg_init(sizeof(struct message)))
+  if (pmsg_init(WIRE_MSG_MAX))
+    goto out;
+  /* talk to a specific daemon when several share this host */
+  if ((env = getenv("OCM_RANK")) && pmsg_set_instance(atoi(env)))
     goto out;
+  /* tracing and recording are optional, the app runs without them */
+  trace_init(NULL, env ? atoi(env) : -1);
+  lib_record_init();
   if (pmsg_open(getpid()))
     goto out;
   opened = true;
@@ -125,12 +338,15 @@ ocm_init(void)
   memset(&msg, 0, sizeof(msg));
   msg.type = MSG_CONNECT;
   msg.pid = getpid();
-  if (pmsg_send(PMSG_DAEMON_PID, &msg))
+  if (wire_pmsg_send(PMSG_DAEMON_PID, &msg))
     goto out;
-  if (pmsg_recv(&msg, true))
+  if (wire_pmsg_recv(&msg, true))
     goto out;
   if (msg.type != MSG_CONNECT_CONFIRM)
     goto out;
+  /* from here on all replies are routed through the dispatcher */
+  if (launch_dispatch_thread())
+    goto out;
   ret = 0;
 
 out:
@@ -149,10 +365,12 @@ ocm_tini(void)
 {
   struct message msg;
   int ret = -1;
+  memset(&msg, 0, sizeof(msg));
   msg.type = MSG_DISCONNECT;
   msg.pid = getpid();
-  if (pmsg_send(PMSG_DAEMON_PID, &msg))
+  if (wire_pmsg_send(PMSG_DAEMON_PID, &msg))
     goto out;
+  stop_dispatch_thread();
   if (pmsg_detach(PMSG_DAEMON_PID))
     goto out;
   if (pmsg_close())
@@ -161,85 +379,302 @@ ocm_tini(void)
 
 out:
   printd("detach from daemon: %s\n", (ret ? "fail" : "success"));
+  lib_stats_fin();
+  lib_record_fin();
+  trace_fin();
   return ret;
 }
 
+/* drop one reference to an async request, freeing it with the last one */
+  static void
+put_alloc_req(struct lib_alloc_req *req)
+{
+  bool last;
+
+  pthread_mutex_lock(&req->lock);
+  last = (--req->refs == 0);
+  pthread_mutex_unlock(&req->lock);
+  if (!last)
+    return;
+  close(req->efd);
+  pthread_cond_destroy(&req->cond);
+  pthread_mutex_destroy(&req->lock);
+  free(req);
+}
+
+  static void *
+alloc_async_thread(void *arg)
+{
+  struct lib_alloc_req *req = (struct lib_alloc_req*)arg;
+  ocm_alloc_t alloc;
+  uint64_t one = 1;
+
+  alloc = ocm_alloc(&req->params);
+
+  pthread_mutex_lock(&req->lock);
+  req->alloc = alloc;
+  req->done = true;
+  pthread_cond_broadcast(&req->cond);
+  pthread_mutex_unlock(&req->lock);
+
+  if (write(req->efd, &one, sizeof(one)) != sizeof(one))
+    printd("could not signal completion eventfd\n");
+  if (req->cb)
+    req->cb(req, req->cb_arg);
+
+  put_alloc_req(req);
+  return NULL;
+}
+
 //Public access function to return the type of an allocation
 enum ocm_kind ocm_alloc_kind(ocm_alloc_t alloc)
 {
   return alloc->kind;
 }
 
-//Allocation function, ocm_alloc
-  ocm_alloc_t
-ocm_alloc(ocm_alloc_param_t alloc_param)
+/* Move len bytes between offset loff of the local buffer of a and offset
+ * roff of its remote buffer */
+  static int
+transport_xfer(void *arg, bool write, size_t loff, size_t roff, size_t len)
 {
-  struct message msg;
-  struct lib_alloc *alloc;
+  struct xfer_ctx *x = (struct xfer_ctx*)arg;
+  ocm_alloc_t a = x->a;
+  uint64_t start = lib_stats_now();
   int ret = -1;
 
-  alloc = calloc(1, sizeof(*alloc));
-  if (!alloc)
-    goto out;
+#ifdef INFINIBAND
+  if (a->kind == OCM_REMOTE_RDMA) {
+    //Remember to call both ib_read and ib_poll in order to correctly measure the time taken for the transfer
+    ret = (STATS_TIME(x->kind, x->op, OCM_STAT_POST,
+          (write ? ib_write : ib_read)(a->u.rdma.ib, loff, roff, len)) ||
+        STATS_TIME(x->kind, x->op, OCM_STAT_WAIT, ib_poll(a->u.rdma.ib)));
+  }
+#endif
+#ifdef EXTOLL
+  if (a->kind == OCM_REMOTE_RMA)
+    ret = STATS_TIME(x->kind, x->op, OCM_STAT_POST,
+        (write ? extoll_write : extoll_read)(a->u.rma.ex, loff, roff, len));
+#endif
+  BUG(a->kind != OCM_REMOTE_RDMA && a->kind != OCM_REMOTE_RMA);
+  //Readahead and flushes are not part of a copy, so they count on their own
+  if (x->op == OCM_STAT_PREFETCH || x->op == OCM_STAT_FLUSH)
+    lib_stats_op(x->kind, x->op, start, len, ret != 0);
+  return (ret ? -1 : 0);
+}
 
-  msg.type        = MSG_REQ_ALLOC;
+/* transport_xfer through the cache of the allocation, if it has one */
+  static int
+store_xfer(void *arg, bool write, size_t loff, size_t roff, size_t len)
+{
+  struct xfer_ctx *x = (struct xfer_ctx*)arg;
+
+  if (!x->a->cache)
+    return transport_xfer(x, write, loff, roff, len);
+  if (write)
+    return lib_cache_write(x->a->cache, loff, roff, len, x);
+  return lib_cache_read(x->a->cache, loff, roff, len, x);
+}
+
+/* An app transfer: store_xfer through the write-combining buffer of a, if
+ * it has one */
+  static int
+remote_xfer(ocm_alloc_t a, enum ocm_kind k, enum ocm_stat_op op, bool write,
+    size_t loff, size_t roff, size_t len)
+{
+  struct xfer_ctx x = { a, k, op };
+  void *buf;
+  size_t local;
+
+  //The transport would let the app reach into the staging area
+  if (ocm_localbuf(a, &buf, &local) || loff + len > local) {
+    printd("local offset %lu + %lu bytes is past the local buffer\n",
+        loff, len);
+    return -1;
+  }
+  if (a->wc)
+    return lib_wc_xfer(a->wc, write, loff, roff, len, &x);
+  return store_xfer(&x, write, loff, roff, len);
+}
+
+/* Bytes the cache of an allocation needs after its local buffer, 0 if it
+ * gets none */
+  static size_t
+cache_stage(ocm_alloc_param_t alloc_param)
+{
+  size_t bytes = alloc_param->cache_bytes, ra = alloc_param->readahead_bytes;
+  bool write_back = alloc_param->cache_write_back;
+
+  return lib_cache_config(&bytes, &write_back, &ra);
+}
+
+/* Bytes of staging after the local buffer: the cache's, then the
+ * write-combining buffer */
+  static size_t
+alloc_stage(ocm_alloc_param_t alloc_param)
+{
+  size_t wc = alloc_param->wc_bytes;
+
+  return cache_stage(alloc_param) + lib_wc_config(&wc);
+}
+
+/* Put a cache in front of the remote buffer if asked to; the allocation
+ * works without one */
+  static void
+setup_cache(struct lib_alloc *alloc, ocm_alloc_param_t alloc_param)
+{
+  size_t bytes = alloc_param->cache_bytes, ra = alloc_param->readahead_bytes;
+  size_t local, remote, stage;
+  bool write_back = alloc_param->cache_write_back;
+  void *buf;
+
+  if (alloc->kind != OCM_REMOTE_RDMA && alloc->kind != OCM_REMOTE_RMA)
+    return;
+  stage = lib_cache_config(&bytes, &write_back, &ra);
+  if (!stage || ocm_localbuf(alloc, &buf, &local) ||
+      ocm_remote_sz(alloc, &remote))
+    return;
+  alloc->ra_ctx.a = alloc;
+  alloc->ra_ctx.kind = alloc->kind;
+  alloc->ra_ctx.op = OCM_STAT_PREFETCH;
+  alloc->cache = lib_cache_new(bytes, write_back, ra, (char*)buf, local,
+      stage, remote, transport_xfer, &alloc->ra_ctx);
+}
+
+/* Combine small writes if asked to; after setup_cache, as flushes go
+ * through the cache */
+  static void
+setup_wc(struct lib_alloc *alloc, ocm_alloc_param_t alloc_param)
+{
+  size_t bytes = alloc_param->wc_bytes, local;
+  void *buf;
+
+  if (alloc->kind != OCM_REMOTE_RDMA && alloc->kind != OCM_REMOTE_RMA)
+    return;
+  if (!lib_wc_config(&bytes) || ocm_localbuf(alloc, &buf, &local))
+    return;
+  alloc->wc_ctx.a = alloc;
+  alloc->wc_ctx.kind = alloc->kind;
+  alloc->wc_ctx.op = OCM_STAT_FLUSH;
+  alloc->wc = lib_wc_new(bytes, (char*)buf, local + cache_stage(alloc_param),
+      store_xfer, &alloc->wc_ctx);
+}
+
+#ifdef INFINIBAND
+  static int
+ib_poll_mode(int mode)
+{
+  switch (mode) {
+    case OCM_POLL_EVENT:
+      return IB_POLL_EVENT;
+    case OCM_POLL_BUSY:
+      return IB_POLL_BUSY;
+    case OCM_POLL_HYBRID:
+      return IB_POLL_HYBRID;
+    default:
+      return IB_POLL_DEFAULT;
+  }
+}
+#endif
+
+//Ask the daemon to release buffer rem_alloc_id of remote_rank
+  static int
+free_remote(enum ocm_kind kind, int remote_rank, uint64_t rem_alloc_id,
+    uint64_t trace)
+{
+  struct message msg;
+
+  memset(&msg, 0, sizeof(msg));
+  msg.type        = MSG_REQ_FREE;
   msg.status      = MSG_REQUEST;
   msg.pid         = getpid();
-  //Specify the allocation size of the remote buffer; in
-  //the local case the local_alloc_bytes field is used since
-  //we will end up making a local allocation
-  msg.u.req.bytes = alloc_param->rem_alloc_bytes;
+  msg.trace_id    = trace;
+  msg.u.alloc.rem_alloc_id  = rem_alloc_id;
+  msg.u.alloc.remote_rank   = remote_rank;
+  msg.u.alloc.type = (kind == OCM_REMOTE_RDMA ? ALLOC_MEM_RDMA : ALLOC_MEM_RMA);
+  if (STATS_TIME(kind, OCM_STAT_FREE, OCM_STAT_POST,
+        send_recv_daemon(&msg)))
+    return -1;
+  BUG(msg.type != MSG_RELEASE_APP);
+  return 0;
+}
 
-  if (alloc_param->kind == OCM_LOCAL_HOST)
+//Release the local side of a: its buffer and, for remote kinds, the
+//connection, which may also be one that setup_alloc left half made
+  static int
+free_local(ocm_alloc_t a)
+{
+  if (a->kind == OCM_LOCAL_HOST) {
+    free(a->u.local.ptr);
+  }
+#ifdef CUDA
+  else if (a->kind == OCM_LOCAL_GPU) {
+    cudaFree(a->u.gpu.cuda_ptr);
+  }
+#endif
+#ifdef INFINIBAND
+  else if (a->kind == OCM_REMOTE_RDMA)
   {
-    msg.u.req.type = ALLOC_MEM_HOST;
-    msg.u.req.bytes = alloc_param->local_alloc_bytes;
+    //release the local IB connection 
+    if (ib_disconnect(a->u.rdma.ib, false/*is client*/))
+      return -1;
+
+    //Free the IB structure
+    if(ib_free(a->u.rdma.ib))
+      return -1;
   }
-  else if(alloc_param->kind == OCM_LOCAL_GPU)
+#endif
+#ifdef EXTOLL
+  else if (a->kind == OCM_REMOTE_RMA)
   {
-    msg.u.req.type = ALLOC_MEM_GPU;
-    msg.u.req.bytes = alloc_param->local_alloc_bytes;
+    //release the local EXTOLL connection 
+    if (extoll_disconnect(a->u.rma.ex, false/*is client*/))
+      return -1;
+
+    //Free the EXTOLL structure
+    if(extoll_free(a->u.rma.ex))
+      return -1;
   }
-  else if (alloc_param->kind == OCM_REMOTE_RDMA)
-    msg.u.req.type = ALLOC_MEM_RDMA;
-  else if (alloc_param->kind == OCM_REMOTE_RMA)
-    msg.u.req.type = ALLOC_MEM_RMA;
+#endif
   else
   {
-    printf("No allocation type specified\n");
-    goto out;
+    BUG(1);
   }
+  return 0;
+}
 
-  printd("sending req_alloc to daemon\n");
-  if (pmsg_send(PMSG_DAEMON_PID, &msg))
-    goto out;
-
-  printd("waiting for reply from daemon\n");
-  if (pmsg_recv(&msg, true))
-    goto out;
-  BUG(msg.type != MSG_RELEASE_APP);
-
-  if (msg.u.alloc.type == ALLOC_MEM_HOST) {
-    printd("ALLOC_MEM_HOST %lu bytes\n", msg.u.alloc.bytes);
+/* Set up buffer 'idx' of the allocation batch the daemon described in msg */
+  static int
+setup_alloc(struct lib_alloc *alloc, struct message *msg,
+    ocm_alloc_param_t alloc_param, unsigned int idx)
+{
+  if (msg->u.alloc.type == ALLOC_MEM_HOST) {
+    printd("ALLOC_MEM_HOST %lu bytes\n", msg->u.alloc.bytes);
     alloc->kind             = OCM_LOCAL_HOST;
-    alloc->u.local.bytes    = msg.u.alloc.bytes;
-    alloc->u.local.ptr      = malloc(msg.u.alloc.bytes);
-    if (!alloc->u.local.ptr)
-      goto out;
+    alloc->u.local.bytes    = msg->u.alloc.bytes;
+    //Only placed when the app names a node; there is no NIC in the way
+    if (alloc_param->numa_node > 0) {
+      if (posix_memalign(&alloc->u.local.ptr, getpagesize(),
+            msg->u.alloc.bytes))
+        return -1;
+      topo_bind_mem(alloc->u.local.ptr, msg->u.alloc.bytes,
+          topo_pick_node(alloc_param->numa_node));
+    }
+    else if (!(alloc->u.local.ptr = malloc(msg->u.alloc.bytes)))
+      return -1;
   }
 #ifdef CUDA
-  else if (msg.u.alloc.type == ALLOC_MEM_GPU) {
-    printd("ALLOC_MEM_GPU %lu bytes\n", msg.u.alloc.bytes);
+  else if (msg->u.alloc.type == ALLOC_MEM_GPU) {
+    printd("ALLOC_MEM_GPU %lu bytes\n", msg->u.alloc.bytes);
 
     INIT_LIST_HEAD(&alloc->link);
     alloc->kind             = OCM_LOCAL_GPU;
-    alloc->u.gpu.bytes    = msg.u.alloc.bytes;
+    alloc->u.gpu.bytes    = msg->u.alloc.bytes;
 
     alloc->u.gpu.cuda_ptr = NULL;
 
-    if(cudaMalloc((void**)&(alloc->u.gpu.cuda_ptr), msg.u.alloc.bytes)==cudaErrorMemoryAllocation)
+    if(cudaMalloc((void**)&(alloc->u.gpu.cuda_ptr), msg->u.alloc.bytes)==cudaErrorMemoryAllocation)
     {
-      goto out;
+      return -1;
     }
 
     printd("adding new alloc to list\n");
@@ -250,35 +685,48 @@ ocm_alloc(ocm_alloc_param_t alloc_param)
 
 #endif
 #ifdef INFINIBAND
-  else if (msg.u.alloc.type == ALLOC_MEM_RDMA) {
-    printd("ALLOC_MEM_RDMA %lu bytes\n", msg.u.alloc.bytes);
+  else if (msg->u.alloc.type == ALLOC_MEM_RDMA) {
+    printd("ALLOC_MEM_RDMA %lu bytes\n", msg->u.alloc.bytes);
     struct ib_params p;
-    p.addr      = strdup(msg.u.alloc.u.rdma.ib_ip);
-    p.port      = msg.u.alloc.u.rdma.port;
-    p.buf_len   = alloc_param->local_alloc_bytes;
-    p.buf       = malloc(p.buf_len);
-    if (!p.buf)
-      goto out;
+    memset(&p, 0, sizeof(p));
+    p.addr      = strdup(msg->u.alloc.u.rdma.ib_ip);
+    p.port      = msg->u.alloc.u.rdma.port + idx;
+    //The cache and write combining stage their transfers after the app's part
+    p.buf_len   = alloc_param->local_alloc_bytes + alloc_stage(alloc_param);
+    p.buf       = buf_alloc(p.buf_len,
+        topo_pick_node(alloc_param->numa_node));
+    if (!p.buf) {
+      free(p.addr);
+      return -1;
+    }
+    p.poll_mode = ib_poll_mode(alloc_param->poll_mode);
+    p.spin_us   = alloc_param->poll_spin_us;
 
     printd("RDMA: local buf %lu bytes <-->"
         " server %s:%d (rank%d) buf %lu bytes\n",
         p.buf_len, p.addr, p.port,
-        msg.u.alloc.remote_rank, msg.u.alloc.bytes);
+        msg->u.alloc.remote_rank, msg->u.alloc.bytes);
 
     alloc->u.rdma.ib = ib_new(&p);
-    if (!alloc->u.rdma.ib)
-      goto out;
+    if (!alloc->u.rdma.ib) {
+      buf_free(p.buf);
+      free(p.addr);
+      return -1;
+    }
 
     INIT_LIST_HEAD(&alloc->link);
     alloc->kind                 = OCM_REMOTE_RDMA;
-    alloc->u.rdma.remote_rank   = msg.u.alloc.remote_rank;
-    alloc->u.rdma.remote_bytes  = msg.u.alloc.bytes;
-    alloc->u.rdma.local_bytes   = p.buf_len;
+    alloc->u.rdma.remote_rank   = msg->u.alloc.remote_rank;
+    alloc->u.rdma.remote_bytes  = msg->u.alloc.bytes;
+    alloc->u.rdma.local_bytes   = alloc_param->local_alloc_bytes;
     alloc->u.rdma.local_ptr     = p.buf;
-    alloc->rem_alloc_id         = msg.u.alloc.rem_alloc_id;
+    alloc->rem_alloc_id         = msg->u.alloc.rem_alloc_id + idx;
 
-    if (ib_connect(alloc->u.rdma.ib, false))
-      goto out;
+    //The caller releases the IB object from here on
+    if (ib_connect(alloc->u.rdma.ib, false)) {
+      free(p.addr);
+      return -1;
+    }
 
     printd("adding new alloc to list\n");
     lock_allocs();
@@ -291,33 +739,38 @@ ocm_alloc(ocm_alloc_param_t alloc_param)
 #endif 
 
 #ifdef EXTOLL
-  else if (msg.u.alloc.type == ALLOC_MEM_RMA) {
-    printd("ALLOC_MEM_RMA %lu bytes\n", msg.u.alloc.bytes);
+  else if (msg->u.alloc.type == ALLOC_MEM_RMA) {
+    printd("ALLOC_MEM_RMA %lu bytes\n", msg->u.alloc.bytes);
     struct extoll_params p;
-    p.buf_len   = alloc_param->local_alloc_bytes;
-    p.dest_node = msg.u.alloc.u.rma.node_id;
-    p.dest_vpid = msg.u.alloc.u.rma.vpid;
-    p.dest_nla =  msg.u. alloc.u.rma.dest_nla;
+    memset(&p, 0, sizeof(p));
+    //The cache and write combining stage their transfers after the app's part
+    p.buf_len   = alloc_param->local_alloc_bytes + alloc_stage(alloc_param);
+    p.dest_node = msg->u.alloc.u.rma.node_id;
+    p.dest_vpid = msg->u.alloc.u.rma.vpid;
+    p.dest_nla  = msg->u.alloc.u.rma.dest_nla + idx * msg->u.alloc.bytes;
+    p.dest_len  = msg->u.alloc.bytes;
+    p.numa_node = alloc_param->numa_node;
 
     //The client will allocate the buffer p.buf
 
     printd("RDMA: local buf %lu bytes <-->"
         " (remote rank%d) buf %lu bytes\n",
         p.buf_len, 
-        msg.u.alloc.remote_rank, msg.u.alloc.bytes);
+        msg->u.alloc.remote_rank, msg->u.alloc.bytes);
     alloc->u.rma.ex = extoll_new(&p);
     if (!alloc->u.rma.ex)
-      goto out;
+      return -1;
 
     INIT_LIST_HEAD(&alloc->link);
     alloc->kind                 = OCM_REMOTE_RMA;
-    alloc->u.rma.remote_rank   = msg.u.alloc.remote_rank;
-    alloc->u.rma.remote_bytes  = msg.u.alloc.bytes;
-    alloc->u.rma.local_bytes   = p.buf_len;
-    alloc->rem_alloc_id        = msg.u.alloc.rem_alloc_id;
+    alloc->u.rma.remote_rank   = msg->u.alloc.remote_rank;
+    alloc->u.rma.remote_bytes  = msg->u.alloc.bytes;
+    alloc->u.rma.local_bytes   = alloc_param->local_alloc_bytes;
+    alloc->rem_alloc_id        = msg->u.alloc.rem_alloc_id + idx;
 
+    //The caller releases the EXTOLL object from here on
     if (extoll_connect(alloc->u.rma.ex, false))
-      goto out;
+      return -1;
 
     //Once the connection is complete the buffer is allocated
     alloc->u.rma.local_ptr = alloc->u.rma.ex->rma_conn.buf;
@@ -332,93 +785,233 @@ ocm_alloc(ocm_alloc_param_t alloc_param)
     BUG(1);
   }
 
-  ret = 0;
-
-out:
-  if (ret) {
-    if (alloc)
-      free(alloc);
-    alloc = NULL;
-  }
-  return alloc;
+  return 0;
 }
 
+//Allocation function for 'count' equally sized buffers. The whole batch
+//travels as a single request, so rank 0 places it in one decision and the
+//serving node registers all of its buffers in one pass.
   int
-ocm_free(ocm_alloc_t a)
+ocm_alloc_many(ocm_alloc_param_t alloc_param, unsigned int count, ocm_alloc_t out[])
 {
-  //We must transfer essential data (remote_rank, rem_alloc_id)
-  //to the message's 'alloc_ation' struct, alloc from the local
-  //lib_alloc structure
   struct message msg;
+  struct lib_alloc *alloc;
+  unsigned int i = 0, j;
+  int ret = -1;
+  bool placed = false;
+  uint64_t start = lib_stats_now(), bytes = 0, trace = trace_new_id(), rec_id;
 
-  msg.type        = MSG_REQ_FREE;
+  if (!alloc_param || !out || count == 0)
+    return -1;
+
+  memset(&msg, 0, sizeof(msg));
+  msg.type        = MSG_REQ_ALLOC;
   msg.status      = MSG_REQUEST;
   msg.pid         = getpid();
-  msg.u.alloc.rem_alloc_id  = a->rem_alloc_id;
+  msg.trace_id    = trace;
+  msg.u.req.count = count;
+  msg.u.req.numa_node = alloc_param->numa_node;
+  //Specify the allocation size of the remote buffer; in
+  //the local case the local_alloc_bytes field is used since
+  //we will end up making a local allocation
+  msg.u.req.bytes = alloc_param->rem_alloc_bytes;
 
-  if (!a) return -1;
-  if (a->kind == OCM_LOCAL_HOST) {
-    free(a->u.local.ptr);
+  if (alloc_param->kind == OCM_LOCAL_HOST)
+  {
+    msg.u.req.type = ALLOC_MEM_HOST;
+    msg.u.req.bytes = alloc_param->local_alloc_bytes;
   }
-#ifdef CUDA
-  else if (a->kind == OCM_LOCAL_GPU) {
-    cudaFree(a->u.gpu.cuda_ptr);
+  else if(alloc_param->kind == OCM_LOCAL_GPU)
+  {
+    msg.u.req.type = ALLOC_MEM_GPU;
+    msg.u.req.bytes = alloc_param->local_alloc_bytes;
   }
-#endif
-#ifdef INFINIBAND
-  else if (a->kind == OCM_REMOTE_RDMA)
+  else if (alloc_param->kind == OCM_REMOTE_RDMA)
+    msg.u.req.type = ALLOC_MEM_RDMA;
+  else if (alloc_param->kind == OCM_REMOTE_RMA)
+    msg.u.req.type = ALLOC_MEM_RMA;
+  else
   {
+    printf("No allocation type specified\n");
+    goto out;
+  }
 
-    msg.u.alloc.type = ALLOC_MEM_RDMA;
-    msg.u.alloc.remote_rank = a->u.rdma.remote_rank;
-    printd("sending req_free to daemon\n");
-    if (pmsg_send(PMSG_DAEMON_PID, &msg))
-      return -1;
+  bytes = (uint64_t)count * msg.u.req.bytes;
+  if (STATS_TIME(alloc_param->kind, OCM_STAT_ALLOC, OCM_STAT_POST,
+        send_recv_daemon(&msg)))
+    goto out;
+  BUG(msg.type != MSG_RELEASE_APP);
+  BUG(msg.u.alloc.count != count);
+  placed = true;
 
-    printd("waiting for reply from daemon\n");
-    if (pmsg_recv(&msg, true))
-      return -1;
+  for (i = 0; i < count; i++) {
+    alloc = calloc(1, sizeof(*alloc));
+    if (!alloc)
+      goto out;
+    if (STATS_TIME(alloc_param->kind, OCM_STAT_ALLOC, OCM_STAT_WAIT,
+          TRACE_SPAN(trace, "connect",
+            setup_alloc(alloc, &msg, alloc_param, i)))) {
+      //Undo what setup_alloc got done, the way ocm_free does
+      if (alloc->kind && free_local(alloc))
+        printd("could not release buffer %u of the batch\n", i);
+      free(alloc);
+      goto out;
+    }
+    out[i] = alloc;
+    setup_cache(alloc, alloc_param);
+    setup_wc(alloc, alloc_param);
+  }
 
-    BUG(msg.type != MSG_RELEASE_APP);
+  ret = 0;
 
-    //release the local IB connection 
-    if (ib_disconnect(a->u.rdma.ib, false/*is client*/))
-      return -1;
+out:
+  if (ret) {
+    //The serving node still holds the buffers of the batch we never
+    //connected to
+    for (j = i; placed && j < count && (msg.u.alloc.type == ALLOC_MEM_RDMA ||
+          msg.u.alloc.type == ALLOC_MEM_RMA); j++)
+      if (free_remote(alloc_param->kind, msg.u.alloc.remote_rank,
+            msg.u.alloc.rem_alloc_id + j, trace))
+        printd("could not free remote buffer %u of the batch\n", j);
+    while (i-- > 0) {
+      ocm_free(out[i]);
+      out[i] = NULL;
+    }
+  }
+  lib_stats_op(alloc_param->kind, OCM_STAT_ALLOC, start, bytes, ret != 0);
+  trace_span(trace, "ocm_alloc", start);
+  rec_id = lib_record_alloc(alloc_param, count, start, ret != 0);
+  for (i = 0; rec_id && i < count; i++)
+    out[i]->rec_id = rec_id + i;
+  return ret;
+}
 
-    //Free the EXTOLL structure
-    if(ib_free(a->u.rdma.ib))
-      return -1;
+//Allocation function, ocm_alloc
+  ocm_alloc_t
+ocm_alloc(ocm_alloc_param_t alloc_param)
+{
+  ocm_alloc_t alloc = NULL;
+
+  if (ocm_alloc_many(alloc_param, 1, &alloc))
+    return NULL;
+  return alloc;
+}
+
+  ocm_alloc_req_t
+ocm_alloc_async(ocm_alloc_param_t alloc_param, ocm_alloc_cb_t cb, void *cb_arg)
+{
+  struct lib_alloc_req *req;
+  pthread_t tid;
+
+  if (!alloc_param)
+    return NULL;
+
+  req = calloc(1, sizeof(*req));
+  if (!req)
+    return NULL;
+  req->efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (req->efd < 0) {
+    free(req);
+    return NULL;
   }
-#endif
-#ifdef EXTOLL
-  else if (a->kind == OCM_REMOTE_RMA)
-  {
-    msg.u.alloc.type = ALLOC_MEM_RMA;
-    msg.u.alloc.remote_rank = a->u.rma.remote_rank;
-    printd("sending req_free to daemon\n");
-    if (pmsg_send(PMSG_DAEMON_PID, &msg))
-      return -1;
+  req->params = *alloc_param;
+  req->cb     = cb;
+  req->cb_arg = cb_arg;
+  req->refs   = 2; /* app and worker thread */
+  pthread_mutex_init(&req->lock, NULL);
+  pthread_cond_init(&req->cond, NULL);
+
+  if (pthread_create(&tid, NULL, alloc_async_thread, (void*)req)) {
+    req->refs = 1;
+    put_alloc_req(req);
+    return NULL;
+  }
+  pthread_detach(tid);
+  return req;
+}
 
-    printd("waiting for reply from daemon\n");
-    if (pmsg_recv(&msg, true))
-      return -1;
-    BUG(msg.type != MSG_RELEASE_APP);
+  int
+ocm_alloc_req_fd(ocm_alloc_req_t req)
+{
+  if (!req)
+    return -1;
+  return req->efd;
+}
 
-    //release the local EXTOLL connection 
-    if (extoll_disconnect(a->u.rma.ex, false/*is client*/))
-      return -1;
+  bool
+ocm_alloc_test(ocm_alloc_req_t req)
+{
+  bool done;
+
+  if (!req)
+    return false;
+  pthread_mutex_lock(&req->lock);
+  done = req->done;
+  pthread_mutex_unlock(&req->lock);
+  return done;
+}
 
-    //Free the EXTOLL structure
-    if(extoll_free(a->u.rma.ex))
-      return -1;
+  ocm_alloc_t
+ocm_alloc_wait(ocm_alloc_req_t req)
+{
+  ocm_alloc_t alloc;
 
-  }
+  if (!req)
+    return NULL;
+  pthread_mutex_lock(&req->lock);
+  while (!req->done)
+    pthread_cond_wait(&req->cond, &req->lock);
+  alloc = req->alloc;
+  pthread_mutex_unlock(&req->lock);
+
+  put_alloc_req(req);
+  return alloc;
+}
+
+  static int
+free_alloc(ocm_alloc_t a, uint64_t trace)
+{
+  if (!a) return -1;
+#ifdef INFINIBAND
+  if (a->kind == OCM_REMOTE_RDMA &&
+      free_remote(a->kind, a->u.rdma.remote_rank, a->rem_alloc_id, trace))
+    return -1;
 #endif
-  else
-  {
-    BUG(1);
-  }
-  return 0;
+#ifdef EXTOLL
+  if (a->kind == OCM_REMOTE_RMA &&
+      free_remote(a->kind, a->u.rma.remote_rank, a->rem_alloc_id, trace))
+    return -1;
+#endif
+  if (a->kind != OCM_REMOTE_RDMA && a->kind != OCM_REMOTE_RMA)
+    return free_local(a);
+  return STATS_TIME(a->kind, OCM_STAT_FREE, OCM_STAT_WAIT,
+      TRACE_SPAN(trace, "disconnect", free_local(a)));
+}
+
+  int
+ocm_free(ocm_alloc_t a)
+{
+  uint64_t start = lib_stats_now(), trace = trace_new_id(), rec_id;
+  enum ocm_kind kind;
+  int ret;
+
+  if (!a) return -1;
+  kind = a->kind;
+  rec_id = a->rec_id;
+  lib_mmap_release(a);
+  //Combined writes were issued by the app, unlike what a write-back cache
+  //holds, so they still go out
+  if (ocm_flush(a))
+    printd("lost combined writes of %p\n", (void*)a);
+  lib_wc_free(a->wc);
+  a->wc = NULL;
+  lib_cache_free(a->cache);
+  a->cache = NULL;
+  ret = free_alloc(a, trace);
+  lib_stats_op(kind, OCM_STAT_FREE, start, 0, ret != 0);
+  trace_span(trace, "ocm_free", start);
+  lib_record_free(rec_id, start, ret != 0);
+  return ret;
 }
 
   int
@@ -498,9 +1091,22 @@ int ocm_copy_in(ocm_alloc_t dest, void *src)
   return -1;
 }
 
-  int
-ocm_copy(ocm_alloc_t dest, ocm_alloc_t src, ocm_param_t cp_param)
+//The kind a copy is accounted under: the remote side if there is one,
+//else whichever side is not plain host memory
+  static enum ocm_kind
+copy_kind(ocm_alloc_t dest, ocm_alloc_t src)
+{
+  if (dest->kind == OCM_REMOTE_RDMA || dest->kind == OCM_REMOTE_RMA)
+    return dest->kind;
+  if (src->kind == OCM_REMOTE_RDMA || src->kind == OCM_REMOTE_RMA)
+    return src->kind;
+  return (dest->kind != OCM_LOCAL_HOST ? dest->kind : src->kind);
+}
+
+  static int
+do_copy(ocm_alloc_t dest, ocm_alloc_t src, ocm_param_t cp_param)
 {
+  enum ocm_kind k = copy_kind(dest, src);
 
   printd("Number of bytes in ocm_copy is %lu \n", cp_param->bytes);
 
@@ -511,24 +1117,24 @@ ocm_copy(ocm_alloc_t dest, ocm_alloc_t src, ocm_param_t cp_param)
   if (!cp_param->op_flag)
   {
     cp_param->op_flag = 1;
-    return ocm_copy(src, dest, cp_param);
+    return do_copy(src, dest, cp_param);
   }
 
   //Local host to other OCM allocation
   if (src->kind == OCM_LOCAL_HOST)
   {
-    //Do a standard memcpy to a local host
+    //Host to host needs no staging; large copies go through the copy engine
     if(dest->kind == OCM_LOCAL_HOST)
     {
-      memcpy(dest->u.local.ptr+cp_param->dest_offset, src->u.local.ptr+cp_param->src_offset, cp_param->bytes);
+      lib_copy(dest->u.local.ptr+cp_param->dest_offset, src->u.local.ptr+cp_param->src_offset, cp_param->bytes);
     }
 #ifdef INFINIBAND
     else if(dest->kind == OCM_REMOTE_RDMA)
     {
       //Do a memcpy to the local buffer and then write to the remote
       //IB buffer
-      memcpy(dest->u.rdma.local_ptr+cp_param->dest_offset, src->u.local.ptr+cp_param->src_offset, cp_param->bytes);
-      if(ib_write(dest->u.rdma.ib, cp_param->src_offset_2, cp_param->dest_offset_2, cp_param->bytes)||ib_poll(dest->u.rdma.ib))
+      STATS_TIME(k, OCM_STAT_COPY, OCM_STAT_STAGE, lib_copy(dest->u.rdma.local_ptr+cp_param->dest_offset, src->u.local.ptr+cp_param->src_offset, cp_param->bytes));
+      if(remote_xfer(dest, k, OCM_STAT_COPY, true, cp_param->src_offset_2, cp_param->dest_offset_2, cp_param->bytes))
         return -1;
     }
 #endif
@@ -537,9 +1143,9 @@ ocm_copy(ocm_alloc_t dest, ocm_alloc_t src, ocm_param_t cp_param)
     {
       //Do a memcpy to the local buffer and then write to the remote
       //EXTOLL buffer
-      memcpy(dest->u.rma.local_ptr+cp_param->dest_offset, src->u.local.ptr+cp_param->src_offset, cp_param->bytes);
+      STATS_TIME(k, OCM_STAT_COPY, OCM_STAT_STAGE, lib_copy(dest->u.rma.local_ptr+cp_param->dest_offset, src->u.local.ptr+cp_param->src_offset, cp_param->bytes));
 
-      if(extoll_write(dest->u.rma.ex, cp_param->src_offset_2, cp_param->dest_offset_2, cp_param->bytes))
+      if(remote_xfer(dest, k, OCM_STAT_COPY, true, cp_param->src_offset_2, cp_param->dest_offset_2, cp_param->bytes))
       {
         printf("extoll_write failed in ocm_copy\n");
         return -1;
@@ -569,18 +1175,18 @@ ocm_copy(ocm_alloc_t dest, ocm_alloc_t src, ocm_param_t cp_param)
     if(dest->kind == OCM_LOCAL_HOST)
     {
       //Remember to call both ib_read and ib_poll in order to correctly measure the time taken for the transfer
-      if(ib_read(src->u.rdma.ib, cp_param->src_offset, cp_param->dest_offset, cp_param->bytes)||ib_poll(src->u.rdma.ib))
+      if(remote_xfer(src, k, OCM_STAT_COPY, false, cp_param->src_offset, cp_param->dest_offset, cp_param->bytes))
         return -1;
-      memcpy(dest->u.local.ptr+cp_param->dest_offset,src->u.rdma.local_ptr+cp_param->src_offset, cp_param->bytes);
+      STATS_TIME(k, OCM_STAT_COPY, OCM_STAT_STAGE, lib_copy(dest->u.local.ptr+cp_param->dest_offset,src->u.rdma.local_ptr+cp_param->src_offset, cp_param->bytes));
 
     }
 #ifdef CUDA
     else if(dest->kind == OCM_LOCAL_GPU)
     {
-      if(ib_read(src->u.rdma.ib, cp_param->src_offset, cp_param->dest_offset, cp_param->bytes)||ib_poll(src->u.rdma.ib))
+      if(remote_xfer(src, k, OCM_STAT_COPY, false, cp_param->src_offset, cp_param->dest_offset, cp_param->bytes))
         return -1;
 
-      cudaErr = cudaMemcpy(dest->u.gpu.cuda_ptr+cp_param->dest_offset_2,src->u.rdma.local_ptr+cp_param->src_offset_2, cp_param->bytes, cudaMemcpyHostToDevice);
+      cudaErr = STATS_TIME(k, OCM_STAT_COPY, OCM_STAT_STAGE, cudaMemcpy(dest->u.gpu.cuda_ptr+cp_param->dest_offset_2,src->u.rdma.local_ptr+cp_param->src_offset_2, cp_param->bytes, cudaMemcpyHostToDevice));
       if(cudaErr)
       {
         printf("cudaMemcpy failed with error %d \n", cudaErr);
@@ -600,24 +1206,24 @@ ocm_copy(ocm_alloc_t dest, ocm_alloc_t src, ocm_param_t cp_param)
     //Do a read from the remote IB buffer and then memcpy to the local buffer
     if(dest->kind == OCM_LOCAL_HOST)
     {
-      if(extoll_read(src->u.rma.ex, cp_param->src_offset, cp_param->dest_offset, cp_param->bytes))
+      if(remote_xfer(src, k, OCM_STAT_COPY, false, cp_param->src_offset, cp_param->dest_offset, cp_param->bytes))
       {
         printf("extoll_read failed in ocm_copy\n");
         return -1;
       }
 
-      memcpy(dest->u.local.ptr+cp_param->dest_offset,src->u.rma.local_ptr+cp_param->src_offset, cp_param->bytes);
+      STATS_TIME(k, OCM_STAT_COPY, OCM_STAT_STAGE, lib_copy(dest->u.local.ptr+cp_param->dest_offset,src->u.rma.local_ptr+cp_param->src_offset, cp_param->bytes));
 
     }
 #ifdef CUDA
     else if(dest->kind == OCM_LOCAL_GPU)
     {
-      if(extoll_read(src->u.rma.ex, cp_param->src_offset, cp_param->dest_offset, cp_param->bytes))
+      if(remote_xfer(src, k, OCM_STAT_COPY, false, cp_param->src_offset, cp_param->dest_offset, cp_param->bytes))
       {
         printf("extoll_read failed in ocm_copy\n");
         return -1;
       }
-      cudaErr = cudaMemcpy(dest->u.gpu.cuda_ptr+cp_param->dest_offset_2,src->u.rma.local_ptr+cp_param->src_offset_2, cp_param->bytes, cudaMemcpyHostToDevice);
+      cudaErr = STATS_TIME(k, OCM_STAT_COPY, OCM_STAT_STAGE, cudaMemcpy(dest->u.gpu.cuda_ptr+cp_param->dest_offset_2,src->u.rma.local_ptr+cp_param->src_offset_2, cp_param->bytes, cudaMemcpyHostToDevice));
       if(cudaErr)
       {
         printf("cudaMemcpy failed with error %d \n", cudaErr);
@@ -642,8 +1248,8 @@ ocm_copy(ocm_alloc_t dest, ocm_alloc_t src, ocm_param_t cp_param)
 #ifdef INFINIBAND
     else if(dest->kind == OCM_REMOTE_RDMA)
     {
-      cudaMemcpy(dest->u.rdma.local_ptr+cp_param->dest_offset, src->u.gpu.cuda_ptr+cp_param->src_offset, cp_param->bytes, cudaMemcpyDeviceToHost);
-      if(ib_write(dest->u.rdma.ib, cp_param->src_offset_2, cp_param->dest_offset_2, cp_param->bytes)||ib_poll(dest->u.rdma.ib))
+      STATS_TIME(k, OCM_STAT_COPY, OCM_STAT_STAGE, cudaMemcpy(dest->u.rdma.local_ptr+cp_param->dest_offset, src->u.gpu.cuda_ptr+cp_param->src_offset, cp_param->bytes, cudaMemcpyDeviceToHost));
+      if(remote_xfer(dest, k, OCM_STAT_COPY, true, cp_param->src_offset_2, cp_param->dest_offset_2, cp_param->bytes))
         return -1;
 
     }
@@ -651,8 +1257,8 @@ ocm_copy(ocm_alloc_t dest, ocm_alloc_t src, ocm_param_t cp_param)
 #ifdef EXTOLL
     else if(dest->kind == OCM_REMOTE_RMA)
     {
-      cudaMemcpy(dest->u.rma.local_ptr+cp_param->src_offset_2, src->u.gpu.cuda_ptr+cp_param->dest_offset_2, cp_param->bytes, cudaMemcpyDeviceToHost);
-      extoll_write(dest->u.rma.ex, cp_param->src_offset_2, cp_param->dest_offset_2, cp_param->bytes);
+      STATS_TIME(k, OCM_STAT_COPY, OCM_STAT_STAGE, cudaMemcpy(dest->u.rma.local_ptr+cp_param->src_offset_2, src->u.gpu.cuda_ptr+cp_param->dest_offset_2, cp_param->bytes, cudaMemcpyDeviceToHost));
+      remote_xfer(dest, k, OCM_STAT_COPY, true, cp_param->src_offset_2, cp_param->dest_offset_2, cp_param->bytes);
     }
 #endif
   }
@@ -664,11 +1270,27 @@ ocm_copy(ocm_alloc_t dest, ocm_alloc_t src, ocm_param_t cp_param)
   return 0;
 }
 
-
-
   int
-ocm_copy_onesided(ocm_alloc_t src, ocm_param_t cp_param)
+ocm_copy(ocm_alloc_t dest, ocm_alloc_t src, ocm_param_t cp_param)
+{
+  uint64_t start = lib_stats_now();
+  //do_copy turns reads into writes the other way round
+  bool write = cp_param->op_flag;
+  int ret;
+
+  ret = do_copy(dest, src, cp_param);
+  lib_stats_op(copy_kind(dest, src), OCM_STAT_COPY, start,
+      cp_param->bytes, ret != 0);
+  lib_record_copy(dest->rec_id, src->rec_id, cp_param, write, start,
+      ret != 0);
+  return ret;
+}
+
+  static int
+do_copy_onesided(ocm_alloc_t src, ocm_param_t cp_param)
 {
+  enum ocm_kind k = src->kind;
+
   if((src->kind == OCM_LOCAL_HOST) || (src->kind == OCM_LOCAL_GPU))
   {
     printf("Error - one-sided copy needs a paired connection, such as IB or EXTOLL\n");
@@ -682,7 +1304,7 @@ ocm_copy_onesided(ocm_alloc_t src, ocm_param_t cp_param)
   if (cp_param->op_flag)
   {
 
-    if(ib_write(src->u.rdma.ib, cp_param->src_offset, cp_param->dest_offset, cp_param->bytes)||ib_poll(src->u.rdma.ib)) 
+    if(remote_xfer(src, k, OCM_STAT_ONESIDED, true, cp_param->src_offset, cp_param->dest_offset, cp_param->bytes)) 
     {
       printf("write failed\n");
       return -1;
@@ -690,7 +1312,7 @@ ocm_copy_onesided(ocm_alloc_t src, ocm_param_t cp_param)
   }
   else
   {
-    if(ib_read(src->u.rdma.ib, cp_param->src_offset, cp_param->dest_offset, cp_param->bytes)||ib_poll(src->u.rdma.ib)) 
+    if(remote_xfer(src, k, OCM_STAT_ONESIDED, false, cp_param->src_offset, cp_param->dest_offset, cp_param->bytes)) 
     {
       printf("read failed\n");
       return -1;
@@ -704,7 +1326,7 @@ ocm_copy_onesided(ocm_alloc_t src, ocm_param_t cp_param)
   if (cp_param->op_flag)
   {
 
-    if(extoll_write(src->u.rma.ex, cp_param->src_offset, cp_param->dest_offset, cp_param->bytes))
+    if(remote_xfer(src, k, OCM_STAT_ONESIDED, true, cp_param->src_offset, cp_param->dest_offset, cp_param->bytes))
     {
       printf("write failed\n");
       return -1;
@@ -712,7 +1334,7 @@ ocm_copy_onesided(ocm_alloc_t src, ocm_param_t cp_param)
   }
   else
   {
-    if(extoll_read(src->u.rma.ex, cp_param->src_offset, cp_param->dest_offset, cp_param->bytes))
+    if(remote_xfer(src, k, OCM_STAT_ONESIDED, false, cp_param->src_offset, cp_param->dest_offset, cp_param->bytes))
     {
       printf("read failed\n");
       return -1;
@@ -722,3 +1344,113 @@ ocm_copy_onesided(ocm_alloc_t src, ocm_param_t cp_param)
   return 0;
 }
 
+  int
+ocm_flush(ocm_alloc_t a)
+{
+  struct xfer_ctx x;
+
+  if (!a) return -1;
+  if (!a->wc) return 0;
+  x.a = a;
+  x.kind = a->kind;
+  x.op = OCM_STAT_FLUSH;
+  return lib_wc_flush(a->wc, &x);
+}
+
+  int
+ocm_cache_flush(ocm_alloc_t a)
+{
+  struct xfer_ctx x;
+
+  if (ocm_flush(a)) return -1;
+  if (!a->cache) return 0;
+  x.a = a;
+  x.kind = a->kind;
+  x.op = OCM_STAT_ONESIDED;
+  return lib_cache_flush(a->cache, &x);
+}
+
+  int
+ocm_prefetch(ocm_alloc_t a, size_t offset, size_t len)
+{
+  if (!a) return -1;
+  //Local allocations are where the data already is
+  if (a->kind == OCM_LOCAL_HOST || a->kind == OCM_LOCAL_GPU) return 0;
+  if (!a->cache) return -1;
+  return lib_cache_prefetch(a->cache, offset, len);
+}
+
+  int
+ocm_cache_stats(ocm_alloc_t a, struct ocm_cache_stats *stats)
+{
+  if (!a || !a->cache || !stats) return -1;
+  lib_cache_stats(a->cache, stats);
+  return 0;
+}
+
+  int
+ocm_copy_onesided(ocm_alloc_t src, ocm_param_t cp_param)
+{
+  uint64_t start = lib_stats_now();
+  int ret;
+
+  ret = do_copy_onesided(src, cp_param);
+  lib_stats_op(src->kind, OCM_STAT_ONESIDED, start, cp_param->bytes, ret != 0);
+  lib_record_onesided(src->rec_id, cp_param, start, ret != 0);
+  return ret;
+}
+
+/* Queue every op on the send queue and wait once, so n small transfers cost
+ * a few doorbells and completions instead of n of each */
+#ifdef INFINIBAND
+  static int
+rdma_onesided_many(ocm_alloc_t a, struct ocm_params ops[], unsigned int n)
+{
+  ib_t ib = a->u.rdma.ib;
+  unsigned int i;
+
+  for (i = 0; i < n; i++) {
+    if (ops[i].src_offset + ops[i].bytes > a->u.rdma.local_bytes) {
+      printd("op %u is past the local buffer\n", i);
+      return -1;
+    }
+    if (STATS_TIME(a->kind, OCM_STAT_ONESIDED, OCM_STAT_POST,
+          (ops[i].op_flag ? ib_write : ib_read)(ib, ops[i].src_offset,
+            ops[i].dest_offset, ops[i].bytes)))
+      break;
+  }
+  //Wait for what was queued even after a failure
+  if (STATS_TIME(a->kind, OCM_STAT_ONESIDED, OCM_STAT_WAIT, ib_poll(ib)) ||
+      i < n)
+    return -1;
+  return 0;
+}
+#endif
+
+  int
+ocm_copy_onesided_many(ocm_alloc_t src, struct ocm_params ops[], unsigned int n)
+{
+  unsigned int i;
+  int ret = 0;
+
+  if (!src || (n && !ops)) return -1;
+
+#ifdef INFINIBAND
+  //The cache and the write-combining buffer see each transfer on its own
+  if (src->kind == OCM_REMOTE_RDMA && !src->cache && !src->wc) {
+    uint64_t start = lib_stats_now();
+    size_t bytes = 0;
+
+    ret = rdma_onesided_many(src, ops, n);
+    for (i = 0; i < n; i++) {
+      bytes += ops[i].bytes;
+      lib_record_onesided(src->rec_id, &ops[i], start, ret != 0);
+    }
+    lib_stats_op(src->kind, OCM_STAT_ONESIDED, start, bytes, ret != 0);
+    return ret;
+  }
+#endif
+  for (i = 0; i < n && !ret; i++)
+    ret = ocm_copy_onesided(src, &ops[i]);
+  return ret;
+}
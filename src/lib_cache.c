@@ -0,0 +1,542 @@
+/**
+ * file: lib_cache.c
+ * desc: client-side block cache of remote buffers, see lib_cache.h
+ */
+
+/* System includes */
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Other project includes */
+
+/* Project includes */
+#include <debug.h>
+#include <lib_cache.h>
+#include <util/misc.h>
+
+/* Internal definitions */
+
+#define DEFAULT_BLOCK   (64UL << 10)
+#define MIN_BLOCK       (4UL << 10)
+#define NONE            (-1)
+#define RA_QUEUE        32  /* pending readahead ranges */
+#define RA_CACHE        4   /* cache for readahead alone, in windows */
+
+struct range
+{
+    size_t off, len;
+};
+
+struct entry
+{
+    uint64_t blk; /* block number in the remote buffer */
+    int next; /* hash chain */
+    bool valid, dirty, ref;
+    bool ahead; /* read ahead and not used yet */
+    char *data;
+};
+
+struct lib_cache
+{
+    size_t block, remote_len, local_len, stage_len;
+    char *local; /* the staging area follows local_len bytes of it */
+    bool write_back;
+    cache_xfer_t xfer;
+
+    struct entry *entries;
+    int nentries, used, hand;
+    int *buckets; /* heads of hash chains */
+    unsigned int nbuckets; /* power of two */
+    char *pool; /* entry data */
+
+    /* readahead */
+    size_t readahead; /* bytes to keep ahead of a stream, 0 for none */
+    void *ra_arg;
+    size_t last_off, last_len, stride; /* previous read, its distance */
+    size_t ra_next; /* where the queued part of the stream ends */
+    bool ra_seq; /* ra_next is in bytes, not accesses */
+    struct range queue[RA_QUEUE];
+    unsigned int qhead, qtail;
+    pthread_cond_t ra_cond;
+    pthread_t ra_tid;
+    bool ra_running, ra_stop;
+
+    pthread_mutex_t lock;
+    struct ocm_cache_stats stats;
+};
+
+/* Private functions */
+
+static size_t
+block_size(void)
+{
+    const char *env = getenv("OCM_CACHE_BLOCK");
+
+    return (env ? parse_size(env) : DEFAULT_BLOCK);
+}
+
+static unsigned int
+hash(struct lib_cache *c, uint64_t blk)
+{
+    return (blk * 0x9e3779b97f4a7c15UL >> 32) & (c->nbuckets - 1);
+}
+
+/* bytes of block blk backed by the remote buffer */
+static size_t
+blk_len(struct lib_cache *c, uint64_t blk)
+{
+    size_t off = blk * c->block;
+    return (off + c->block > c->remote_len ? c->remote_len - off : c->block);
+}
+
+static struct entry *
+lookup(struct lib_cache *c, uint64_t blk)
+{
+    int i;
+
+    for (i = c->buckets[hash(c, blk)]; i != NONE; i = c->entries[i].next)
+        if (c->entries[i].blk == blk)
+            return &c->entries[i];
+    return NULL;
+}
+
+static void
+unhash(struct lib_cache *c, struct entry *e)
+{
+    int *p = &c->buckets[hash(c, e->blk)], i = e - c->entries;
+
+    while (*p != i)
+        p = &c->entries[*p].next;
+    *p = e->next;
+    e->valid = false;
+}
+
+/* through the staging area */
+static int
+write_entry(struct lib_cache *c, struct entry *e, void *arg)
+{
+    size_t len = blk_len(c, e->blk);
+
+    memcpy(c->local + c->local_len, e->data, len);
+    if (c->xfer(arg, true, c->local_len, e->blk * c->block, len))
+        return -1;
+    e->dirty = false;
+    c->stats.writebacks++;
+    return 0;
+}
+
+/* a free entry, evicting one if need be; for readahead (clean) only one
+ * that needs no write-back */
+static struct entry *
+get_entry(struct lib_cache *c, bool clean, void *arg)
+{
+    struct entry *e;
+    int n;
+
+    if (c->used < c->nentries)
+        return &c->entries[c->used++];
+    /* two sweeps clear every reference bit */
+    for (n = 0; n < 2 * c->nentries; n++) {
+        e = &c->entries[c->hand];
+        c->hand = (c->hand + 1) % c->nentries;
+        if (!e->valid)
+            return e;
+        if (e->ref) {
+            e->ref = false;
+            continue;
+        }
+        if (e->dirty) {
+            if (clean)
+                continue;
+            if (write_entry(c, e, arg))
+                return NULL;
+        }
+        unhash(c, e);
+        c->stats.evictions++;
+        return e;
+    }
+    return NULL;
+}
+
+/* cache block blk with the contents at src */
+static int
+insert(struct lib_cache *c, uint64_t blk, const char *src, bool dirty,
+        bool ahead, void *arg)
+{
+    struct entry *e;
+    unsigned int h = hash(c, blk);
+
+    if (!(e = get_entry(c, ahead, arg)))
+        return -1;
+    memcpy(e->data, src, blk_len(c, blk));
+    e->blk = blk;
+    e->valid = true;
+    e->dirty = dirty;
+    e->ahead = ahead;
+    e->ref = false; /* a second touch earns it a second chance */
+    e->next = c->buckets[h];
+    c->buckets[h] = e - c->entries;
+    return 0;
+}
+
+/* read remote [lo, hi), none of it cached, and keep its whole blocks */
+static int
+fill(struct lib_cache *c, size_t loff, size_t roff, size_t lo, size_t hi,
+        void *arg)
+{
+    uint64_t blk;
+    size_t start;
+
+    if (c->xfer(arg, false, loff + (lo - roff), lo, hi - lo))
+        return -1;
+    for (blk = lo / c->block; blk * c->block < hi; blk++) {
+        start = blk * c->block;
+        if (start >= lo && start + blk_len(c, blk) <= hi &&
+                insert(c, blk, c->local + loff + (start - roff), false, false,
+                    arg))
+            return -1;
+    }
+    return 0;
+}
+
+static void
+enqueue(struct lib_cache *c, size_t off, size_t len)
+{
+    if (off >= c->remote_len || !len)
+        return;
+    if (len > c->remote_len - off)
+        len = c->remote_len - off;
+    /* the oldest hints are the likeliest to be served already */
+    if (c->qtail - c->qhead == RA_QUEUE)
+        c->qhead++;
+    c->queue[c->qtail++ % RA_QUEUE] = (struct range){ off, len };
+    pthread_cond_signal(&c->ra_cond);
+}
+
+/* note a read of [roff, roff + len) and, when it continues a sequential or
+ * strided stream that is less than half a window ahead of the readahead,
+ * queue the next window */
+static void
+detect(struct lib_cache *c, size_t roff, size_t len)
+{
+    size_t stride = roff - c->last_off, cost, n, next, end;
+    bool seq, strided;
+
+    seq = (c->last_len && roff == c->last_off + c->last_len);
+    strided = (roff > c->last_off && stride == c->stride);
+    c->stride = (roff > c->last_off ? stride : 0);
+    c->last_off = roff;
+    c->last_len = len;
+    if (!c->readahead || !(seq || strided) || seq != c->ra_seq)
+        c->ra_next = 0;
+    c->ra_seq = seq;
+    if (!c->readahead || !(seq || strided))
+        return;
+
+    if (seq) {
+        if (c->ra_next < roff + len)
+            c->ra_next = roff + len;
+        if (2 * (c->ra_next - roff - len) > c->readahead)
+            return;
+        end = roff + len + c->readahead;
+        enqueue(c, c->ra_next, end - c->ra_next);
+        c->ra_next = end;
+        return;
+    }
+
+    /* each access costs at least a block */
+    cost = (len + c->block - 1) / c->block * c->block;
+    n = c->readahead / cost;
+    if (n > RA_QUEUE / 2)
+        n = RA_QUEUE / 2;
+    if (!n)
+        n = 1;
+    if (c->ra_next < roff + stride)
+        c->ra_next = roff + stride;
+    if (2 * ((c->ra_next - roff) / stride - 1) > n)
+        return;
+    end = roff + (n + 1) * stride;
+    for (next = c->ra_next; next < end; next += stride)
+        enqueue(c, next, len);
+    c->ra_next = end;
+}
+
+/* read the missing blocks of remote [off, off + len) into the cache, a
+ * staging area at a time, letting go of the lock in between */
+static void
+read_ahead(struct lib_cache *c, size_t off, size_t len)
+{
+    uint64_t blk = off / c->block, last = (off + len - 1) / c->block, first;
+    uint64_t max = c->stage_len / c->block, b;
+    char *stage = c->local + c->local_len;
+    size_t bytes;
+
+    while (blk <= last && !c->ra_stop) {
+        while (blk <= last && lookup(c, blk))
+            blk++;
+        for (first = blk; blk <= last && blk - first < max &&
+                !lookup(c, blk); blk++)
+            ;
+        if (first == blk)
+            return;
+        bytes = (blk - 1 - first) * c->block + blk_len(c, blk - 1);
+        if (c->xfer(c->ra_arg, false, c->local_len, first * c->block,
+                    bytes)) {
+            printd("readahead of %lu bytes at %lu failed\n",
+                    bytes, first * c->block);
+            return;
+        }
+        for (b = first; b < blk; b++) {
+            /* all the rest is dirty or in use */
+            if (insert(c, b, stage + (b - first) * c->block, false, true,
+                        NULL))
+                return;
+            c->stats.prefetched++;
+        }
+        pthread_mutex_unlock(&c->lock);
+        pthread_mutex_lock(&c->lock);
+    }
+}
+
+static void *
+ra_thread(void *arg)
+{
+    struct lib_cache *c = (struct lib_cache *)arg;
+    struct range r;
+
+    pthread_mutex_lock(&c->lock);
+    while (true) {
+        while (!c->ra_stop && c->qhead == c->qtail)
+            pthread_cond_wait(&c->ra_cond, &c->lock);
+        if (c->ra_stop)
+            break;
+        r = c->queue[c->qhead++ % RA_QUEUE];
+        read_ahead(c, r.off, r.len);
+    }
+    pthread_mutex_unlock(&c->lock);
+    return NULL;
+}
+
+/* Public functions */
+
+size_t
+lib_cache_config(size_t *cache_bytes, bool *write_back, size_t *readahead)
+{
+    const char *env;
+    size_t block = block_size(), stage;
+
+    if (!*cache_bytes) {
+        if ((env = getenv("OCM_CACHE_BYTES")))
+            *cache_bytes = parse_size(env);
+        if ((env = getenv("OCM_CACHE_POLICY")))
+            *write_back = !strcmp(env, "wb");
+    }
+    if (!*readahead && (env = getenv("OCM_READAHEAD")))
+        *readahead = parse_size(env);
+    if (*readahead && !*cache_bytes)
+        *cache_bytes = RA_CACHE * *readahead;
+    if (!*cache_bytes || block < MIN_BLOCK)
+        return 0;
+    stage = (*readahead > block ? *readahead : block);
+    return (stage + block - 1) / block * block;
+}
+
+struct lib_cache *
+lib_cache_new(size_t capacity, bool write_back, size_t readahead,
+        char *local, size_t local_len, size_t stage_len, size_t remote_len,
+        cache_xfer_t xfer, void *ra_arg)
+{
+    struct lib_cache *c;
+    size_t block = block_size();
+    sigset_t all, old;
+    int i;
+
+    /* blocks are written back and read ahead through the staging area */
+    if (block > stage_len)
+        block = stage_len;
+    if (block < MIN_BLOCK || capacity < block || !remote_len) {
+        printd("no cache: %lu byte blocks, %lu bytes capacity\n",
+                block, capacity);
+        return NULL;
+    }
+
+    if (!(c = calloc(1, sizeof(*c))))
+        return NULL;
+    c->block = block;
+    c->local = local;
+    c->local_len = local_len;
+    c->stage_len = stage_len;
+    c->remote_len = remote_len;
+    c->write_back = write_back;
+    c->xfer = xfer;
+    c->ra_arg = ra_arg;
+    c->nentries = capacity / block;
+    for (c->nbuckets = 1; c->nbuckets < (unsigned int)c->nentries; )
+        c->nbuckets <<= 1;
+    c->entries = calloc(c->nentries, sizeof(*c->entries));
+    c->buckets = malloc(c->nbuckets * sizeof(*c->buckets));
+    c->pool = malloc(c->nentries * block);
+    if (!c->entries || !c->buckets || !c->pool) {
+        lib_cache_free(c);
+        return NULL;
+    }
+    for (i = 0; i < c->nentries; i++)
+        c->entries[i].data = c->pool + i * block;
+    for (i = 0; i < (int)c->nbuckets; i++)
+        c->buckets[i] = NONE;
+    /* a window larger than half the cache would evict itself */
+    c->readahead = (readahead < capacity / 2 ? readahead : capacity / 2);
+    pthread_mutex_init(&c->lock, NULL);
+    pthread_cond_init(&c->ra_cond, NULL);
+
+    /* signals are for the app's threads, not ours */
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    c->ra_running = !pthread_create(&c->ra_tid, NULL, ra_thread, c);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (!c->ra_running) {
+        lib_cache_free(c);
+        return NULL;
+    }
+    printd("cache: %d blocks of %lu bytes, write-%s, %lu bytes readahead\n",
+            c->nentries, block, (write_back ? "back" : "through"),
+            c->readahead);
+    return c;
+}
+
+void
+lib_cache_free(struct lib_cache *c)
+{
+    if (!c)
+        return;
+    if (c->ra_running) {
+        pthread_mutex_lock(&c->lock);
+        c->ra_stop = true;
+        pthread_cond_signal(&c->ra_cond);
+        pthread_mutex_unlock(&c->lock);
+        pthread_join(c->ra_tid, NULL);
+    }
+    free(c->entries);
+    free(c->buckets);
+    free(c->pool);
+    free(c);
+}
+
+int
+lib_cache_read(struct lib_cache *c, size_t loff, size_t roff, size_t len,
+        void *arg)
+{
+    struct entry *e;
+    uint64_t blk;
+    size_t lo, hi, miss = SIZE_MAX;
+    int ret = 0;
+
+    pthread_mutex_lock(&c->lock);
+    for (blk = roff / c->block; !ret && blk * c->block < roff + len; blk++) {
+        /* the part of the block the read covers */
+        lo = (blk * c->block > roff ? blk * c->block : roff);
+        hi = (blk + 1) * c->block;
+        if (hi > roff + len)
+            hi = roff + len;
+        /* misses before this block go out as one read; that may evict it */
+        if (miss != SIZE_MAX && lookup(c, blk)) {
+            if ((ret = fill(c, loff, roff, miss, lo, arg)))
+                break;
+            miss = SIZE_MAX;
+        }
+        if (!(e = lookup(c, blk))) {
+            c->stats.misses++;
+            c->stats.miss_bytes += hi - lo;
+            if (miss == SIZE_MAX)
+                miss = lo;
+            continue;
+        }
+        memcpy(c->local + loff + (lo - roff), e->data + (lo - blk * c->block),
+                hi - lo);
+        e->ref = true;
+        if (e->ahead) {
+            e->ahead = false;
+            c->stats.prefetch_hits++;
+        }
+        c->stats.hits++;
+        c->stats.hit_bytes += hi - lo;
+    }
+    if (!ret && miss != SIZE_MAX)
+        ret = fill(c, loff, roff, miss, roff + len, arg);
+    if (!ret && len)
+        detect(c, roff, len);
+    pthread_mutex_unlock(&c->lock);
+    return ret;
+}
+
+int
+lib_cache_write(struct lib_cache *c, size_t loff, size_t roff, size_t len,
+        void *arg)
+{
+    struct entry *e;
+    uint64_t blk;
+    size_t lo, hi;
+    int ret = 0;
+
+    pthread_mutex_lock(&c->lock);
+    if (!c->write_back)
+        ret = c->xfer(arg, true, loff, roff, len);
+    for (blk = roff / c->block; !ret && blk * c->block < roff + len; blk++) {
+        lo = (blk * c->block > roff ? blk * c->block : roff);
+        hi = (blk + 1) * c->block;
+        if (hi > roff + len)
+            hi = roff + len;
+        if ((e = lookup(c, blk))) {
+            memcpy(e->data + (lo - blk * c->block),
+                    c->local + loff + (lo - roff), hi - lo);
+            e->dirty |= c->write_back;
+            e->ref = true;
+        } else if (lo == blk * c->block && hi - lo == blk_len(c, blk)) {
+            ret = insert(c, blk, c->local + loff + (lo - roff),
+                    c->write_back, false, arg);
+        } else if (c->write_back) {
+            /* part of a block we do not have: nothing to merge it into */
+            ret = c->xfer(arg, true, loff + (lo - roff), lo, hi - lo);
+        }
+    }
+    pthread_mutex_unlock(&c->lock);
+    return ret;
+}
+
+int
+lib_cache_prefetch(struct lib_cache *c, size_t roff, size_t len)
+{
+    if (roff > c->remote_len)
+        return -1;
+    /* more would push out what was read ahead first */
+    if (len > c->nentries * c->block / 2)
+        len = c->nentries * c->block / 2;
+    pthread_mutex_lock(&c->lock);
+    enqueue(c, roff, len);
+    pthread_mutex_unlock(&c->lock);
+    return 0;
+}
+
+int
+lib_cache_flush(struct lib_cache *c, void *arg)
+{
+    int i, ret = 0;
+
+    pthread_mutex_lock(&c->lock);
+    for (i = 0; i < c->used && !ret; i++)
+        if (c->entries[i].valid && c->entries[i].dirty)
+            ret = write_entry(c, &c->entries[i], arg);
+    pthread_mutex_unlock(&c->lock);
+    return ret;
+}
+
+void
+lib_cache_stats(struct lib_cache *c, struct ocm_cache_stats *s)
+{
+    pthread_mutex_lock(&c->lock);
+    *s = c->stats;
+    pthread_mutex_unlock(&c->lock);
+}
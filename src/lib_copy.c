@@ -0,0 +1,304 @@
+/**
+ * file: lib_copy.c
+ * desc: copy engine of the library, see lib_copy.h. A copy is cut into
+ * chunks that the caller and the pool threads take turns claiming, so the
+ * caller never waits on a thread that has not woken up yet. One copy uses
+ * the pool at a time; a concurrent caller copies on its own instead of
+ * queueing behind it.
+ */
+
+/* System includes */
+#define _GNU_SOURCE /* for cpu_set_t */
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+/* Other project includes */
+
+/* Project includes */
+#include <debug.h>
+#include <lib_copy.h>
+#include <topo.h>
+#include <util/misc.h>
+
+/* Internal definitions */
+
+#define MAX_THREADS         16
+#define DEFAULT_THREADS     3
+#define DEFAULT_MIN_BYTES   (1UL << 20)
+#define MIN_CHUNK           (256UL << 10)
+
+typedef void (*copy_fn_t)(char *dst, const char *src, size_t len);
+
+struct copy_job
+{
+    char *dst;
+    const char *src;
+    size_t len, chunk;
+    unsigned long nchunks;
+    unsigned long next; /* next chunk to claim */
+    unsigned long done; /* chunks copied */
+};
+
+/* Internal state */
+
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+static copy_fn_t nt_copy;
+static const char *nt_name;
+static size_t min_bytes = DEFAULT_MIN_BYTES;
+static int want_threads; /* as configured */
+static int nthreads; /* as started, at most one less than the node's CPUs */
+
+/* pool, started with the first large copy */
+static bool pool_started;
+static pthread_mutex_t job_lock = PTHREAD_MUTEX_INITIALIZER; /* one job */
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+static struct copy_job *cur_job;
+static unsigned long job_gen;
+static int busy; /* pool threads working on cur_job */
+
+/* Private functions */
+
+static void
+copy_plain(char *dst, const char *src, size_t len)
+{
+    memcpy(dst, src, len);
+}
+
+#if defined(__x86_64__)
+/* streaming stores need an aligned destination; the unaligned head and the
+ * tail go through memcpy */
+__attribute__((target("avx2")))
+static void
+copy_avx2(char *dst, const char *src, size_t len)
+{
+    size_t head = (-(uintptr_t)dst) & 31;
+    __m256i a, b, c, d;
+
+    if (head > len)
+        head = len;
+    memcpy(dst, src, head);
+    dst += head; src += head; len -= head;
+    for (; len >= 128; dst += 128, src += 128, len -= 128) {
+        a = _mm256_loadu_si256((const __m256i*)(src));
+        b = _mm256_loadu_si256((const __m256i*)(src + 32));
+        c = _mm256_loadu_si256((const __m256i*)(src + 64));
+        d = _mm256_loadu_si256((const __m256i*)(src + 96));
+        _mm256_stream_si256((__m256i*)(dst), a);
+        _mm256_stream_si256((__m256i*)(dst + 32), b);
+        _mm256_stream_si256((__m256i*)(dst + 64), c);
+        _mm256_stream_si256((__m256i*)(dst + 96), d);
+    }
+    _mm_sfence();
+    memcpy(dst, src, len);
+}
+
+__attribute__((target("avx512f")))
+static void
+copy_avx512(char *dst, const char *src, size_t len)
+{
+    size_t head = (-(uintptr_t)dst) & 63;
+    __m512i a, b, c, d;
+
+    if (head > len)
+        head = len;
+    memcpy(dst, src, head);
+    dst += head; src += head; len -= head;
+    for (; len >= 256; dst += 256, src += 256, len -= 256) {
+        a = _mm512_loadu_si512((const void*)(src));
+        b = _mm512_loadu_si512((const void*)(src + 64));
+        c = _mm512_loadu_si512((const void*)(src + 128));
+        d = _mm512_loadu_si512((const void*)(src + 192));
+        _mm512_stream_si512((void*)(dst), a);
+        _mm512_stream_si512((void*)(dst + 64), b);
+        _mm512_stream_si512((void*)(dst + 128), c);
+        _mm512_stream_si512((void*)(dst + 192), d);
+    }
+    _mm_sfence();
+    memcpy(dst, src, len);
+}
+#endif
+
+/* claim and copy chunks until none are left */
+static void
+run_job(struct copy_job *job)
+{
+    unsigned long i;
+    size_t off, len;
+
+    while ((i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED))
+            < job->nchunks) {
+        off = i * job->chunk;
+        len = (off + job->chunk > job->len ? job->len - off : job->chunk);
+        nt_copy(job->dst + off, job->src + off, len);
+        __atomic_fetch_add(&job->done, 1, __ATOMIC_RELEASE);
+    }
+}
+
+static void *
+pool_thread(void *arg)
+{
+    cpu_set_t *cpus = (cpu_set_t*)arg;
+    struct copy_job *job;
+    unsigned long seen = 0;
+
+    if (cpus && pthread_setaffinity_np(pthread_self(), sizeof(*cpus), cpus))
+        printd("could not pin copy thread to its node\n");
+
+    pthread_mutex_lock(&pool_lock);
+    while (true) {
+        while (seen == job_gen || !cur_job)
+            pthread_cond_wait(&work_cond, &pool_lock);
+        seen = job_gen;
+        job = cur_job;
+        busy++;
+        pthread_mutex_unlock(&pool_lock);
+
+        run_job(job);
+
+        pthread_mutex_lock(&pool_lock);
+        if (--busy == 0)
+            pthread_cond_broadcast(&done_cond);
+    }
+    pthread_mutex_unlock(&pool_lock);
+    return NULL;
+}
+
+/* job_lock held */
+static void
+start_pool(void)
+{
+    static cpu_set_t cpus;
+    sigset_t all, old;
+    pthread_t tid;
+    int i, node = topo_nic_node(), ncpus;
+
+    pool_started = true;
+    /* copies stage to and from NIC buffers, so work next to the NIC */
+    if (node < 0)
+        node = topo_cur_node();
+    ncpus = topo_node_cpus(node, &cpus);
+    /* one CPU stays for the caller */
+    if (ncpus > 0 && nthreads > ncpus - 1)
+        nthreads = ncpus - 1;
+
+    /* signals are for the app's threads, not ours */
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    for (i = 0; i < nthreads; i++) {
+        if (pthread_create(&tid, NULL, pool_thread,
+                    (ncpus > 0 ? &cpus : NULL)))
+            break;
+        pthread_detach(tid);
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    nthreads = i;
+    printd("copy engine: %d threads on node %d, %s\n",
+            nthreads, node, nt_name);
+}
+
+/* the pool does not survive fork; the child starts its own when needed */
+static void
+atfork_child(void)
+{
+    pthread_mutex_init(&job_lock, NULL);
+    pthread_mutex_init(&pool_lock, NULL);
+    pthread_cond_init(&work_cond, NULL);
+    pthread_cond_init(&done_cond, NULL);
+    pool_started = false;
+    cur_job = NULL;
+    busy = 0;
+    nthreads = want_threads;
+}
+
+static void
+copy_init(void)
+{
+    const char *env;
+
+    nt_copy = copy_plain;
+    nt_name = "memcpy";
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        nt_copy = copy_avx512;
+        nt_name = "avx512 streaming stores";
+    } else if (__builtin_cpu_supports("avx2")) {
+        nt_copy = copy_avx2;
+        nt_name = "avx2 streaming stores";
+    }
+#endif
+
+    want_threads = DEFAULT_THREADS;
+    if ((env = getenv("OCM_COPY_THREADS")))
+        want_threads = atoi(env);
+    if (want_threads < 0)
+        want_threads = 0;
+    if (want_threads > MAX_THREADS)
+        want_threads = MAX_THREADS;
+    nthreads = want_threads;
+    if ((env = getenv("OCM_COPY_MIN_BYTES")))
+        min_bytes = parse_size(env);
+    pthread_atfork(NULL, NULL, atfork_child);
+}
+
+/* Public functions */
+
+void *
+lib_copy(void *dst, const void *src, size_t len)
+{
+    struct copy_job job;
+    int workers;
+
+    pthread_once(&init_once, copy_init);
+    if (len < min_bytes)
+        return memcpy(dst, src, len);
+
+    /* pool taken by another copy, or none: stream it ourselves */
+    if (nthreads == 0 || pthread_mutex_trylock(&job_lock)) {
+        nt_copy(dst, src, len);
+        return dst;
+    }
+    if (!pool_started)
+        start_pool();
+
+    workers = nthreads + 1;
+    memset(&job, 0, sizeof(job));
+    job.dst = dst;
+    job.src = src;
+    job.len = len;
+    /* a few chunks per worker evens out threads that start late */
+    job.chunk = (len / (workers * 4) + 63) & ~63UL;
+    if (job.chunk < MIN_CHUNK)
+        job.chunk = MIN_CHUNK;
+    job.nchunks = (len + job.chunk - 1) / job.chunk;
+
+    pthread_mutex_lock(&pool_lock);
+    cur_job = &job;
+    job_gen++;
+    pthread_cond_broadcast(&work_cond);
+    pthread_mutex_unlock(&pool_lock);
+
+    run_job(&job);
+
+    /* job lives on our stack: no pool thread may still hold it */
+    pthread_mutex_lock(&pool_lock);
+    while (busy > 0 ||
+            __atomic_load_n(&job.done, __ATOMIC_ACQUIRE) < job.nchunks)
+        pthread_cond_wait(&done_cond, &pool_lock);
+    cur_job = NULL;
+    pthread_mutex_unlock(&pool_lock);
+
+    pthread_mutex_unlock(&job_lock);
+    return dst;
+}
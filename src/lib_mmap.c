@@ -0,0 +1,469 @@
+/**
+ * file: lib_mmap.c
+ * desc: ocm_mmap and friends, see lib_mmap.h
+ */
+
+/* System includes */
+#define _GNU_SOURCE /* for MAP_NORESERVE */
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/userfaultfd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/* Other project includes */
+
+/* Project includes */
+#include <debug.h>
+#include <lib_mmap.h>
+#include <util/list.h>
+#include <util/misc.h>
+
+/* Internal definitions */
+
+#define DEFAULT_BLOCK   (64UL << 10)
+
+/* block state */
+#define BLK_RESIDENT    0x1
+#define BLK_DIRTY       0x2
+#define BLK_REF         0x4 /* used since the clock hand last passed */
+
+struct lib_mmap
+{
+    struct list_head link;
+    ocm_alloc_t alloc;
+    char *addr;
+    size_t len; /* whole blocks */
+    size_t remote_bytes;
+    size_t block;
+    unsigned long nblocks;
+    uint8_t *state;
+    char *stage; /* the allocation's local buffer */
+    unsigned long max_resident, resident, hand;
+    int uffd, stop_fd;
+    pthread_t tid;
+    bool running;
+    pthread_mutex_t lock; /* block state and the stage */
+    unsigned long faults, wp_faults, evictions, writebacks;
+};
+
+/* Internal state */
+
+static LIST_HEAD(maps);
+static pthread_mutex_t maps_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Private functions */
+
+static size_t
+block_size(size_t local)
+{
+    size_t page = getpagesize(), block = DEFAULT_BLOCK;
+    const char *env;
+
+    if ((env = getenv("OCM_MMAP_BLOCK")))
+        block = parse_size(env);
+    /* the block is staged through the local buffer */
+    if (block > local)
+        block = local;
+    return block & ~(page - 1);
+}
+
+static char *
+blk_addr(struct lib_mmap *m, unsigned long b)
+{
+    return m->addr + b * m->block;
+}
+
+/* bytes of block b backed by the remote buffer */
+static size_t
+blk_bytes(struct lib_mmap *m, unsigned long b)
+{
+    size_t off = b * m->block;
+    return (off + m->block > m->remote_bytes ? m->remote_bytes - off : m->block);
+}
+
+/* move block b between the stage and the remote buffer */
+static int
+remote_io(struct lib_mmap *m, unsigned long b, bool write)
+{
+    struct ocm_params p;
+
+    memset(&p, 0, sizeof(p));
+    p.src_offset = 0;
+    p.dest_offset = b * m->block;
+    p.bytes = blk_bytes(m, b);
+    p.op_flag = write;
+    return ocm_copy_onesided(m->alloc, &p);
+}
+
+static void
+wake(struct lib_mmap *m, unsigned long b)
+{
+    struct uffdio_range r = {
+        .start = (uintptr_t)blk_addr(m, b), .len = m->block
+    };
+
+    if (ioctl(m->uffd, UFFDIO_WAKE, &r))
+        printd("UFFDIO_WAKE block %lu: %s\n", b, strerror(errno));
+}
+
+/* write protection also wakes threads waiting on the block when lifted */
+static int
+protect(struct lib_mmap *m, unsigned long b, bool wp)
+{
+    struct uffdio_writeprotect w = {
+        .range = { .start = (uintptr_t)blk_addr(m, b), .len = m->block },
+        .mode = (wp ? UFFDIO_WRITEPROTECT_MODE_WP : 0)
+    };
+
+    return ioctl(m->uffd, UFFDIO_WRITEPROTECT, &w);
+}
+
+/* lock held. Stores stall on the protected block while it is copied out */
+static int
+writeback(struct lib_mmap *m, unsigned long b)
+{
+    if (protect(m, b, true))
+        return -1;
+    memcpy(m->stage, blk_addr(m, b), blk_bytes(m, b));
+    if (remote_io(m, b, true))
+        return -1;
+    m->state[b] &= ~BLK_DIRTY;
+    m->writebacks++;
+    return 0;
+}
+
+/* lock held */
+static int
+evict_one(struct lib_mmap *m)
+{
+    unsigned long b;
+
+    while (true) {
+        b = m->hand;
+        m->hand = (m->hand + 1) % m->nblocks;
+        if (!(m->state[b] & BLK_RESIDENT))
+            continue;
+        if (m->state[b] & BLK_REF) {
+            m->state[b] &= ~BLK_REF;
+            continue;
+        }
+        if ((m->state[b] & BLK_DIRTY) && writeback(m, b))
+            return -1;
+        madvise(blk_addr(m, b), m->block, MADV_DONTNEED);
+        /* stores that stalled during write-back now fault it back in */
+        wake(m, b);
+        m->state[b] = 0;
+        m->resident--;
+        m->evictions++;
+        return 0;
+    }
+}
+
+/* lock held. A load or store on a page we do not have */
+static int
+serve_missing(struct lib_mmap *m, unsigned long b, bool write)
+{
+    struct uffdio_copy c;
+
+    /* several threads may have faulted on the block */
+    if (m->state[b] & BLK_RESIDENT) {
+        wake(m, b);
+        return 0;
+    }
+    if (m->resident >= m->max_resident && evict_one(m))
+        return -1;
+    if (remote_io(m, b, false))
+        return -1;
+    memset(m->stage + blk_bytes(m, b), 0, m->block - blk_bytes(m, b));
+
+    /* loads get the block write-protected so the first store is seen */
+    c.dst = (uintptr_t)blk_addr(m, b);
+    c.src = (uintptr_t)m->stage;
+    c.len = m->block;
+    c.mode = (write ? 0 : UFFDIO_COPY_MODE_WP);
+    c.copy = 0;
+    if (ioctl(m->uffd, UFFDIO_COPY, &c)) {
+        if (errno != EEXIST)
+            return -1;
+        wake(m, b);
+    }
+    m->state[b] = BLK_RESIDENT | BLK_REF | (write ? BLK_DIRTY : 0);
+    m->resident++;
+    m->faults++;
+    return 0;
+}
+
+/* lock held. First store to a clean block */
+static int
+serve_wp(struct lib_mmap *m, unsigned long b)
+{
+    /* evicted while the store waited: it faults again as missing */
+    if (!(m->state[b] & BLK_RESIDENT)) {
+        wake(m, b);
+        return 0;
+    }
+    m->state[b] |= BLK_DIRTY | BLK_REF;
+    m->wp_faults++;
+    return protect(m, b, false);
+}
+
+static void *
+handler_thread(void *arg)
+{
+    struct lib_mmap *m = (struct lib_mmap*)arg;
+    struct pollfd fds[2] = {
+        { .fd = m->uffd, .events = POLLIN },
+        { .fd = m->stop_fd, .events = POLLIN }
+    };
+    struct uffd_msg msg;
+    unsigned long b;
+    ssize_t n;
+    int ret;
+
+    while (true) {
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        if (fds[1].revents)
+            break;
+        n = read(m->uffd, &msg, sizeof(msg));
+        if (n < 0 && (errno == EAGAIN || errno == EINTR))
+            continue;
+        if (n != sizeof(msg))
+            break;
+        if (msg.event != UFFD_EVENT_PAGEFAULT)
+            continue;
+
+        b = (msg.arg.pagefault.address - (uintptr_t)m->addr) / m->block;
+        pthread_mutex_lock(&m->lock);
+        if (msg.arg.pagefault.flags & UFFD_PAGEFAULT_FLAG_WP)
+            ret = serve_wp(m, b);
+        else
+            ret = serve_missing(m, b,
+                    msg.arg.pagefault.flags & UFFD_PAGEFAULT_FLAG_WRITE);
+        pthread_mutex_unlock(&m->lock);
+
+        /* a load or store cannot be failed back to the app */
+        if (ret) {
+            fprintf(stderr, "ocm_mmap: cannot serve a fault at %p: %s\n",
+                    (void*)(uintptr_t)msg.arg.pagefault.address,
+                    strerror(errno));
+            abort();
+        }
+    }
+    return NULL;
+}
+
+static int
+open_uffd(void)
+{
+    struct uffdio_api api;
+    int fd;
+
+    /* kernel accesses to the mapping need the full kind */
+    fd = syscall(SYS_userfaultfd, O_CLOEXEC | O_NONBLOCK);
+#ifdef UFFD_USER_MODE_ONLY
+    /* unprivileged_userfaultfd=0 and no CAP_SYS_PTRACE */
+    if (fd < 0 && errno == EPERM) {
+        fd = syscall(SYS_userfaultfd,
+                O_CLOEXEC | O_NONBLOCK | UFFD_USER_MODE_ONLY);
+        if (fd >= 0)
+            printd("userfaultfd: user-mode only, syscalls on"
+                    " the mapping fail with EFAULT\n");
+    }
+#endif
+    if (fd < 0) {
+        printd("userfaultfd: %s\n", strerror(errno));
+        return -1;
+    }
+    memset(&api, 0, sizeof(api));
+    api.api = UFFD_API;
+    api.features = UFFD_FEATURE_PAGEFAULT_FLAG_WP;
+    if (ioctl(fd, UFFDIO_API, &api) ||
+            !(api.features & UFFD_FEATURE_PAGEFAULT_FLAG_WP)) {
+        printd("userfaultfd lacks write-protect support (Linux 5.7+)\n");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* lock-free part of ocm_munmap/lib_mmap_release; m is off the list */
+static void
+teardown(struct lib_mmap *m)
+{
+    uint64_t one = 1;
+
+    if (m->running) {
+        if (write(m->stop_fd, &one, sizeof(one)) != sizeof(one))
+            printd("cannot stop fault handler\n");
+        pthread_join(m->tid, NULL);
+    }
+    printd("unmap %p: %lu faults, %lu first writes, %lu evictions, "
+            "%lu write-backs\n", m->addr, m->faults, m->wp_faults,
+            m->evictions, m->writebacks);
+    if (m->addr)
+        munmap(m->addr, m->len);
+    if (m->uffd >= 0)
+        close(m->uffd);
+    if (m->stop_fd >= 0)
+        close(m->stop_fd);
+    pthread_mutex_destroy(&m->lock);
+    free(m->state);
+    free(m);
+}
+
+static struct lib_mmap *
+find_map(ocm_alloc_t a, bool unlink)
+{
+    struct lib_mmap *m;
+
+    pthread_mutex_lock(&maps_lock);
+    list_for_each_entry(m, &maps, link) {
+        if (m->alloc == a) {
+            if (unlink)
+                list_del(&m->link);
+            pthread_mutex_unlock(&maps_lock);
+            return m;
+        }
+    }
+    pthread_mutex_unlock(&maps_lock);
+    return NULL;
+}
+
+/* Public functions */
+
+void *
+ocm_mmap(ocm_alloc_t a)
+{
+    struct uffdio_register reg;
+    struct lib_mmap *m;
+    sigset_t all, old;
+    size_t local;
+    void *buf;
+
+    if (!a)
+        return NULL;
+    if (ocm_alloc_kind(a) == OCM_LOCAL_HOST)
+        return (ocm_localbuf(a, &buf, &local) ? NULL : buf);
+    if ((m = find_map(a, false)))
+        return m->addr;
+
+    if (!(m = calloc(1, sizeof(*m))))
+        return NULL;
+    m->alloc = a;
+    m->uffd = m->stop_fd = -1;
+    pthread_mutex_init(&m->lock, NULL);
+    if (ocm_remote_sz(a, &m->remote_bytes) || m->remote_bytes == 0)
+        goto fail;
+    if (ocm_localbuf(a, &buf, &local))
+        goto fail;
+    m->stage = (char*)buf;
+    if (!(m->block = block_size(local))) {
+        printd("local buffer of %lu bytes is smaller than a page\n", local);
+        goto fail;
+    }
+    m->nblocks = (m->remote_bytes + m->block - 1) / m->block;
+    m->len = m->nblocks * m->block;
+    m->max_resident = local / m->block;
+    if (!(m->state = calloc(m->nblocks, sizeof(*m->state))))
+        goto fail;
+
+    if ((m->uffd = open_uffd()) < 0)
+        goto fail;
+    m->addr = mmap(NULL, m->len, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (m->addr == MAP_FAILED) {
+        m->addr = NULL;
+        goto fail;
+    }
+    memset(&reg, 0, sizeof(reg));
+    reg.range.start = (uintptr_t)m->addr;
+    reg.range.len = m->len;
+    reg.mode = UFFDIO_REGISTER_MODE_MISSING | UFFDIO_REGISTER_MODE_WP;
+    if (ioctl(m->uffd, UFFDIO_REGISTER, &reg)) {
+        printd("UFFDIO_REGISTER: %s\n", strerror(errno));
+        goto fail;
+    }
+    if ((m->stop_fd = eventfd(0, EFD_CLOEXEC)) < 0)
+        goto fail;
+
+    /* signals are for the app's threads, not ours */
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    m->running = !pthread_create(&m->tid, NULL, handler_thread, m);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (!m->running)
+        goto fail;
+
+    printd("mapped %lu remote bytes at %p, %lu byte blocks, %lu resident\n",
+            m->remote_bytes, m->addr, m->block, m->max_resident);
+    INIT_LIST_HEAD(&m->link);
+    pthread_mutex_lock(&maps_lock);
+    list_add(&m->link, &maps);
+    pthread_mutex_unlock(&maps_lock);
+    return m->addr;
+
+fail:
+    teardown(m);
+    return NULL;
+}
+
+int
+ocm_msync(ocm_alloc_t a)
+{
+    struct lib_mmap *m;
+    unsigned long b;
+    int ret = 0;
+
+    if (!a)
+        return -1;
+    if (!(m = find_map(a, false)))
+        return (ocm_alloc_kind(a) == OCM_LOCAL_HOST ? 0 : -1);
+    pthread_mutex_lock(&m->lock);
+    for (b = 0; b < m->nblocks && !ret; b++)
+        if (m->state[b] & BLK_DIRTY)
+            ret = writeback(m, b);
+    pthread_mutex_unlock(&m->lock);
+    /* a write-back cache may still hold them */
+    return (ret ? ret : ocm_cache_flush(a));
+}
+
+int
+ocm_munmap(ocm_alloc_t a)
+{
+    struct lib_mmap *m;
+    int ret;
+
+    if (!a)
+        return -1;
+    if (ocm_alloc_kind(a) == OCM_LOCAL_HOST)
+        return 0;
+    ret = ocm_msync(a);
+    if (!(m = find_map(a, true)))
+        return -1;
+    teardown(m);
+    return ret;
+}
+
+void
+lib_mmap_release(ocm_alloc_t a)
+{
+    struct lib_mmap *m;
+
+    if ((m = find_map(a, true)))
+        teardown(m);
+}
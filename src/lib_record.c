@@ -0,0 +1,268 @@
+/**
+ * file: lib_record.c
+ * desc: workload recorder of the library, see lib_record.h for the file
+ * format. Records are encoded into a buffer under a lock and written out
+ * when it fills and at ocm_tini/exit, so a call costs a few hundred ns.
+ */
+
+/* System includes */
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Other project includes */
+
+/* Project includes */
+#include <debug.h>
+#include <lib_record.h>
+#include <lib_stats.h>
+
+/* Internal definitions */
+
+#define REC_BUF_LEN     (64 << 10)
+
+/* Internal state */
+
+static int rec_fd = -1;
+static pthread_mutex_t rec_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint8_t rec_buf[REC_BUF_LEN];
+static size_t rec_len;
+static uint64_t prev_start; /* start of the last record encoded */
+
+static uint64_t next_id = 1;
+static uint32_t next_thread = 1;
+static __thread uint32_t my_thread;
+
+static pthread_once_t setup_once = PTHREAD_ONCE_INIT;
+static bool forked; /* a parent of ours recorded */
+
+/* Private functions */
+
+static size_t
+put_var(uint8_t *p, uint64_t v)
+{
+    size_t n = 0;
+    while (v >= 0x80) {
+        p[n++] = (v & 0x7f) | 0x80;
+        v >>= 7;
+    }
+    p[n++] = v;
+    return n;
+}
+
+static uint64_t
+zigzag(int64_t v)
+{
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+/* rec_lock held */
+static void
+flush_buf(void)
+{
+    size_t off = 0;
+    ssize_t n;
+
+    while (off < rec_len) {
+        n = write(rec_fd, rec_buf + off, rec_len - off);
+        if (n <= 0) {
+            perror("OCM_RECORD");
+            close(rec_fd);
+            rec_fd = -1;
+            break;
+        }
+        off += n;
+    }
+    rec_len = 0;
+}
+
+/* encode the common part of a record and then the n op fields */
+static void
+add_rec(enum ocm_rec_op op, uint8_t flags, uint64_t start,
+        const uint64_t *f, unsigned int n)
+{
+    uint8_t rec[OCM_REC_MAX_LEN];
+    uint64_t dur = lib_stats_now() - start;
+    size_t len = 0;
+    unsigned int i;
+
+    if (!my_thread)
+        my_thread = __atomic_fetch_add(&next_thread, 1, __ATOMIC_RELAXED);
+
+    pthread_mutex_lock(&rec_lock);
+    if (rec_fd < 0)
+        goto out;
+    rec[len++] = op;
+    rec[len++] = flags;
+    len += put_var(rec + len, my_thread);
+    len += put_var(rec + len, zigzag((int64_t)(start - prev_start)));
+    len += put_var(rec + len, dur);
+    for (i = 0; i < n; i++)
+        len += put_var(rec + len, f[i]);
+    prev_start = start;
+
+    if (rec_len + len > REC_BUF_LEN)
+        flush_buf();
+    memcpy(rec_buf + rec_len, rec, len);
+    rec_len += len;
+out:
+    pthread_mutex_unlock(&rec_lock);
+}
+
+/* the child's copy of the buffer holds the parent's records; drop it */
+static void
+atfork_child(void)
+{
+    pthread_mutex_init(&rec_lock, NULL);
+    if (rec_fd >= 0) {
+        close(rec_fd);
+        rec_fd = -1;
+        forked = true;
+    }
+    rec_len = 0;
+    my_thread = 0;
+    next_thread = 1;
+}
+
+static void
+setup(void)
+{
+    pthread_atfork(NULL, NULL, atfork_child);
+    atexit(lib_record_fin);
+}
+
+/* Public functions */
+
+int
+lib_record_init(void)
+{
+    const char *env = getenv("OCM_RECORD"), *p;
+    char path[PATH_MAX];
+    uint8_t hdr[OCM_REC_HDR_LEN];
+    struct timespec ts;
+    uint64_t wall;
+    size_t len = 0;
+    int i;
+
+    if (!env || !*env)
+        return 0;
+    pthread_once(&setup_once, setup);
+
+    for (p = env; *p && len < sizeof(path) - 1; p++) {
+        if (p[0] == '%' && p[1] == 'p') {
+            len += snprintf(path + len, sizeof(path) - len, "%d", getpid());
+            p++;
+        } else {
+            path[len++] = *p;
+        }
+        if (len >= sizeof(path))
+            len = sizeof(path) - 1;
+    }
+    path[len] = '\0';
+    if (forked && !strstr(env, "%p"))
+        snprintf(path + len, sizeof(path) - len, ".%d", getpid());
+
+    pthread_mutex_lock(&rec_lock);
+    if (rec_fd >= 0)
+        goto out;
+    rec_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (rec_fd < 0) {
+        perror(path);
+        pthread_mutex_unlock(&rec_lock);
+        return -1;
+    }
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    wall = ts.tv_sec * 1000000000UL + ts.tv_nsec;
+    memcpy(hdr, OCM_REC_MAGIC, 6);
+    hdr[6] = OCM_REC_VERSION;
+    hdr[7] = 0;
+    for (i = 0; i < 8; i++)
+        hdr[8 + i] = wall >> (8 * i);
+    memcpy(rec_buf, hdr, sizeof(hdr));
+    rec_len = sizeof(hdr);
+    prev_start = lib_stats_now();
+    printd("recording calls to %s\n", path);
+out:
+    pthread_mutex_unlock(&rec_lock);
+    return 0;
+}
+
+void
+lib_record_fin(void)
+{
+    pthread_mutex_lock(&rec_lock);
+    if (rec_fd >= 0) {
+        flush_buf();
+        if (rec_fd >= 0)
+            close(rec_fd);
+        rec_fd = -1;
+    }
+    pthread_mutex_unlock(&rec_lock);
+}
+
+uint64_t
+lib_record_alloc(ocm_alloc_param_t p, unsigned int count, uint64_t start,
+        bool failed)
+{
+    uint64_t f[5], id = 0;
+
+    if (rec_fd < 0)
+        return 0;
+    if (!failed)
+        id = __atomic_fetch_add(&next_id, count, __ATOMIC_RELAXED);
+    f[0] = p->kind;
+    f[1] = count;
+    f[2] = p->local_alloc_bytes;
+    f[3] = p->rem_alloc_bytes;
+    f[4] = id;
+    add_rec(OCM_REC_ALLOC, (failed ? OCM_REC_FAILED : 0), start, f, 5);
+    return id;
+}
+
+void
+lib_record_free(uint64_t id, uint64_t start, bool failed)
+{
+    if (rec_fd < 0)
+        return;
+    add_rec(OCM_REC_FREE, (failed ? OCM_REC_FAILED : 0), start, &id, 1);
+}
+
+void
+lib_record_copy(uint64_t dest_id, uint64_t src_id, ocm_param_t p,
+        bool write, uint64_t start, bool failed)
+{
+    uint64_t f[7];
+
+    if (rec_fd < 0)
+        return;
+    f[0] = dest_id;
+    f[1] = src_id;
+    f[2] = p->bytes;
+    f[3] = p->src_offset;
+    f[4] = p->dest_offset;
+    f[5] = p->src_offset_2;
+    f[6] = p->dest_offset_2;
+    add_rec(OCM_REC_COPY, (failed ? OCM_REC_FAILED : 0) |
+            (write ? OCM_REC_WRITE : 0), start, f, 7);
+}
+
+void
+lib_record_onesided(uint64_t id, ocm_param_t p, uint64_t start, bool failed)
+{
+    uint64_t f[4];
+
+    if (rec_fd < 0)
+        return;
+    f[0] = id;
+    f[1] = p->bytes;
+    f[2] = p->src_offset;
+    f[3] = p->dest_offset;
+    add_rec(OCM_REC_ONESIDED, (failed ? OCM_REC_FAILED : 0) |
+            (p->op_flag ? OCM_REC_WRITE : 0), start, f, 4);
+}
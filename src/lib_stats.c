@@ -0,0 +1,199 @@
+/**
+ * file: lib_stats.c
+ * desc: latency histograms and byte counters of the library. Counters are
+ * allocated the first time an op of a kind is seen and never freed, so
+ * recording needs no lock.
+ */
+
+/* System includes */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Other project includes */
+
+/* Project includes */
+#include <oncillamem.h>
+#include <lib_stats.h>
+#include <util/hist.h>
+
+/* Internal definitions */
+
+#define NUM_KINDS   (OCM_REMOTE_GPU + 1)
+
+struct op_stats
+{
+    struct hist phase[OCM_STAT_NUM_PHASES];
+    uint64_t errors, bytes;
+};
+
+/* Internal state */
+
+static struct op_stats *stats[NUM_KINDS][OCM_STAT_NUM_OPS];
+
+static const char *kind_str[NUM_KINDS] = {
+    [OCM_LOCAL_HOST]  = "host",
+    [OCM_LOCAL_RMA]   = "local_rma",
+    [OCM_REMOTE_RMA]  = "rma",
+    [OCM_LOCAL_RDMA]  = "local_rdma",
+    [OCM_REMOTE_RDMA] = "rdma",
+    [OCM_LOCAL_GPU]   = "gpu",
+    [OCM_REMOTE_GPU]  = "remote_gpu",
+};
+
+static const char *op_str[OCM_STAT_NUM_OPS] = {
+    "alloc", "free", "copy", "onesided", "prefetch", "flush"
+};
+
+static const char *phase_str[OCM_STAT_NUM_PHASES] = {
+    "total", "stage", "post", "wait"
+};
+
+/* Private functions */
+
+static struct op_stats *
+get_stats(enum ocm_kind kind, enum ocm_stat_op op, bool create)
+{
+    struct op_stats *s, *expected = NULL;
+
+    if ((unsigned)kind >= NUM_KINDS || (unsigned)op >= OCM_STAT_NUM_OPS)
+        return NULL;
+    s = __atomic_load_n(&stats[kind][op], __ATOMIC_ACQUIRE);
+    if (s || !create)
+        return s;
+    if (!(s = calloc(1, sizeof(*s))))
+        return NULL;
+    if (!__atomic_compare_exchange_n(&stats[kind][op], &expected, s,
+                false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        free(s);
+        s = expected;
+    }
+    return s;
+}
+
+/* Public functions */
+
+void
+lib_stats_record(enum ocm_kind kind, enum ocm_stat_op op,
+        enum ocm_stat_phase phase, uint64_t ns)
+{
+    struct op_stats *s = get_stats(kind, op, true);
+    if (s && (unsigned)phase < OCM_STAT_NUM_PHASES)
+        hist_add(&s->phase[phase], ns);
+}
+
+void
+lib_stats_op(enum ocm_kind kind, enum ocm_stat_op op,
+        uint64_t start_ns, uint64_t bytes, bool failed)
+{
+    struct op_stats *s = get_stats(kind, op, true);
+    if (!s)
+        return;
+    hist_add(&s->phase[OCM_STAT_TOTAL], lib_stats_now() - start_ns);
+    if (failed)
+        __atomic_fetch_add(&s->errors, 1, __ATOMIC_RELAXED);
+    else
+        __atomic_fetch_add(&s->bytes, bytes, __ATOMIC_RELAXED);
+}
+
+void
+lib_stats_fin(void)
+{
+    const char *env = getenv("OCM_STATS");
+    FILE *f;
+
+    if (!env || !*env || !strcmp(env, "0"))
+        return;
+    if (!strcmp(env, "1")) {
+        ocm_stats_dump(stderr);
+        return;
+    }
+    if (!(f = fopen(env, "a"))) {
+        perror(env);
+        return;
+    }
+    ocm_stats_dump(f);
+    fclose(f);
+}
+
+int
+ocm_stats_get(enum ocm_kind kind, enum ocm_stat_op op,
+        enum ocm_stat_phase phase, struct ocm_stats *out)
+{
+    struct op_stats *s;
+    struct hist *h;
+
+    if (!out || (unsigned)phase >= OCM_STAT_NUM_PHASES)
+        return -1;
+    if ((unsigned)kind >= NUM_KINDS || (unsigned)op >= OCM_STAT_NUM_OPS)
+        return -1;
+    memset(out, 0, sizeof(*out));
+    if (!(s = get_stats(kind, op, false)))
+        return 0;
+    h = &s->phase[phase];
+    out->count   = hist_count(h);
+    out->errors  = __atomic_load_n(&s->errors, __ATOMIC_RELAXED);
+    out->bytes   = __atomic_load_n(&s->bytes, __ATOMIC_RELAXED);
+    out->min_ns  = hist_min(h);
+    out->mean_ns = hist_mean(h);
+    out->p50_ns  = hist_percentile(h, 0.5);
+    out->p90_ns  = hist_percentile(h, 0.9);
+    out->p99_ns  = hist_percentile(h, 0.99);
+    out->p999_ns = hist_percentile(h, 0.999);
+    out->max_ns  = hist_max(h);
+    return 0;
+}
+
+void
+ocm_stats_dump(FILE *f)
+{
+    struct ocm_stats st;
+    int kind, op, phase;
+
+    if (!f)
+        return;
+    fprintf(f, "ocm stats pid %d (latency in us)\n", getpid());
+    fprintf(f, "%-10s %-9s %-6s %9s %7s %12s %9s %9s %9s %9s %9s %9s\n",
+            "kind", "op", "phase", "count", "errors", "bytes",
+            "mean", "p50", "p90", "p99", "p99.9", "max");
+    for (kind = 0; kind < NUM_KINDS; kind++) {
+        for (op = 0; op < OCM_STAT_NUM_OPS; op++) {
+            for (phase = 0; phase < OCM_STAT_NUM_PHASES; phase++) {
+                if (ocm_stats_get(kind, op, phase, &st) || !st.count)
+                    continue;
+                fprintf(f, "%-10s %-9s %-6s %9lu ",
+                        (kind_str[kind] ? kind_str[kind] : "?"),
+                        op_str[op], phase_str[phase], st.count);
+                /* errors and bytes are per operation, shown once */
+                if (phase == OCM_STAT_TOTAL)
+                    fprintf(f, "%7lu %12lu ", st.errors, st.bytes);
+                else
+                    fprintf(f, "%7s %12s ", "", "");
+                fprintf(f, "%9.1f %9.1f %9.1f %9.1f %9.1f %9.1f\n",
+                        st.mean_ns / 1e3,
+                        st.p50_ns / 1e3, st.p90_ns / 1e3, st.p99_ns / 1e3,
+                        st.p999_ns / 1e3, st.max_ns / 1e3);
+            }
+        }
+    }
+    fflush(f);
+}
+
+void
+ocm_stats_reset(void)
+{
+    struct op_stats *s;
+    int kind, op, phase;
+
+    for (kind = 0; kind < NUM_KINDS; kind++) {
+        for (op = 0; op < OCM_STAT_NUM_OPS; op++) {
+            if (!(s = get_stats(kind, op, false)))
+                continue;
+            for (phase = 0; phase < OCM_STAT_NUM_PHASES; phase++)
+                hist_reset(&s->phase[phase]);
+            __atomic_store_n(&s->errors, 0, __ATOMIC_RELAXED);
+            __atomic_store_n(&s->bytes, 0, __ATOMIC_RELAXED);
+        }
+    }
+}
@@ -0,0 +1,234 @@
+/**
+ * file: lib_wc.c
+ * desc: write-combining buffer of remote allocations, see lib_wc.h
+ */
+
+/* System includes */
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Other project includes */
+
+/* Project includes */
+#include <debug.h>
+#include <lib_wc.h>
+#include <util/misc.h>
+
+/* Internal definitions */
+
+#define DEFAULT_TIMEOUT_US  100
+#define MIN_BYTES           256
+
+struct lib_wc
+{
+    char *buf; /* in the registered buffer, at off */
+    size_t size, off;
+    wc_xfer_t xfer;
+    void *timer_arg;
+
+    size_t lo, hi; /* pending extent of the remote buffer, lo == hi if none */
+    uint64_t since; /* when it started, ns */
+    uint64_t timeout; /* ns */
+    bool failed; /* a timed flush failed; reported by the next call */
+
+    uint64_t writes, combined, flushes, timed;
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t tid;
+    bool running, stop;
+};
+
+/* Private functions */
+
+static uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+static int
+flush(struct lib_wc *w, void *arg)
+{
+    int ret;
+
+    if (w->lo == w->hi)
+        return 0;
+    ret = w->xfer(arg, true, w->off, w->lo, w->hi - w->lo);
+    w->lo = w->hi = 0;
+    w->flushes++;
+    return ret;
+}
+
+/* merge the write into the pending extent, or start a new one */
+static int
+combine(struct lib_wc *w, const char *src, size_t roff, size_t len, void *arg)
+{
+    size_t lo = (roff < w->lo ? roff : w->lo);
+    size_t hi = (roff + len > w->hi ? roff + len : w->hi);
+
+    w->writes++;
+    if (w->lo != w->hi && roff <= w->hi && roff + len >= w->lo &&
+            hi - lo <= w->size) {
+        if (lo < w->lo)
+            memmove(w->buf + (w->lo - lo), w->buf, w->hi - w->lo);
+        memcpy(w->buf + (roff - lo), src, len);
+        w->lo = lo;
+        w->hi = hi;
+        w->combined++;
+    } else {
+        if (flush(w, arg))
+            return -1;
+        memcpy(w->buf, src, len);
+        w->lo = roff;
+        w->hi = roff + len;
+        w->since = now_ns();
+        pthread_cond_signal(&w->cond);
+    }
+    return (w->hi - w->lo == w->size ? flush(w, arg) : 0);
+}
+
+static void *
+timer_thread(void *arg)
+{
+    struct lib_wc *w = (struct lib_wc *)arg;
+    struct timespec ts;
+    uint64_t deadline;
+
+    pthread_mutex_lock(&w->lock);
+    while (!w->stop) {
+        if (w->lo == w->hi) {
+            pthread_cond_wait(&w->cond, &w->lock);
+            continue;
+        }
+        deadline = w->since + w->timeout;
+        if (now_ns() < deadline) {
+            ts.tv_sec = deadline / 1000000000UL;
+            ts.tv_nsec = deadline % 1000000000UL;
+            pthread_cond_timedwait(&w->cond, &w->lock, &ts);
+            continue;
+        }
+        w->timed++;
+        if (flush(w, w->timer_arg)) {
+            printd("timed flush failed\n");
+            w->failed = true;
+        }
+    }
+    pthread_mutex_unlock(&w->lock);
+    return NULL;
+}
+
+/* Public functions */
+
+size_t
+lib_wc_config(size_t *wc_bytes)
+{
+    const char *env;
+
+    if (!*wc_bytes && (env = getenv("OCM_WC_BYTES")))
+        *wc_bytes = parse_size(env);
+    if (*wc_bytes && *wc_bytes < MIN_BYTES)
+        *wc_bytes = MIN_BYTES;
+    return *wc_bytes;
+}
+
+struct lib_wc *
+lib_wc_new(size_t bytes, char *local, size_t off, wc_xfer_t xfer,
+        void *timer_arg)
+{
+    struct lib_wc *w;
+    pthread_condattr_t attr;
+    sigset_t all, old;
+    const char *env;
+
+    if (!(w = calloc(1, sizeof(*w))))
+        return NULL;
+    w->buf = local + off;
+    w->size = bytes;
+    w->off = off;
+    w->xfer = xfer;
+    w->timer_arg = timer_arg;
+    w->timeout = DEFAULT_TIMEOUT_US * 1000UL;
+    if ((env = getenv("OCM_WC_TIMEOUT")))
+        w->timeout = strtoul(env, NULL, 0) * 1000UL;
+
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&w->cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    /* signals are for the app's threads, not ours */
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    w->running = !pthread_create(&w->tid, NULL, timer_thread, w);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (!w->running) {
+        lib_wc_free(w);
+        return NULL;
+    }
+    printd("write combining: %lu bytes, %lu us\n", bytes,
+            w->timeout / 1000UL);
+    return w;
+}
+
+void
+lib_wc_free(struct lib_wc *w)
+{
+    if (!w)
+        return;
+    if (w->running) {
+        pthread_mutex_lock(&w->lock);
+        w->stop = true;
+        pthread_cond_signal(&w->cond);
+        pthread_mutex_unlock(&w->lock);
+        pthread_join(w->tid, NULL);
+    }
+    printd("write combining: %lu writes, %lu combined, %lu flushes "
+            "(%lu timed)\n", w->writes, w->combined, w->flushes, w->timed);
+    free(w);
+}
+
+int
+lib_wc_xfer(struct lib_wc *w, bool write, size_t loff, size_t roff,
+        size_t len, void *arg)
+{
+    char *local = w->buf - w->off;
+    int ret = 0;
+
+    pthread_mutex_lock(&w->lock);
+    if (w->failed) {
+        w->failed = false;
+        ret = -1;
+    } else if (write && len && len <= w->size / 4) {
+        ret = combine(w, local + loff, roff, len, arg);
+    } else {
+        /* the pending extent must not be read stale or overtaken */
+        if (w->lo != w->hi && roff < w->hi && roff + len > w->lo)
+            ret = flush(w, arg);
+        if (!ret)
+            ret = w->xfer(arg, write, loff, roff, len);
+    }
+    pthread_mutex_unlock(&w->lock);
+    return ret;
+}
+
+int
+lib_wc_flush(struct lib_wc *w, void *arg)
+{
+    int ret;
+
+    pthread_mutex_lock(&w->lock);
+    ret = (w->failed ? -1 : flush(w, arg));
+    w->failed = false;
+    pthread_mutex_unlock(&w->lock);
+    return ret;
+}
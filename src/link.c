@@ -0,0 +1,610 @@
+/**
+ * file: link.c
+ * desc: persistent per-peer daemon connections with coalesced sends
+ *
+ * A frame on the socket is
+ *
+ *   u32 length of what follows | u16 entries | u16 reserved | entries ...
+ *
+ * and each entry is
+ *
+ *   u64 sequence | u8 kind | 3 bytes reserved | wire encoded message
+ *
+ * the message being self-delimiting through its wire header. Requests carry
+ * a sequence number unique to the sending side of the link; the reply echoes
+ * it back so the waiting caller can be found.
+ */
+
+/* System includes */
+#include <endian.h>
+#include <errno.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+/* Other project includes */
+
+/* Project includes */
+#include <debug.h>
+#include <link.h>
+#include <msg.h>
+#include <nodefile.h>
+#include <sock.h>
+#include <util/list.h>
+#include <wire.h>
+
+/* Internal definitions */
+
+#define FRAME_HDR_LEN       8
+#define ENTRY_HDR_LEN       12
+/* largest frame a receiver accepts */
+#define FRAME_MAX           (1 << 20)
+
+#define DFT_DELAY_US        0
+#define DFT_BATCH_BYTES     16384
+
+enum entry_kind
+{
+  ENTRY_ONEWAY = 0,
+  ENTRY_REQUEST,
+  ENTRY_REPLY
+};
+
+/* an encoded entry waiting in a link's send queue */
+struct link_out
+{
+  struct list_head link;
+  size_t len;
+  uint8_t data[ENTRY_HDR_LEN + WIRE_MSG_MAX];
+};
+
+/* a caller blocked in link_send_recv */
+struct link_wait
+{
+  struct list_head link;
+  uint64_t seq;
+  bool done;
+  int err;
+  struct message *msg;
+  pthread_cond_t cond;
+};
+
+struct peer_link
+{
+  int rank; /* peer, or -1 for accepted links */
+  int peer; /* rank at the other end, -1 until known */
+  struct sockconn conn;
+  pthread_mutex_t lock;
+  pthread_cond_t send_cond;
+  bool alive;
+  int refs;
+  int corked; /* > 0 while the receive thread works through a batch */
+
+  struct list_head sendq;
+  size_t queued; /* bytes in sendq */
+  struct list_head waiters;
+  uint64_t next_seq;
+
+  pthread_t send_tid, recv_tid;
+};
+
+/* Internal state */
+
+static link_handler_t handler;
+static int delay_us = DFT_DELAY_US;
+static size_t batch_bytes = DFT_BATCH_BYTES;
+
+/* outbound links, indexed by rank */
+static struct peer_link **peers;
+static pthread_mutex_t peers_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* traffic per peer rank, updated without locks */
+static struct link_stats *peer_stats;
+
+#define pstat_add(l, field, n)                                        \
+  do {                                                                \
+    if ((l)->peer >= 0)                                               \
+      __atomic_fetch_add(&peer_stats[(l)->peer].field, (uint64_t)(n), \
+          __ATOMIC_RELAXED);                                          \
+  } while (0)
+
+/* Private functions */
+
+  static void
+put_link(struct peer_link *l)
+{
+  struct link_out *o, *tmp;
+  bool last;
+
+  pthread_mutex_lock(&l->lock);
+  last = (--l->refs == 0);
+  pthread_mutex_unlock(&l->lock);
+  if (!last)
+    return;
+  list_for_each_entry_safe(o, tmp, &l->sendq, link) {
+    pstat_add(l, queued, -(int64_t)o->len);
+    list_del(&o->link);
+    free(o);
+  }
+  conn_close(&l->conn);
+  pthread_cond_destroy(&l->send_cond);
+  pthread_mutex_destroy(&l->lock);
+  free(l);
+}
+
+/* mark the link dead and release everyone waiting on it; lock held */
+  static void
+__kill_link(struct peer_link *l)
+{
+  struct link_wait *w, *tmp;
+
+  if (l->alive)
+    shutdown(l->conn.socket, SHUT_RDWR);
+  l->alive = false;
+  pthread_cond_broadcast(&l->send_cond);
+  list_for_each_entry_safe(w, tmp, &l->waiters, link) {
+    w->err = -1;
+    w->done = true;
+    list_del_init(&w->link);
+    pthread_cond_signal(&w->cond);
+  }
+}
+
+/* encode and queue one entry; lock held */
+  static int
+__enqueue(struct peer_link *l, uint64_t seq, enum entry_kind kind,
+    struct message *msg)
+{
+  struct link_out *o;
+  uint64_t seq_be = htobe64(seq);
+  int len;
+
+  if (!l->alive)
+    return -1;
+  if (!(o = malloc(sizeof(*o))))
+    return -1;
+  memcpy(o->data, &seq_be, sizeof(seq_be));
+  o->data[8] = kind;
+  memset(o->data + 9, 0, 3);
+  len = wire_pack(msg, o->data + ENTRY_HDR_LEN, WIRE_MSG_MAX);
+  if (len < 0) {
+    free(o);
+    return -1;
+  }
+  o->len = ENTRY_HDR_LEN + len;
+  list_add_tail(&o->link, &l->sendq);
+  l->queued += o->len;
+  pstat_add(l, queued, o->len);
+  pthread_cond_signal(&l->send_cond);
+  return 0;
+}
+
+/* drains the send queue, one write per batch */
+  static void *
+send_thread(void *arg)
+{
+  struct peer_link *l = (struct peer_link*)arg;
+  struct link_out *o, *tmp;
+  LIST_HEAD(batch);
+  uint8_t *frame;
+  size_t frame_len, cap = FRAME_HDR_LEN + batch_bytes + sizeof(o->data);
+  uint32_t len_be;
+  uint16_t count, count_be;
+  int ret;
+
+  if (!(frame = malloc(cap))) {
+    pthread_mutex_lock(&l->lock);
+    __kill_link(l);
+    pthread_mutex_unlock(&l->lock);
+    return NULL;
+  }
+
+  pthread_mutex_lock(&l->lock);
+  while (true) {
+    while (l->alive && list_empty(&l->sendq))
+      pthread_cond_wait(&l->send_cond, &l->lock);
+    if (!l->alive)
+      break;
+
+    /* give more messages a chance to join the batch */
+    if (delay_us > 0 && l->queued < batch_bytes) {
+      pthread_mutex_unlock(&l->lock);
+      usleep(delay_us);
+      pthread_mutex_lock(&l->lock);
+    }
+    while (l->alive && l->corked > 0 && l->queued < batch_bytes)
+      pthread_cond_wait(&l->send_cond, &l->lock);
+    if (!l->alive)
+      break;
+
+    frame_len = FRAME_HDR_LEN;
+    count = 0;
+    list_for_each_entry_safe(o, tmp, &l->sendq, link) {
+      if (count > 0 && (frame_len + o->len > cap || count == UINT16_MAX))
+        break;
+      list_move_tail(&o->link, &batch);
+      l->queued -= o->len;
+      pstat_add(l, queued, -(int64_t)o->len);
+      frame_len += o->len;
+      count++;
+    }
+    pthread_mutex_unlock(&l->lock);
+
+    len_be = htobe32(frame_len - 4);
+    count_be = htobe16(count);
+    memcpy(frame, &len_be, 4);
+    memcpy(frame + 4, &count_be, 2);
+    memset(frame + 6, 0, 2);
+    frame_len = FRAME_HDR_LEN;
+    list_for_each_entry_safe(o, tmp, &batch, link) {
+      memcpy(frame + frame_len, o->data, o->len);
+      frame_len += o->len;
+      list_del(&o->link);
+      free(o);
+    }
+    printd("rank %d: sending %u messages in %lu bytes\n",
+        l->rank, count, frame_len);
+    ret = conn_put(&l->conn, frame, frame_len);
+
+    pthread_mutex_lock(&l->lock);
+    if (ret < 1) {
+      printd("rank %d: send failed\n", l->rank);
+      __kill_link(l);
+      break;
+    }
+    pstat_add(l, tx_msgs, count);
+    pstat_add(l, tx_frames, 1);
+    pstat_add(l, tx_bytes, frame_len);
+  }
+  pthread_mutex_unlock(&l->lock);
+  free(frame);
+  return NULL;
+}
+
+/* hand one received entry to its waiter or the handler */
+  static void
+deliver(struct peer_link *l, uint64_t seq, enum entry_kind kind,
+    struct message *msg)
+{
+  struct link_wait *w;
+  struct link_in in;
+
+  if (kind == ENTRY_REPLY) {
+    pthread_mutex_lock(&l->lock);
+    list_for_each_entry(w, &l->waiters, link) {
+      if (w->seq == seq) {
+        *w->msg = *msg;
+        w->done = true;
+        list_del_init(&w->link);
+        pthread_cond_signal(&w->cond);
+        break;
+      }
+    }
+    pthread_mutex_unlock(&l->lock);
+    return;
+  }
+
+  in.link = l;
+  in.seq = seq;
+  in.want_reply = (kind == ENTRY_REQUEST);
+  handler(&in, msg);
+}
+
+/* reads frames and processes each batch as a whole */
+  static void *
+recv_thread(void *arg)
+{
+  struct peer_link *l = (struct peer_link*)arg;
+  uint8_t hdr[FRAME_HDR_LEN], *frame = NULL, *p, *end;
+  uint32_t len;
+  uint16_t count, num;
+  uint64_t seq;
+  size_t msg_len;
+  struct message msg;
+  int ret;
+
+  while (true) {
+    ret = conn_get(&l->conn, hdr, FRAME_HDR_LEN);
+    if (ret < 1)
+      break;
+    memcpy(&len, hdr, 4);
+    len = be32toh(len);
+    memcpy(&count, hdr + 4, 2);
+    count = be16toh(count);
+    if (len < FRAME_HDR_LEN - 4 || len > FRAME_MAX) {
+      printd("rank %d: bad frame length %u\n", l->rank, len);
+      break;
+    }
+    len -= FRAME_HDR_LEN - 4;
+    if (!(frame = realloc(frame, len > 0 ? len : 1)))
+      break;
+    if (len > 0 && conn_get(&l->conn, frame, len) < 1)
+      break;
+    printd("rank %d: got %u messages in %u bytes\n", l->rank, count, len);
+
+    /* hold back replies until the whole batch is handled */
+    pthread_mutex_lock(&l->lock);
+    l->corked++;
+    pthread_mutex_unlock(&l->lock);
+
+    p = frame;
+    end = frame + len;
+    num = 0;
+    while (count-- > 0 && end - p >= ENTRY_HDR_LEN + WIRE_HDR_LEN) {
+      memcpy(&seq, p, 8);
+      seq = be64toh(seq);
+      msg_len = WIRE_HDR_LEN + wire_body_len(p + ENTRY_HDR_LEN);
+      if (msg_len > (size_t)(end - p - ENTRY_HDR_LEN)) {
+        printd("rank %d: truncated entry\n", l->rank);
+        break;
+      }
+      if (wire_unpack(&msg, p + ENTRY_HDR_LEN, msg_len) == 0) {
+        /* accepted links learn who is calling from the first message */
+        if (l->peer < 0 && msg.rank >= 0 && msg.rank < node_file_entries) {
+          pthread_mutex_lock(&l->lock);
+          l->peer = msg.rank;
+          pthread_mutex_unlock(&l->lock);
+        }
+        deliver(l, seq, p[8], &msg);
+      }
+      p += ENTRY_HDR_LEN + msg_len;
+      num++;
+    }
+    pstat_add(l, rx_msgs, num);
+    pstat_add(l, rx_frames, 1);
+    pstat_add(l, rx_bytes, FRAME_HDR_LEN + len);
+
+    pthread_mutex_lock(&l->lock);
+    l->corked--;
+    pthread_cond_signal(&l->send_cond);
+    pthread_mutex_unlock(&l->lock);
+  }
+  free(frame);
+
+  printd("rank %d: link closed\n", l->rank);
+  pthread_mutex_lock(&peers_lock);
+  if (l->rank >= 0 && peers[l->rank] == l)
+    peers[l->rank] = NULL;
+  pthread_mutex_unlock(&peers_lock);
+
+  pthread_mutex_lock(&l->lock);
+  __kill_link(l);
+  pthread_mutex_unlock(&l->lock);
+  pthread_join(l->send_tid, NULL);
+  put_link(l);
+  return NULL;
+}
+
+/* wrap a connected socket and start its threads; the receive thread owns
+ * the returned reference */
+  static struct peer_link *
+new_link(int rank, struct sockconn *conn)
+{
+  struct peer_link *l;
+  int one = 1;
+
+  if (!(l = calloc(1, sizeof(*l))))
+    return NULL;
+  l->rank = rank;
+  l->peer = rank;
+  l->conn = *conn;
+  l->alive = true;
+  l->refs = 1;
+  l->next_seq = 1;
+  INIT_LIST_HEAD(&l->sendq);
+  INIT_LIST_HEAD(&l->waiters);
+  pthread_mutex_init(&l->lock, NULL);
+  pthread_cond_init(&l->send_cond, NULL);
+
+  /* batching is done here, don't let Nagle add its own delay */
+  setsockopt(l->conn.socket, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+  if (pthread_create(&l->send_tid, NULL, send_thread, (void*)l))
+    goto fail;
+  if (pthread_create(&l->recv_tid, NULL, recv_thread, (void*)l)) {
+    pthread_mutex_lock(&l->lock);
+    __kill_link(l);
+    pthread_mutex_unlock(&l->lock);
+    pthread_join(l->send_tid, NULL);
+    goto fail;
+  }
+  pthread_detach(l->recv_tid);
+  return l;
+
+fail:
+  pthread_cond_destroy(&l->send_cond);
+  pthread_mutex_destroy(&l->lock);
+  free(l);
+  return NULL;
+}
+
+/* outbound link to rank, connecting on first use; caller must put_link */
+  static struct peer_link *
+get_link(int rank)
+{
+  struct peer_link *l = NULL;
+  struct sockconn conn;
+  char port[HOST_NAME_MAX];
+
+  BUG(rank < 0 || rank > node_file_entries - 1);
+
+  pthread_mutex_lock(&peers_lock);
+  if (!(l = peers[rank])) {
+    snprintf(port, HOST_NAME_MAX, "%d", node_file[rank].ocm_port);
+    if (conn_connect(&conn, node_file[rank].ip_eth, port))
+      goto out;
+    if (!(l = new_link(rank, &conn))) {
+      conn_close(&conn);
+      goto out;
+    }
+    peers[rank] = l;
+    printd("connected to rank %d\n", rank);
+  }
+  pthread_mutex_lock(&l->lock);
+  l->refs++;
+  pthread_mutex_unlock(&l->lock);
+out:
+  pthread_mutex_unlock(&peers_lock);
+  return l;
+}
+
+/* Public functions */
+
+  int
+link_init(link_handler_t h)
+{
+  char *env;
+
+  BUG(!h);
+  handler = h;
+  if ((env = getenv("OCM_LINK_DELAY_US")))
+    delay_us = atoi(env);
+  if ((env = getenv("OCM_LINK_BATCH_BYTES")) && atoi(env) > 0)
+    batch_bytes = atoi(env);
+  /* receivers drop the link on frames larger than FRAME_MAX, and a frame
+   * may run one entry past batch_bytes */
+  if (batch_bytes > FRAME_MAX - FRAME_HDR_LEN - sizeof(struct link_out))
+    batch_bytes = FRAME_MAX - FRAME_HDR_LEN - sizeof(struct link_out);
+  printd("link batching: delay %d us, %lu bytes\n", delay_us, batch_bytes);
+
+  peers = calloc(node_file_entries, sizeof(*peers));
+  peer_stats = calloc(node_file_entries, sizeof(*peer_stats));
+  if (!peers || !peer_stats)
+    return -1;
+  return 0;
+}
+
+  void
+link_fin(void)
+{
+  int rank;
+
+  if (!peers)
+    return;
+  pthread_mutex_lock(&peers_lock);
+  for (rank = 0; rank < node_file_entries; rank++) {
+    if (!peers[rank])
+      continue;
+    pthread_mutex_lock(&peers[rank]->lock);
+    __kill_link(peers[rank]);
+    pthread_mutex_unlock(&peers[rank]->lock);
+  }
+  pthread_mutex_unlock(&peers_lock);
+}
+
+  int
+link_accept(struct sockconn *conn)
+{
+  BUG(!conn);
+  return (new_link(-1, conn) ? 0 : -1);
+}
+
+  int
+link_send(int rank, struct message *msg)
+{
+  struct peer_link *l;
+  int ret;
+
+  BUG(!msg);
+  if (!(l = get_link(rank)))
+    return -1;
+  pthread_mutex_lock(&l->lock);
+  ret = __enqueue(l, 0, ENTRY_ONEWAY, msg);
+  pthread_mutex_unlock(&l->lock);
+  put_link(l);
+  return ret;
+}
+
+  int
+link_send_recv(int rank, struct message *msg)
+{
+  struct peer_link *l;
+  struct link_wait w;
+  int ret = -1;
+
+  BUG(!msg);
+  if (!(l = get_link(rank)))
+    return -1;
+
+  memset(&w, 0, sizeof(w));
+  INIT_LIST_HEAD(&w.link);
+  w.msg = msg;
+  pthread_cond_init(&w.cond, NULL);
+
+  pthread_mutex_lock(&l->lock);
+  w.seq = l->next_seq++;
+  list_add_tail(&w.link, &l->waiters);
+  if (__enqueue(l, w.seq, ENTRY_REQUEST, msg)) {
+    list_del(&w.link);
+    pthread_mutex_unlock(&l->lock);
+    goto out;
+  }
+  pstat_add(l, waiting, 1);
+  while (!w.done)
+    pthread_cond_wait(&w.cond, &l->lock);
+  pstat_add(l, waiting, -1);
+  pthread_mutex_unlock(&l->lock);
+  ret = w.err;
+
+out:
+  pthread_cond_destroy(&w.cond);
+  put_link(l);
+  return ret;
+}
+
+  int
+link_reply(struct link_in *in, struct message *msg)
+{
+  struct peer_link *l;
+  int ret;
+
+  BUG(!in || !msg);
+  if (!in->want_reply)
+    return 0;
+  l = in->link;
+  pthread_mutex_lock(&l->lock);
+  ret = __enqueue(l, in->seq, ENTRY_REPLY, msg);
+  pthread_mutex_unlock(&l->lock);
+  in->want_reply = false; /* one reply per request */
+  return ret;
+}
+
+  void
+link_hold(struct link_in *in)
+{
+  BUG(!in);
+  pthread_mutex_lock(&in->link->lock);
+  in->link->refs++;
+  pthread_mutex_unlock(&in->link->lock);
+}
+
+  void
+link_release(struct link_in *in)
+{
+  BUG(!in);
+  put_link(in->link);
+}
+
+  int
+link_get_stats(int rank, struct link_stats *stats)
+{
+  struct link_stats *ps;
+
+  if (!stats || !peer_stats || rank < 0 || rank > node_file_entries - 1)
+    return -1;
+  ps = &peer_stats[rank];
+  stats->tx_msgs   = __atomic_load_n(&ps->tx_msgs, __ATOMIC_RELAXED);
+  stats->tx_frames = __atomic_load_n(&ps->tx_frames, __ATOMIC_RELAXED);
+  stats->tx_bytes  = __atomic_load_n(&ps->tx_bytes, __ATOMIC_RELAXED);
+  stats->rx_msgs   = __atomic_load_n(&ps->rx_msgs, __ATOMIC_RELAXED);
+  stats->rx_frames = __atomic_load_n(&ps->rx_frames, __ATOMIC_RELAXED);
+  stats->rx_bytes  = __atomic_load_n(&ps->rx_bytes, __ATOMIC_RELAXED);
+  stats->queued    = __atomic_load_n(&ps->queued, __ATOMIC_RELAXED);
+  stats->waiting   = __atomic_load_n(&ps->waiting, __ATOMIC_RELAXED);
+  return 0;
+}
@@ -0,0 +1,360 @@
+/**
+ * file: log.c
+ * desc: logging backend. Each thread owns a ring of formatted records that
+ * only it writes and only the drain thread reads, so logging takes no lock.
+ * The drain thread wakes periodically (or when a ring fills up), merges the
+ * rings by timestamp and writes the result to stderr in one go. A full ring
+ * drops messages and reports how many.
+ */
+
+/* System includes */
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Other project includes */
+
+/* Project includes */
+#include <log.h>
+#include <util/list.h>
+
+/* Internal definitions */
+
+#define RING_SLOTS          256     /* per thread, power of two */
+#define MSG_MAX             224
+#define DRAIN_PERIOD_MS     20
+#define OUT_BUF_LEN         (64 << 10)
+#define LINE_MAX_LEN        (MSG_MAX + 256)
+
+struct log_rec
+{
+    uint64_t ns; /* wall clock */
+    const char *file, *func;
+    int line;
+    char msg[MSG_MAX];
+};
+
+struct log_ring
+{
+    struct list_head link;
+    pid_t tid;
+    uint64_t head; /* next slot the owner fills */
+    uint64_t tail; /* next slot the drain thread reads */
+    uint64_t drain_to; /* head as seen when the current drain began */
+    uint64_t dropped;
+    bool dead; /* owner has exited */
+    struct log_rec rec[RING_SLOTS];
+};
+
+/* Internal state */
+
+int log_cur_level = -1;
+
+static LIST_HEAD(rings);
+/* held while rings are added, drained or removed */
+static pthread_mutex_t rings_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t drain_cond = PTHREAD_COND_INITIALIZER;
+static pthread_once_t setup_once = PTHREAD_ONCE_INIT;
+static pthread_key_t ring_key;
+static bool drain_running;
+static bool sync_mode;
+static unsigned int generation;
+
+static __thread struct log_ring *my_ring;
+/* generation my_ring was created in; an older one was freed by a fork, so
+ * my_ring must not be looked at */
+static __thread unsigned int my_gen;
+
+/* drain output, only touched with rings_lock held */
+static char out_buf[OUT_BUF_LEN];
+static size_t out_len;
+
+/* Private functions */
+
+static uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+static void
+write_all(const char *p, size_t len)
+{
+    ssize_t n;
+    while (len > 0) {
+        n = write(STDERR_FILENO, p, len);
+        if (n <= 0)
+            return;
+        p += n;
+        len -= n;
+    }
+}
+
+static int
+format_line(char *buf, size_t len, pid_t tid, const struct log_rec *rec)
+{
+    size_t msg_len = strnlen(rec->msg, MSG_MAX);
+    int n;
+
+    n = snprintf(buf, len, "%lu.%06lu (%d:%d) %s::%s[%d]: %s%s",
+            rec->ns / 1000000000UL, (rec->ns / 1000UL) % 1000000UL,
+            getpid(), tid, rec->file, rec->func, rec->line, rec->msg,
+            (msg_len && rec->msg[msg_len - 1] == '\n' ? "" : "\n"));
+    return (n < (int)len ? n : (int)len - 1);
+}
+
+static void
+out_append(const char *p, size_t len)
+{
+    if (out_len + len > OUT_BUF_LEN) {
+        write_all(out_buf, out_len);
+        out_len = 0;
+    }
+    memcpy(out_buf + out_len, p, len);
+    out_len += len;
+}
+
+/* write out all rings merged by time; rings_lock held */
+static void
+drain_rings(void)
+{
+    struct log_ring *r, *tmp, *next;
+    struct log_rec *rec;
+    char line[LINE_MAX_LEN];
+    uint64_t dropped;
+    int n;
+
+    list_for_each_entry(r, &rings, link)
+        r->drain_to = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+
+    while (true) {
+        next = NULL;
+        list_for_each_entry(r, &rings, link) {
+            if (r->tail == r->drain_to)
+                continue;
+            if (!next || r->rec[r->tail & (RING_SLOTS - 1)].ns <
+                    next->rec[next->tail & (RING_SLOTS - 1)].ns)
+                next = r;
+        }
+        if (!next)
+            break;
+        rec = &next->rec[next->tail & (RING_SLOTS - 1)];
+        n = format_line(line, sizeof(line), next->tid, rec);
+        out_append(line, n);
+        __atomic_store_n(&next->tail, next->tail + 1, __ATOMIC_RELEASE);
+    }
+
+    list_for_each_entry_safe(r, tmp, &rings, link) {
+        dropped = __atomic_exchange_n(&r->dropped, 0, __ATOMIC_RELAXED);
+        if (dropped) {
+            n = snprintf(line, sizeof(line), "(%d:%d) log: %lu messages "
+                    "dropped\n", getpid(), r->tid, dropped);
+            out_append(line, n);
+        }
+        if (__atomic_load_n(&r->dead, __ATOMIC_ACQUIRE) &&
+                r->tail == __atomic_load_n(&r->head, __ATOMIC_ACQUIRE)) {
+            list_del(&r->link);
+            free(r);
+        }
+    }
+
+    write_all(out_buf, out_len);
+    out_len = 0;
+}
+
+static void *
+drain_thread(void *arg)
+{
+    struct timespec ts;
+
+    pthread_mutex_lock(&rings_lock);
+    while (true) {
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_nsec += DRAIN_PERIOD_MS * 1000000L;
+        if (ts.tv_nsec >= 1000000000L) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&drain_cond, &rings_lock, &ts);
+        drain_rings();
+    }
+    pthread_mutex_unlock(&rings_lock);
+    return NULL;
+}
+
+/* rings_lock held */
+static int
+start_drain_thread(void)
+{
+    pthread_t tid;
+    sigset_t all, old;
+    int err;
+
+    /* signal handlers may exit() and flush the log, which must not find
+     * its lock held by an interrupted drain */
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    err = pthread_create(&tid, NULL, drain_thread, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (err)
+        return -1;
+    pthread_detach(tid);
+    drain_running = true;
+    return 0;
+}
+
+/* thread exit: the drain thread frees the ring once it is empty */
+static void
+ring_exit(void *arg)
+{
+    struct log_ring *r = (struct log_ring*)arg;
+    __atomic_store_n(&r->dead, true, __ATOMIC_RELEASE);
+    pthread_cond_signal(&drain_cond);
+}
+
+/* the child has only the forking thread; forget the parent's rings, whose
+ * contents the parent will write itself */
+static void
+atfork_child(void)
+{
+    struct log_ring *r, *tmp;
+
+    pthread_mutex_init(&rings_lock, NULL);
+    pthread_cond_init(&drain_cond, NULL);
+    list_for_each_entry_safe(r, tmp, &rings, link) {
+        list_del(&r->link);
+        free(r);
+    }
+    /* this thread's ring is gone too, don't let its exit touch it */
+    pthread_setspecific(ring_key, NULL);
+    generation++;
+    drain_running = false;
+    out_len = 0;
+}
+
+static void
+log_setup(void)
+{
+    sync_mode = (getenv("OCM_LOG_SYNC") != NULL);
+    pthread_key_create(&ring_key, ring_exit);
+    pthread_atfork(NULL, NULL, atfork_child);
+    atexit(log_flush);
+}
+
+static struct log_ring *
+get_ring(void)
+{
+    struct log_ring *r;
+
+    if (my_ring && my_gen == generation)
+        return my_ring;
+    if (!(r = calloc(1, sizeof(*r))))
+        return NULL;
+    r->tid = (pid_t)syscall(SYS_gettid);
+    INIT_LIST_HEAD(&r->link);
+
+    pthread_mutex_lock(&rings_lock);
+    if (!drain_running && start_drain_thread()) {
+        pthread_mutex_unlock(&rings_lock);
+        free(r);
+        sync_mode = true;
+        return NULL;
+    }
+    list_add_tail(&r->link, &rings);
+    pthread_mutex_unlock(&rings_lock);
+
+    pthread_setspecific(ring_key, r);
+    my_ring = r;
+    my_gen = generation;
+    return r;
+}
+
+/* Public functions */
+
+int
+log_level_init(void)
+{
+    const char *env;
+    int level = OCM_LOG_WARN;
+
+    if ((env = getenv("OCM_LOG_LEVEL"))) {
+        if (!strcasecmp(env, "error"))
+            level = OCM_LOG_ERROR;
+        else if (!strcasecmp(env, "warn"))
+            level = OCM_LOG_WARN;
+        else if (!strcasecmp(env, "info"))
+            level = OCM_LOG_INFO;
+        else if (!strcasecmp(env, "debug"))
+            level = OCM_LOG_DEBUG;
+        else if (*env >= '0' && *env <= '9')
+            level = atoi(env);
+    } else if (getenv("OCM_VERBOSE")) {
+        level = OCM_LOG_DEBUG;
+    }
+    __atomic_store_n(&log_cur_level, level, __ATOMIC_RELAXED);
+    return level;
+}
+
+void
+log_write(int level, const char *file, const char *func, int line,
+        const char *fmt, ...)
+{
+    struct log_ring *r = NULL;
+    struct log_rec *rec, tmp;
+    char buf[LINE_MAX_LEN];
+    uint64_t head, used;
+    va_list ap;
+
+    pthread_once(&setup_once, log_setup);
+    if (!sync_mode)
+        r = get_ring();
+
+    if (!r) {
+        rec = &tmp;
+    } else {
+        head = r->head;
+        used = head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+        if (used >= RING_SLOTS) {
+            __atomic_fetch_add(&r->dropped, 1, __ATOMIC_RELAXED);
+            pthread_cond_signal(&drain_cond);
+            return;
+        }
+        rec = &r->rec[head & (RING_SLOTS - 1)];
+    }
+
+    rec->ns   = now_ns();
+    rec->file = file;
+    rec->func = func;
+    rec->line = line;
+    va_start(ap, fmt);
+    vsnprintf(rec->msg, MSG_MAX, fmt, ap);
+    va_end(ap);
+
+    if (!r) {
+        write_all(buf, format_line(buf, sizeof(buf),
+                    (pid_t)syscall(SYS_gettid), rec));
+        return;
+    }
+    __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+    if (used + 1 >= RING_SLOTS * 3 / 4)
+        pthread_cond_signal(&drain_cond);
+}
+
+void
+log_flush(void)
+{
+    pthread_once(&setup_once, log_setup);
+    pthread_mutex_lock(&rings_lock);
+    drain_rings();
+    pthread_mutex_unlock(&rings_lock);
+}
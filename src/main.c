@@ -8,6 +8,7 @@
  */
 
 /* System includes */
+#include <limits.h>
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -20,6 +21,10 @@
 #include <debug.h>
 #include <mem.h>
 #include <pmsg.h>
+#include <stats.h>
+#include <topo.h>
+#include <trace.h>
+#include <wire.h>
 
 //Create a signal handler to handle closing the daemon
 #include <signal.h>
@@ -72,6 +77,8 @@ process_msg(struct message *msg)
         lock_apps();
         list_add(&app->link, &apps);
         unlock_apps();
+        stats_inc(STATS_APPS);
+        stats_inc(STATS_APPS_TOTAL);
 
         if (pmsg_attach(app->pid) < 0) {
             fprintf(stderr, "error attaching new pid %d\n", app->pid);
@@ -80,7 +87,8 @@ process_msg(struct message *msg)
 
         msg->type = MSG_CONNECT_CONFIRM;
         msg->status = MSG_RESPONSE;
-        pmsg_send(app->pid, msg);
+        wire_pmsg_send(app->pid, msg);
+        stats_inc(STATS_PMSG_OUT);
     }
 
     else if (msg->type == MSG_DISCONNECT) {
@@ -92,6 +100,7 @@ process_msg(struct message *msg)
         BUG(!app);
         list_del(&app->link);
         unlock_apps();
+        stats_dec(STATS_APPS);
 
         printd("app %d found, detaching\n", msg->pid);
         pmsg_detach(app->pid);
@@ -113,12 +122,15 @@ poll_mailbox(void *arg)
         /* <-- send out */
         while (!q_empty(&outbox)) {
             q_pop(&outbox, &msg);
-            pmsg_send(msg.pid, &msg);
+            stats_dec(STATS_OUTBOX);
+            wire_pmsg_send(msg.pid, &msg);
+            stats_inc(STATS_PMSG_OUT);
         }
         /* --> pull in for processing */
         while (pmsg_pending() > 0) {
-            if (pmsg_recv(&msg, false) < 0)
+            if (wire_pmsg_recv(&msg, false) < 0)
                 pthread_exit(NULL);
+            stats_inc(STATS_PMSG_IN);
             printd("got a msg: %d\n", msg.type);
             process_msg(&msg);
         }
@@ -162,7 +174,14 @@ notify_rank0(void)
 static void
 usage(int argc, char *argv[])
 {
-    fprintf(stderr, "Usage: %s nodefile\n", *argv);
+    fprintf(stderr, "Usage: %s nodefile [rank]\n"
+            "\trank (or env OCM_RANK) selects the nodefile entry to run as instead\n"
+            "\tof matching the hostname, so several daemons can share a host.\n"
+            "\tApps pick their daemon with the same OCM_RANK variable.\n"
+            "\tStatistics are served on the Unix socket OCM_STATS_SOCK\n"
+            "\t(default /tmp/oncillamem<rank>.sock). If OCM_TRACE names a\n"
+            "\tdirectory, request spans are recorded there (see ocm_trace).\n",
+            *argv);
 }
 
 static int run_flag;
@@ -175,6 +194,8 @@ static void sighandler(int sig)
     run_flag = 0;
 
     //Stop any threads and destroy any state 
+    stats_fin();
+    trace_fin();
     mem_fin();
 
     //Remove any mqueues that are in /dev/mqueue
@@ -186,26 +207,54 @@ static void sighandler(int sig)
 
 int main(int argc, char *argv[])
 {
+    int rank = -1;
+    char *env, stats_path[PATH_MAX], name[64];
+
     signal(SIGINT, &sighandler);
     run_flag = 1;
 
     printd("Verbose printing enabled\n");
 
-    if (argc != 2) {
+    if (argc != 2 && argc != 3) {
         usage(argc, argv);
         return -1;
     }
+    if (argc == 3)
+        rank = atoi(argv[2]);
+    else if ((env = getenv("OCM_RANK")))
+        rank = atoi(env);
 
     q_init(&outbox, sizeof(struct message));
 
-    if (mem_init(argv[1]))
+    /* every thread started from here on polls or fills NIC buffers */
+    if (topo_bind_thread(topo_nic_node()))
+        fprintf(stderr, "could not run on the NIC's NUMA node\n");
+
+    if (mem_init(argv[1], rank))
+        return -1;
+
+    /* monitoring is optional, the daemon runs without it */
+    if ((env = getenv("OCM_STATS_SOCK")))
+        snprintf(stats_path, sizeof(stats_path), "%s", env);
+    else
+        snprintf(stats_path, sizeof(stats_path), "/tmp/oncillamem%d.sock",
+                mem_get_rank());
+    if (stats_init(stats_path))
+        fprintf(stderr, "no statistics endpoint at %s\n", stats_path);
+    snprintf(name, sizeof(name), "oncillamem rank %d", mem_get_rank());
+    if (trace_init(name, mem_get_rank()))
+        fprintf(stderr, "not tracing, cannot write to %s\n",
+                getenv("OCM_TRACE"));
+
+    /* each instance on a host gets its own mailbox */
+    if (rank >= 0 && pmsg_set_instance(rank))
         return -1;
 
     /* <-- mem sends msgs to apps via this queue */
     mem_set_outbox(&outbox);
 
     pmsg_cleanup();
-    if (pmsg_init(sizeof(struct message)))
+    if (pmsg_init(WIRE_MSG_MAX))
         return -1;
     if (pmsg_open(PMSG_DAEMON_PID))
         return -1;
@@ -24,7 +24,10 @@
 #include <sock.h>
 #include <util/queue.h>
 #include <nodefile.h>
+#include <link.h>
 #include <signal.h>
+#include <stats.h>
+#include <trace.h>
 
 /* Directory includes */
 
@@ -35,6 +38,8 @@
 /* Internal state */
 static int myrank = -1;
 #ifdef INFINIBAND
+//Port of the first RDMA CM listener; taken from the nodefile's rdmacm_port
+//when given so daemons sharing a host don't collide
 static int ib_port = 67980;
 #endif
 
@@ -43,6 +48,9 @@ static pthread_t listen_tid;
 //A sequentially increasing allocation ID that identifies remote allocations
 //so they can be freed properly
 static uint64_t rem_alloc_id  = 1;
+//Inbound threads run concurrently, one per connection, so ID and port
+//assignment must be serialized
+static pthread_mutex_t rem_alloc_lock = PTHREAD_MUTEX_INITIALIZER;
 
 /* TODO need list representing pending alloc requests */
 
@@ -55,6 +63,7 @@ send_pid(struct message *m, pid_t to_pid)
 {
   printd("%s %d\n", __func__, to_pid);
   m->pid = to_pid;
+  stats_inc(STATS_OUTBOX);
   q_push(outbox, m);
 }
 
@@ -62,52 +71,18 @@ send_pid(struct message *m, pid_t to_pid)
   static int
 send_recv_msg(struct message *msg, int rank)
 {
-  int ret = -1, i = 2;
-  char port[HOST_NAME_MAX];
-  struct sockconn conn;
-  memset(&conn, 0, sizeof(conn));
   BUG(!msg);
   BUG(rank > node_file_entries - 1);
-  snprintf(port, HOST_NAME_MAX, "%d", node_file[rank].ocm_port);
-  if (conn_connect(&conn, node_file[rank].ip_eth, port))
-    goto out;
-  while (i-- > 0) {
-    switch (i) {
-      case 1: ret = conn_put(&conn, msg, sizeof(*msg)); break;
-      case 0: ret = conn_get(&conn, msg, sizeof(*msg)); break;
-    }
-    if (--ret < 0) /* 0 means remote closed; turn into error condition */
-      break;
-  }
-  if (ret < 0 || (ret = conn_close(&conn)))
-    goto out;
-  ret = 0;
-out:
-  /* TODO close connection on error */
-  return ret;
+  return link_send_recv(rank, msg);
 }
 
 /* send 1 message to rank */
   static int
 send_msg(struct message *msg, int rank)
 {
-  int ret = -1;
-  char port[HOST_NAME_MAX];
-  struct sockconn conn;
-  memset(&conn, 0, sizeof(conn));
   BUG(!msg);
   BUG(rank > node_file_entries - 1);
-  snprintf(port, HOST_NAME_MAX, "%d", node_file[rank].ocm_port);
-  if (conn_connect(&conn, node_file[rank].ip_eth, port))
-    goto out;
-  ret = conn_put(&conn, msg, sizeof(*msg));
-  if (--ret < 0) /* 0 means remote closed; turn into error condition */
-    goto out;
-  if ((ret = conn_close(&conn)))
-    goto out;
-  ret = 0;
-out:
-  return ret;
+  return link_send(rank, msg);
 }
 
 /* message handlers */
@@ -164,8 +139,11 @@ out:
   static void
 msg_recv_do_alloc(struct message *msg)
 {
+  uint64_t start = stats_now();
   BUG(!msg);
   __msg_do_alloc(msg);
+  stats_phase(STATS_PH_SERVE_ALLOC, start);
+  trace_span(msg->trace_id, "serve_alloc", start);
 }
 
   static void
@@ -198,8 +176,11 @@ out:
   static void
 msg_recv_do_free(struct message *msg) 
 { 
+  uint64_t start = stats_now();
   BUG(!msg);
   __msg_do_free(msg);
+  stats_phase(STATS_PH_SERVE_FREE, start);
+  trace_span(msg->trace_id, "serve_free", start);
 }
 
 
@@ -234,6 +215,7 @@ __msg_req_free(struct message *msg)
 msg_send_req_alloc(struct message *msg)
 {
   int ret = 0;
+  uint64_t start = stats_now();
   BUG(!msg);
   BUG(msg->type != MSG_REQ_ALLOC);
 
@@ -244,15 +226,20 @@ msg_send_req_alloc(struct message *msg)
     ret = send_recv_msg(msg, 0);
   if (ret)
     goto out;
+  stats_phase(STATS_PH_PLACE, start);
+  trace_span(msg->trace_id, "place", start);
 
   printd("got alloc type %d\n", msg->u.alloc.type);
   if ((msg->u.alloc.type != ALLOC_MEM_HOST) && (msg->u.alloc.type != ALLOC_MEM_GPU)) {
     msg->type   = MSG_DO_ALLOC;
     msg->status = MSG_REQUEST;
     /* TODO support multiple allocs across nodes here */
+    start = stats_now();
     ret = send_recv_msg(msg, msg->u.alloc.remote_rank);
     if (ret)
       goto out;
+    stats_phase(STATS_PH_DO_ALLOC, start);
+    trace_span(msg->trace_id, "do_alloc", start);
   }
   ret = 0;
 out:
@@ -282,9 +269,12 @@ msg_send_req_free(struct message *msg)
   printd("Sending free for allocation type %d to remote rank %d\n", msg->u.alloc.type, msg->u.alloc.remote_rank);
   if ((msg->u.alloc.type == ALLOC_MEM_RDMA) || (msg->u.alloc.type == ALLOC_MEM_RMA))
   {
+    uint64_t start = stats_now();
     ret = send_recv_msg(msg, msg->u.alloc.remote_rank);
     if (ret)
       goto out;
+    stats_phase(STATS_PH_DO_FREE, start);
+    trace_span(msg->trace_id, "do_free", start);
   }
   else
     BUG(1);
@@ -298,9 +288,11 @@ out:
   static void
 msg_recv_req_alloc(struct message *msg)
 {
+  uint64_t start = trace_now();
   BUG(!msg); BUG(myrank != 0);
   printd("got msg from rank%d\n", msg->rank);
   __msg_req_alloc(msg);
+  trace_span(msg->trace_id, "find_node", start);
 }
 
 //Message received at master node, rank 0
@@ -314,94 +306,157 @@ msg_recv_req_free(struct message *msg)
 
 /* threads */
 
-/* <-- process requests from other daemons */
-  static void *
-inbound_thread(void *arg)
+/* an inbound request served off the link's receive thread */
+struct inbound_work
 {
-  struct sockconn *conn = (struct sockconn*)arg;
+  struct link_in in;
   struct message msg;
+};
+
+#ifdef INFINIBAND
+/* rdma_accept blocks until the app connects, so it runs off the link's
+ * receive thread */
+  static void *
+do_alloc_thread(void *arg)
+{
+  struct message *msg = (struct message*)arg;
+  msg_recv_do_alloc(msg); /* blocks */
+  free(msg);
+  return NULL;
+}
+#endif
+
+/* setting up or tearing down a buffer and its IB/EXTOLL state would hold up
+ * every other message of the peer, so it is done here and the reply sent
+ * from here */
+  static void *
+do_serve_thread(void *arg)
+{
+  struct inbound_work *w = (struct inbound_work*)arg;
+
+  if (w->msg.type == MSG_DO_ALLOC)
+    msg_recv_do_alloc(&w->msg);
+  else
+    msg_recv_do_free(&w->msg);
+  if (link_reply(&w->in, &w->msg))
+    printd("could not reply to %s\n", MSG_TYPE2STR(w->msg.type));
+  link_release(&w->in);
+  free(w);
+  return NULL;
+}
+
+  static void
+serve_detached(struct link_in *in, struct message *msg)
+{
+  struct inbound_work *w;
+  pthread_t tid;
+
+  BUG(!(w = malloc(sizeof(*w))));
+  w->in = *in;
+  w->msg = *msg;
+  link_hold(&w->in);
+  /* the reply is the worker's now */
+  in->want_reply = false;
+  BUG(pthread_create(&tid, NULL, do_serve_thread, (void*)w));
+  BUG(pthread_detach(tid));
+}
+
+/* <-- process requests from other daemons; runs on the link's receive
+ * thread, once per message of a received batch */
+  static void
+inbound_msg(struct link_in *in, struct message *msg)
+{
   int ret = 0;
-  BUG(!conn);
-  printd("spawned\n");
-  while (true) {
-    ret = conn_get(conn, &msg, sizeof(msg));
-    if (ret < 1)
-      break;
-    printd("got msg %s\n", MSG_TYPE2STR(msg.type));
-    if (msg.type == MSG_ADD_NODE) {
-      alloc_add_node(msg.rank, &msg.u.node.config);
-    } else if (msg.type == MSG_REQ_ALLOC) {
-      //Currently only rank 0 can handle inital allocation request
-      //messages to determine the rank of the node that will fulfill
-      //the allocation
-      BUG(myrank != 0);
-      msg_recv_req_alloc(&msg);
-      ret = conn_put(conn, &msg, sizeof(msg));
-      if (--ret < 0)
-        break;
-    } else if (msg.type == MSG_DO_ALLOC) {
-
-      //As remote allocations are created, assign them an identifying ID
-      printd("Remote allocation has local ID of %lu\n", rem_alloc_id);
-      msg.u.alloc.rem_alloc_id = rem_alloc_id;
-      //Increment the ID for each allocation
-      rem_alloc_id++;
+#ifdef INFINIBAND
+  struct message *copy;
+  pthread_t tid;
+#endif
+
+  printd("got msg %s\n", MSG_TYPE2STR(msg->type));
+  if (msg->type == MSG_ADD_NODE) {
+    alloc_add_node(msg->rank, &msg->u.node.config);
+  } else if (msg->type == MSG_REQ_ALLOC) {
+    //Currently only rank 0 can handle inital allocation request
+    //messages to determine the rank of the node that will fulfill
+    //the allocation
+    BUG(myrank != 0);
+    msg_recv_req_alloc(msg);
+    ret = link_reply(in, msg);
+  } else if (msg->type == MSG_DO_ALLOC) {
+
+    //As remote allocations are created, assign them an identifying ID
+    //A batch of buffers takes one ID (and RDMA port) per buffer
+    if (msg->u.alloc.count == 0)
+      msg->u.alloc.count = 1;
+    pthread_mutex_lock(&rem_alloc_lock);
+    printd("Remote allocation has local ID of %lu (%u buffers)\n",
+        rem_alloc_id, msg->u.alloc.count);
+    msg->u.alloc.rem_alloc_id = rem_alloc_id;
+    //Increment the ID for each allocation
+    rem_alloc_id += msg->u.alloc.count;
+#ifdef INFINIBAND
+    if (msg->u.alloc.type == ALLOC_MEM_RDMA) {
+      msg->u.alloc.u.rdma.port = ib_port;
+      ib_port += msg->u.alloc.count;
+    }
+#endif
+    pthread_mutex_unlock(&rem_alloc_lock);
 
 #ifdef INFINIBAND
+    if (msg->u.alloc.type == ALLOC_MEM_RDMA) {
       /* First, send msg back to orig rank to unblock app, so it can
        * initiate connection to us. Then listen for connections.
        * XXX possible race condition
        */
-      msg.u.alloc.u.rdma.port = ib_port;
-      ib_port += 1;
-
-      ret = conn_put(conn, &msg, sizeof(msg));
-      if (--ret < 0)
-        break;
-      msg_recv_do_alloc(&msg); /* blocks */
+      ret = link_reply(in, msg);
+      if (ret)
+        goto out;
+      BUG(!(copy = malloc(sizeof(*copy))));
+      *copy = *msg;
+      BUG(pthread_create(&tid, NULL, do_alloc_thread, (void*)copy));
+      BUG(pthread_detach(tid));
+    }
 #endif
 #ifdef EXTOLL
+    if (msg->u.alloc.type == ALLOC_MEM_RMA) {
       /* EXTOLL server allocations are nonblocking and the call to
-       * alloc_ate should return the needed setup parameters for the client
-       * in msg.
+       * alloc_ate returns the needed setup parameters for the client in
+       * msg, but registering the buffer still takes a while.
        */
-      msg_recv_do_alloc(&msg); /* should not block for EXTOLL setup */
-      ret = conn_put(conn, &msg, sizeof(msg));
-
-#endif
-    } 
-    else if (msg.type == MSG_DO_FREE) 
-    {
-      printd("InboundThread received free request for allocation \n");
-      //Free the remote allocation
-      msg_recv_do_free(&msg);
-      ret = conn_put(conn, &msg, sizeof(msg));
-
-    } else if (msg.type == MSG_REQ_FREE) {
-      //TODO - should only be received at root node and releases data structures
-      //that hold information about this allocation
-      ret = 0;
-      ret = conn_put(conn, &msg, sizeof(msg));
-    } else {
-      printd("unhandled message %s\n", MSG_TYPE2STR(msg.type));
-      BUG(1);
+      serve_detached(in, msg);
     }
+#endif
   }
-  printd("exiting %s\n", (ret < 0 ? "with error" : "normally"));
-  if (ret) BUG(1);
-  return NULL;
+  else if (msg->type == MSG_DO_FREE)
+  {
+    printd("InboundThread received free request for allocation \n");
+    //Free the remote allocation
+    serve_detached(in, msg);
+
+  } else if (msg->type == MSG_REQ_FREE) {
+    //TODO - should only be received at root node and releases data structures
+    //that hold information about this allocation
+    ret = link_reply(in, msg);
+  } else {
+    printd("unhandled message %s\n", MSG_TYPE2STR(msg->type));
+    BUG(1);
+  }
+#ifdef INFINIBAND
+out:
+#endif
+  if (ret)
+    printd("could not reply to %s\n", MSG_TYPE2STR(msg->type));
 }
 
 
 ///listen_thread is spawned on each node from the mem_init call and it
-///creates a connection to a socket on the OCM port. It also spawns
-///inbound_thread to listen for new messages on this port
+///creates a connection to a socket on the OCM port. Each accepted
+///connection becomes a link whose messages go to inbound_msg
   static void *
 listen_thread(void *arg) /* persistent */
 {
   struct sockconn conn;
-  struct sockconn newconn, *newp;
-  pthread_t tid; /* not used */
+  struct sockconn newconn;
   int ret = -1;
   char port[HOST_NAME_MAX];
 
@@ -416,13 +471,7 @@ listen_thread(void *arg) /* persistent */
   while (true) {
     if ((ret = conn_accept(&conn, &newconn)))
       break;
-    ret = -1;
-    if (!(newp = malloc(sizeof(*newp))))
-      break;
-    *newp = newconn;
-    if (pthread_create(&tid, NULL, inbound_thread, (void*)newp))
-      break;
-    if (pthread_detach(tid))
+    if ((ret = link_accept(&newconn)))
       break;
   }
 
@@ -438,6 +487,7 @@ request_thread(void *arg)
 {
   int ret = -1;
   struct message *msg = (struct message*)arg;
+  uint64_t start = stats_now();
   BUG(!msg);
   printd("spawned, msg %s\n", MSG_TYPE2STR(msg->type));
   msg->rank = myrank;
@@ -446,22 +496,30 @@ request_thread(void *arg)
     if(ret)
       printd("Please check that the master node (typically first host in the nodefile) has been started first\n");
   } else if (msg->type == MSG_REQ_ALLOC) {
+    stats_inc(STATS_REQ_ALLOC);
     ret = msg_send_req_alloc(msg);
     //release the request thread since the request has finished
     msg->type = MSG_RELEASE_APP;
     send_pid(msg, msg->pid);
+    stats_phase(STATS_PH_APP_ALLOC, start);
+    trace_span(msg->trace_id, "request", start);
   } else if (msg->type == MSG_REQ_FREE) {
+    stats_inc(STATS_REQ_FREE);
     ret = msg_send_req_free(msg);
     msg->type = MSG_RELEASE_APP;
     send_pid(msg, msg->pid);
+    stats_phase(STATS_PH_APP_FREE, start);
+    trace_span(msg->trace_id, "request", start);
 
   } else {
     __detailed_print("unhandled message %s\n", MSG_TYPE2STR(msg->type));
     BUG(1);
   }
 
-  if (ret)
+  if (ret) {
+    stats_inc(STATS_REQ_ERRORS);
     __detailed_print("error sending message %s\n", MSG_TYPE2STR(msg->type));
+  }
 
   //If MSG_ADD_NODE fails, this is not necessarily a bug - it just means the root node has not been
   //added yet. We want to handle this case by closing gracefully.
@@ -474,6 +532,7 @@ request_thread(void *arg)
   }
 
   free(msg);
+  stats_dec(STATS_REQS_INFLIGHT);
   printd("Exiting %s\n", (ret < 0 ? "with error" : "normally"));
   if (ret) BUG(1);
   pthread_exit(NULL);
@@ -482,15 +541,22 @@ request_thread(void *arg)
 /* Public functions */
 
   int
-mem_init(const char *nodefile_path)
+mem_init(const char *nodefile_path, int rank)
 {
   //pthread_t tid; /* not used */
   printd("memory interface initializing\n");
 
-  if (parse_nodefile(nodefile_path, &myrank))
+  if (parse_nodefile(nodefile_path, rank, &myrank))
     return -1;
   printd("I am rank %d\n", myrank);
   BUG(myrank < 0);
+#ifdef INFINIBAND
+  if (node_file[myrank].rdmacm_port > 0)
+    ib_port = node_file[myrank].rdmacm_port;
+#endif
+
+  if (link_init(inbound_msg))
+    return -1;
 
   if (pthread_create(&listen_tid, NULL, listen_thread, NULL))
     return -1;
@@ -507,6 +573,7 @@ mem_fin(void)
 {
   //Kill listen thread
   pthread_cancel(listen_tid);
+  link_fin();
 }
 
 /* message received from application */
@@ -519,8 +586,11 @@ mem_new_request(struct message *m)
   if (!m || !new_msg)
     goto out;
   *new_msg = *m;
-  if (pthread_create(&tid, NULL, request_thread, (void*)new_msg))
+  stats_inc(STATS_REQS_INFLIGHT);
+  if (pthread_create(&tid, NULL, request_thread, (void*)new_msg)) {
+    stats_dec(STATS_REQS_INFLIGHT);
     goto out;
+  }
   if (pthread_detach(tid))
     goto out;
   ret = 0;
@@ -528,6 +598,12 @@ out:
   return ret;
 }
 
+  int
+mem_get_rank(void)
+{
+  return myrank;
+}
+
   void
 mem_set_outbox(struct queue *q)
 {
@@ -37,7 +37,7 @@ and cause setup to fail.
 */
 
 int
-parse_nodefile(const char *path, int *_myrank /* out */)
+parse_nodefile(const char *path, int myrank, int *_myrank /* out */)
 {
     int entries = 0;
     char *buf = NULL;
@@ -89,16 +89,25 @@ parse_nodefile(const char *path, int *_myrank /* out */)
                 e->dns, e->ip_eth, &e->ocm_port, &e->rdmacm_port);
     }
 
-    if (gethostname(buf, HOST_NAME_MAX))
-        goto out;
-    rank = entries;
-    while (rank-- > 0)
-        if (0 == strncmp(node_file[rank].dns, buf, HOST_NAME_MAX))
-            break;
-    if (rank < 0)
-    {
+    if (myrank >= 0) {
+        /* explicit rank, e.g. several daemons on one host */
+        if (myrank > entries - 1) {
+            printf("Rank %d is not listed in the nodefile\n", myrank);
+            goto out;
+        }
+        rank = myrank;
+    } else {
+        if (gethostname(buf, HOST_NAME_MAX))
+            goto out;
+        rank = entries;
+        while (rank-- > 0)
+            if (0 == strncmp(node_file[rank].dns, buf, HOST_NAME_MAX))
+                break;
+        if (rank < 0)
+        {
 			printf("Couldn't find hostname listed in file on accessible systems\n");
-        goto out;
+            goto out;
+        }
     }
     *_myrank = rank;
 
@@ -10,7 +10,9 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <mqueue.h>
+#include <poll.h>
 #include <pthread.h>
+#include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -65,6 +67,9 @@ static pthread_mutex_t mailboxes_lock = PTHREAD_MUTEX_INITIALIZER;
 static struct mailbox recv_mb;
 static struct mailbox *daemon_mb;
 
+/* daemon mailbox of the selected instance */
+static char daemon_mq_name[MAX_LEN] = ATTACH_DAEMON_MQ_NAME;
+
 static size_t max_msg_size = 0UL;
 
 /* Private functions */
@@ -111,8 +116,8 @@ add_mailbox(struct mailbox *mb)
     unlock_mailboxes();
 }
 
-// Receive a message. If we are sent some signal while receiving, we retry the
-// receive. If the MQ is empty, exit with -EAGAIN
+// Receive a message, returning its length. If we are sent some signal while
+// receiving, we retry the receive. If the MQ is empty, exit with -EAGAIN
 static int
 recv_message(struct mailbox *mb, void *msg)
 {
@@ -125,7 +130,7 @@ again:
 		exit_errno = -(errno);
 		goto fail;
 	}
-	return 0;
+	return err;
 fail:
 	return exit_errno;
 }
@@ -145,7 +150,7 @@ again:
 		exit_errno = -(errno);
 		goto fail;
 	}
-	return 0;
+	return err;
 fail:
 	return exit_errno;
 }
@@ -191,7 +196,7 @@ attach_daemon(void)
         printd("out of memory\n");
         return -1;
     }
-    snprintf(daemon_mb->name, MAX_LEN, "%s", ATTACH_DAEMON_MQ_NAME);
+    snprintf(daemon_mb->name, MAX_LEN, "%s", daemon_mq_name);
     daemon_mb->pid = PMSG_DAEMON_PID;
     daemon_mb->id = mq_open(daemon_mb->name, MQ_OPEN_CONNECT_FLAGS, MQ_PERMS, qattr);
     if (!MQ_ID_IS_VALID(daemon_mb->id)) {
@@ -223,11 +228,11 @@ detach_daemon(void)
 
 /* retries if MQ is full */
 static int
-send_message(struct mailbox *mb, void *msg)
+send_message(struct mailbox *mb, void *msg, size_t len)
 {
 	int err, exit_errno;
 again:
-	err = mq_send(mb->id, (char*)msg, max_msg_size, MQ_DFT_PRIO);
+	err = mq_send(mb->id, (char*)msg, len, MQ_DFT_PRIO);
 	if (err < 0) {
 		if (errno == EINTR)
 			goto again; // A signal interrupted the call, try again
@@ -350,6 +355,16 @@ pmsg_init(size_t pmsg_size)
     return 0;
 }
 
+int
+pmsg_set_instance(int instance)
+{
+    if (instance < 0)
+        return -1;
+    snprintf(daemon_mq_name, MAX_LEN, "%s%d", ATTACH_DAEMON_MQ_NAME, instance);
+    printd("daemon mailbox '%s'\n", daemon_mq_name);
+    return 0;
+}
+
 int
 pmsg_open(pid_t self_pid)
 {
@@ -361,7 +376,7 @@ pmsg_open(pid_t self_pid)
 
     if (self_pid == PMSG_DAEMON_PID) {
         memset(&recv_mb, 0, sizeof(recv_mb));
-        snprintf(recv_mb.name, MAX_LEN, "%s", ATTACH_DAEMON_MQ_NAME);
+        snprintf(recv_mb.name, MAX_LEN, "%s", daemon_mq_name);
         recv_mb.id = mq_open(recv_mb.name,
                 MQ_OPEN_OWNER_FLAGS, MQ_PERMS, &qattr);
         if (!MQ_ID_IS_VALID(recv_mb.id) ) {
@@ -453,10 +468,13 @@ pmsg_detach(pid_t to_pid)
 }
 
 int
-pmsg_send(pid_t to_pid, void *msg)
+pmsg_send(pid_t to_pid, void *msg, size_t len)
 {
     struct mailbox *mb = NULL;
 
+    if (len > max_msg_size)
+        return -1;
+
     if (to_pid == PMSG_DAEMON_PID)
         mb = daemon_mb;
     else {
@@ -466,7 +484,7 @@ pmsg_send(pid_t to_pid, void *msg)
             return -1;
         }
     }
-    if (send_message(mb, msg) < 0) {
+    if (send_message(mb, msg, len) < 0) {
         printd("error sending message to pid %d\n", mb->pid);
         return -1;
     }
@@ -476,20 +494,22 @@ pmsg_send(pid_t to_pid, void *msg)
 int
 pmsg_recv(void *msg, bool block)
 {
+    int len;
+
     if (!msg)
         return -1;
     if (block) {
-        if (0 > recv_message_block(&recv_mb, msg)) {
+        if (0 > (len = recv_message_block(&recv_mb, msg))) {
             printd("error receiving message: %s\n", strerror(errno));
             return -1;
         }
     } else {
-        if (0 > recv_message(&recv_mb, msg)) {
+        if (0 > (len = recv_message(&recv_mb, msg))) {
             printd("error receiving message\n");
             return -1;
         }
     }
-    return 0;
+    return len;
 }
 
 int
@@ -519,6 +539,9 @@ pmsg_cleanup(void)
     /* 1 is init, MQ will never exist */
     fprintf(stderr, "> (info) removing lingering MQs ..\n");
     for (pid = 2; pid <= maxpid; pid++) {
+        /* apps still running may belong to another daemon on this host */
+        if (0 == kill(pid, 0) || errno == EPERM)
+            continue;
         snprintf(name, MAX_LEN, "%s%d", ATTACH_NAME_PREFIX, pid);
         if (0 > mq_unlink(name)) {
             if (errno == ENOENT)
@@ -529,7 +552,7 @@ pmsg_cleanup(void)
         num_cleaned++;
     }
 
-    snprintf(name, MAX_LEN, "%s", ATTACH_DAEMON_MQ_NAME);
+    snprintf(name, MAX_LEN, "%s", daemon_mq_name);
     if (mq_unlink(name) < 0)
         if (errno != ENOENT)
             fprintf(stderr, "> (err) could not remove daemon MQ: %s\n",
@@ -554,6 +577,26 @@ int pmsg_pending(void)
     return attr.mq_curmsgs;
 }
 
+/* On Linux a mqd_t is a file descriptor, so we can block in poll() instead of
+ * spinning on the non-blocking receive mailbox. */
+int pmsg_wait(int timeout_ms)
+{
+    struct pollfd pfd;
+    int err;
+
+    pfd.fd = (int)recv_mb.id;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+again:
+    err = poll(&pfd, 1, timeout_ms);
+    if (err < 0) {
+        if (errno == EINTR)
+            goto again;
+        return -1;
+    }
+    return (err > 0 ? 1 : 0);
+}
+
 /*
  * *************************
  */
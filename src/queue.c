@@ -84,7 +84,8 @@ __pop(struct queue *q, void *data)
     e = list_first_entry(&q->work, struct qentry, link);
     memcpy(data, e->data, q->data_size);
     list_del(&e->link);
-    __init_qentry2(e, data);
+    /* keep the entry's own storage; it is reused by the next push */
+    INIT_LIST_HEAD(&e->link);
     list_add(&e->link, &q->free);
 }
 
@@ -13,9 +13,12 @@
 #include <infiniband/verbs.h>
 #include <netdb.h>
 #include <rdma/rdma_cma.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <limits.h>
@@ -27,6 +30,7 @@
 /* Project includes */
 #include <util/list.h>
 #include <io/rdma.h>
+#include <buf.h>
 #include <debug.h>
 
 /* Directory includes */
@@ -36,20 +40,176 @@
 
 /* Internal definitions */
 
+#define DEFAULT_SPIN_US     50
+
 /* Internal state */
 
 static LIST_HEAD(ib_allocs);
+/* allocations may be created and released from many app threads at once */
+static pthread_mutex_t ib_allocs_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* process-wide poll mode, from OCM_IB_POLL and OCM_IB_SPIN_US */
+static pthread_once_t poll_once = PTHREAD_ONCE_INIT;
+static int poll_mode = IB_POLL_EVENT;
+static uint32_t spin_us = DEFAULT_SPIN_US;
 
 /* Private functions */
 
-/* only used by client code */
+static void
+poll_init(void)
+{
+    const char *env;
+
+    if ((env = getenv("OCM_IB_POLL"))) {
+        if (!strcmp(env, "busy"))
+            poll_mode = IB_POLL_BUSY;
+        else if (!strcmp(env, "hybrid"))
+            poll_mode = IB_POLL_HYBRID;
+        else if (strcmp(env, "event"))
+            printd("unknown OCM_IB_POLL '%s', using event\n", env);
+    }
+    if ((env = getenv("OCM_IB_SPIN_US")))
+        spin_us = strtoul(env, NULL, 0);
+}
+
+static uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+/* take one completion off the CQ: 1 if there was one, 0 if not. It
+ * completes wr_id requests */
 static int
-post_send(struct ib_alloc *ib, int opcode, size_t src_offset, size_t dest_offset, size_t len)
+reap(struct ib_alloc *ib)
 {
+    struct ibv_wc   wc;
+    int             ne;
+
+    ne = ibv_poll_cq(ib->verbs.cq, 1, &wc);
+    if (ne < 0)
+        return -1;
+    if (ne > 0 && wc.status != IBV_WC_SUCCESS) {
+        printd("work request failed: %s\n", ibv_wc_status_str(wc.status));
+        /* the QP is in error and flushes the rest */
+        ib->send.posted = ib->send.npend = ib->send.unsignaled = 0;
+        return -1;
+    }
+    if (ne > 0)
+        ib->send.posted -= (wc.wr_id < ib->send.posted ?
+                wc.wr_id : ib->send.posted);
+    return ne;
+}
+
+/* sleep on the completion channel until there is a completion. Spinning
+ * takes completions the armed CQ has already raised events for, so an
+ * event may find the CQ empty; then wait again */
+static int
+wait_event(struct ib_alloc *ib)
+{
+    struct ibv_cq   *evt_cq;
+    void            *cq_ctxt;
+    int             ret;
 
-    struct ibv_sge          sge;
-    struct ibv_send_wr      wr;
+    while (true) {
+        if (ibv_req_notify_cq(ib->verbs.cq, 0))
+            return -1;
+        /* it may have come in before the CQ was armed */
+        if ((ret = reap(ib)))
+            return ret;
+        if (ibv_get_cq_event(ib->verbs.ch, &evt_cq, &cq_ctxt))
+            return -1;
+        ibv_ack_cq_events(evt_cq, 1);
+        if ((ret = reap(ib)))
+            return ret;
+    }
+}
+
+/* wait for the next completion, the way params.poll_mode says. Busy
+ * polling trades a core for the interrupt and wake-up of the event path */
+static int
+wait_one(struct ib_alloc *ib)
+{
+    uint64_t        deadline;
+    unsigned int    i;
+    int             ret;
+
+    switch (ib->params.poll_mode) {
+    case IB_POLL_BUSY:
+        while (!(ret = reap(ib)))
+            ;
+        break;
+    case IB_POLL_HYBRID:
+        deadline = now_ns() + ib->params.spin_us * 1000UL;
+        /* only look at the clock now and then */
+        for (i = 1; !(ret = reap(ib)); i++)
+            if (!(i % 64) && now_ns() > deadline) {
+                ret = wait_event(ib);
+                break;
+            }
+        break;
+    default:
+        ret = wait_event(ib);
+        break;
+    }
+    return (ret < 0 ? -1 : 0);
+}
+
+/* post the chained requests with one doorbell */
+static int
+post_chain(struct ib_alloc *ib)
+{
+    struct __send_t         *s = &ib->send;
     struct ibv_send_wr      *bad_wr;
+    unsigned int            i;
+
+    if (!s->npend)
+        return 0;
+    for (i = 0; i < s->npend; i++)
+        s->wr[i].next = (i + 1 < s->npend ? &s->wr[i + 1] : NULL);
+    if (ibv_post_send(ib->rdma.id->qp, s->wr, &bad_wr)) {
+        perror("ibv_post_send");
+        return -1;
+    }
+    s->posted += s->npend;
+    s->npend = 0;
+    return 0;
+}
+
+/* make the last request queued ask for a completion, adding an empty
+ * write if it was already posted */
+static void
+signal_last(struct ib_alloc *ib)
+{
+    struct __send_t     *s = &ib->send;
+    struct ibv_send_wr  *wr;
+
+    if (!s->unsignaled)
+        return;
+    if (!s->npend) {
+        wr = &s->wr[s->npend++];
+        memset(wr, 0, sizeof(*wr));
+        wr->opcode              = IBV_WR_RDMA_WRITE;
+        wr->wr.rdma.rkey        = ib->ibv.buf_rkey;
+        wr->wr.rdma.remote_addr = ib->ibv.buf_va;
+        s->unsignaled++;
+    }
+    wr = &s->wr[s->npend - 1];
+    wr->send_flags  |= IBV_SEND_SIGNALED;
+    wr->wr_id       = s->unsignaled;
+    s->unsignaled   = 0;
+}
+
+/* only used by client code */
+static int
+queue_send(struct ib_alloc *ib, int opcode, size_t src_offset, size_t dest_offset, size_t len)
+{
+    struct __send_t         *s = &ib->send;
+    struct ibv_send_wr      *wr;
+    struct ibv_sge          *sge;
 
     /* "from" address and key */
     if((src_offset+len) > ib->params.buf_len)
@@ -58,29 +218,42 @@ post_send(struct ib_alloc *ib, int opcode, size_t src_offset, size_t dest_offset
       BUG(1);
     }
 
-    sge.addr   = (uintptr_t)(ib->params.buf+src_offset);
-    sge.length = len;
-    sge.lkey   = ib->verbs.mr->lkey;
+    /* out of credits: the request that filled the queue was signaled */
+    if (s->posted + s->npend == s->depth) {
+        if (post_chain(ib) || wait_one(ib))
+            return -1;
+    }
 
-    memset(&wr, 0, sizeof(wr));
+    wr  = &s->wr[s->npend];
+    sge = &s->sge[s->npend];
+    sge->addr   = (uintptr_t)(ib->params.buf+src_offset);
+    sge->length = len;
+    sge->lkey   = ib->verbs.mr->lkey;
 
-    wr.wr_id                = 1 /* ignored: user-defined ID */;
-    wr.opcode               = opcode;
-    /* This flag is needed so we can poll on send/recv using the Completion
-     * Queue data structure. */
-    wr.send_flags           = IBV_SEND_SIGNALED;
-    wr.sg_list              = &sge;
-    wr.num_sge              = 1;
+    memset(wr, 0, sizeof(*wr));
+    wr->opcode              = opcode;
+    wr->sg_list             = sge;
+    wr->num_sge             = 1;
     /* "to" address and key */
-    wr.wr.rdma.rkey         = ib->ibv.buf_rkey;
-    wr.wr.rdma.remote_addr  = ib->ibv.buf_va + dest_offset;
-
-    if (ibv_post_send(ib->rdma.id->qp, &wr, &bad_wr)){
-        perror("ibv_post_send");
-        return -1;
+    wr->wr.rdma.rkey        = ib->ibv.buf_rkey;
+    wr->wr.rdma.remote_addr = ib->ibv.buf_va + dest_offset;
+
+    if (opcode == IBV_WR_RDMA_READ)
+        s->reads = true;
+    else {
+        /* the HCA copies small payloads at post time, no DMA read */
+        if (len <= s->max_inline)
+            wr->send_flags |= IBV_SEND_INLINE;
+        /* a write may not gather local data a read is still filling in */
+        if (s->reads)
+            wr->send_flags |= IBV_SEND_FENCE;
     }
 
-
+    s->npend++;
+    if (++s->unsignaled == SQ_SIGNAL || s->posted + s->npend == s->depth)
+        signal_last(ib);
+    if (s->npend == SQ_BATCH)
+        return post_chain(ib);
     return 0;
 }
 
@@ -143,10 +316,19 @@ ib_new(struct ib_params *p)
     if (p->addr) /* only client specifies this */
         ib->params.addr = strdup(p->addr);
     memcpy(&ib->params, p, sizeof(*p));
+    ib->rdma.cancel_fd = -1;
+
+    pthread_once(&poll_once, poll_init);
+    if (ib->params.poll_mode <= IB_POLL_DEFAULT ||
+            ib->params.poll_mode > IB_POLL_HYBRID)
+        ib->params.poll_mode = poll_mode;
+    if (!ib->params.spin_us)
+        ib->params.spin_us = spin_us;
 
-    /* TODO Lock this list */
     INIT_LIST_HEAD(&ib->link);
+    pthread_mutex_lock(&ib_allocs_lock);
     list_add(&ib->link, &ib_allocs);
+    pthread_mutex_unlock(&ib_allocs_lock);
 
     return (ib_t)ib;
 
@@ -162,10 +344,20 @@ ib_free(ib_t ib)
 
     //Free the buffer in the ib->params struct
     if(ib->params.buf)
-      free(ib->params.buf);
+      buf_free(ib->params.buf);
+
+    //A server that never accepted still listens
+    if (ib->rdma.listen_id && !ib->rdma.id) {
+        rdma_destroy_id(ib->rdma.listen_id);
+        rdma_destroy_event_channel(ib->rdma.ch);
+    }
+    if (ib->rdma.cancel_fd >= 0)
+        close(ib->rdma.cancel_fd);
 
     //Delete the IB object from the list
+    pthread_mutex_lock(&ib_allocs_lock);
     list_del(&(ib->link));
+    pthread_mutex_unlock(&ib_allocs_lock);
 
     //Free the IB object
     free(ib);
@@ -175,6 +367,28 @@ ib_free(ib_t ib)
 
 
 
+/* server function: start listening on params.port without waiting for the
+ * client; a later ib_connect accepts on the same listener */
+int
+ib_listen(ib_t ib)
+{
+    if (!ib)
+        return -1;
+    return ib_server_listen((struct ib_alloc*)ib);
+}
+
+int
+ib_cancel(ib_t ib)
+{
+    uint64_t one = 1;
+
+    if (!ib || ib->rdma.cancel_fd < 0)
+        return -1;
+    if (write(ib->rdma.cancel_fd, &one, sizeof(one)) != sizeof(one))
+        return -1;
+    return 0;
+}
+
 /* TODO provide an accept and connect separately, instead of the bool */
 int
 ib_connect(ib_t ib, bool is_server)
@@ -232,9 +446,8 @@ ib_reg_mr(ib_t ib, void *buf, size_t len)
     return 0;
 }
 
-/* TODO Include specifying segments to send, instead of static offsets.  Like,
- * enqueue a write, then flush the writes
- */
+/* Requests are queued and go out in batches; ib_poll posts the rest and
+ * waits for them */
 
 /* client function: pull data fom server */
 int
@@ -246,7 +459,7 @@ ib_read(ib_t ib, size_t src_offset, size_t dest_offset, size_t len)
         printd("error: would read past end of remote buffer\n");
         return -1;
     }
-    return post_send(ib, IBV_WR_RDMA_READ, src_offset, dest_offset, len);
+    return queue_send(ib, IBV_WR_RDMA_READ, src_offset, dest_offset, len);
 }
 
 /* client function: push data to server */
@@ -259,44 +472,21 @@ ib_write(ib_t ib, size_t src_offset, size_t dest_offset, size_t len)
         printd("error: would write past end of remote buffer\n");
         return -1;
     }
-    return post_send(ib, IBV_WR_RDMA_WRITE, src_offset, dest_offset, len);
+    return queue_send(ib, IBV_WR_RDMA_WRITE, src_offset, dest_offset, len);
 }
 
-/* Wait for some event. Code found in manpage of ibv_get_cq_event */
+/* Post what ib_read/ib_write queued and wait for all of it */
 int
 ib_poll(ib_t ib)
 {
-    struct ibv_wc   wc;
-    struct ibv_cq   *evt_cq;
-    void            *cq_ctxt;
-    int             ne;
-
-
-    if (ibv_req_notify_cq(ib->verbs.cq, 0))
-        return -1;
-
-    if (ibv_get_cq_event(ib->verbs.ch, &evt_cq, &cq_ctxt))
+    if (!ib)
         return -1;
-
-    ibv_ack_cq_events(evt_cq, 1);
-
-    if (ibv_req_notify_cq(evt_cq, 0))
+    signal_last(ib);
+    if (post_chain(ib))
         return -1;
-
-    do {
-        ne = ibv_poll_cq(ib->verbs.cq, 1, &wc);
-
-        if (ne == 0)
-        {
-            continue;
-        }
-        else if (ne < 0)
-            return -1;
-
-        if (wc.status != IBV_WC_SUCCESS)
+    while (ib->send.posted)
+        if (wait_one(ib))
             return -1;
-
-    } while (ne);
-
+    ib->send.reads = false;
     return 0;
 }
@@ -14,6 +14,7 @@
 #include <infiniband/verbs.h>
 #include <netdb.h>
 #include <rdma/rdma_cma.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -30,6 +31,14 @@ enum {
     RESOLVE_TIMEOUT_MS = 5000
 };
 
+/* client send queue */
+enum {
+    SQ_DEPTH    = 64, /* work requests */
+    SQ_BATCH    = 16, /* chained per ibv_post_send */
+    SQ_SIGNAL   = 16, /* one completion for every this many */
+    SQ_INLINE   = 64  /* bytes of an RDMA write sent inline */
+};
+
 /* 
  * Data structure used to exchange authentication keys and buffer address
  * between client and server
@@ -46,6 +55,7 @@ struct __rdma_t {
     struct rdma_cm_id           *id; /* TODO only handles one client */
     struct rdma_cm_event        *evt;
     struct rdma_conn_param      param;
+    int                         cancel_fd; /* server: ib_cancel wakes accept */
 };
 
 struct __ibv_t {
@@ -68,16 +78,35 @@ struct __verbs_t {
     struct ibv_context      *context;
 };
 
+/*
+ * Work requests queued by ib_read/ib_write wait in a chain until it is full
+ * or ib_poll posts it. Only every SQ_SIGNAL'th request asks for a
+ * completion; its wr_id is how many requests it completes. Credits keep the
+ * posted requests within the send queue.
+ */
+struct __send_t {
+    struct ibv_send_wr  wr[SQ_BATCH];
+    struct ibv_sge      sge[SQ_BATCH];
+    unsigned int        npend; /* chained, not posted */
+    unsigned int        posted; /* posted, completion not seen */
+    unsigned int        unsignaled; /* since the last signaled request */
+    unsigned int        depth;
+    unsigned int        max_inline;
+    bool                reads; /* an RDMA read may still be in flight */
+};
+
 struct ib_alloc
 {
     struct list_head    link;
     struct __rdma_t     rdma;
     struct __ibv_t      ibv;
     struct __verbs_t    verbs;
+    struct __send_t     send;
     struct ib_params    params;
 };
 
 /* server functions */
+int ib_server_listen(struct ib_alloc *ib);
 int ib_server_connect(struct ib_alloc *ib);
 int ib_server_disconnect(struct ib_alloc *ib);
 
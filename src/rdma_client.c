@@ -105,7 +105,7 @@ ib_client_connect(struct ib_alloc *ib)
     return -1;
 
   if (!(ib->verbs.cq = ibv_create_cq(ib->rdma.id->verbs,
-          2, NULL, ib->verbs.ch, 0)))
+          SQ_DEPTH, NULL, ib->verbs.ch, 0)))
     return -1;
 
   if (ibv_req_notify_cq(ib->verbs.cq, 0))
@@ -126,7 +126,7 @@ ib_client_connect(struct ib_alloc *ib)
   printd("registered memory region (%lu bytes)\n",
       ib->verbs.mr->length);
 
-  ib->verbs.qp_attr.cap.max_send_wr   = 2;
+  ib->verbs.qp_attr.cap.max_send_wr   = SQ_DEPTH;
   ib->verbs.qp_attr.cap.max_send_sge  = 2;
   ib->verbs.qp_attr.cap.max_recv_wr   = 2;
   ib->verbs.qp_attr.cap.max_recv_sge  = 2;
@@ -139,8 +139,15 @@ ib_client_connect(struct ib_alloc *ib)
 
 
 
-  if (rdma_create_qp(ib->rdma.id, ib->verbs.pd, &ib->verbs.qp_attr))
-    return -1;
+  ib->verbs.qp_attr.cap.max_inline_data = SQ_INLINE;
+  if (rdma_create_qp(ib->rdma.id, ib->verbs.pd, &ib->verbs.qp_attr)) {
+    //Not every device sends data inline
+    ib->verbs.qp_attr.cap.max_inline_data = 0;
+    if (rdma_create_qp(ib->rdma.id, ib->verbs.pd, &ib->verbs.qp_attr))
+      return -1;
+  }
+  ib->send.depth      = SQ_DEPTH;
+  ib->send.max_inline = ib->verbs.qp_attr.cap.max_inline_data;
 
   /* 3. Connect to server */
 
@@ -199,21 +206,25 @@ ib_client_disconnect(struct ib_alloc *ib)
   //-rdma_destroy_event_channel
   //
 
+  //Also undoes a connect that failed half way, so every step checks
+  //that its object exists
   int rc = 0;
 
-  if (rdma_disconnect(ib->rdma.id))
+  if (!ib->rdma.id)
+    goto channel;
+
+  if (ib->rdma.id->qp && rdma_disconnect(ib->rdma.id))
   {
     fprintf(stderr, "failed to disconnect RDMA connection\n");
     rc = 1;
   }
 
-
   //Destroy the queue pair - returns void
-  rdma_destroy_qp(ib->rdma.id);
-
+  if (ib->rdma.id->qp)
+    rdma_destroy_qp(ib->rdma.id);
 
   //------deregister pinned pages---------
-  if (ibv_dereg_mr(ib->verbs.mr))
+  if (ib->verbs.mr && ibv_dereg_mr(ib->verbs.mr))
   {
     fprintf(stderr, "failed to deregister MR\n");
     rc = 1;
@@ -222,20 +233,19 @@ ib_client_disconnect(struct ib_alloc *ib)
   //Make sure to free the buffer, ib->ib_params.buf in the dealloc function
   //free(res->buf);
 
-
-  if (ibv_destroy_cq(ib->verbs.cq))
+  if (ib->verbs.cq && ibv_destroy_cq(ib->verbs.cq))
   {
     fprintf(stderr, "failed to destroy CQ\n");
     rc = 1;
   }
 
-  if (ibv_destroy_comp_channel(ib->verbs.ch))
+  if (ib->verbs.ch && ibv_destroy_comp_channel(ib->verbs.ch))
   {
     fprintf(stderr, "failed to destroy CQ channel\n");
     rc = 1;
   }
 
-  if (ibv_dealloc_pd(ib->verbs.pd))
+  if (ib->verbs.pd && ibv_dealloc_pd(ib->verbs.pd))
   {
     fprintf(stderr, "failed to deallocate PD\n");
     rc = 1;
@@ -243,7 +253,9 @@ ib_client_disconnect(struct ib_alloc *ib)
 
   rdma_destroy_id(ib->rdma.id);
 
-  rdma_destroy_event_channel(ib->rdma.ch);
+channel:
+  if (ib->rdma.ch)
+    rdma_destroy_event_channel(ib->rdma.ch);
 
   //  printf("Successfully destroyed all IB and RDMA CM objects\n");
 
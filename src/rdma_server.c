@@ -11,8 +11,10 @@
 #include <infiniband/verbs.h>
 #include <netdb.h>
 #include <rdma/rdma_cma.h>
+#include <poll.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <errno.h>
@@ -38,13 +40,16 @@
 #include <arpa/inet.h>
 
 int
-ib_server_connect(struct ib_alloc *ib)
+ib_server_listen(struct ib_alloc *ib)
 {
 
    /* 1. Set up RDMA CM structures */
 
     struct sockaddr_in addr;
 
+    if ((ib->rdma.cancel_fd = eventfd(0, EFD_CLOEXEC)) < 0)
+        return -1;
+
     if (!(ib->rdma.ch = rdma_create_event_channel()))
         return -1;
 
@@ -71,10 +76,30 @@ ib_server_connect(struct ib_alloc *ib)
 
     if (rdma_listen(ib->rdma.listen_id, 1))
         return -1;
-    
+
+    return 0;
+}
+
+int
+ib_server_connect(struct ib_alloc *ib)
+{
+    /* listen now unless ib_listen already did so */
+    if (!ib->rdma.listen_id && ib_server_listen(ib))
+        return -1;
 
     printd("waiting for connection on port %d...\n", ib->params.port);
-    if (rdma_get_cm_event(ib->rdma.ch, &ib->rdma.evt)) /* blocks */
+    struct pollfd fds[2] = {
+        { .fd = ib->rdma.ch->fd, .events = POLLIN },
+        { .fd = ib->rdma.cancel_fd, .events = POLLIN }
+    };
+    while (poll(fds, 2, -1) < 0) /* blocks */
+        if (errno != EINTR)
+            return -1;
+    if (fds[1].revents) {
+        printd("accept on port %d cancelled\n", ib->params.port);
+        return -1;
+    }
+    if (rdma_get_cm_event(ib->rdma.ch, &ib->rdma.evt))
         return -1;
 
     printd("got connection\n");
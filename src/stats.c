@@ -0,0 +1,316 @@
+/**
+ * file: stats.c
+ * desc: daemon statistics endpoint. Every connection to the Unix socket gets
+ * one snapshot and is closed. A client may first send a line naming the
+ * format, "json" (the default) or "prometheus"; one that sends nothing gets
+ * JSON, e.g.
+ *
+ *     socat - UNIX-CONNECT:/tmp/oncillamem0.sock < /dev/null
+ *     echo prometheus | socat - UNIX-CONNECT:/tmp/oncillamem0.sock
+ *
+ * Counters are cumulative since start-up; rates are left to the reader.
+ */
+
+/* System includes */
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/* Other project includes */
+
+/* Project includes */
+#include <debug.h>
+#include <link.h>
+#include <mem.h>
+#include <nodefile.h>
+#include <pmsg.h>
+#include <stats.h>
+#include <util/hist.h>
+
+/* Internal definitions */
+
+/* how long a client has to name the format it wants */
+#define REQUEST_TIMEOUT_MS  200
+
+static const char *counter_str[STATS_NUM_COUNTERS] = {
+    [STATS_APPS]            = "apps",
+    [STATS_APPS_TOTAL]      = "apps_total",
+    [STATS_PMSG_IN]         = "app_msgs_in",
+    [STATS_PMSG_OUT]        = "app_msgs_out",
+    [STATS_OUTBOX]          = "outbox_depth",
+    [STATS_REQS_INFLIGHT]   = "requests_inflight",
+    [STATS_REQ_ALLOC]       = "requests_alloc",
+    [STATS_REQ_FREE]        = "requests_free",
+    [STATS_REQ_ERRORS]      = "requests_failed",
+    [STATS_PLACED]          = "buffers_placed",
+    [STATS_SERVED]          = "buffers_served",
+    [STATS_SERVED_BYTES]    = "bytes_served",
+    [STATS_SERVED_ALLOCS]   = "buffers_served_total",
+    [STATS_SERVED_FREES]    = "buffers_released_total",
+};
+
+/* gauges go up and down; everything else only counts up */
+static const bool counter_gauge[STATS_NUM_COUNTERS] = {
+    [STATS_APPS]            = true,
+    [STATS_OUTBOX]          = true,
+    [STATS_REQS_INFLIGHT]   = true,
+    [STATS_SERVED]          = true,
+    [STATS_SERVED_BYTES]    = true,
+};
+
+static const char *phase_str[STATS_NUM_PHASES] = {
+    [STATS_PH_APP_ALLOC]    = "app_alloc",
+    [STATS_PH_APP_FREE]     = "app_free",
+    [STATS_PH_PLACE]        = "place",
+    [STATS_PH_DO_ALLOC]     = "do_alloc",
+    [STATS_PH_DO_FREE]      = "do_free",
+    [STATS_PH_SERVE_ALLOC]  = "serve_alloc",
+    [STATS_PH_SERVE_FREE]   = "serve_free",
+};
+
+static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+#define NUM_QUANTILES (sizeof(quantiles) / sizeof(*quantiles))
+
+/* Internal state */
+
+uint64_t stats_counters[STATS_NUM_COUNTERS];
+
+static struct hist phases[STATS_NUM_PHASES];
+static uint64_t start_ns;
+
+static int listen_fd = -1;
+static char sock_path[sizeof(((struct sockaddr_un*)0)->sun_path)];
+static pthread_t server_tid;
+
+/* Private functions */
+
+static void
+write_json(FILE *f)
+{
+    struct link_stats ls;
+    struct hist *h;
+    unsigned int i, q;
+    int rank, me = mem_get_rank();
+    const char *sep = "";
+
+    fprintf(f, "{\n  \"rank\": %d,\n  \"pid\": %d,\n  \"uptime_s\": %.3f,\n",
+            me, getpid(), (stats_now() - start_ns) / 1e9);
+
+    fprintf(f, "  \"counters\": {");
+    for (i = 0; i < STATS_NUM_COUNTERS; i++)
+        fprintf(f, "%s\n    \"%s\": %ld", (i ? "," : ""), counter_str[i],
+                (int64_t)__atomic_load_n(&stats_counters[i], __ATOMIC_RELAXED));
+    fprintf(f, ",\n    \"mailbox_depth\": %d\n  },\n", pmsg_pending());
+
+    fprintf(f, "  \"latency_us\": {");
+    for (i = 0; i < STATS_NUM_PHASES; i++) {
+        h = &phases[i];
+        fprintf(f, "%s\n    \"%s\": {\"count\": %lu, \"mean\": %.1f",
+                (i ? "," : ""), phase_str[i], hist_count(h),
+                hist_mean(h) / 1e3);
+        for (q = 0; q < NUM_QUANTILES; q++)
+            fprintf(f, ", \"p%g\": %.1f", quantiles[q] * 100,
+                    hist_percentile(h, quantiles[q]) / 1e3);
+        fprintf(f, ", \"max\": %.1f}", hist_max(h) / 1e3);
+    }
+    fprintf(f, "\n  },\n");
+
+    fprintf(f, "  \"peers\": [");
+    for (rank = 0; rank < node_file_entries; rank++) {
+        if (rank == me || link_get_stats(rank, &ls))
+            continue;
+        fprintf(f, "%s\n    {\"rank\": %d, \"tx_msgs\": %lu, "
+                "\"tx_frames\": %lu, \"tx_bytes\": %lu, \"rx_msgs\": %lu, "
+                "\"rx_frames\": %lu, \"rx_bytes\": %lu, "
+                "\"queued_bytes\": %lu, \"waiting\": %lu}",
+                sep, rank, ls.tx_msgs, ls.tx_frames,
+                ls.tx_bytes, ls.rx_msgs, ls.rx_frames, ls.rx_bytes,
+                ls.queued, ls.waiting);
+        sep = ",";
+    }
+    fprintf(f, "\n  ]\n}\n");
+}
+
+static void
+write_prometheus(FILE *f)
+{
+    struct link_stats ls;
+    struct hist *h;
+    unsigned int i, q;
+    int rank, me = mem_get_rank();
+
+    fprintf(f, "# TYPE ocm_uptime_seconds gauge\n");
+    fprintf(f, "ocm_uptime_seconds{rank=\"%d\"} %.3f\n",
+            me, (stats_now() - start_ns) / 1e9);
+    for (i = 0; i < STATS_NUM_COUNTERS; i++) {
+        fprintf(f, "# TYPE ocm_%s %s\n", counter_str[i],
+                (counter_gauge[i] ? "gauge" : "counter"));
+        fprintf(f, "ocm_%s{rank=\"%d\"} %ld\n", counter_str[i], me,
+                (int64_t)__atomic_load_n(&stats_counters[i], __ATOMIC_RELAXED));
+    }
+    fprintf(f, "# TYPE ocm_mailbox_depth gauge\n");
+    fprintf(f, "ocm_mailbox_depth{rank=\"%d\"} %d\n", me, pmsg_pending());
+
+    fprintf(f, "# TYPE ocm_phase_latency_seconds summary\n");
+    for (i = 0; i < STATS_NUM_PHASES; i++) {
+        h = &phases[i];
+        for (q = 0; q < NUM_QUANTILES; q++)
+            fprintf(f, "ocm_phase_latency_seconds{rank=\"%d\",phase=\"%s\","
+                    "quantile=\"%g\"} %.9f\n", me, phase_str[i],
+                    quantiles[q], hist_percentile(h, quantiles[q]) / 1e9);
+        fprintf(f, "ocm_phase_latency_seconds_sum{rank=\"%d\",phase=\"%s\"} "
+                "%.9f\n", me, phase_str[i],
+                __atomic_load_n(&h->sum, __ATOMIC_RELAXED) / 1e9);
+        fprintf(f, "ocm_phase_latency_seconds_count{rank=\"%d\",phase=\"%s\"} "
+                "%lu\n", me, phase_str[i], hist_count(h));
+    }
+
+    fprintf(f, "# TYPE ocm_peer_msgs_total counter\n");
+    fprintf(f, "# TYPE ocm_peer_frames_total counter\n");
+    fprintf(f, "# TYPE ocm_peer_bytes_total counter\n");
+    fprintf(f, "# TYPE ocm_peer_queued_bytes gauge\n");
+    fprintf(f, "# TYPE ocm_peer_waiting gauge\n");
+    for (rank = 0; rank < node_file_entries; rank++) {
+        if (rank == me || link_get_stats(rank, &ls))
+            continue;
+#define PEER(name, dir, v) \
+        fprintf(f, "ocm_peer_%s{rank=\"%d\",peer=\"%d\"%s} %lu\n", \
+                name, me, rank, dir, v)
+        PEER("msgs_total", ",dir=\"tx\"", ls.tx_msgs);
+        PEER("msgs_total", ",dir=\"rx\"", ls.rx_msgs);
+        PEER("frames_total", ",dir=\"tx\"", ls.tx_frames);
+        PEER("frames_total", ",dir=\"rx\"", ls.rx_frames);
+        PEER("bytes_total", ",dir=\"tx\"", ls.tx_bytes);
+        PEER("bytes_total", ",dir=\"rx\"", ls.rx_bytes);
+        PEER("queued_bytes", "", ls.queued);
+        PEER("waiting", "", ls.waiting);
+#undef PEER
+    }
+}
+
+static void
+serve_client(int fd)
+{
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    char req[64], *out = NULL;
+    size_t out_len = 0, off = 0;
+    ssize_t n = 0;
+    FILE *f;
+
+    /* the request line is optional; EOF or silence means JSON */
+    memset(req, 0, sizeof(req));
+    if (poll(&pfd, 1, REQUEST_TIMEOUT_MS) > 0)
+        n = read(fd, req, sizeof(req) - 1);
+
+    if (!(f = open_memstream(&out, &out_len)))
+        return;
+    if (n > 0 && (!strncmp(req, "prom", 4) || !strncmp(req, "metrics", 7)))
+        write_prometheus(f);
+    else
+        write_json(f);
+    fclose(f);
+
+    /* a client that hung up must not take the daemon down with SIGPIPE */
+    while (off < out_len) {
+        n = send(fd, out + off, out_len - off, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        off += n;
+    }
+    free(out);
+}
+
+static void *
+server_thread(void *arg)
+{
+    int fd;
+
+    printd("stats endpoint at %s\n", sock_path);
+    while (true) {
+        fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            break;
+        }
+        serve_client(fd);
+        close(fd);
+    }
+    return NULL;
+}
+
+/* Public functions */
+
+uint64_t
+stats_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+void
+stats_phase(enum stats_phase phase, uint64_t start)
+{
+    BUG(phase >= STATS_NUM_PHASES);
+    hist_add(&phases[phase], stats_now() - start);
+}
+
+int
+stats_init(const char *path)
+{
+    struct sockaddr_un addr;
+
+    BUG(!path);
+    start_ns = stats_now();
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "stats socket path too long: %s\n", path);
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    strcpy(sock_path, path);
+
+    listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0)
+        goto fail;
+    /* left over from a daemon that did not shut down cleanly */
+    unlink(path);
+    if (bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)))
+        goto fail;
+    if (listen(listen_fd, 8))
+        goto fail;
+    if (pthread_create(&server_tid, NULL, server_thread, NULL))
+        goto fail;
+    pthread_detach(server_tid);
+    return 0;
+
+fail:
+    perror("stats socket");
+    if (listen_fd >= 0)
+        close(listen_fd);
+    listen_fd = -1;
+    return -1;
+}
+
+void
+stats_fin(void)
+{
+    if (listen_fd < 0)
+        return;
+    shutdown(listen_fd, SHUT_RDWR);
+    close(listen_fd);
+    listen_fd = -1;
+    unlink(sock_path);
+}
@@ -0,0 +1,228 @@
+/**
+ * file: topo.c
+ * desc: NUMA topology from /sys/devices/system/node
+ */
+
+/* System includes */
+#define _GNU_SOURCE /* for cpu_set_t, sched_getcpu */
+#include <dirent.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/* Other project includes */
+
+/* Project includes */
+#include <debug.h>
+#include <oncillamem.h>
+#include <topo.h>
+
+/* Internal definitions */
+
+#define NODE_DIR    "/sys/devices/system/node"
+#define MAX_NODES   1024
+
+/* from linux/mempolicy.h, which libc does not ship */
+#define MPOL_PREFERRED  1
+#define MPOL_MF_MOVE    (1 << 1)
+
+/* device classes whose devices may carry our traffic, in order of preference */
+static const char *nic_classes[] = { "infiniband", "extoll", NULL };
+
+/* Internal state */
+
+static pthread_once_t nic_once = PTHREAD_ONCE_INIT;
+static int nic_node = -1;
+
+/* Private functions */
+
+/* parse a sysfs list such as "0-3,8-11" into set */
+static int
+parse_cpulist(const char *s, cpu_set_t *set)
+{
+    char *end;
+    long a, b;
+    int n = 0;
+
+    CPU_ZERO(set);
+    while (*s && *s != '\n') {
+        a = strtol(s, &end, 10);
+        if (end == s)
+            return -1;
+        b = a;
+        s = end;
+        if (*s == '-') {
+            b = strtol(s + 1, &end, 10);
+            s = end;
+        }
+        for (; a <= b && a < CPU_SETSIZE; a++, n++)
+            CPU_SET(a, set);
+        if (*s == ',')
+            s++;
+    }
+    return n;
+}
+
+/* node of the first device of a class in sysfs that reports one, or -1 */
+static int
+class_node(const char *cls)
+{
+    char path[PATH_MAX];
+    struct dirent *e;
+    FILE *f;
+    DIR *d;
+    int node = -1;
+
+    snprintf(path, sizeof(path), "/sys/class/%s", cls);
+    if (!(d = opendir(path)))
+        return -1;
+    while (node < 0 && (e = readdir(d))) {
+        if (e->d_name[0] == '.')
+            continue;
+        snprintf(path, sizeof(path), "/sys/class/%s/%s/device/numa_node",
+                cls, e->d_name);
+        if (!(f = fopen(path, "r")))
+            continue;
+        /* -1 when the platform does not know */
+        if (fscanf(f, "%d", &node) != 1)
+            node = -1;
+        fclose(f);
+    }
+    closedir(d);
+    return node;
+}
+
+static void
+find_nic_node(void)
+{
+    const char **cls;
+    char *env;
+
+    if ((env = getenv("OCM_NIC_NODE"))) {
+        nic_node = atoi(env);
+    } else if (topo_num_nodes() > 1) {
+        for (cls = nic_classes; *cls && nic_node < 0; cls++)
+            nic_node = class_node(*cls);
+    }
+    if (nic_node >= topo_num_nodes())
+        nic_node = -1;
+    printd("NIC on node %d of %d\n", nic_node, topo_num_nodes());
+}
+
+/* Public functions */
+
+int
+topo_num_nodes(void)
+{
+    static int num_nodes; /* nodes do not come and go */
+    struct dirent *e;
+    DIR *d;
+    int n = 0;
+
+    if (num_nodes)
+        return num_nodes;
+    if ((d = opendir(NODE_DIR))) {
+        while ((e = readdir(d)))
+            if (!strncmp(e->d_name, "node", 4) &&
+                    e->d_name[4] >= '0' && e->d_name[4] <= '9')
+                n++;
+        closedir(d);
+    }
+    num_nodes = (n > 0 ? n : 1);
+    return num_nodes;
+}
+
+int
+topo_cur_node(void)
+{
+    cpu_set_t set;
+    int cpu = sched_getcpu(), node, nodes = topo_num_nodes();
+
+    if (cpu < 0 || nodes == 1)
+        return 0;
+    for (node = 0; node < nodes; node++)
+        if (topo_node_cpus(node, &set) > 0 && CPU_ISSET(cpu, &set))
+            return node;
+    return 0;
+}
+
+int
+topo_node_cpus(int node, cpu_set_t *set)
+{
+    char path[64], buf[1024];
+    FILE *f;
+    int ret;
+
+    snprintf(path, sizeof(path), NODE_DIR "/node%d/cpulist", node);
+    if (!(f = fopen(path, "r"))) {
+        /* no NUMA information: node 0 has every CPU we may run on */
+        if (node != 0)
+            return -1;
+        if (sched_getaffinity(0, sizeof(*set), set))
+            return -1;
+        return CPU_COUNT(set);
+    }
+    ret = (fgets(buf, sizeof(buf), f) ? parse_cpulist(buf, set) : -1);
+    fclose(f);
+    return ret;
+}
+
+int
+topo_nic_node(void)
+{
+    pthread_once(&nic_once, find_nic_node);
+    return nic_node;
+}
+
+int
+topo_pick_node(int numa_node)
+{
+    if (numa_node == OCM_NUMA_NIC)
+        return topo_nic_node();
+    if (numa_node > 0 && numa_node - 1 < topo_num_nodes())
+        return numa_node - 1;
+    return -1;
+}
+
+int
+topo_bind_mem(void *addr, size_t len, int node)
+{
+    unsigned long mask[MAX_NODES / (8 * sizeof(unsigned long))];
+    const size_t bits = 8 * sizeof(unsigned long);
+
+    if (node < 0 || len == 0)
+        return 0;
+    if (node >= MAX_NODES || ((uintptr_t)addr & (getpagesize() - 1)))
+        return -1;
+    memset(mask, 0, sizeof(mask));
+    mask[node / bits] |= 1UL << (node % bits);
+    /* preferred, not bound: a full node spills over instead of failing */
+    if (syscall(SYS_mbind, addr, len, MPOL_PREFERRED, mask, MAX_NODES,
+                MPOL_MF_MOVE)) {
+        printd("mbind %p+%lu to node %d failed\n", addr, len, node);
+        return -1;
+    }
+    return 0;
+}
+
+int
+topo_bind_thread(int node)
+{
+    cpu_set_t set;
+
+    if (node < 0)
+        return 0;
+    if (topo_node_cpus(node, &set) <= 0)
+        return -1;
+    if (sched_setaffinity(0, sizeof(set), &set)) {
+        printd("could not pin thread to node %d\n", node);
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,189 @@
+/**
+ * file: trace.c
+ * desc: span recorder behind trace.h. Each span is one short line written
+ * with a single write() to a file opened O_APPEND, so threads need no lock
+ * and a crash loses nothing already recorded.
+ */
+
+/* System includes */
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/* Other project includes */
+
+/* Project includes */
+#include <debug.h>
+#include <trace.h>
+
+/* Internal definitions */
+
+#define SPAN_LINE_MAX   256
+
+/* Internal state */
+
+int trace_fd = -1;
+
+static char trace_name[64];
+static int trace_rank = -1;
+/* wall clock minus CLOCK_MONOTONIC, to turn span times into wall time */
+static int64_t wall_offset;
+
+static uint64_t id_seed;
+static uint64_t id_next;
+static pthread_once_t atfork_once = PTHREAD_ONCE_INIT;
+
+/* Private functions */
+
+static uint64_t
+mix64(uint64_t x)
+{
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9UL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebUL;
+    x ^= x >> 31;
+    return x;
+}
+
+static uint64_t
+wall_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+static void
+seed_ids(void)
+{
+    id_seed = mix64(wall_now() ^ ((uint64_t)getpid() << 32) ^
+            (uint64_t)gethostid());
+}
+
+static int
+open_trace(void)
+{
+    char path[PATH_MAX], host[HOST_NAME_MAX + 1], line[SPAN_LINE_MAX];
+    const char *dir;
+    int fd, n;
+
+    if (!(dir = getenv("OCM_TRACE")) || !*dir)
+        return 0;
+    if (gethostname(host, sizeof(host)))
+        strcpy(host, "localhost");
+    host[HOST_NAME_MAX] = '\0';
+    snprintf(path, sizeof(path), "%s/ocm-trace.%s.%d", dir, host, getpid());
+
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        perror(path);
+        return -1;
+    }
+    n = snprintf(line, sizeof(line), "P %d %d %s\n",
+            getpid(), trace_rank, trace_name);
+    if (write(fd, line, n) != n) {
+        close(fd);
+        return -1;
+    }
+    trace_fd = fd;
+    printd("tracing to %s\n", path);
+    return 0;
+}
+
+/* a forked child records into a file of its own, under fresh ids */
+static void
+atfork_child(void)
+{
+    seed_ids();
+    id_next = 0;
+    if (trace_fd < 0)
+        return;
+    close(trace_fd);
+    trace_fd = -1;
+    open_trace();
+}
+
+static void
+setup_atfork(void)
+{
+    pthread_atfork(NULL, NULL, atfork_child);
+}
+
+/* Public functions */
+
+int
+trace_init(const char *name, int rank)
+{
+    struct timespec ts;
+    FILE *f;
+
+    pthread_once(&atfork_once, setup_atfork);
+    if (trace_fd >= 0)
+        return 0;
+
+    if (name) {
+        snprintf(trace_name, sizeof(trace_name), "%s", name);
+    } else if ((f = fopen("/proc/self/comm", "r"))) {
+        if (!fgets(trace_name, sizeof(trace_name), f))
+            trace_name[0] = '\0';
+        trace_name[strcspn(trace_name, "\n")] = '\0';
+        fclose(f);
+    }
+    if (!trace_name[0])
+        strcpy(trace_name, "app");
+    trace_rank = rank;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    wall_offset = (int64_t)(wall_now() -
+            (ts.tv_sec * 1000000000UL + ts.tv_nsec));
+    return open_trace();
+}
+
+void
+trace_fin(void)
+{
+    int fd = trace_fd;
+
+    if (fd < 0)
+        return;
+    /* stop new spans before the descriptor can be reused */
+    trace_fd = -1;
+    close(fd);
+}
+
+uint64_t
+trace_new_id(void)
+{
+    uint64_t id;
+
+    if (!id_seed)
+        seed_ids();
+    do {
+        id = mix64(id_seed + __atomic_fetch_add(&id_next, 1, __ATOMIC_RELAXED));
+    } while (!id);
+    return id;
+}
+
+void
+trace_span(uint64_t id, const char *name, uint64_t start)
+{
+    char line[SPAN_LINE_MAX];
+    uint64_t now;
+    int fd = trace_fd, n;
+
+    if (fd < 0 || !id)
+        return;
+    now = trace_now();
+    n = snprintf(line, sizeof(line), "S %016lx %lu %lu %ld %s\n", id,
+            start + wall_offset, now - start, syscall(SYS_gettid), name);
+    if (n >= (int)sizeof(line))
+        n = sizeof(line) - 1;
+    if (write(fd, line, n) != n)
+        printd("lost span %s of %016lx\n", name, id);
+}
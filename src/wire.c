@@ -0,0 +1,431 @@
+/**
+ * file: wire.c
+ * desc: encoder/decoder for the message wire format described in wire.h
+ */
+
+/* System includes */
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+/* Other project includes */
+
+/* Project includes */
+#include <debug.h>
+#include <msg.h>
+#include <pmsg.h>
+#include <wire.h>
+
+/* Internal definitions */
+
+#define SECTION_HDR_LEN     4
+
+/* cursor over an encode or decode buffer. An encoder that runs out of room
+ * sets 'err'; a decoder that runs out of bytes returns zeros. */
+struct wbuf
+{
+    uint8_t *p;
+    size_t len, off;
+    bool err;
+};
+
+/* Private functions */
+
+static void
+put_u8(struct wbuf *b, uint8_t v)
+{
+    if (b->off + 1 > b->len) {
+        b->err = true;
+        return;
+    }
+    b->p[b->off++] = v;
+}
+
+static void
+put_u16(struct wbuf *b, uint16_t v)
+{
+    put_u8(b, v >> 8);
+    put_u8(b, v);
+}
+
+static void
+put_u32(struct wbuf *b, uint32_t v)
+{
+    put_u16(b, v >> 16);
+    put_u16(b, v);
+}
+
+static void
+put_u64(struct wbuf *b, uint64_t v)
+{
+    put_u32(b, v >> 32);
+    put_u32(b, v);
+}
+
+static void
+put_str(struct wbuf *b, const char *s, size_t max)
+{
+    size_t n = strnlen(s, max);
+    put_u16(b, n);
+    if (b->off + n > b->len) {
+        b->err = true;
+        return;
+    }
+    memcpy(b->p + b->off, s, n);
+    b->off += n;
+}
+
+static uint8_t
+get_u8(struct wbuf *b)
+{
+    if (b->off + 1 > b->len)
+        return 0;
+    return b->p[b->off++];
+}
+
+static uint16_t
+get_u16(struct wbuf *b)
+{
+    uint16_t v = get_u8(b);
+    return (v << 8) | get_u8(b);
+}
+
+static uint32_t
+get_u32(struct wbuf *b)
+{
+    uint32_t v = get_u16(b);
+    return (v << 16) | get_u16(b);
+}
+
+static uint64_t
+get_u64(struct wbuf *b)
+{
+    uint64_t v = get_u32(b);
+    return (v << 32) | get_u32(b);
+}
+
+/* copies at most max - 1 bytes and always terminates s */
+static void
+get_str(struct wbuf *b, char *s, size_t max)
+{
+    size_t n = get_u16(b), keep;
+    if (n > b->len - b->off)
+        n = b->len - b->off;
+    keep = (n < max ? n : max - 1);
+    memcpy(s, b->p + b->off, keep);
+    s[keep] = '\0';
+    b->off += n;
+}
+
+/* start a section, returning the offset of its length field */
+static size_t
+begin_section(struct wbuf *b, enum wire_tag tag)
+{
+    size_t at;
+    put_u8(b, tag);
+    put_u8(b, 0);
+    at = b->off;
+    put_u16(b, 0);
+    return at;
+}
+
+static void
+end_section(struct wbuf *b, size_t at)
+{
+    size_t len = b->off - at - 2;
+    if (b->err || len > UINT16_MAX) {
+        b->err = true;
+        return;
+    }
+    b->p[at]     = len >> 8;
+    b->p[at + 1] = len;
+}
+
+/* which union member of the message carries data */
+static enum wire_tag
+body_tag(const struct message *msg)
+{
+    switch (msg->type) {
+    case MSG_ADD_NODE:
+        return WIRE_TAG_NODE;
+    case MSG_REQ_ALLOC:
+        /* rank 0 answers a request in place with the allocation */
+        if (msg->status != MSG_RESPONSE)
+            return WIRE_TAG_REQ;
+        return WIRE_TAG_ALLOC;
+    case MSG_DO_ALLOC:
+    case MSG_REQ_FREE:
+    case MSG_DO_FREE:
+    case MSG_RELEASE_APP:
+        return WIRE_TAG_ALLOC;
+    default:
+        return WIRE_TAG_INVALID;
+    }
+}
+
+static void
+pack_req(struct wbuf *b, const struct alloc_request *r)
+{
+    put_u32(b, r->orig_rank);
+    put_u32(b, r->remote_rank);
+    put_u64(b, r->bytes);
+    put_u32(b, r->count);
+    put_u8(b, r->type);
+    put_u32(b, r->numa_node);
+}
+
+static void
+unpack_req(struct wbuf *b, struct alloc_request *r)
+{
+    r->orig_rank   = (int32_t)get_u32(b);
+    r->remote_rank = (int32_t)get_u32(b);
+    r->bytes       = get_u64(b);
+    r->count       = get_u32(b);
+    r->type        = get_u8(b);
+    r->numa_node   = (int32_t)get_u32(b);
+}
+
+static void
+pack_alloc(struct wbuf *b, const struct alloc_ation *a)
+{
+    size_t at;
+
+    at = begin_section(b, WIRE_TAG_ALLOC);
+    put_u32(b, a->orig_rank);
+    put_u32(b, a->remote_rank);
+    put_u64(b, a->rem_alloc_id);
+    put_u8(b, a->type);
+    put_u64(b, a->bytes);
+    put_u32(b, a->count);
+    put_u32(b, a->numa_node);
+    end_section(b, at);
+
+    /* a->u holds the connection details of a->type only */
+#ifdef INFINIBAND
+    if (a->type == ALLOC_MEM_RDMA) {
+        at = begin_section(b, WIRE_TAG_RDMA);
+        put_str(b, a->u.rdma.ib_ip, HOST_NAME_MAX);
+        put_u32(b, a->u.rdma.port);
+        end_section(b, at);
+    }
+#endif
+#ifdef EXTOLL
+    if (a->type == ALLOC_MEM_RMA) {
+        at = begin_section(b, WIRE_TAG_RMA);
+        put_u16(b, a->u.rma.node_id);
+        put_u16(b, a->u.rma.vpid);
+        put_u64(b, a->u.rma.dest_nla);
+        end_section(b, at);
+    }
+#endif
+}
+
+static void
+pack_node(struct wbuf *b, const struct alloc_node_config *c)
+{
+    int i, num_gpu = c->num_gpu;
+
+    if (num_gpu < 0 || num_gpu > ALLOC_MAX_GPUS)
+        num_gpu = 0;
+    put_str(b, c->ib_ip, HOST_NAME_MAX);
+    put_u64(b, c->ram);
+    put_u32(b, num_gpu);
+    for (i = 0; i < num_gpu; i++)
+        put_u64(b, c->gpu_mem[i]);
+}
+
+static void
+unpack_node(struct wbuf *b, struct alloc_node_config *c)
+{
+    int i;
+
+    get_str(b, c->ib_ip, HOST_NAME_MAX);
+    c->ram = get_u64(b);
+    c->num_gpu = (int32_t)get_u32(b);
+    if (c->num_gpu < 0 || c->num_gpu > ALLOC_MAX_GPUS)
+        c->num_gpu = 0;
+    for (i = 0; i < c->num_gpu; i++)
+        c->gpu_mem[i] = get_u64(b);
+}
+
+/* decode one section whose payload is s; unknown tags are ignored, a
+ * connection section not matching the allocation's type is an error */
+static int
+unpack_section(struct message *msg, enum wire_tag tag, struct wbuf *s)
+{
+    struct alloc_ation *a = &msg->u.alloc;
+
+    switch (tag) {
+    case WIRE_TAG_COMMON:
+        msg->pid  = (int32_t)get_u32(s);
+        msg->rank = (int32_t)get_u32(s);
+        msg->id   = get_u64(s);
+        msg->trace_id = get_u64(s);
+        break;
+    case WIRE_TAG_REQ:
+        unpack_req(s, &msg->u.req);
+        break;
+    case WIRE_TAG_ALLOC:
+        a->orig_rank    = (int32_t)get_u32(s);
+        a->remote_rank  = (int32_t)get_u32(s);
+        a->rem_alloc_id = get_u64(s);
+        a->type         = get_u8(s);
+        a->bytes        = get_u64(s);
+        a->count        = get_u32(s);
+        a->numa_node    = (int32_t)get_u32(s);
+        break;
+#ifdef INFINIBAND
+    case WIRE_TAG_RDMA:
+        if (a->type != ALLOC_MEM_RDMA)
+            return -1;
+        get_str(s, a->u.rdma.ib_ip, HOST_NAME_MAX);
+        a->u.rdma.port = (int32_t)get_u32(s);
+        break;
+#endif
+#ifdef EXTOLL
+    case WIRE_TAG_RMA:
+        if (a->type != ALLOC_MEM_RMA)
+            return -1;
+        a->u.rma.node_id  = get_u16(s);
+        a->u.rma.vpid     = get_u16(s);
+        a->u.rma.dest_nla = get_u64(s);
+        break;
+#endif
+    case WIRE_TAG_NODE:
+        unpack_node(s, &msg->u.node.config);
+        break;
+    default:
+        printd("skipping unknown section %d\n", tag);
+        break;
+    }
+    return 0;
+}
+
+/* Public functions */
+
+int
+wire_pack(const struct message *msg, void *buf, size_t len)
+{
+    struct wbuf b = { .p = buf, .len = len, .off = 0, .err = false };
+    size_t at;
+
+    BUG(!msg || !buf);
+
+    put_u8(&b, WIRE_VERSION);
+    put_u8(&b, msg->type);
+    put_u8(&b, msg->status);
+    put_u8(&b, 0);
+    put_u32(&b, 0); /* body length, filled in below */
+
+    at = begin_section(&b, WIRE_TAG_COMMON);
+    put_u32(&b, msg->pid);
+    put_u32(&b, msg->rank);
+    put_u64(&b, msg->id);
+    put_u64(&b, msg->trace_id);
+    end_section(&b, at);
+
+    switch (body_tag(msg)) {
+    case WIRE_TAG_REQ:
+        at = begin_section(&b, WIRE_TAG_REQ);
+        pack_req(&b, &msg->u.req);
+        end_section(&b, at);
+        break;
+    case WIRE_TAG_ALLOC:
+        pack_alloc(&b, &msg->u.alloc);
+        break;
+    case WIRE_TAG_NODE:
+        at = begin_section(&b, WIRE_TAG_NODE);
+        pack_node(&b, &msg->u.node.config);
+        end_section(&b, at);
+        break;
+    default:
+        break;
+    }
+
+    if (b.err) {
+        printd("%s does not fit in %lu bytes\n",
+                MSG_TYPE2STR(msg->type), len);
+        return -1;
+    }
+    at = b.off;
+    b.off = 4;
+    put_u32(&b, at - WIRE_HDR_LEN);
+    return at;
+}
+
+int
+wire_unpack(struct message *msg, const void *buf, size_t len)
+{
+    struct wbuf b = { .p = (uint8_t*)buf, .len = len, .off = 0 };
+    struct wbuf s;
+    uint8_t version;
+    size_t body_len, slen;
+    enum wire_tag tag;
+
+    BUG(!msg || !buf);
+
+    if (len < WIRE_HDR_LEN)
+        return -1;
+    version = get_u8(&b);
+    if (version == 0) {
+        printd("bad wire version %d\n", version);
+        return -1;
+    }
+    memset(msg, 0, sizeof(*msg));
+    msg->type   = get_u8(&b);
+    msg->status = get_u8(&b);
+    get_u8(&b);
+    body_len = get_u32(&b);
+    if (body_len > len - WIRE_HDR_LEN)
+        return -1;
+    b.len = WIRE_HDR_LEN + body_len;
+
+    while (b.len - b.off >= SECTION_HDR_LEN) {
+        tag  = get_u8(&b);
+        get_u8(&b);
+        slen = get_u16(&b);
+        if (slen > b.len - b.off)
+            return -1;
+        s.p   = b.p + b.off;
+        s.len = slen;
+        s.off = 0;
+        if (unpack_section(msg, tag, &s)) {
+            printd("section %d does not match allocation type %d\n",
+                    tag, msg->u.alloc.type);
+            return -1;
+        }
+        b.off += slen;
+    }
+    return 0;
+}
+
+size_t
+wire_body_len(const void *hdr)
+{
+    struct wbuf b = { .p = (uint8_t*)hdr, .len = WIRE_HDR_LEN, .off = 4 };
+    return get_u32(&b);
+}
+
+int
+wire_pmsg_send(pid_t to_pid, const struct message *msg)
+{
+    uint8_t buf[WIRE_MSG_MAX];
+    int len;
+
+    len = wire_pack(msg, buf, sizeof(buf));
+    if (len < 0)
+        return -1;
+    return pmsg_send(to_pid, buf, len);
+}
+
+int
+wire_pmsg_recv(struct message *msg, bool block)
+{
+    uint8_t buf[WIRE_MSG_MAX];
+    int len;
+
+    len = pmsg_recv(buf, block);
+    if (len < 0)
+        return -1;
+    return wire_unpack(msg, buf, len);
+}
@@ -56,6 +56,7 @@ static int alloc_test(long long unsigned int size_B)
   //The extoll_client_connect function currently allocates memory 
 
   printf("Remote server connection - node: %d, vpid: %d, NLA %llx\n",server_node_id, server_vpid,server_nla);
+  memset(&params, 0, sizeof(struct extoll_params));
   params.dest_node = server_node_id;
   params.dest_vpid = server_vpid;
   params.dest_nla = server_nla;
@@ -84,6 +85,7 @@ static int read_write_bw_test(uint64_t max_size_B)
   long long unsigned int size_B2= size_B;
 
   printf("Remote server connection - node: %d, vpid: %d, NLA %llx\n",server_node_id, server_vpid,server_nla);
+  memset(&params, 0, sizeof(struct extoll_params));
   params.dest_node = server_node_id;
   params.dest_vpid = server_vpid;
   params.dest_nla = server_nla;
@@ -58,6 +58,7 @@ static int alloc_test(long long unsigned int size_B)
     if (!(buf = calloc(num_bufs_to_alloc, sizeof(*buf))))
         return -1;
 
+    memset(&params, 0, sizeof(params));
     params.addr     = serverIP;
     params.port     = 12345;
     params.buf      = buf;
@@ -94,6 +95,7 @@ static int read_write_bw_test()
     printf("size of count: %llu\n", count);
     printf("size of *buf : %lu\n", sizeof(*buf));
 
+    memset(&params, 0, sizeof(params));
     params.addr     = serverIP;
     params.port     = 23456;
     params.buf      = buf;
@@ -153,6 +155,7 @@ static int one_sided_test(long long unsigned int size_B)
     if (!(buf = calloc(count, sizeof(*buf))))
         return -1;
 
+    memset(&params, 0, sizeof(params));
     params.addr     = serverIP;
     params.port     = 12345;
     params.buf      = buf;
@@ -205,6 +208,7 @@ static int buffer_size_mismatch_test(void)
     if (!(buf = calloc(1, len)))
         return -1;
 
+    memset(&params, 0, sizeof(params));
     params.addr     = serverIP;
     params.port     = 12345;
     params.buf      = buf;
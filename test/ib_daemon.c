@@ -53,6 +53,7 @@ static int alloc_test(long long unsigned int size_B)
   if (!(buf = calloc(len, sizeof(*buf))))
     return -1;
 
+  memset(&params, 0, sizeof(params));
   params.addr     = NULL;
   params.port     = 12345;
   params.buf      = buf;
@@ -84,6 +85,7 @@ static int read_write_bw_test(void){
 
   printf("Daemon allocating %lu B or %3f GB of memory\n", len, ((double)count/pow(2,30.0)));
 
+  memset(&params, 0, sizeof(params));
   params.addr     = NULL;
   params.port     = 23456;
   params.buf      = buf;
@@ -116,6 +118,7 @@ static int one_sided_test(void)
   if (!(buf = calloc(count, sizeof(*buf))))
     return -1;
 
+  memset(&params, 0, sizeof(params));
   params.addr     = NULL;
   params.port     = 12345;
   params.buf      = buf;
@@ -159,6 +162,7 @@ static int buffer_size_mismatch_test(void)
   if (!(buf = calloc(count, sizeof(*buf))))
     return -1;
 
+  memset(&params, 0, sizeof(params));
   params.addr     = NULL;
   params.port     = 12345;
   params.buf      = buf;
@@ -3,6 +3,8 @@
 #include <string.h>
 #include <oncillamem.h>
 #include <math.h>
+#include <pthread.h>
+#include <poll.h>
 
 //Needed to explicitly close EXTOLL connections
 #ifdef EXTOLL
@@ -19,14 +21,26 @@ void print_usage(const char* prog_name)
 {
   fprintf(stderr, "Usage: %s <which test> <allocation size 1 in MB (alloc1)> <allocation size 2 in MB (alloc2)> "
       "<suboption1_allocation_type> <suboption2_test4_num_iter>\n"
-      "\tWhich test: 1=allocation; 2=copy-onesided; 3=copy-twosided; 4=read/write BW\n"
+      "\tWhich test: 1=allocation; 2=copy-onesided; 3=copy-twosided; 4=read/write BW; 5=concurrent allocation; 6=async allocation; 7=ocm_mmap; 8=readahead; 9=write combining; 10=record\n"
       "\t\tSuboptions for test 1: 1=allocate host memory; 2=allocate GPU memory; \n"
       "\t\t\t\t3=allocate IB buffer (alloc1-local, alloc2-remote); 4=allocate EXTOLL buffer (alloc1-local, alloc2-remote)\n"
-      "\t\tSuboptions for test 4: type of allocation (IB=0, EXTOLL=1); number iterations\n\n"
+      "\t\tSuboptions for test 4: type of allocation (IB=0, EXTOLL=1); number iterations\n"
+      "\t\tSuboptions for test 5: allocation type as in test 1; number of threads\n"
+      "\t\tSuboptions for test 6: allocation type as in test 1; number of outstanding requests\n"
+      "\t\tSuboptions for test 7: allocation type 3 or 4 (alloc1 bounds the resident pages)\n"
+      "\t\tSuboptions for test 8: allocation type 3 or 4 (alloc2 at least 4 MB)\n"
+      "\t\tSuboptions for test 9: allocation type 3 or 4\n"
+      "\t\tSuboptions for test 10: allocation type 3 or 4 (needs bin/ocm_replay)\n\n"
       "\tEx: Test 1 with IB memory: %s 1 10.0 10.0 3\n"
       "\tEx: Test 2 with 10 MB memory: %s 2 10.0 10.0\n"
       "\tEx: Test 3 with 10 MB memory: %s 3 10.0 10.0\n"
-      "\tEx: Test 4 BW test for EXTOLL, 5 iterations: %s 4 1 5\n", prog_name, prog_name, prog_name, prog_name, prog_name);
+      "\tEx: Test 4 BW test for EXTOLL, 5 iterations: %s 4 1 5\n"
+      "\tEx: Test 5 with 8 threads allocating host memory: %s 5 10.0 10.0 1 8\n"
+      "\tEx: Test 6 with 8 outstanding host allocations: %s 6 10.0 10.0 1 8\n"
+      "\tEx: Test 7 mapping 64 MB of EXTOLL memory through 4 MB: %s 7 4.0 64.0 4\n"
+      "\tEx: Test 8 streaming 64 MB of IB memory: %s 8 1.0 64.0 3\n"
+      "\tEx: Test 9 small writes to EXTOLL memory: %s 9 1.0 8.0 4\n"
+      "\tEx: Test 10 recording copies to EXTOLL memory: %s 10 1.0 8.0 4\n", prog_name, prog_name, prog_name, prog_name, prog_name, prog_name, prog_name, prog_name, prog_name, prog_name, prog_name);
 }
 
 static int alloc_test(int suboption, uint64_t local_size_B, uint64_t rem_size_B){
@@ -104,6 +118,27 @@ static int alloc_test(int suboption, uint64_t local_size_B, uint64_t rem_size_B)
   
 
  
+    if(ocm_free(a[i]))
+    {
+      printf("ocm_free failed\n");
+      goto fail;
+    }
+  }
+
+  //Now request all of the buffers with a single batched allocation
+  printf("Checking to see if ocm_alloc_many works.\n");
+  if (ocm_alloc_many(alloc_params, num_allocs, a)) {
+    printf("ocm_alloc_many failed for %d allocations\n", num_allocs);
+    goto fail;
+  }
+  for(i = 0; i < num_allocs; i++)
+  {
+    if (ocm_localbuf(a[i], &buf, &buf_len))
+    {
+      printf("ocm_localbuf failed on batch allocation %d\n", i);
+      goto fail;
+    }
+    printf("batch buffer %d: local buffer size %lu @ %p\n", i, buf_len, buf);
     if(ocm_free(a[i]))
     {
       printf("ocm_free failed\n");
@@ -424,6 +459,532 @@ fail:
   return -1;
 }
 
+//Each thread of the concurrent test keeps its own allocation requests in flight
+struct conc_args
+{
+  ocm_alloc_param_t alloc_params;
+  int num_allocs;
+  int failed;
+};
+
+static void *conc_alloc_thread(void *arg)
+{
+  struct conc_args *args = (struct conc_args*)arg;
+  ocm_alloc_t a;
+  int i;
+
+  for(i = 0; i < args->num_allocs; i++)
+  {
+    a = ocm_alloc(args->alloc_params);
+    if (!a) {
+      args->failed++;
+      continue;
+    }
+    if(ocm_free(a))
+      args->failed++;
+  }
+  return NULL;
+}
+
+static int concurrent_alloc_test(int suboption, int num_threads, uint64_t local_size_B, uint64_t rem_size_B){
+  int num_allocs = 3;
+  pthread_t tids[num_threads];
+  struct conc_args args[num_threads];
+  ocm_alloc_param_t alloc_params;
+  int i, failed = 0;
+
+  if (0 > ocm_init()) {
+    printf("Cannot connect to OCM\n");
+    return -1;
+  }
+
+  alloc_params = calloc(1, sizeof(struct ocm_alloc_params));
+  alloc_params->local_alloc_bytes = local_size_B;
+  alloc_params->rem_alloc_bytes = rem_size_B;
+  if(suboption == 3)
+    alloc_params->kind = OCM_REMOTE_RDMA;
+  else if(suboption == 4)
+    alloc_params->kind = OCM_REMOTE_RMA;
+  else
+    alloc_params->kind = OCM_LOCAL_HOST;
+
+  printf("Testing %d threads with %d allocations each\n", num_threads, num_allocs);
+  for(i = 0; i < num_threads; i++)
+  {
+    args[i].alloc_params = alloc_params;
+    args[i].num_allocs = num_allocs;
+    args[i].failed = 0;
+    if(pthread_create(&tids[i], NULL, conc_alloc_thread, &args[i]))
+    {
+      printf("pthread_create failed\n");
+      num_threads = i;
+      failed++;
+      break;
+    }
+  }
+  for(i = 0; i < num_threads; i++)
+  {
+    pthread_join(tids[i], NULL);
+    failed += args[i].failed;
+  }
+  free(alloc_params);
+
+  if (0 > ocm_tini()) {
+    printf("ocm_tini failed\n");
+    return -1;
+  }
+
+  if(failed)
+  {
+    printf("%d allocations failed\n", failed);
+    return -1;
+  }
+  printf("OCM test completed successfully\n");
+  return 0;
+}
+
+//Callbacks may still be running after ocm_alloc_wait returns, so count them
+//somewhere that outlives the test
+static int async_completed;
+
+static void async_alloc_cb(ocm_alloc_req_t req, void *arg)
+{
+  int *completed = (int*)arg;
+  __sync_fetch_and_add(completed, 1);
+}
+
+static int async_alloc_test(int suboption, int num_reqs, uint64_t local_size_B, uint64_t rem_size_B){
+  ocm_alloc_req_t reqs[num_reqs];
+  struct pollfd fds[num_reqs];
+  struct ocm_alloc_params alloc_params;
+  ocm_alloc_t a;
+  int i, pending, failed = 0;
+
+  if (0 > ocm_init()) {
+    printf("Cannot connect to OCM\n");
+    return -1;
+  }
+
+  memset(&alloc_params, 0, sizeof(alloc_params));
+  alloc_params.local_alloc_bytes = local_size_B;
+  alloc_params.rem_alloc_bytes = rem_size_B;
+  if(suboption == 3)
+    alloc_params.kind = OCM_REMOTE_RDMA;
+  else if(suboption == 4)
+    alloc_params.kind = OCM_REMOTE_RMA;
+  else
+    alloc_params.kind = OCM_LOCAL_HOST;
+
+  printf("Issuing %d asynchronous allocations\n", num_reqs);
+  for(i = 0; i < num_reqs; i++)
+  {
+    reqs[i] = ocm_alloc_async(&alloc_params, async_alloc_cb, &async_completed);
+    if(!reqs[i])
+    {
+      printf("ocm_alloc_async failed\n");
+      num_reqs = i;
+      failed++;
+      break;
+    }
+    fds[i].fd = ocm_alloc_req_fd(reqs[i]);
+    fds[i].events = POLLIN;
+  }
+
+  //Wait on the completion fds as an event loop would
+  pending = num_reqs;
+  while(pending > 0)
+  {
+    if(poll(fds, num_reqs, -1) < 0)
+    {
+      printf("poll failed\n");
+      failed++;
+      break;
+    }
+    for(i = 0; i < num_reqs; i++)
+    {
+      if(fds[i].fd < 0 || !(fds[i].revents & POLLIN))
+        continue;
+      if(!ocm_alloc_test(reqs[i]))
+        failed++;
+      fds[i].fd = -1;
+      pending--;
+    }
+  }
+
+  for(i = 0; i < num_reqs; i++)
+  {
+    a = ocm_alloc_wait(reqs[i]);
+    if(!a || ocm_free(a))
+      failed++;
+  }
+
+  if (0 > ocm_tini()) {
+    printf("ocm_tini failed\n");
+    return -1;
+  }
+
+  if(failed)
+  {
+    printf("%d allocations failed\n", failed);
+    return -1;
+  }
+  printf("OCM test completed successfully\n");
+  return 0;
+}
+
+/* move the whole remote buffer through the local one, pattern seed */
+static int mmap_test_pass(ocm_alloc_t a, uint64_t seed, bool write){
+  struct ocm_params p;
+  uint64_t *buf, i;
+  size_t local, remote, off;
+
+  if(ocm_localbuf(a, (void**)&buf, &local) || ocm_remote_sz(a, &remote))
+    return -1;
+  for(off = 0; off < remote; off += local)
+  {
+    memset(&p, 0, sizeof(p));
+    p.dest_offset = off;
+    p.bytes = (off + local > remote ? remote - off : local);
+    p.op_flag = write;
+    if(write)
+      for(i = 0; i < p.bytes / 8; i++)
+        buf[i] = (off / 8 + i) * 2654435761UL + seed;
+    if(ocm_copy_onesided(a, &p))
+      return -1;
+    if(!write)
+      for(i = 0; i < p.bytes / 8; i++)
+        if(buf[i] != (off / 8 + i) * 2654435761UL + seed)
+        {
+          printf("word %lu is %lx\n", off / 8 + i, buf[i]);
+          return -1;
+        }
+  }
+  return 0;
+}
+
+static int mmap_test(int suboption, uint64_t local_size_B, uint64_t rem_size_B){
+  struct ocm_alloc_params alloc_params;
+  ocm_alloc_t a;
+  uint64_t *map, i, words = rem_size_B / 8;
+  int failed = 0;
+
+  if (0 > ocm_init()) {
+    printf("Cannot connect to OCM\n");
+    return -1;
+  }
+
+  memset(&alloc_params, 0, sizeof(alloc_params));
+  alloc_params.local_alloc_bytes = local_size_B;
+  alloc_params.rem_alloc_bytes = rem_size_B;
+  alloc_params.kind = (suboption == 3 ? OCM_REMOTE_RDMA : OCM_REMOTE_RMA);
+  if(!(a = ocm_alloc(&alloc_params)))
+  {
+    printf("ocm_alloc failed\n");
+    ocm_tini();
+    return -1;
+  }
+
+  //Seed the remote buffer, read it through the mapping, overwrite it there
+  //and check the remote buffer again once unmapped
+  if(mmap_test_pass(a, 1, true))
+    failed++;
+  else if(!(map = ocm_mmap(a)))
+  {
+    printf("ocm_mmap failed\n");
+    failed++;
+  }
+  else
+  {
+    for(i = 0; i < words && !failed; i++)
+      if(map[i] != i * 2654435761UL + 1)
+      {
+        printf("mapped word %lu is %lx\n", i, map[i]);
+        failed++;
+      }
+    for(i = 0; i < words; i++)
+      map[i] = i * 2654435761UL + 2;
+    if(ocm_munmap(a))
+    {
+      printf("ocm_munmap failed\n");
+      failed++;
+    }
+    else if(mmap_test_pass(a, 2, false))
+      failed++;
+  }
+
+  if(ocm_free(a))
+    failed++;
+  if (0 > ocm_tini()) {
+    printf("ocm_tini failed\n");
+    return -1;
+  }
+  if(failed)
+    return -1;
+  printf("OCM test completed successfully\n");
+  return 0;
+}
+
+/* read [off, off + bytes) of the remote buffer into the local one and check
+ * it against the pattern mmap_test_pass wrote */
+static int readahead_check(ocm_alloc_t a, size_t off, size_t bytes, uint64_t seed){
+  struct ocm_params p;
+  uint64_t *buf, i;
+  size_t local;
+
+  if(ocm_localbuf(a, (void**)&buf, &local))
+    return -1;
+  memset(&p, 0, sizeof(p));
+  p.dest_offset = off;
+  p.bytes = bytes;
+  if(ocm_copy_onesided(a, &p))
+    return -1;
+  for(i = 0; i < bytes / 8; i++)
+    if(buf[i] != (off / 8 + i) * 2654435761UL + seed)
+    {
+      printf("word %lu is %lx\n", off / 8 + i, buf[i]);
+      return -1;
+    }
+  return 0;
+}
+
+static int readahead_test(int suboption, uint64_t local_size_B, uint64_t rem_size_B){
+  struct ocm_alloc_params alloc_params;
+  struct ocm_cache_stats st;
+  ocm_alloc_t a;
+  size_t chunk = 64 << 10, off;
+  int failed = 0;
+
+  //Seeding writes every block through the cache; with a cache of half the
+  //remote buffer at most, the first half is gone again when it is scanned
+  if(rem_size_B < 64 * chunk)
+  {
+    printf("Please use a remote buffer of at least %lu MB\n", (64 * chunk) >> 20);
+    return -1;
+  }
+
+  if (0 > ocm_init()) {
+    printf("Cannot connect to OCM\n");
+    return -1;
+  }
+
+  memset(&alloc_params, 0, sizeof(alloc_params));
+  alloc_params.local_alloc_bytes = local_size_B;
+  alloc_params.rem_alloc_bytes = rem_size_B;
+  alloc_params.kind = (suboption == 3 ? OCM_REMOTE_RDMA : OCM_REMOTE_RMA);
+  alloc_params.readahead_bytes = 16 * chunk;
+  alloc_params.cache_bytes = 32 * chunk;
+  if(local_size_B < chunk || !(a = ocm_alloc(&alloc_params)))
+  {
+    printf("ocm_alloc failed\n");
+    ocm_tini();
+    return -1;
+  }
+
+  //Seed the remote buffer, scan the first half of it sequentially, then
+  //hint the second half and read it backwards
+  if(mmap_test_pass(a, 1, true))
+    failed++;
+  for(off = 0; !failed && off + chunk <= rem_size_B / 2; off += chunk)
+    if(readahead_check(a, off, chunk, 1))
+      failed++;
+  if(!failed && ocm_prefetch(a, rem_size_B / 2, 4 * chunk))
+    failed++;
+  for(off = rem_size_B / 2 + 3 * chunk; !failed && off >= rem_size_B / 2;
+      off -= chunk)
+    if(readahead_check(a, off, chunk, 1))
+      failed++;
+
+  if(ocm_cache_stats(a, &st))
+    failed++;
+  else
+  {
+    printf("cache: %lu hits, %lu misses, %lu blocks read ahead, %lu of them used\n",
+        st.hits, st.misses, st.prefetched, st.prefetch_hits);
+    if(!st.prefetched)
+    {
+      printf("nothing was read ahead\n");
+      failed++;
+    }
+  }
+
+  if(ocm_free(a))
+    failed++;
+  if (0 > ocm_tini()) {
+    printf("ocm_tini failed\n");
+    return -1;
+  }
+  if(failed)
+    return -1;
+  printf("OCM test completed successfully\n");
+  return 0;
+}
+
+static int write_combining_test(int suboption, uint64_t local_size_B, uint64_t rem_size_B){
+  struct ocm_alloc_params alloc_params;
+  struct ocm_params p;
+  struct ocm_stats st, fl;
+  ocm_alloc_t a;
+  uint64_t *buf, i;
+  size_t local, rec = 64, off, end;
+  int failed = 0;
+
+  if (0 > ocm_init()) {
+    printf("Cannot connect to OCM\n");
+    return -1;
+  }
+
+  memset(&alloc_params, 0, sizeof(alloc_params));
+  alloc_params.local_alloc_bytes = local_size_B;
+  alloc_params.rem_alloc_bytes = rem_size_B;
+  alloc_params.kind = (suboption == 3 ? OCM_REMOTE_RDMA : OCM_REMOTE_RMA);
+  alloc_params.wc_bytes = 64 << 10;
+  if(!(a = ocm_alloc(&alloc_params)) || ocm_localbuf(a, (void**)&buf, &local))
+  {
+    printf("ocm_alloc failed\n");
+    ocm_tini();
+    return -1;
+  }
+
+  //Write the first few MB a record at a time, then read them back whole
+  end = (rem_size_B < (4 << 20) ? rem_size_B : (4 << 20));
+  for(off = 0; !failed && off + rec <= end; off += rec)
+  {
+    for(i = 0; i < rec / 8; i++)
+      buf[i] = (off / 8 + i) * 2654435761UL + 3;
+    memset(&p, 0, sizeof(p));
+    p.dest_offset = off;
+    p.bytes = rec;
+    p.op_flag = 1;
+    if(ocm_copy_onesided(a, &p))
+      failed++;
+  }
+  if(!failed && ocm_flush(a))
+    failed++;
+  for(off = 0; !failed && off < end; off += local)
+    if(readahead_check(a, off, (off + local > end ? end - off : local), 3))
+      failed++;
+
+  //Flushes a write triggers count under ocm_copy_onesided, the rest apart
+  if(!ocm_stats_get(ocm_alloc_kind(a), OCM_STAT_ONESIDED, OCM_STAT_POST, &st) &&
+      !ocm_stats_get(ocm_alloc_kind(a), OCM_STAT_FLUSH, OCM_STAT_POST, &fl))
+    printf("%lu writes of %lu bytes and the reads took %lu transfers\n",
+        end / rec, rec, st.count + fl.count);
+
+  if(ocm_free(a))
+    failed++;
+  if (0 > ocm_tini()) {
+    printf("ocm_tini failed\n");
+    return -1;
+  }
+  if(failed)
+    return -1;
+  printf("OCM test completed successfully\n");
+  return 0;
+}
+
+//Records a write and a read between a local and a remote allocation and
+//checks that ocm_replay -d shows them in the directions they were issued
+static int record_test(int suboption, uint64_t local_size_B, uint64_t rem_size_B){
+  struct ocm_alloc_params alloc_params;
+  struct ocm_params p;
+  ocm_alloc_t local, remote;
+  char path[64], exe[4096], cmd[4300], line[512], op[16], *tok, *save;
+  unsigned long ids[2][2];
+  bool write[2];
+  int failed = 0, ncopies = 0, i;
+  ssize_t len;
+  FILE *f;
+
+  snprintf(path, sizeof(path), "/tmp/ocm_test.%d.rec", getpid());
+  setenv("OCM_RECORD", path, 1);
+  if (0 > ocm_init()) {
+    printf("Cannot connect to OCM\n");
+    return -1;
+  }
+
+  memset(&alloc_params, 0, sizeof(alloc_params));
+  alloc_params.local_alloc_bytes = local_size_B;
+  alloc_params.kind = OCM_LOCAL_HOST;
+  local = ocm_alloc(&alloc_params);
+  alloc_params.rem_alloc_bytes = rem_size_B;
+  alloc_params.kind = (suboption == 3 ? OCM_REMOTE_RDMA : OCM_REMOTE_RMA);
+  remote = ocm_alloc(&alloc_params);
+  if(!local || !remote)
+  {
+    printf("ocm_alloc failed\n");
+    ocm_tini();
+    return -1;
+  }
+
+  memset(&p, 0, sizeof(p));
+  p.bytes = local_size_B;
+  p.op_flag = 1;
+  if(ocm_copy(remote, local, &p))
+    failed++;
+  //op_flag 0 reads remote into local
+  p.op_flag = 0;
+  if(ocm_copy(local, remote, &p))
+    failed++;
+  if(ocm_free(remote) || ocm_free(local))
+    failed++;
+  if (0 > ocm_tini()) {
+    printf("ocm_tini failed\n");
+    return -1;
+  }
+
+  //ocm_replay sits next to ocm_test in bin/
+  if((len = readlink("/proc/self/exe", exe, sizeof(exe) - 1)) < 0)
+    return -1;
+  exe[len] = '\0';
+  if(strrchr(exe, '/'))
+    *strrchr(exe, '/') = '\0';
+  snprintf(cmd, sizeof(cmd), "%s/ocm_replay -d %s", exe, path);
+  if(!(f = popen(cmd, "r")))
+    return -1;
+  while(fgets(line, sizeof(line), f))
+  {
+    if(sscanf(line, "%*f ms thread %*u %15s", op) != 1 || strcmp(op, "copy"))
+      continue;
+    if(ncopies == 2)
+    {
+      ncopies++;
+      break;
+    }
+    //the ids follow "us" and its flags
+    write[ncopies] = false;
+    i = -1;
+    for(tok = strtok_r(line, " \n", &save); tok && i < 2;
+        tok = strtok_r(NULL, " \n", &save))
+    {
+      if(i < 0)
+        i = (!strcmp(tok, "us") ? 0 : -1);
+      else if(!strcmp(tok, "write"))
+        write[ncopies] = true;
+      else if(strcmp(tok, "failed"))
+        ids[ncopies][i++] = strtoul(tok, NULL, 0);
+    }
+    ncopies++;
+  }
+  if(pclose(f))
+    failed++;
+  unlink(path);
+
+  if(ncopies != 2)
+  {
+    printf("expected 2 recorded copies, found %d\n", ncopies);
+    return -1;
+  }
+  printf("recorded: copy %lu <- %lu%s, copy %lu <- %lu%s\n",
+      ids[0][0], ids[0][1], (write[0] ? " write" : ""),
+      ids[1][0], ids[1][1], (write[1] ? " write" : ""));
+  //the same (dest, src) order as issued, and only the first a write
+  if(!write[0] || write[1] || ids[0][0] != ids[1][1] || ids[0][1] != ids[1][0])
+    failed++;
+  if(failed)
+    return -1;
+  printf("OCM test completed successfully\n");
+  return 0;
+}
 
 int main(int argc, char *argv[])
 {
@@ -453,7 +1014,7 @@ int main(int argc, char *argv[])
   //All tests except the bandwidth test specify a size
   if(test_num != 4)
   {
-    if((test_num == 1 && argc != 5) || ((test_num == 2 || test_num == 3) && argc != 4)) 
+    if((test_num == 1 && argc != 5) || ((test_num == 2 || test_num == 3) && argc != 4) || ((test_num == 5 || test_num == 6) && argc != 6) || (test_num >= 7 && argc != 5)) 
     {
       print_usage(argv[0]); 
       return -1;
@@ -521,6 +1082,60 @@ int main(int argc, char *argv[])
       else
         printf("pass: read/write bw test\n");
       break;
+    case 5:
+      alloc_type = atoi(argv[4]);
+      if(concurrent_alloc_test(alloc_type, atoi(argv[5]), local_size_B, rem_size_B)){
+        fprintf(stderr, "FAIL: concurrent allocation test\n");
+        return -1;
+      }
+      else
+        printf("pass: concurrent allocation test\n");
+      break;
+    case 6:
+      alloc_type = atoi(argv[4]);
+      if(async_alloc_test(alloc_type, atoi(argv[5]), local_size_B, rem_size_B)){
+        fprintf(stderr, "FAIL: async allocation test\n");
+        return -1;
+      }
+      else
+        printf("pass: async allocation test\n");
+      break;
+    case 7:
+      alloc_type = atoi(argv[4]);
+      if(mmap_test(alloc_type, local_size_B, rem_size_B)){
+        fprintf(stderr, "FAIL: mmap test\n");
+        return -1;
+      }
+      else
+        printf("pass: mmap test\n");
+      break;
+    case 8:
+      alloc_type = atoi(argv[4]);
+      if(readahead_test(alloc_type, local_size_B, rem_size_B)){
+        fprintf(stderr, "FAIL: readahead test\n");
+        return -1;
+      }
+      else
+        printf("pass: readahead test\n");
+      break;
+    case 9:
+      alloc_type = atoi(argv[4]);
+      if(write_combining_test(alloc_type, local_size_B, rem_size_B)){
+        fprintf(stderr, "FAIL: write combining test\n");
+        return -1;
+      }
+      else
+        printf("pass: write combining test\n");
+      break;
+    case 10:
+      alloc_type = atoi(argv[4]);
+      if(record_test(alloc_type, local_size_B, rem_size_B)){
+        fprintf(stderr, "FAIL: record test\n");
+        return -1;
+      }
+      else
+        printf("pass: record test\n");
+      break;
     default:
       print_usage(argv[0]);
   }
@@ -19,7 +19,7 @@ int main(void)
     memset(msg.text, 0, sizeof(msg.text));
     strncpy(msg.text, CLIENT_MSG, strlen(CLIENT_MSG));
 
-    pmsg_send(PMSG_DAEMON_PID, &msg);
+    pmsg_send(PMSG_DAEMON_PID, &msg, sizeof(msg));
 
     pmsg_recv(&msg, true);
     printf("text: '%s'\n", msg.text);
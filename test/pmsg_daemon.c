@@ -22,7 +22,7 @@ int main(void)
     pmsg_attach(pid);
     memset(msg.text, 0, sizeof(msg.text));
     strncpy(msg.text, DAEMON_MSG, strlen(DAEMON_MSG));
-    pmsg_send(pid, &msg);
+    pmsg_send(pid, &msg, sizeof(msg));
 
     pmsg_detach(pid);
     pmsg_close();
@@ -0,0 +1,601 @@
+/**
+ * file: ocm_bench.c
+ * desc: allocation and copy microbenchmarks with machine-readable output
+ *
+ * Suites:
+ *  alloc     ocm_alloc/ocm_free latency per allocation kind
+ *  copy      two-sided ocm_copy bandwidth/latency over a size sweep
+ *  onesided  ocm_copy_onesided read/write over a size sweep
+ *  conc      alloc/free throughput from many threads in many processes
+ *
+ * Every measurement becomes one record (CSV row or JSON object) with the
+ * same columns, so results from different releases can be diffed or plotted
+ * directly.
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <oncillamem.h>
+#include <util/misc.h>
+
+#define MAX_KINDS     8
+#define MAX_PROCS     256
+
+enum out_fmt { FMT_CSV = 0, FMT_JSON };
+
+struct bench_opts
+{
+  uint64_t min_size, max_size; /* copy sweeps */
+  uint64_t alloc_size; /* alloc and conc suites */
+  uint64_t bytes_budget; /* per size point of a sweep */
+  int iters; /* samples per point, upper bound for sweeps */
+  int threads, procs;
+  enum ocm_kind kinds[MAX_KINDS];
+  int num_kinds;
+  enum out_fmt fmt;
+  FILE *out;
+};
+
+/* summary of one measured point */
+struct record
+{
+  const char *suite, *op, *kind;
+  uint64_t size;
+  int threads, procs;
+  unsigned long samples, errors;
+  double min, mean, p50, p90, p99, p999, max; /* microseconds */
+  double mb_s, ops_s;
+};
+
+static struct bench_opts opts;
+static int records_out;
+
+static const struct { const char *name; enum ocm_kind kind; } kind_names[] = {
+  { "host", OCM_LOCAL_HOST },
+  { "rma",  OCM_REMOTE_RMA },
+  { "rdma", OCM_REMOTE_RDMA },
+  { "gpu",  OCM_LOCAL_GPU },
+};
+#define NUM_KIND_NAMES  (sizeof(kind_names) / sizeof(*kind_names))
+
+static const char *kind_str(enum ocm_kind kind)
+{
+  unsigned int i;
+  for (i = 0; i < NUM_KIND_NAMES; i++)
+    if (kind_names[i].kind == kind)
+      return kind_names[i].name;
+  return "unknown";
+}
+
+static bool is_remote_kind(enum ocm_kind kind)
+{
+  return (kind == OCM_REMOTE_RMA || kind == OCM_REMOTE_RDMA);
+}
+
+/* sorts samples in place and fills in the latency fields of r */
+static void summarize(struct record *r, double *samples, unsigned long n)
+{
+  unsigned long i;
+  double sum = 0;
+
+  r->samples = n;
+  if (n == 0)
+    return;
+  qsort(samples, n, sizeof(*samples), cmp_double);
+  for (i = 0; i < n; i++)
+    sum += samples[i];
+  r->min  = samples[0];
+  r->max  = samples[n - 1];
+  r->mean = sum / n;
+  r->p50  = pct(samples, n, 0.50);
+  r->p90  = pct(samples, n, 0.90);
+  r->p99  = pct(samples, n, 0.99);
+  r->p999 = pct(samples, n, 0.999);
+}
+
+static void emit(const struct record *r)
+{
+  FILE *f = opts.out;
+
+  if (opts.fmt == FMT_CSV) {
+    if (records_out == 0)
+      fprintf(f, "suite,op,kind,size,threads,procs,samples,errors,"
+          "min_us,mean_us,p50_us,p90_us,p99_us,p999_us,max_us,mb_s,ops_s\n");
+    fprintf(f, "%s,%s,%s,%lu,%d,%d,%lu,%lu,"
+        "%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f\n",
+        r->suite, r->op, r->kind, r->size, r->threads, r->procs,
+        r->samples, r->errors, r->min, r->mean, r->p50, r->p90, r->p99,
+        r->p999, r->max, r->mb_s, r->ops_s);
+  } else {
+    fprintf(f, "%s\n    {\"suite\": \"%s\", \"op\": \"%s\", \"kind\": \"%s\", "
+        "\"size\": %lu, \"threads\": %d, \"procs\": %d, \"samples\": %lu, "
+        "\"errors\": %lu, \"min_us\": %.3f, \"mean_us\": %.3f, "
+        "\"p50_us\": %.3f, \"p90_us\": %.3f, \"p99_us\": %.3f, "
+        "\"p999_us\": %.3f, \"max_us\": %.3f, \"mb_s\": %.3f, "
+        "\"ops_s\": %.3f}",
+        (records_out ? "," : ""), r->suite, r->op, r->kind, r->size,
+        r->threads, r->procs, r->samples, r->errors, r->min, r->mean, r->p50,
+        r->p90, r->p99, r->p999, r->max, r->mb_s, r->ops_s);
+  }
+  records_out++;
+  fflush(f);
+}
+
+static void emit_begin(void)
+{
+  char host[256] = "";
+  if (opts.fmt != FMT_JSON)
+    return;
+  gethostname(host, sizeof(host) - 1);
+  fprintf(opts.out, "{\n  \"host\": \"%s\",\n  \"time\": %ld,\n"
+      "  \"records\": [", host, (long)time(NULL));
+}
+
+static void emit_end(void)
+{
+  if (opts.fmt == FMT_JSON)
+    fprintf(opts.out, "\n  ]\n}\n");
+}
+
+static void init_record(struct record *r, const char *suite, const char *op,
+    enum ocm_kind kind, uint64_t size)
+{
+  memset(r, 0, sizeof(*r));
+  r->suite = suite;
+  r->op = op;
+  r->kind = kind_str(kind);
+  r->size = size;
+  r->threads = 1;
+  r->procs = 1;
+}
+
+static void fill_params(struct ocm_alloc_params *p, enum ocm_kind kind,
+    uint64_t bytes)
+{
+  memset(p, 0, sizeof(*p));
+  p->kind = kind;
+  p->local_alloc_bytes = bytes;
+  p->rem_alloc_bytes = bytes;
+}
+
+/* samples for a sweep point: enough to move bytes_budget, within bounds */
+static int sweep_iters(uint64_t size)
+{
+  uint64_t n = opts.bytes_budget / size;
+  if (n > (uint64_t)opts.iters)
+    n = opts.iters;
+  if (n < 3)
+    n = 3;
+  return (int)n;
+}
+
+/* ------------------------------------------------------------------------ */
+
+static int bench_alloc(enum ocm_kind kind)
+{
+  struct ocm_alloc_params p;
+  struct record ra, rf;
+  double *lat_a, *lat_f, t0, t1;
+  unsigned long na = 0, nf = 0;
+  ocm_alloc_t a;
+  int i;
+
+  lat_a = calloc(opts.iters, sizeof(*lat_a));
+  lat_f = calloc(opts.iters, sizeof(*lat_f));
+  if (!lat_a || !lat_f)
+    return -1;
+  init_record(&ra, "alloc", "alloc", kind, opts.alloc_size);
+  init_record(&rf, "alloc", "free", kind, opts.alloc_size);
+  fill_params(&p, kind, opts.alloc_size);
+
+  for (i = 0; i < opts.iters; i++) {
+    t0 = now_us();
+    a = ocm_alloc(&p);
+    t1 = now_us();
+    if (!a) {
+      ra.errors++;
+      continue;
+    }
+    lat_a[na++] = t1 - t0;
+    t0 = now_us();
+    if (ocm_free(a))
+      rf.errors++;
+    else
+      lat_f[nf++] = now_us() - t0;
+  }
+  summarize(&ra, lat_a, na);
+  summarize(&rf, lat_f, nf);
+  ra.ops_s = (ra.mean > 0 ? 1e6 / ra.mean : 0);
+  rf.ops_s = (rf.mean > 0 ? 1e6 / rf.mean : 0);
+  emit(&ra);
+  emit(&rf);
+  free(lat_a);
+  free(lat_f);
+  return 0;
+}
+
+/* time 'fn' over a size sweep; fn returns nonzero on failure */
+typedef int (*copy_fn_t)(ocm_alloc_t dst, ocm_alloc_t src, ocm_param_t cp);
+
+static int do_copy(ocm_alloc_t dst, ocm_alloc_t src, ocm_param_t cp)
+{
+  return ocm_copy(dst, src, cp);
+}
+
+static int do_onesided(ocm_alloc_t dst, ocm_alloc_t src, ocm_param_t cp)
+{
+  return ocm_copy_onesided(src, cp);
+}
+
+static void sweep(const char *suite, const char *op, enum ocm_kind kind,
+    copy_fn_t fn, ocm_alloc_t dst, ocm_alloc_t src, int op_flag)
+{
+  struct ocm_params cp;
+  struct record r;
+  double *lat, t0, total;
+  uint64_t size;
+  unsigned long n;
+  int i, iters;
+
+  lat = calloc(opts.iters > 3 ? opts.iters : 3, sizeof(*lat));
+  if (!lat)
+    return;
+  for (size = opts.min_size; size <= opts.max_size; size *= 2) {
+    init_record(&r, suite, op, kind, size);
+    memset(&cp, 0, sizeof(cp));
+    cp.bytes = size;
+    iters = sweep_iters(size);
+    total = 0;
+    n = 0;
+    for (i = 0; i < iters; i++) {
+      cp.op_flag = op_flag; /* ocm_copy flips it for reads */
+      t0 = now_us();
+      if (fn(dst, src, &cp)) {
+        r.errors++;
+        continue;
+      }
+      lat[n] = now_us() - t0;
+      total += lat[n++];
+    }
+    summarize(&r, lat, n);
+    if (total > 0) {
+      r.mb_s = (double)size * n / total; /* bytes/us == MB/s */
+      r.ops_s = n * 1e6 / total;
+    }
+    emit(&r);
+    if (size > UINT64_MAX / 2)
+      break;
+  }
+  free(lat);
+}
+
+static int bench_copy(enum ocm_kind kind, bool onesided)
+{
+  struct ocm_alloc_params p;
+  ocm_alloc_t local = NULL, other = NULL;
+  int ret = -1;
+
+  if (onesided && !is_remote_kind(kind))
+    return 0;
+
+  fill_params(&p, OCM_LOCAL_HOST, opts.max_size);
+  if (!onesided && !(local = ocm_alloc(&p))) {
+    fprintf(stderr, "could not allocate %lu B of host memory\n", opts.max_size);
+    goto out;
+  }
+  fill_params(&p, kind, opts.max_size);
+  if (!(other = ocm_alloc(&p))) {
+    fprintf(stderr, "could not allocate %lu B of %s memory\n",
+        opts.max_size, kind_str(kind));
+    goto out;
+  }
+
+  if (onesided) {
+    sweep("onesided", "read", kind, do_onesided, NULL, other, 0);
+    sweep("onesided", "write", kind, do_onesided, NULL, other, 1);
+  } else {
+    /* host->kind is a write into 'other', kind->host a read from it */
+    sweep("copy", "write", kind, do_copy, other, local, 1);
+    sweep("copy", "read", kind, do_copy, local, other, 1);
+  }
+  ret = 0;
+
+out:
+  if (other)
+    ocm_free(other);
+  if (local)
+    ocm_free(local);
+  return ret;
+}
+
+/* ------------------------------------------------------------------------ */
+
+struct conc_thread
+{
+  pthread_t tid;
+  enum ocm_kind kind;
+  int iters;
+  double *lat;
+  unsigned long n, errors;
+};
+
+static void *conc_thread_fn(void *arg)
+{
+  struct conc_thread *t = (struct conc_thread*)arg;
+  struct ocm_alloc_params p;
+  ocm_alloc_t a;
+  double t0;
+  int i;
+
+  fill_params(&p, t->kind, opts.alloc_size);
+  for (i = 0; i < t->iters; i++) {
+    t0 = now_us();
+    a = ocm_alloc(&p);
+    if (!a || ocm_free(a)) {
+      t->errors++;
+      continue;
+    }
+    t->lat[t->n++] = now_us() - t0;
+  }
+  return NULL;
+}
+
+/* runs 'threads' alloc/free loops in this process; writes the sample count,
+ * error count and all samples to fd */
+static int conc_worker(enum ocm_kind kind, int fd)
+{
+  struct conc_thread *t;
+  unsigned long n = 0, errors = 0;
+  int i, ret = -1;
+
+  if (ocm_init())
+    return -1;
+  t = calloc(opts.threads, sizeof(*t));
+  if (!t)
+    goto out;
+  for (i = 0; i < opts.threads; i++) {
+    t[i].kind = kind;
+    t[i].iters = opts.iters;
+    if (!(t[i].lat = calloc(opts.iters, sizeof(double))))
+      goto out;
+  }
+  for (i = 0; i < opts.threads; i++)
+    if (pthread_create(&t[i].tid, NULL, conc_thread_fn, &t[i]))
+      goto out;
+  for (i = 0; i < opts.threads; i++) {
+    pthread_join(t[i].tid, NULL);
+    n += t[i].n;
+    errors += t[i].errors;
+  }
+  if (write(fd, &n, sizeof(n)) != sizeof(n) ||
+      write(fd, &errors, sizeof(errors)) != sizeof(errors))
+    goto out;
+  for (i = 0; i < opts.threads; i++)
+    if (write(fd, t[i].lat, t[i].n * sizeof(double))
+        != (ssize_t)(t[i].n * sizeof(double)))
+      goto out;
+  ret = 0;
+out:
+  ocm_tini();
+  return ret;
+}
+
+static int read_full(int fd, void *buf, size_t len)
+{
+  char *p = buf;
+  ssize_t r;
+  while (len > 0) {
+    r = read(fd, p, len);
+    if (r < 0 && errno == EINTR)
+      continue;
+    if (r <= 0)
+      return -1;
+    p += r;
+    len -= r;
+  }
+  return 0;
+}
+
+/* each process gets its own connection to the daemon, so the processes are
+ * forked before any of them calls ocm_init */
+static int bench_conc(enum ocm_kind kind)
+{
+  int fds[MAX_PROCS][2];
+  pid_t pids[MAX_PROCS];
+  struct record r;
+  double *lat, t0, elapsed;
+  unsigned long n = 0, cnt, perr, errors = 0, cap;
+  int i, status;
+
+  cap = (unsigned long)opts.procs * opts.threads * opts.iters;
+  if (!(lat = calloc(cap, sizeof(*lat))))
+    return -1;
+  init_record(&r, "conc", "alloc_free", kind, opts.alloc_size);
+  r.threads = opts.threads;
+  r.procs = opts.procs;
+
+  fflush(NULL);
+  t0 = now_us();
+  for (i = 0; i < opts.procs; i++) {
+    if (pipe(fds[i]))
+      return -1;
+    if ((pids[i] = fork()) == 0) {
+      close(fds[i][0]);
+      exit(conc_worker(kind, fds[i][1]) ? 1 : 0);
+    }
+    close(fds[i][1]);
+  }
+  for (i = 0; i < opts.procs; i++) {
+    if (pids[i] < 0 || read_full(fds[i][0], &cnt, sizeof(cnt)) ||
+        read_full(fds[i][0], &perr, sizeof(perr))) {
+      errors += (unsigned long)opts.threads * opts.iters;
+    } else {
+      errors += perr;
+      if (cnt > cap - n || read_full(fds[i][0], lat + n, cnt * sizeof(double)))
+        errors += cnt;
+      else
+        n += cnt;
+    }
+    close(fds[i][0]);
+  }
+  for (i = 0; i < opts.procs; i++)
+    if (pids[i] > 0)
+      waitpid(pids[i], &status, 0);
+  elapsed = now_us() - t0;
+
+  r.errors = errors;
+  summarize(&r, lat, n);
+  r.ops_s = (elapsed > 0 ? n * 1e6 / elapsed : 0);
+  emit(&r);
+  free(lat);
+  return 0;
+}
+
+/* ------------------------------------------------------------------------ */
+
+static int parse_kinds(char *list)
+{
+  char *tok, *save = NULL;
+  unsigned int i;
+
+  opts.num_kinds = 0;
+  for (tok = strtok_r(list, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+    for (i = 0; i < NUM_KIND_NAMES; i++)
+      if (!strcmp(tok, kind_names[i].name))
+        break;
+    if (i == NUM_KIND_NAMES || opts.num_kinds == MAX_KINDS) {
+      fprintf(stderr, "unknown kind '%s'\n", tok);
+      return -1;
+    }
+    opts.kinds[opts.num_kinds++] = kind_names[i].kind;
+  }
+  return 0;
+}
+
+static void usage(const char *prog)
+{
+  fprintf(stderr, "Usage: %s [options] [suite ...]\n"
+      "\tSuites: alloc copy onesided conc (default: all)\n"
+      "\t-k kinds    comma separated from host,rma,rdma,gpu (default: host plus\n"
+      "\t            the remote kinds this build supports)\n"
+      "\t-s min      smallest copy size (default 8)\n"
+      "\t-S max      largest copy size (default 1G); suffixes k, m, g\n"
+      "\t-a bytes    allocation size for alloc and conc (default 1m)\n"
+      "\t-b bytes    bytes to move per sweep point (default 1g)\n"
+      "\t-i iters    samples per point (default 1000)\n"
+      "\t-t threads  threads per process for conc (default 4)\n"
+      "\t-p procs    processes for conc (default 2)\n"
+      "\t-f fmt      csv or json (default csv)\n"
+      "\t-o file     write results to file instead of stdout, which the\n"
+      "\t            library also prints progress messages to\n"
+      "\tEx: %s -k host,rma -S 64m -f json copy onesided\n", prog, prog);
+}
+
+int main(int argc, char *argv[])
+{
+  bool run_alloc = false, run_copy = false, run_onesided = false,
+       run_conc = false;
+  int c, i, k, ret = 0;
+
+  opts.min_size = 8;
+  opts.max_size = 1UL << 30;
+  opts.alloc_size = 1UL << 20;
+  opts.bytes_budget = 1UL << 30;
+  opts.iters = 1000;
+  opts.threads = 4;
+  opts.procs = 2;
+  opts.fmt = FMT_CSV;
+  opts.out = stdout;
+  opts.kinds[opts.num_kinds++] = OCM_LOCAL_HOST;
+#ifdef EXTOLL
+  opts.kinds[opts.num_kinds++] = OCM_REMOTE_RMA;
+#endif
+#ifdef INFINIBAND
+  opts.kinds[opts.num_kinds++] = OCM_REMOTE_RDMA;
+#endif
+
+  while ((c = getopt(argc, argv, "k:s:S:a:b:i:t:p:f:o:h")) != -1) {
+    switch (c) {
+      case 'k': if (parse_kinds(optarg)) return -1; break;
+      case 's': opts.min_size = parse_size(optarg); break;
+      case 'S': opts.max_size = parse_size(optarg); break;
+      case 'a': opts.alloc_size = parse_size(optarg); break;
+      case 'b': opts.bytes_budget = parse_size(optarg); break;
+      case 'i': opts.iters = atoi(optarg); break;
+      case 't': opts.threads = atoi(optarg); break;
+      case 'p': opts.procs = atoi(optarg); break;
+      case 'f':
+        if (!strcmp(optarg, "json"))
+          opts.fmt = FMT_JSON;
+        else if (strcmp(optarg, "csv")) {
+          usage(argv[0]);
+          return -1;
+        }
+        break;
+      case 'o':
+        if (!(opts.out = fopen(optarg, "w"))) {
+          perror(optarg);
+          return -1;
+        }
+        break;
+      default:
+        usage(argv[0]);
+        return -1;
+    }
+  }
+  if (opts.min_size == 0 || opts.min_size > opts.max_size || opts.iters < 1 ||
+      opts.threads < 1 || opts.procs < 1 || opts.procs > MAX_PROCS) {
+    usage(argv[0]);
+    return -1;
+  }
+  for (i = optind; i < argc; i++) {
+    if (!strcmp(argv[i], "alloc")) run_alloc = true;
+    else if (!strcmp(argv[i], "copy")) run_copy = true;
+    else if (!strcmp(argv[i], "onesided")) run_onesided = true;
+    else if (!strcmp(argv[i], "conc")) run_conc = true;
+    else {
+      usage(argv[0]);
+      return -1;
+    }
+  }
+  if (optind == argc)
+    run_alloc = run_copy = run_onesided = run_conc = true;
+
+  emit_begin();
+
+  /* conc forks its own clients, so it runs before this process connects */
+  if (run_conc)
+    for (k = 0; k < opts.num_kinds; k++)
+      if (bench_conc(opts.kinds[k]))
+        ret = -1;
+
+  if (run_alloc || run_copy || run_onesided) {
+    if (ocm_init()) {
+      fprintf(stderr, "Cannot connect to OCM\n");
+      return -1;
+    }
+    for (k = 0; k < opts.num_kinds; k++) {
+      if (run_alloc && bench_alloc(opts.kinds[k]))
+        ret = -1;
+      if (run_copy && bench_copy(opts.kinds[k], false))
+        ret = -1;
+      if (run_onesided && bench_copy(opts.kinds[k], true))
+        ret = -1;
+    }
+    if (ocm_tini())
+      ret = -1;
+  }
+
+  emit_end();
+  if (opts.out != stdout)
+    fclose(opts.out);
+  return ret;
+}
@@ -0,0 +1,433 @@
+/**
+ * file: ocm_loadgen.c
+ * desc: control-plane load generator. Forks many simulated apps, each with
+ * several threads issuing a configurable mix of ocm_alloc/ocm_free at a
+ * target rate, then reports throughput, latency percentiles and the CPU
+ * time the daemon spent serving the load.
+ *
+ * With a target rate the threads run open loop: latency is measured from
+ * when an operation was due, not when it was issued, so a stalled daemon
+ * shows up in the tail instead of just lowering the offered load.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <oncillamem.h>
+#include <util/misc.h>
+
+#define MAX_PROCS     1024
+#define MAX_LIVE      4096
+
+enum op { OP_ALLOC = 0, OP_FREE, OP_MAX };
+static const char *op_names[OP_MAX] = { "alloc", "free" };
+
+struct load_opts
+{
+  int procs, threads;
+  double duration; /* seconds */
+  double rate; /* total ops/s over all threads, 0 = as fast as possible */
+  int alloc_pct; /* share of allocs while below max_live */
+  int max_live; /* allocations a thread holds at most */
+  uint64_t min_size, max_size;
+  enum ocm_kind kind;
+  pid_t daemon_pid;
+  bool json;
+};
+
+/* latencies of one op type, grown as needed */
+struct samples
+{
+  double *v;
+  unsigned long n, cap;
+  unsigned long errors;
+};
+
+struct load_thread
+{
+  pthread_t tid;
+  unsigned int seed;
+  struct samples s[OP_MAX];
+};
+
+static struct load_opts opts;
+
+static void add_sample(struct samples *s, double v)
+{
+  double *nv;
+  if (s->n == s->cap) {
+    s->cap = (s->cap ? s->cap * 2 : 1024);
+    if (!(nv = realloc(s->v, s->cap * sizeof(*nv)))) {
+      s->errors++;
+      return;
+    }
+    s->v = nv;
+  }
+  s->v[s->n++] = v;
+}
+
+static void sleep_until(double t_us)
+{
+  struct timespec ts;
+  double d = t_us - now_us();
+  if (d <= 0)
+    return;
+  ts.tv_sec = (time_t)(d / 1e6);
+  ts.tv_nsec = (long)((d - ts.tv_sec * 1e6) * 1e3);
+  while (nanosleep(&ts, &ts) && errno == EINTR)
+    ;
+}
+
+static uint64_t pick_size(unsigned int *seed)
+{
+  if (opts.max_size <= opts.min_size)
+    return opts.min_size;
+  return opts.min_size + rand_r(seed) % (opts.max_size - opts.min_size + 1);
+}
+
+static void *load_thread_fn(void *arg)
+{
+  struct load_thread *t = (struct load_thread*)arg;
+  ocm_alloc_t live[MAX_LIVE];
+  struct ocm_alloc_params p;
+  int num_live = 0, idx;
+  double start, end, due, interval = 0, t0;
+  enum op op;
+
+  if (opts.rate > 0)
+    interval = 1e6 * opts.procs * opts.threads / opts.rate;
+  memset(&p, 0, sizeof(p));
+  p.kind = opts.kind;
+
+  start = now_us();
+  end = start + opts.duration * 1e6;
+  /* stagger threads so an open-loop run doesn't start as one burst */
+  due = start + (interval > 0 ? rand_r(&t->seed) % (int)(interval + 1) : 0);
+  while (due < end) {
+    if (interval > 0)
+      sleep_until(due);
+    else
+      due = now_us();
+
+    if (num_live == 0)
+      op = OP_ALLOC;
+    else if (num_live == opts.max_live)
+      op = OP_FREE;
+    else
+      op = ((rand_r(&t->seed) % 100) < opts.alloc_pct ? OP_ALLOC : OP_FREE);
+
+    t0 = (interval > 0 ? due : now_us());
+    if (op == OP_ALLOC) {
+      p.local_alloc_bytes = p.rem_alloc_bytes = pick_size(&t->seed);
+      if ((live[num_live] = ocm_alloc(&p)))
+        num_live++;
+      else
+        t->s[op].errors++;
+    } else {
+      idx = rand_r(&t->seed) % num_live;
+      if (ocm_free(live[idx]))
+        t->s[op].errors++;
+      live[idx] = live[--num_live];
+    }
+    add_sample(&t->s[op], now_us() - t0);
+    due += interval;
+  }
+
+  while (num_live > 0)
+    ocm_free(live[--num_live]);
+  return NULL;
+}
+
+static int write_full(int fd, const void *buf, size_t len)
+{
+  const char *p = buf;
+  ssize_t w;
+  while (len > 0) {
+    w = write(fd, p, len);
+    if (w < 0 && errno == EINTR)
+      continue;
+    if (w <= 0)
+      return -1;
+    p += w;
+    len -= w;
+  }
+  return 0;
+}
+
+static int read_full(int fd, void *buf, size_t len)
+{
+  char *p = buf;
+  ssize_t r;
+  while (len > 0) {
+    r = read(fd, p, len);
+    if (r < 0 && errno == EINTR)
+      continue;
+    if (r <= 0)
+      return -1;
+    p += r;
+    len -= r;
+  }
+  return 0;
+}
+
+/* one simulated app: its threads' samples go back to the parent over fd as
+ * (count, errors, samples...) per op */
+static int app_main(int id, int fd)
+{
+  struct load_thread *t;
+  unsigned long n, errors;
+  int i, o, ret = -1;
+
+  if (ocm_init()) {
+    fprintf(stderr, "app %d: cannot connect to OCM\n", id);
+    return -1;
+  }
+  if (!(t = calloc(opts.threads, sizeof(*t))))
+    goto out;
+  for (i = 0; i < opts.threads; i++) {
+    t[i].seed = (unsigned int)(time(NULL) ^ (getpid() << 8) ^ i);
+    if (pthread_create(&t[i].tid, NULL, load_thread_fn, &t[i]))
+      goto out;
+  }
+  for (i = 0; i < opts.threads; i++)
+    pthread_join(t[i].tid, NULL);
+
+  for (o = 0; o < OP_MAX; o++) {
+    n = errors = 0;
+    for (i = 0; i < opts.threads; i++) {
+      n += t[i].s[o].n;
+      errors += t[i].s[o].errors;
+    }
+    if (write_full(fd, &n, sizeof(n)) || write_full(fd, &errors, sizeof(errors)))
+      goto out;
+    for (i = 0; i < opts.threads; i++)
+      if (write_full(fd, t[i].s[o].v, t[i].s[o].n * sizeof(double)))
+        goto out;
+  }
+  ret = 0;
+out:
+  ocm_tini();
+  return ret;
+}
+
+/* utime + stime of a process in seconds, < 0 if unavailable */
+static double proc_cpu_s(pid_t pid)
+{
+  char path[64], buf[1024], *p;
+  unsigned long utime, stime;
+  FILE *f;
+
+  if (pid <= 0)
+    return -1;
+  snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+  if (!(f = fopen(path, "r")))
+    return -1;
+  p = fgets(buf, sizeof(buf), f);
+  fclose(f);
+  /* the command name may contain spaces; fields resume after its ')' */
+  if (!p || !(p = strrchr(buf, ')')))
+    return -1;
+  if (2 != sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+        &utime, &stime))
+    return -1;
+  return (double)(utime + stime) / sysconf(_SC_CLK_TCK);
+}
+
+/* cpu time of the daemon given with -D, or else of every oncillamem on this
+ * host, < 0 if none was found */
+static double daemon_cpu_s(void)
+{
+  char path[300], comm[64];
+  struct dirent *d;
+  double sum = -1, cpu;
+  DIR *dir;
+  FILE *f;
+
+  if (opts.daemon_pid > 0)
+    return proc_cpu_s(opts.daemon_pid);
+  if (!(dir = opendir("/proc")))
+    return -1;
+  while ((d = readdir(dir))) {
+    if (d->d_name[0] < '0' || d->d_name[0] > '9')
+      continue;
+    snprintf(path, sizeof(path), "/proc/%s/comm", d->d_name);
+    if (!(f = fopen(path, "r")))
+      continue;
+    if (fgets(comm, sizeof(comm), f) && !strcmp(comm, "oncillamem\n") &&
+        (cpu = proc_cpu_s(atoi(d->d_name))) >= 0)
+      sum = (sum < 0 ? cpu : sum + cpu);
+    fclose(f);
+  }
+  closedir(dir);
+  return sum;
+}
+
+static void report(struct samples *s, double elapsed_s, double cpu_s)
+{
+  unsigned long total = 0;
+  int o;
+
+  for (o = 0; o < OP_MAX; o++) {
+    qsort(s[o].v, s[o].n, sizeof(double), cmp_double);
+    total += s[o].n;
+  }
+
+  if (opts.json) {
+    printf("{\n  \"procs\": %d, \"threads\": %d, \"duration_s\": %.3f, "
+        "\"target_rate\": %.1f,\n  \"ops\": %lu, \"ops_s\": %.1f, "
+        "\"daemon_cpu_s\": %.3f, \"daemon_cpu_pct\": %.1f,\n  \"latency\": [",
+        opts.procs, opts.threads, elapsed_s, opts.rate, total,
+        total / elapsed_s, cpu_s, (cpu_s >= 0 ? 100 * cpu_s / elapsed_s : -1));
+    for (o = 0; o < OP_MAX; o++)
+      printf("%s\n    {\"op\": \"%s\", \"samples\": %lu, \"errors\": %lu, "
+          "\"p50_us\": %.1f, \"p90_us\": %.1f, \"p99_us\": %.1f, "
+          "\"p999_us\": %.1f, \"max_us\": %.1f}", (o ? "," : ""),
+          op_names[o], s[o].n, s[o].errors, pct(s[o].v, s[o].n, 0.5),
+          pct(s[o].v, s[o].n, 0.9), pct(s[o].v, s[o].n, 0.99),
+          pct(s[o].v, s[o].n, 0.999), pct(s[o].v, s[o].n, 1));
+    printf("\n  ]\n}\n");
+    return;
+  }
+
+  printf("%d apps x %d threads, %.1f s, target %.0f ops/s\n",
+      opts.procs, opts.threads, elapsed_s, opts.rate);
+  printf("throughput: %lu ops, %.1f ops/s\n", total, total / elapsed_s);
+  if (cpu_s >= 0)
+    printf("daemon cpu: %.2f s (%.1f%% of one core)\n",
+        cpu_s, 100 * cpu_s / elapsed_s);
+  else
+    printf("daemon cpu: unavailable (no daemon found)\n");
+  printf("%-6s %9s %7s %10s %10s %10s %10s %10s\n", "op", "samples", "errors",
+      "p50_us", "p90_us", "p99_us", "p999_us", "max_us");
+  for (o = 0; o < OP_MAX; o++)
+    printf("%-6s %9lu %7lu %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+        op_names[o], s[o].n, s[o].errors, pct(s[o].v, s[o].n, 0.5),
+        pct(s[o].v, s[o].n, 0.9), pct(s[o].v, s[o].n, 0.99),
+        pct(s[o].v, s[o].n, 0.999), pct(s[o].v, s[o].n, 1));
+}
+
+static void usage(const char *prog)
+{
+  fprintf(stderr, "Usage: %s [options]\n"
+      "\t-p apps     simulated app processes (default 8)\n"
+      "\t-t threads  threads per app (default 4)\n"
+      "\t-d seconds  run time (default 10)\n"
+      "\t-r rate     total target ops/s, 0 for closed loop (default 0)\n"
+      "\t-a pct      share of allocs vs frees, in percent (default 50)\n"
+      "\t-l live     allocations a thread holds at most (default 16)\n"
+      "\t-s min      smallest allocation (default 4k)\n"
+      "\t-S max      largest allocation (default 1m)\n"
+      "\t-k kind     host, rma, rdma or gpu (default host)\n"
+      "\t-D pid      daemon to measure CPU of (default: all oncillamem here)\n"
+      "\t-j          JSON output\n"
+      "\tEx: %s -p 64 -t 2 -r 20000 -d 30 -k rma\n", prog, prog);
+}
+
+int main(int argc, char *argv[])
+{
+  int fds[MAX_PROCS][2];
+  pid_t pids[MAX_PROCS];
+  struct samples all[OP_MAX];
+  unsigned long n, errors;
+  double t0, cpu0, cpu1, elapsed;
+  int c, i, o, status, ret = 0;
+
+  opts.procs = 8;
+  opts.threads = 4;
+  opts.duration = 10;
+  opts.alloc_pct = 50;
+  opts.max_live = 16;
+  opts.min_size = 4UL << 10;
+  opts.max_size = 1UL << 20;
+  opts.kind = OCM_LOCAL_HOST;
+  opts.daemon_pid = -1;
+
+  while ((c = getopt(argc, argv, "p:t:d:r:a:l:s:S:k:D:jh")) != -1) {
+    switch (c) {
+      case 'p': opts.procs = atoi(optarg); break;
+      case 't': opts.threads = atoi(optarg); break;
+      case 'd': opts.duration = strtod(optarg, NULL); break;
+      case 'r': opts.rate = strtod(optarg, NULL); break;
+      case 'a': opts.alloc_pct = atoi(optarg); break;
+      case 'l': opts.max_live = atoi(optarg); break;
+      case 's': opts.min_size = parse_size(optarg); break;
+      case 'S': opts.max_size = parse_size(optarg); break;
+      case 'k':
+        if (!strcmp(optarg, "host")) opts.kind = OCM_LOCAL_HOST;
+        else if (!strcmp(optarg, "rma")) opts.kind = OCM_REMOTE_RMA;
+        else if (!strcmp(optarg, "rdma")) opts.kind = OCM_REMOTE_RDMA;
+        else if (!strcmp(optarg, "gpu")) opts.kind = OCM_LOCAL_GPU;
+        else {
+          usage(argv[0]);
+          return -1;
+        }
+        break;
+      case 'D': opts.daemon_pid = atoi(optarg); break;
+      case 'j': opts.json = true; break;
+      default:
+        usage(argv[0]);
+        return -1;
+    }
+  }
+  if (opts.procs < 1 || opts.procs > MAX_PROCS || opts.threads < 1 ||
+      opts.duration <= 0 || opts.rate < 0 || opts.alloc_pct < 0 ||
+      opts.alloc_pct > 100 || opts.max_live < 1 || opts.max_live > MAX_LIVE ||
+      opts.min_size == 0 || opts.min_size > opts.max_size) {
+    usage(argv[0]);
+    return -1;
+  }
+  fflush(NULL);
+  cpu0 = daemon_cpu_s();
+  t0 = now_us();
+  for (i = 0; i < opts.procs; i++) {
+    if (pipe(fds[i])) {
+      perror("pipe");
+      return -1;
+    }
+    if ((pids[i] = fork()) == 0) {
+      close(fds[i][0]);
+      exit(app_main(i, fds[i][1]) ? 1 : 0);
+    }
+    close(fds[i][1]);
+  }
+
+  memset(all, 0, sizeof(all));
+  for (i = 0; i < opts.procs; i++) {
+    for (o = 0; o < OP_MAX; o++) {
+      if (pids[i] < 0 || read_full(fds[i][0], &n, sizeof(n)) ||
+          read_full(fds[i][0], &errors, sizeof(errors))) {
+        fprintf(stderr, "app %d reported no results\n", i);
+        ret = -1;
+        break;
+      }
+      all[o].errors += errors;
+      all[o].cap = all[o].n + n;
+      if (!(all[o].v = realloc(all[o].v, (all[o].cap ? all[o].cap : 1) * sizeof(double))) ||
+          read_full(fds[i][0], all[o].v + all[o].n, n * sizeof(double))) {
+        ret = -1;
+        break;
+      }
+      all[o].n += n;
+    }
+    close(fds[i][0]);
+  }
+  for (i = 0; i < opts.procs; i++)
+    if (pids[i] > 0)
+      waitpid(pids[i], &status, 0);
+  elapsed = (now_us() - t0) / 1e6;
+  cpu1 = daemon_cpu_s();
+
+  report(all, elapsed, (cpu0 >= 0 && cpu1 >= 0 ? cpu1 - cpu0 : -1));
+  for (o = 0; o < OP_MAX; o++)
+    if (all[o].errors)
+      ret = -1;
+  return ret;
+}
@@ -0,0 +1,520 @@
+/**
+ * file: ocm_replay.c
+ * desc: re-issues a workload recorded with OCM_RECORD (see
+ * inc/lib_record.h) against the running cluster. Every recorded thread gets
+ * a replay thread that issues its calls at their original offsets from the
+ * start, divided by the speed factor, so a trace can be replayed as it
+ * happened, compressed, or as fast as possible. Calls on an allocation
+ * made by another thread wait until the replay has made it. At the end the
+ * recorded and replayed latencies are reported side by side, along with
+ * how far behind schedule the replay fell.
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <oncillamem.h>
+#include <lib_record.h>
+#include <util/misc.h>
+
+#define NUM_OPS       (OCM_REC_ONESIDED + 1)
+#define MAX_FIELDS    7
+
+static const char *op_names[NUM_OPS] = {
+  [OCM_REC_ALLOC] = "alloc", [OCM_REC_FREE] = "free",
+  [OCM_REC_COPY] = "copy", [OCM_REC_ONESIDED] = "onesided",
+};
+static const unsigned int op_fields[NUM_OPS] = {
+  [OCM_REC_ALLOC] = 5, [OCM_REC_FREE] = 1,
+  [OCM_REC_COPY] = 7, [OCM_REC_ONESIDED] = 4,
+};
+
+struct rec
+{
+  uint8_t op, flags;
+  uint32_t thread;
+  int64_t start; /* ns from the start of the recording */
+  uint64_t dur;
+  uint64_t f[MAX_FIELDS];
+};
+
+enum slot_state { SLOT_NONE = 0, SLOT_PENDING, SLOT_LIVE, SLOT_GONE };
+
+/* a recorded allocation and what the replay made of it */
+struct slot
+{
+  enum slot_state state;
+  ocm_alloc_t a;
+};
+
+struct samples
+{
+  double *v;
+  unsigned long n, cap;
+};
+
+struct op_result
+{
+  struct samples rec, replay; /* us */
+  unsigned long errors, skipped;
+};
+
+struct replay_thread
+{
+  pthread_t tid;
+  struct rec *recs;
+  unsigned long n;
+  struct op_result res[NUM_OPS];
+  double late_sum, late_max; /* us behind schedule */
+  ocm_alloc_t *strays; /* made by allocs that failed when recorded */
+  unsigned long nstrays, cap_strays;
+};
+
+static struct rec *recs;
+static unsigned long nrecs;
+static struct slot *slots;
+static uint64_t nslots;
+static pthread_mutex_t slots_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t slots_cond = PTHREAD_COND_INITIALIZER;
+
+static double speed = 1.0;
+static int kind_override;
+static struct timespec t0;
+
+static void add_sample(struct samples *s, double v)
+{
+  double *nv;
+  if (s->n == s->cap) {
+    s->cap = (s->cap ? s->cap * 2 : 1024);
+    if (!(nv = realloc(s->v, s->cap * sizeof(*nv))))
+      return;
+    s->v = nv;
+  }
+  s->v[s->n++] = v;
+}
+
+static int get_var(const uint8_t **p, const uint8_t *end, uint64_t *v)
+{
+  unsigned int shift = 0;
+  *v = 0;
+  while (*p < end && shift < 64) {
+    *v |= (uint64_t)(**p & 0x7f) << shift;
+    if (!(*(*p)++ & 0x80))
+      return 0;
+    shift += 7;
+  }
+  return -1;
+}
+
+static int load(const char *path)
+{
+  const uint8_t *p, *end;
+  uint8_t *buf;
+  struct stat st;
+  struct rec r, *n;
+  unsigned long cap = 0, k;
+  uint64_t v, last;
+  int64_t start = 0;
+  unsigned int i;
+  FILE *f;
+
+  if (!(f = fopen(path, "r")) || fstat(fileno(f), &st)) {
+    perror(path);
+    return -1;
+  }
+  if (!(buf = malloc(st.st_size + 1)) ||
+      fread(buf, 1, st.st_size, f) != (size_t)st.st_size) {
+    fprintf(stderr, "cannot read %s\n", path);
+    fclose(f);
+    return -1;
+  }
+  fclose(f);
+  if (st.st_size < OCM_REC_HDR_LEN || memcmp(buf, OCM_REC_MAGIC, 6) ||
+      buf[6] != OCM_REC_VERSION) {
+    fprintf(stderr, "%s is not an OCM_RECORD file\n", path);
+    return -1;
+  }
+
+  p = buf + OCM_REC_HDR_LEN;
+  end = buf + st.st_size;
+  while (p < end) {
+    if (end - p < 2)
+      break;
+    memset(&r, 0, sizeof(r));
+    r.op = *p++;
+    r.flags = *p++;
+    if (r.op < OCM_REC_ALLOC || r.op >= NUM_OPS)
+      break;
+    if (get_var(&p, end, &v))
+      break;
+    r.thread = v;
+    if (get_var(&p, end, &v))
+      break;
+    start += (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+    r.start = start;
+    if (get_var(&p, end, &r.dur))
+      break;
+    for (i = 0; i < op_fields[r.op]; i++)
+      if (get_var(&p, end, &r.f[i]))
+        break;
+    if (i < op_fields[r.op])
+      break;
+
+    if (nrecs == cap) {
+      cap = (cap ? cap * 2 : 4096);
+      if (!(n = realloc(recs, cap * sizeof(*n))))
+        return -1;
+      recs = n;
+    }
+    recs[nrecs++] = r;
+    if (r.op == OCM_REC_ALLOC && r.f[4] && (last = r.f[4] + r.f[1]) > nslots)
+      nslots = last;
+  }
+  if (p < end)
+    fprintf(stderr, "%s: ignoring %ld bytes after a truncated record\n",
+        path, (long)(end - p));
+  free(buf);
+
+  /* only ids some alloc in the file made are worth waiting for */
+  if (!(slots = calloc(nslots + 1, sizeof(*slots))))
+    return -1;
+  for (k = 0; k < nrecs; k++)
+    if (recs[k].op == OCM_REC_ALLOC && recs[k].f[4])
+      for (v = 0; v < recs[k].f[1]; v++)
+        slots[recs[k].f[4] + v].state = SLOT_PENDING;
+  return 0;
+}
+
+static void dump(void)
+{
+  const struct rec *r;
+  unsigned long i;
+  unsigned int j;
+
+  for (i = 0; i < nrecs; i++) {
+    r = &recs[i];
+    printf("%12.3f ms  thread %-3u %-8s %8.1f us%s%s ", r->start / 1e6,
+        r->thread, op_names[r->op], r->dur / 1e3,
+        (r->flags & OCM_REC_FAILED ? " failed" : ""),
+        (r->flags & OCM_REC_WRITE ? " write" : ""));
+    for (j = 0; j < op_fields[r->op]; j++)
+      printf(" %lu", r->f[j]);
+    printf("\n");
+  }
+}
+
+/* the allocation for a recorded id, waiting for another thread to make it;
+ * NULL if the replay never had or no longer has it */
+static ocm_alloc_t get_slot(uint64_t id)
+{
+  ocm_alloc_t a = NULL;
+
+  if (!id || id > nslots)
+    return NULL;
+  pthread_mutex_lock(&slots_lock);
+  while (slots[id].state == SLOT_PENDING)
+    pthread_cond_wait(&slots_cond, &slots_lock);
+  if (slots[id].state == SLOT_LIVE)
+    a = slots[id].a;
+  pthread_mutex_unlock(&slots_lock);
+  return a;
+}
+
+static void set_slot(uint64_t id, enum slot_state state, ocm_alloc_t a)
+{
+  if (!id || id > nslots)
+    return;
+  pthread_mutex_lock(&slots_lock);
+  slots[id].state = state;
+  slots[id].a = a;
+  pthread_cond_broadcast(&slots_cond);
+  pthread_mutex_unlock(&slots_lock);
+}
+
+static void wait_until(const struct rec *r, struct replay_thread *t)
+{
+  struct timespec due;
+  double late;
+  uint64_t ns;
+
+  if (speed <= 0)
+    return;
+  ns = t0.tv_nsec + (uint64_t)(r->start / speed);
+  due.tv_sec = t0.tv_sec + ns / 1000000000UL;
+  due.tv_nsec = ns % 1000000000UL;
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL) == EINTR)
+    ;
+  late = now_us() - (due.tv_sec * 1e6 + due.tv_nsec / 1e3);
+  t->late_sum += late;
+  if (late > t->late_max)
+    t->late_max = late;
+}
+
+/* returns 0 if done, 1 if skipped, -1 on error */
+static int replay_one(const struct rec *r, struct replay_thread *t)
+{
+  struct ocm_alloc_params ap;
+  struct ocm_params cp;
+  ocm_alloc_t a, b, *out, *n;
+  unsigned int i, count;
+  int ret = 0;
+
+  switch (r->op) {
+    case OCM_REC_ALLOC:
+      memset(&ap, 0, sizeof(ap));
+      ap.kind = (kind_override ? kind_override : (int)r->f[0]);
+      count = r->f[1];
+      ap.local_alloc_bytes = r->f[2];
+      ap.rem_alloc_bytes = r->f[3];
+      if (!count || !(out = calloc(count, sizeof(*out))))
+        return -1;
+      if (ocm_alloc_many(&ap, count, out)) {
+        for (i = 0; i < count; i++)
+          set_slot(r->f[4] + i, SLOT_GONE, NULL);
+        free(out);
+        return -1;
+      }
+      for (i = 0; i < count; i++) {
+        if (r->f[4]) {
+          set_slot(r->f[4] + i, SLOT_LIVE, out[i]);
+          continue;
+        }
+        /* failed when recorded; keep it to free at the end */
+        if (t->nstrays == t->cap_strays) {
+          t->cap_strays = (t->cap_strays ? t->cap_strays * 2 : 16);
+          if (!(n = realloc(t->strays, t->cap_strays * sizeof(*n)))) {
+            ocm_free(out[i]);
+            continue;
+          }
+          t->strays = n;
+        }
+        t->strays[t->nstrays++] = out[i];
+      }
+      free(out);
+      break;
+    case OCM_REC_FREE:
+      if (!(a = get_slot(r->f[0])))
+        return 1;
+      set_slot(r->f[0], SLOT_GONE, NULL);
+      ret = ocm_free(a);
+      break;
+    case OCM_REC_COPY:
+      if (!(a = get_slot(r->f[0])) || !(b = get_slot(r->f[1])))
+        return 1;
+      memset(&cp, 0, sizeof(cp));
+      cp.bytes = r->f[2];
+      cp.src_offset = r->f[3];
+      cp.dest_offset = r->f[4];
+      cp.src_offset_2 = r->f[5];
+      cp.dest_offset_2 = r->f[6];
+      cp.op_flag = !!(r->flags & OCM_REC_WRITE);
+      ret = ocm_copy(a, b, &cp);
+      break;
+    case OCM_REC_ONESIDED:
+      if (!(a = get_slot(r->f[0])))
+        return 1;
+      memset(&cp, 0, sizeof(cp));
+      cp.bytes = r->f[1];
+      cp.src_offset = r->f[2];
+      cp.dest_offset = r->f[3];
+      cp.op_flag = !!(r->flags & OCM_REC_WRITE);
+      ret = ocm_copy_onesided(a, &cp);
+      break;
+  }
+  return (ret ? -1 : 0);
+}
+
+static void *replay_thread_fn(void *arg)
+{
+  struct replay_thread *t = arg;
+  struct op_result *res;
+  const struct rec *r;
+  unsigned long i;
+  double start;
+  int ret;
+
+  for (i = 0; i < t->n; i++) {
+    r = &t->recs[i];
+    res = &t->res[r->op];
+    wait_until(r, t);
+    start = now_us();
+    ret = replay_one(r, t);
+    if (ret > 0) {
+      res->skipped++;
+      continue;
+    }
+    if (ret < 0)
+      res->errors++;
+    add_sample(&res->replay, now_us() - start);
+    add_sample(&res->rec, r->dur / 1e3);
+  }
+  return NULL;
+}
+
+/* by recorded thread, then in the order the thread made its calls */
+static int cmp_rec(const void *a, const void *b)
+{
+  const struct rec *x = a, *y = b;
+  if (x->thread != y->thread)
+    return (x->thread < y->thread ? -1 : 1);
+  return (x->start > y->start) - (x->start < y->start);
+}
+
+static double mean(const double *v, unsigned long n)
+{
+  double sum = 0;
+  unsigned long i;
+  for (i = 0; i < n; i++)
+    sum += v[i];
+  return (n ? sum / n : 0);
+}
+
+static void merge(struct samples *to, const struct samples *from)
+{
+  unsigned long i;
+  for (i = 0; i < from->n; i++)
+    add_sample(to, from->v[i]);
+}
+
+static void report(struct replay_thread *t, int nthreads, double elapsed_us)
+{
+  struct op_result all[NUM_OPS];
+  double late_sum = 0, late_max = 0;
+  unsigned long calls = 0;
+  int i, o;
+
+  memset(all, 0, sizeof(all));
+  for (i = 0; i < nthreads; i++) {
+    for (o = OCM_REC_ALLOC; o < NUM_OPS; o++) {
+      merge(&all[o].rec, &t[i].res[o].rec);
+      merge(&all[o].replay, &t[i].res[o].replay);
+      all[o].errors += t[i].res[o].errors;
+      all[o].skipped += t[i].res[o].skipped;
+    }
+    late_sum += t[i].late_sum;
+    if (t[i].late_max > late_max)
+      late_max = t[i].late_max;
+    calls += t[i].n;
+  }
+
+  printf("%lu calls from %d threads in %.3f s (recorded %.3f s, speed %g)\n",
+      calls, nthreads, elapsed_us / 1e6,
+      (nrecs ? recs[nrecs - 1].start / 1e9 : 0), speed);
+  if (speed > 0)
+    printf("behind schedule: mean %.1f us, max %.1f us\n",
+        (calls ? late_sum / calls : 0), late_max);
+  printf("%-9s %8s %7s %7s %12s %12s %12s %12s\n", "op", "calls", "errors",
+      "skipped", "rec_mean_us", "rec_p99_us", "mean_us", "p99_us");
+  for (o = OCM_REC_ALLOC; o < NUM_OPS; o++) {
+    if (!all[o].rec.n && !all[o].skipped)
+      continue;
+    qsort(all[o].rec.v, all[o].rec.n, sizeof(double), cmp_double);
+    qsort(all[o].replay.v, all[o].replay.n, sizeof(double), cmp_double);
+    printf("%-9s %8lu %7lu %7lu %12.1f %12.1f %12.1f %12.1f\n", op_names[o],
+        all[o].replay.n, all[o].errors, all[o].skipped,
+        mean(all[o].rec.v, all[o].rec.n), pct(all[o].rec.v, all[o].rec.n, 0.99),
+        mean(all[o].replay.v, all[o].replay.n),
+        pct(all[o].replay.v, all[o].replay.n, 0.99));
+  }
+}
+
+static void usage(const char *prog)
+{
+  fprintf(stderr, "Usage: %s [options] <recording>\n"
+      "\t-s speed    replay speed-up, 0 for as fast as possible (default 1)\n"
+      "\t-k kind     make every allocation this kind: host, rma, rdma or gpu\n"
+      "\t-d          print the recorded calls instead of replaying them\n"
+      "\tEx: OCM_RECORD=app.rec ./app; %s -s 4 -k rma app.rec\n", prog, prog);
+}
+
+int main(int argc, char *argv[])
+{
+  struct replay_thread *t;
+  unsigned long i, j;
+  uint64_t id;
+  int c, nthreads = 0, started, ret = -1;
+  double start;
+  bool dump_only = false;
+
+  while ((c = getopt(argc, argv, "s:k:dh")) != -1) {
+    switch (c) {
+      case 's': speed = strtod(optarg, NULL); break;
+      case 'k':
+        if (!strcmp(optarg, "host")) kind_override = OCM_LOCAL_HOST;
+        else if (!strcmp(optarg, "rma")) kind_override = OCM_REMOTE_RMA;
+        else if (!strcmp(optarg, "rdma")) kind_override = OCM_REMOTE_RDMA;
+        else if (!strcmp(optarg, "gpu")) kind_override = OCM_LOCAL_GPU;
+        else {
+          usage(argv[0]);
+          return -1;
+        }
+        break;
+      case 'd': dump_only = true; break;
+      default:
+        usage(argv[0]);
+        return -1;
+    }
+  }
+  if (optind != argc - 1 || speed < 0) {
+    usage(argv[0]);
+    return -1;
+  }
+  if (load(argv[optind]))
+    return -1;
+  if (dump_only) {
+    dump();
+    return 0;
+  }
+
+  /* one replay thread per recorded thread, each with its calls in order */
+  qsort(recs, nrecs, sizeof(*recs), cmp_rec);
+  for (i = 0; i < nrecs; i++)
+    if (i == 0 || recs[i].thread != recs[i - 1].thread)
+      nthreads++;
+  if (!(t = calloc(nthreads + 1, sizeof(*t))))
+    return -1;
+  for (i = 0, c = -1; i < nrecs; i++) {
+    if (i == 0 || recs[i].thread != recs[i - 1].thread)
+      t[++c].recs = &recs[i];
+    t[c].n++;
+  }
+
+  if (ocm_init()) {
+    fprintf(stderr, "cannot connect to OCM\n");
+    return -1;
+  }
+  start = now_us();
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  for (started = 0; started < nthreads; started++)
+    if (pthread_create(&t[started].tid, NULL, replay_thread_fn, &t[started]))
+      break;
+  for (c = 0; c < started; c++)
+    pthread_join(t[c].tid, NULL);
+  if (started < nthreads) {
+    fprintf(stderr, "could only start %d of %d threads\n", started, nthreads);
+    goto out;
+  }
+  report(t, nthreads, now_us() - start);
+  ret = 0;
+
+out:
+  /* leave nothing allocated on the cluster */
+  for (id = 1, j = 0; id <= nslots; id++)
+    if (slots[id].state == SLOT_LIVE && !ocm_free(slots[id].a))
+      j++;
+  for (c = 0; c < nthreads; c++)
+    for (i = 0; i < t[c].nstrays; i++)
+      if (!ocm_free(t[c].strays[i]))
+        j++;
+  if (j)
+    printf("freed %lu allocations the recording left live\n", j);
+  ocm_tini();
+  return ret;
+}
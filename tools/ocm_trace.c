@@ -0,0 +1,300 @@
+/**
+ * file: ocm_trace.c
+ * desc: merges the per-process span files written under OCM_TRACE (see
+ * inc/trace.h) into one Chrome trace, viewable in chrome://tracing or
+ * ui.perfetto.dev. Each process becomes a track; the spans of one request
+ * are joined by flow arrows in the order they started, so the hop where an
+ * alloc or free spent its time stands out. -s prints a per-span latency
+ * summary instead.
+ */
+
+#include <dirent.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define NAME_LEN      32
+#define PROC_NAME_LEN 192
+#define LINE_LEN      512
+
+struct span
+{
+  uint64_t id;
+  uint64_t start, dur; /* ns */
+  int proc, tid;
+  char name[NAME_LEN];
+};
+
+struct proc
+{
+  int pid, rank;
+  char name[PROC_NAME_LEN];
+};
+
+static struct span *spans;
+static size_t nspans, cap_spans;
+static struct proc *procs;
+static size_t nprocs, cap_procs;
+
+static int add_span(const struct span *s)
+{
+  struct span *n;
+  if (nspans == cap_spans) {
+    cap_spans = (cap_spans ? cap_spans * 2 : 4096);
+    if (!(n = realloc(spans, cap_spans * sizeof(*n))))
+      return -1;
+    spans = n;
+  }
+  spans[nspans++] = *s;
+  return 0;
+}
+
+static int add_proc(void)
+{
+  struct proc *n;
+  if (nprocs == cap_procs) {
+    cap_procs = (cap_procs ? cap_procs * 2 : 64);
+    if (!(n = realloc(procs, cap_procs * sizeof(*n))))
+      return -1;
+    procs = n;
+  }
+  memset(&procs[nprocs], 0, sizeof(*procs));
+  return nprocs++;
+}
+
+/* host part of <dir>/ocm-trace.<host>.<pid> */
+static void file_host(const char *path, char *host, size_t len)
+{
+  const char *b = strrchr(path, '/'), *e;
+  b = (b ? b + 1 : path);
+  if (!strncmp(b, "ocm-trace.", 10))
+    b += 10;
+  if (!(e = strrchr(b, '.')) || e < b)
+    e = b + strlen(b);
+  snprintf(host, len, "%.*s", (int)(e - b), b);
+}
+
+static int load_file(const char *path, uint64_t only)
+{
+  char line[LINE_LEN], host[64], pname[96];
+  struct span s;
+  FILE *f;
+  int p = -1, pid, rank;
+
+  if (!(f = fopen(path, "r"))) {
+    perror(path);
+    return -1;
+  }
+  file_host(path, host, sizeof(host));
+  while (fgets(line, sizeof(line), f)) {
+    if (line[0] == 'P' &&
+        sscanf(line, "P %d %d %95[^\n]", &pid, &rank, pname) == 3) {
+      if ((p = add_proc()) < 0)
+        goto fail;
+      procs[p].pid = pid;
+      procs[p].rank = rank;
+      snprintf(procs[p].name, PROC_NAME_LEN, "%s (pid %d on %s)",
+          pname, pid, host);
+    } else if (line[0] == 'S' && p >= 0) {
+      memset(&s, 0, sizeof(s));
+      if (sscanf(line, "S %" SCNx64 " %" SCNu64 " %" SCNu64 " %d %31s",
+            &s.id, &s.start, &s.dur, &s.tid, s.name) != 5)
+        continue;
+      if (only && s.id != only)
+        continue;
+      s.proc = p;
+      if (add_span(&s))
+        goto fail;
+    }
+  }
+  fclose(f);
+  return 0;
+
+fail:
+  fprintf(stderr, "out of memory reading %s\n", path);
+  fclose(f);
+  return -1;
+}
+
+/* a file, or a directory holding ocm-trace.* files */
+static int load_path(const char *path, uint64_t only)
+{
+  char file[4096];
+  struct dirent *e;
+  struct stat st;
+  DIR *d;
+  int ret = 0;
+
+  if (stat(path, &st)) {
+    perror(path);
+    return -1;
+  }
+  if (!S_ISDIR(st.st_mode))
+    return load_file(path, only);
+  if (!(d = opendir(path))) {
+    perror(path);
+    return -1;
+  }
+  while (!ret && (e = readdir(d))) {
+    if (strncmp(e->d_name, "ocm-trace.", 10))
+      continue;
+    snprintf(file, sizeof(file), "%s/%s", path, e->d_name);
+    ret = load_file(file, only);
+  }
+  closedir(d);
+  return ret;
+}
+
+/* by request, then in the order its spans started */
+static int cmp_span(const void *a, const void *b)
+{
+  const struct span *x = a, *y = b;
+  if (x->id != y->id)
+    return (x->id < y->id ? -1 : 1);
+  if (x->start != y->start)
+    return (x->start < y->start ? -1 : 1);
+  /* enclosing span first */
+  return (x->dur > y->dur ? -1 : x->dur < y->dur);
+}
+
+static void write_json(FILE *out)
+{
+  uint64_t t0 = UINT64_MAX;
+  const struct span *s;
+  const char *ph, *sep = "";
+  size_t i;
+
+  for (i = 0; i < nspans; i++)
+    if (spans[i].start < t0)
+      t0 = spans[i].start;
+
+  fprintf(out, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [");
+  for (i = 0; i < nprocs; i++) {
+    fprintf(out, "%s\n{\"name\": \"process_name\", \"ph\": \"M\", "
+        "\"pid\": %zu, \"args\": {\"name\": \"%s\"}}", sep, i + 1,
+        procs[i].name);
+    sep = ",";
+    /* daemons in rank order, apps after them */
+    fprintf(out, ",\n{\"name\": \"process_sort_index\", \"ph\": \"M\", "
+        "\"pid\": %zu, \"args\": {\"sort_index\": %d}}", i + 1,
+        (procs[i].rank >= 0 && !strncmp(procs[i].name, "oncillamem", 10) ?
+         procs[i].rank : 1000000 + (int)i));
+  }
+
+  for (i = 0; i < nspans; i++) {
+    s = &spans[i];
+    fprintf(out, "%s\n{\"name\": \"%s\", \"cat\": \"ocm\", \"ph\": \"X\", "
+        "\"ts\": %.3f, \"dur\": %.3f, \"pid\": %d, \"tid\": %d, "
+        "\"args\": {\"trace\": \"%016" PRIx64 "\"}}", sep, s->name,
+        (s->start - t0) / 1e3, s->dur / 1e3, s->proc + 1, s->tid, s->id);
+    sep = ",";
+
+    /* flow arrows from each span of a request to the next */
+    if (i > 0 && spans[i - 1].id == s->id)
+      ph = (i + 1 < nspans && spans[i + 1].id == s->id ? "t" : "f");
+    else if (i + 1 < nspans && spans[i + 1].id == s->id)
+      ph = "s";
+    else
+      continue;
+    fprintf(out, ",\n{\"name\": \"request\", \"cat\": \"ocm\", "
+        "\"ph\": \"%s\", \"bp\": \"e\", \"id\": \"0x%016" PRIx64 "\", "
+        "\"ts\": %.3f, \"pid\": %d, \"tid\": %d}", ph, s->id,
+        (s->start - t0) / 1e3, s->proc + 1, s->tid);
+  }
+  fprintf(out, "\n]}\n");
+}
+
+struct summary
+{
+  char name[NAME_LEN];
+  unsigned long n;
+  double sum, max; /* us */
+};
+
+static void write_summary(FILE *out)
+{
+  struct summary sum[64];
+  unsigned int nsum = 0, j;
+  uint64_t traces = 0;
+  size_t i;
+
+  for (i = 0; i < nspans; i++) {
+    if (i == 0 || spans[i - 1].id != spans[i].id)
+      traces++;
+    for (j = 0; j < nsum; j++)
+      if (!strcmp(sum[j].name, spans[i].name))
+        break;
+    if (j == nsum) {
+      if (nsum == sizeof(sum) / sizeof(*sum))
+        continue;
+      memset(&sum[nsum], 0, sizeof(*sum));
+      strcpy(sum[nsum++].name, spans[i].name);
+    }
+    sum[j].n++;
+    sum[j].sum += spans[i].dur / 1e3;
+    if (spans[i].dur / 1e3 > sum[j].max)
+      sum[j].max = spans[i].dur / 1e3;
+  }
+  fprintf(out, "%" PRIu64 " requests, %zu spans from %zu processes\n",
+      traces, nspans, nprocs);
+  fprintf(out, "%-16s %10s %12s %12s\n", "span", "count", "mean_us",
+      "max_us");
+  for (j = 0; j < nsum; j++)
+    fprintf(out, "%-16s %10lu %12.1f %12.1f\n", sum[j].name, sum[j].n,
+        sum[j].sum / sum[j].n, sum[j].max);
+}
+
+static void usage(const char *prog)
+{
+  fprintf(stderr, "Usage: %s [options] <trace dir or file>...\n"
+      "\t-o file     write the trace to file (default stdout)\n"
+      "\t-t id       only the request with this trace id (hex)\n"
+      "\t-s          print a per-span latency summary instead\n"
+      "\tEx: OCM_TRACE=/tmp/tr bin/oncillamem ...; OCM_TRACE=/tmp/tr app\n"
+      "\t    %s -o trace.json /tmp/tr\n", prog, prog);
+}
+
+int main(int argc, char *argv[])
+{
+  const char *out_path = NULL;
+  uint64_t only = 0;
+  bool summary = false;
+  FILE *out = stdout;
+  int c, i;
+
+  while ((c = getopt(argc, argv, "o:t:sh")) != -1) {
+    switch (c) {
+      case 'o': out_path = optarg; break;
+      case 't': only = strtoull(optarg, NULL, 16); break;
+      case 's': summary = true; break;
+      default:
+        usage(argv[0]);
+        return -1;
+    }
+  }
+  if (optind >= argc) {
+    usage(argv[0]);
+    return -1;
+  }
+  for (i = optind; i < argc; i++)
+    if (load_path(argv[i], only))
+      return -1;
+  qsort(spans, nspans, sizeof(*spans), cmp_span);
+
+  if (out_path && !(out = fopen(out_path, "w"))) {
+    perror(out_path);
+    return -1;
+  }
+  if (summary)
+    write_summary(out);
+  else
+    write_json(out);
+  if (out != stdout)
+    fclose(out);
+  return 0;
+}